@@ -0,0 +1,159 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "AudioConversion.h"
+
+namespace RTMPAudio
+{
+	static void DeinterleaveStereo(const float* Interleaved, float* Left, float* Right, int32 NumFrames)
+	{
+		const VectorRegister MinValue = MakeVectorRegister(-1.0f, -1.0f, -1.0f, -1.0f);
+		const VectorRegister MaxValue = MakeVectorRegister(1.0f, 1.0f, 1.0f, 1.0f);
+
+		int32 Frame = 0;
+		for (; Frame + 4 <= NumFrames; Frame += 4)
+		{
+			// L0 R0 L1 R1 | L2 R2 L3 R3
+			const VectorRegister Low = VectorLoad(Interleaved + Frame * 2);
+			const VectorRegister High = VectorLoad(Interleaved + Frame * 2 + 4);
+
+			const VectorRegister LeftValues = VectorShuffle(Low, High, 0, 2, 0, 2);
+			const VectorRegister RightValues = VectorShuffle(Low, High, 1, 3, 1, 3);
+
+			VectorStore(VectorMin(VectorMax(LeftValues, MinValue), MaxValue), Left + Frame);
+			VectorStore(VectorMin(VectorMax(RightValues, MinValue), MaxValue), Right + Frame);
+		}
+
+		for (; Frame < NumFrames; ++Frame)
+		{
+			Left[Frame] = FMath::Clamp(Interleaved[Frame * 2], -1.0f, 1.0f);
+			Right[Frame] = FMath::Clamp(Interleaved[Frame * 2 + 1], -1.0f, 1.0f);
+		}
+	}
+
+	static void CopyMono(const float* Mono, float* const* OutPlanes, int32 NumOutputChannels, int32 NumFrames)
+	{
+		const VectorRegister MinValue = MakeVectorRegister(-1.0f, -1.0f, -1.0f, -1.0f);
+		const VectorRegister MaxValue = MakeVectorRegister(1.0f, 1.0f, 1.0f, 1.0f);
+
+		int32 Frame = 0;
+		for (; Frame + 4 <= NumFrames; Frame += 4)
+		{
+			const VectorRegister Values = VectorMin(VectorMax(VectorLoad(Mono + Frame), MinValue), MaxValue);
+			for (int32 Channel = 0; Channel < NumOutputChannels; ++Channel)
+			{
+				VectorStore(Values, OutPlanes[Channel] + Frame);
+			}
+		}
+
+		for (; Frame < NumFrames; ++Frame)
+		{
+			const float Value = FMath::Clamp(Mono[Frame], -1.0f, 1.0f);
+			for (int32 Channel = 0; Channel < NumOutputChannels; ++Channel)
+			{
+				OutPlanes[Channel][Frame] = Value;
+			}
+		}
+	}
+
+	static void Deinterleave(const float* Interleaved, int32 NumChannels, float* const* OutPlanes, int32 NumFrames)
+	{
+		for (int32 Frame = 0; Frame < NumFrames; ++Frame)
+		{
+			for (int32 Channel = 0; Channel < NumChannels; ++Channel)
+			{
+				OutPlanes[Channel][Frame] = FMath::Clamp(Interleaved[Frame * NumChannels + Channel], -1.0f, 1.0f);
+			}
+		}
+	}
+
+	/** Channels in mixer order: FL FR FC LFE SL SR BL BR */
+	static const int32 MaxMixerChannels = 8;
+
+	/**
+	 * Gain of every input channel in every output channel for a layout without all of the input's channels. Each input
+	 * channel goes to one place: the same channel where the output has it, otherwise folded into its nearest neighbours
+	 * at -3dB (center into the front pair, sides into the front pair, backs into the sides or the front pair). LFE is
+	 * dropped when the output has none. Mono is the average of the stereo fold.
+	 */
+	static void GetFoldDownGains(int32 NumInputChannels, int32 NumOutputChannels, float (&OutGains)[MaxMixerChannels][MaxMixerChannels])
+	{
+		static const float SideGain = 0.7071f;
+
+		FMemory::Memzero(OutGains);
+		const int32 NumTargetChannels = NumOutputChannels == 1 ? 2 : NumOutputChannels;
+		for (int32 Channel = 0; Channel < NumInputChannels; ++Channel)
+		{
+			if (Channel < NumTargetChannels) {
+				OutGains[Channel][Channel] = 1.0f;
+				continue;
+			}
+
+			switch (Channel)
+			{
+			case 2:
+				OutGains[0][Channel] = SideGain;
+				OutGains[1][Channel] = SideGain;
+				break;
+			case 4:
+			case 5:
+				OutGains[Channel - 4][Channel] = SideGain;
+				break;
+			case 6:
+			case 7:
+				OutGains[NumTargetChannels > 5 ? Channel - 2 : Channel - 6][Channel] = SideGain;
+				break;
+			default:
+				break;
+			}
+		}
+
+		if (NumOutputChannels == 1) {
+			for (int32 Channel = 0; Channel < NumInputChannels; ++Channel)
+			{
+				OutGains[0][Channel] = (OutGains[0][Channel] + OutGains[1][Channel]) * 0.5f;
+			}
+		}
+	}
+
+	static void FoldDown(const float* Interleaved, int32 NumInputChannels, float* const* OutPlanes, int32 NumOutputChannels, int32 NumFrames)
+	{
+		check(NumOutputChannels <= MaxMixerChannels);
+
+		float Gains[MaxMixerChannels][MaxMixerChannels];
+		const int32 NumMixedChannels = FMath::Min(NumInputChannels, MaxMixerChannels);
+		GetFoldDownGains(NumMixedChannels, NumOutputChannels, Gains);
+
+		for (int32 Frame = 0; Frame < NumFrames; ++Frame)
+		{
+			const float* In = Interleaved + Frame * NumInputChannels;
+			for (int32 OutChannel = 0; OutChannel < NumOutputChannels; ++OutChannel)
+			{
+				float Value = 0.0f;
+				for (int32 InChannel = 0; InChannel < NumMixedChannels; ++InChannel)
+				{
+					Value += In[InChannel] * Gains[OutChannel][InChannel];
+				}
+				OutPlanes[OutChannel][Frame] = FMath::Clamp(Value, -1.0f, 1.0f);
+			}
+		}
+	}
+
+	void DeinterleaveToPlanes(const float* Interleaved, int32 NumInputChannels, float* const* OutPlanes, int32 NumOutputChannels, int32 NumFrames)
+	{
+		check(NumInputChannels > 0 && NumOutputChannels > 0);
+
+		if (NumInputChannels == 2 && NumOutputChannels == 2) {
+			DeinterleaveStereo(Interleaved, OutPlanes[0], OutPlanes[1], NumFrames);
+		}
+		else if (NumInputChannels == 1) {
+			CopyMono(Interleaved, OutPlanes, NumOutputChannels, NumFrames);
+		}
+		else if (NumInputChannels == NumOutputChannels) {
+			Deinterleave(Interleaved, NumInputChannels, OutPlanes, NumFrames);
+		}
+		else {
+			FoldDown(Interleaved, NumInputChannels, OutPlanes, NumOutputChannels, NumFrames);
+		}
+	}
+}
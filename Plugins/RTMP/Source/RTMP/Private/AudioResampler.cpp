@@ -0,0 +1,278 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "AudioResampler.h"
+#include "RTMPPublisher.h"
+
+extern "C" {
+#include <libavutil/audio_fifo.h>
+#include <libavutil/channel_layout.h>
+#include <libavutil/frame.h>
+#include <libavutil/opt.h>
+#include <libswresample/swresample.h>
+}
+
+namespace RTMPAudio
+{
+	// Frames pulled from the ring per conversion step.
+	static const int32 ConvertChunkFrames = 1024;
+
+	// Largest stretch/squeeze swr may apply to follow the audio clock, in parts per million.
+	static const double MaxClockCompensationPPM = 1000.0;
+
+	/**
+	 * Submix planes can be copied to the encoder as they are. A 5.1 submix names its surround pair side channels where
+	 * the AAC 5.1 layout names them back channels, same planes in the same order. The encoder's 7.1 has front wide
+	 * channels the submix doesn't, that goes through swr.
+	 */
+	static bool HasSameChannelOrder(uint64 SubmixChannelLayout, uint64 EncoderChannelLayout)
+	{
+		return SubmixChannelLayout == EncoderChannelLayout || (SubmixChannelLayout == AV_CH_LAYOUT_5POINT1 && EncoderChannelLayout == AV_CH_LAYOUT_5POINT1_BACK);
+	}
+}
+
+FAudioResampler::FAudioResampler(int32 InOutSampleRate, uint64 InOutChannelLayout)
+	: OutSampleRate(InOutSampleRate)
+	, OutChannelLayout(InOutChannelLayout)
+	, OutNumChannels(av_get_channel_layout_nb_channels(InOutChannelLayout))
+	, bPassthrough(false)
+	, SwrCtx(nullptr)
+	, OutputFifo(nullptr)
+	, OutputFifoEndClock(0.0)
+	, OutputScratchFrames(0)
+{
+	OutputFifo = av_audio_fifo_alloc(AV_SAMPLE_FMT_FLTP, OutNumChannels, RTMPAudio::ConvertChunkFrames * 4);
+	InputScratch.SetNumZeroed(RTMPAudio::ConvertChunkFrames * FAudioRingBuffer::MaxChannels);
+
+	for (int32 Channel = 0; Channel < FAudioRingBuffer::MaxChannels; ++Channel)
+	{
+		InputPlaneOrder[Channel] = Channel;
+	}
+}
+
+FAudioResampler::~FAudioResampler()
+{
+	ReleaseConverter();
+
+	if (OutputFifo != nullptr) {
+		av_audio_fifo_free(OutputFifo);
+		OutputFifo = nullptr;
+	}
+}
+
+bool FAudioResampler::ReadFrame(FAudioRingBuffer& Ring, struct AVFrame* Frame, double& OutAudioClock)
+{
+	FAudioRingBufferFormat RequestedFormat;
+	if (Ring.GetRequestedFormat(RequestedFormat)) {
+		// Keep what was captured in the old format before switching.
+		if (InputFormat.IsValid()) {
+			ConvertReadable(Ring);
+		}
+
+		// The submix can change again while the converter is set up, the ring only switches to the format it was set up for.
+		bool bApplied = false;
+		do
+		{
+			if (!Configure(RequestedFormat)) {
+				return false;
+			}
+			bApplied = Ring.ApplyRequestedFormat(RequestedFormat);
+		} while (!bApplied && Ring.GetRequestedFormat(RequestedFormat));
+	}
+
+	if (!InputFormat.IsValid() || OutputFifo == nullptr) {
+		return false;
+	}
+
+	// Fast path, no conversion needed and nothing left over from a previous format.
+	if (bPassthrough && av_audio_fifo_size(OutputFifo) == 0) {
+		if (Ring.NumReadable() < Frame->nb_samples || !Ring.GetReadClock(OutAudioClock)) {
+			return false;
+		}
+
+		if (!Ring.ReadPlanar(reinterpret_cast<float* const*>(Frame->extended_data), Frame->nb_samples)) {
+			return false;
+		}
+
+		Stats.FramesIn += Frame->nb_samples;
+		Stats.FramesOut += Frame->nb_samples;
+		return true;
+	}
+
+	if (!ConvertReadable(Ring)) {
+		return false;
+	}
+
+	const int32 FifoSize = av_audio_fifo_size(OutputFifo);
+	if (FifoSize < Frame->nb_samples) {
+		return false;
+	}
+
+	OutAudioClock = OutputFifoEndClock - double(FifoSize) / OutSampleRate;
+
+	return av_audio_fifo_read(OutputFifo, reinterpret_cast<void**>(Frame->extended_data), Frame->nb_samples) == Frame->nb_samples;
+}
+
+FAudioResamplerStats FAudioResampler::GetStats() const
+{
+	return Stats;
+}
+
+uint64 FAudioResampler::GetSubmixChannelLayout(int32 NumChannels)
+{
+	// Audio mixer channel order: FL FR FC LFE SL SR BL BR
+	switch (NumChannels)
+	{
+	case 1: return AV_CH_LAYOUT_MONO;
+	case 2: return AV_CH_LAYOUT_STEREO;
+	case 4: return AV_CH_LAYOUT_2_2;
+	case 6: return AV_CH_LAYOUT_5POINT1;
+	case 8: return AV_CH_LAYOUT_7POINT1;
+	default: return uint64(av_get_default_channel_layout(NumChannels));
+	}
+}
+
+bool FAudioResampler::Configure(const FAudioRingBufferFormat& Format)
+{
+	ReleaseConverter();
+
+	InputFormat = Format;
+	++Stats.NumFormatChanges;
+	Stats.InputFormat = Format;
+
+	const uint64 InChannelLayout = GetSubmixChannelLayout(Format.NumChannels);
+
+	bPassthrough = Format.SampleRate == OutSampleRate && RTMPAudio::HasSameChannelOrder(InChannelLayout, OutChannelLayout);
+	Stats.bPassthrough = bPassthrough;
+
+	UE_LOG(LogFFMPEGEncoder_Audio, Log, TEXT("Submix format is %d Hz, %d channels, encoder format is %d Hz, %d channels%s."),
+		Format.SampleRate, Format.NumChannels, OutSampleRate, OutNumChannels, bPassthrough ? TEXT(", no conversion needed") : TEXT(""));
+
+	if (bPassthrough) {
+		return true;
+	}
+
+	for (int32 Channel = 0; Channel < FAudioRingBuffer::MaxChannels; ++Channel)
+	{
+		InputPlaneOrder[Channel] = Channel;
+	}
+
+	if (InChannelLayout == AV_CH_LAYOUT_7POINT1) {
+		// ffmpeg orders 7.1 as FL FR FC LFE BL BR SL SR.
+		InputPlaneOrder[4] = 6;
+		InputPlaneOrder[5] = 7;
+		InputPlaneOrder[6] = 4;
+		InputPlaneOrder[7] = 5;
+	}
+
+	SwrCtx = swr_alloc();
+	if (SwrCtx == nullptr) {
+		UE_LOG(LogFFMPEGEncoder_Audio, Error, TEXT("Cloud not allocate resampler context."));
+		return false;
+	}
+
+	av_opt_set_channel_layout(SwrCtx, "in_channel_layout", InChannelLayout, 0);
+	av_opt_set_int(SwrCtx, "in_sample_rate", Format.SampleRate, 0);
+	av_opt_set_sample_fmt(SwrCtx, "in_sample_fmt", AV_SAMPLE_FMT_FLTP, 0);
+	av_opt_set_channel_layout(SwrCtx, "out_channel_layout", OutChannelLayout, 0);
+	av_opt_set_int(SwrCtx, "out_sample_rate", OutSampleRate, 0);
+	av_opt_set_sample_fmt(SwrCtx, "out_sample_fmt", AV_SAMPLE_FMT_FLTP, 0);
+
+	// Stretch/squeeze towards the audio clock passed through swr_next_pts, fill or trim on larger gaps.
+	av_opt_set_double(SwrCtx, "async", OutSampleRate * RTMPAudio::MaxClockCompensationPPM / 1000000.0, 0);
+
+	if (swr_init(SwrCtx) < 0) {
+		UE_LOG(LogFFMPEGEncoder_Audio, Error, TEXT("Failed to initialize the resampling context."));
+		ReleaseConverter();
+		return false;
+	}
+
+	return true;
+}
+
+bool FAudioResampler::ConvertReadable(FAudioRingBuffer& Ring)
+{
+	float* InPlanes[FAudioRingBuffer::MaxChannels];
+	for (int32 Channel = 0; Channel < FAudioRingBuffer::MaxChannels; ++Channel)
+	{
+		InPlanes[Channel] = InputScratch.GetData() + Channel * RTMPAudio::ConvertChunkFrames;
+	}
+
+	int32 NumReadable = Ring.NumReadable();
+	while (NumReadable > 0)
+	{
+		const int32 NumFrames = FMath::Min(NumReadable, RTMPAudio::ConvertChunkFrames);
+		NumReadable -= NumFrames;
+
+		double AudioClock = 0.0;
+		const bool bHasClock = Ring.GetReadClock(AudioClock);
+
+		if (!Ring.ReadPlanar(InPlanes, NumFrames)) {
+			return false;
+		}
+
+		Stats.FramesIn += NumFrames;
+
+		if (bPassthrough) {
+			av_audio_fifo_write(OutputFifo, reinterpret_cast<void**>(InPlanes), NumFrames);
+			Stats.FramesOut += NumFrames;
+			if (bHasClock) {
+				OutputFifoEndClock = AudioClock + double(NumFrames) / InputFormat.SampleRate;
+			}
+			continue;
+		}
+
+		if (SwrCtx == nullptr) {
+			return false;
+		}
+
+		if (bHasClock) {
+			swr_next_pts(SwrCtx, llrint(AudioClock * InputFormat.SampleRate * OutSampleRate));
+		}
+
+		const int32 MaxOutFrames = swr_get_out_samples(SwrCtx, NumFrames);
+		if (MaxOutFrames > OutputScratchFrames) {
+			OutputScratchFrames = MaxOutFrames;
+			OutputScratch.SetNumUninitialized(OutputScratchFrames * OutNumChannels);
+		}
+
+		const uint8* SwrInPlanes[FAudioRingBuffer::MaxChannels];
+		for (int32 Channel = 0; Channel < InputFormat.NumChannels; ++Channel)
+		{
+			SwrInPlanes[Channel] = reinterpret_cast<const uint8*>(InPlanes[InputPlaneOrder[Channel]]);
+		}
+
+		uint8* SwrOutPlanes[FAudioRingBuffer::MaxChannels];
+		for (int32 Channel = 0; Channel < OutNumChannels; ++Channel)
+		{
+			SwrOutPlanes[Channel] = reinterpret_cast<uint8*>(OutputScratch.GetData() + Channel * OutputScratchFrames);
+		}
+
+		const int32 Converted = swr_convert(SwrCtx, SwrOutPlanes, OutputScratchFrames, SwrInPlanes, NumFrames);
+		if (Converted < 0) {
+			UE_LOG(LogFFMPEGEncoder_Audio, Error, TEXT("Cloud not convert submix audio to encoder format."));
+			return false;
+		}
+
+		if (Converted > 0) {
+			av_audio_fifo_write(OutputFifo, reinterpret_cast<void**>(SwrOutPlanes), Converted);
+			Stats.FramesOut += Converted;
+		}
+
+		if (bHasClock) {
+			// Input consumed so far, minus what swr still holds back.
+			const double SwrDelay = double(swr_get_delay(SwrCtx, 1000000)) / 1000000.0;
+			OutputFifoEndClock = AudioClock + double(NumFrames) / InputFormat.SampleRate - SwrDelay;
+		}
+	}
+
+	return true;
+}
+
+void FAudioResampler::ReleaseConverter()
+{
+	if (SwrCtx != nullptr) {
+		swr_free(&SwrCtx);
+		SwrCtx = nullptr;
+	}
+}
@@ -0,0 +1,224 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "AudioRingBuffer.h"
+#include "AudioConversion.h"
+
+FAudioRingBuffer::FAudioRingBuffer(int32 InCapacityFrames)
+	: WritePosition(0)
+	, ReadPosition(0)
+	, ActiveFormat(0)
+	, RequestedFormat(0)
+	, ClockSequence(0)
+	, ClockAnchorPosition(0)
+	, ClockAnchorTime(0.0)
+	, NumOverflows(0)
+	, DroppedFrames(0)
+	, FormatChangeDroppedFrames(0)
+	, HighWaterMark(0)
+{
+	check(InCapacityFrames > 0);
+
+	Capacity = int32(FMath::RoundUpToPowerOfTwo(uint32(InCapacityFrames)));
+	Mask = uint32(Capacity) - 1;
+	Samples.SetNumZeroed(Capacity * MaxChannels);
+}
+
+bool FAudioRingBuffer::WriteInterleaved(const float* Interleaved, int32 NumFrames, int32 NumChannels, int32 SampleRate, double AudioClock)
+{
+	if (NumChannels <= 0 || NumChannels > MaxChannels || SampleRate <= 0) {
+		FormatChangeDroppedFrames.fetch_add(NumFrames, std::memory_order_relaxed);
+		return false;
+	}
+
+	const int64 Format = PackFormat(SampleRate, NumChannels);
+	if (Format != ActiveFormat.load(std::memory_order_acquire)) {
+		RequestedFormat.store(Format, std::memory_order_release);
+		FormatChangeDroppedFrames.fetch_add(NumFrames, std::memory_order_relaxed);
+		return false;
+	}
+	else if (RequestedFormat.load(std::memory_order_relaxed) != Format) {
+		// Format went back to the active one before the consumer switched, withdraw the request.
+		RequestedFormat.store(Format, std::memory_order_release);
+	}
+
+	const uint64 Write = WritePosition.load(std::memory_order_relaxed);
+	const uint64 Read = ReadPosition.load(std::memory_order_acquire);
+	const uint64 Used = Write - Read;
+
+	if (Used + NumFrames > uint64(Capacity)) {
+		NumOverflows.fetch_add(1, std::memory_order_relaxed);
+		DroppedFrames.fetch_add(NumFrames, std::memory_order_relaxed);
+		return false;
+	}
+
+	const int32 Offset = int32(uint32(Write) & Mask);
+	const int32 FirstPart = FMath::Min(NumFrames, Capacity - Offset);
+
+	float* Planes[MaxChannels];
+	for (int32 Channel = 0; Channel < NumChannels; ++Channel)
+	{
+		Planes[Channel] = GetPlane(Channel) + Offset;
+	}
+	RTMPAudio::DeinterleaveToPlanes(Interleaved, NumChannels, Planes, NumChannels, FirstPart);
+
+	if (FirstPart < NumFrames) {
+		for (int32 Channel = 0; Channel < NumChannels; ++Channel)
+		{
+			Planes[Channel] = GetPlane(Channel);
+		}
+		RTMPAudio::DeinterleaveToPlanes(Interleaved + FirstPart * NumChannels, NumChannels, Planes, NumChannels, NumFrames - FirstPart);
+	}
+
+	// Odd sequence while the anchor is being updated, readers retry.
+	const uint32 Sequence = ClockSequence.load(std::memory_order_relaxed);
+	ClockSequence.store(Sequence + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	ClockAnchorPosition.store(Write, std::memory_order_relaxed);
+	ClockAnchorTime.store(AudioClock, std::memory_order_relaxed);
+	ClockSequence.store(Sequence + 2, std::memory_order_release);
+
+	WritePosition.store(Write + NumFrames, std::memory_order_release);
+
+	const int32 Readable = int32(Used + NumFrames);
+	if (Readable > HighWaterMark.load(std::memory_order_relaxed)) {
+		HighWaterMark.store(Readable, std::memory_order_relaxed);
+	}
+
+	return true;
+}
+
+bool FAudioRingBuffer::ReadPlanar(float* const* OutPlanes, int32 NumFrames)
+{
+	const uint64 Read = ReadPosition.load(std::memory_order_relaxed);
+	const uint64 Write = WritePosition.load(std::memory_order_acquire);
+
+	if (Write - Read < uint64(NumFrames)) {
+		return false;
+	}
+
+	const int32 NumChannels = GetFormat().NumChannels;
+	const int32 Offset = int32(uint32(Read) & Mask);
+	const int32 FirstPart = FMath::Min(NumFrames, Capacity - Offset);
+
+	for (int32 Channel = 0; Channel < NumChannels; ++Channel)
+	{
+		const float* Plane = GetPlane(Channel);
+		FMemory::Memcpy(OutPlanes[Channel], Plane + Offset, FirstPart * sizeof(float));
+		if (FirstPart < NumFrames) {
+			FMemory::Memcpy(OutPlanes[Channel] + FirstPart, Plane, (NumFrames - FirstPart) * sizeof(float));
+		}
+	}
+
+	ReadPosition.store(Read + NumFrames, std::memory_order_release);
+	return true;
+}
+
+bool FAudioRingBuffer::GetReadClock(double& OutAudioClock) const
+{
+	const FAudioRingBufferFormat Format = GetFormat();
+	if (!Format.IsValid()) {
+		return false;
+	}
+
+	uint64 AnchorPosition = 0;
+	double AnchorTime = 0.0;
+	uint32 Sequence = 0;
+	do
+	{
+		Sequence = ClockSequence.load(std::memory_order_acquire);
+		AnchorPosition = ClockAnchorPosition.load(std::memory_order_relaxed);
+		AnchorTime = ClockAnchorTime.load(std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_acquire);
+	} while ((Sequence & 1) != 0 || Sequence != ClockSequence.load(std::memory_order_relaxed));
+
+	if (Sequence == 0) {
+		return false;
+	}
+
+	// Frames are contiguous since the anchor, walk back (or forward) from it at the nominal rate.
+	const int64 FramesFromAnchor = int64(ReadPosition.load(std::memory_order_relaxed)) - int64(AnchorPosition);
+	OutAudioClock = AnchorTime + double(FramesFromAnchor) / Format.SampleRate;
+	return true;
+}
+
+int32 FAudioRingBuffer::NumReadable() const
+{
+	const uint64 Read = ReadPosition.load(std::memory_order_acquire);
+	const uint64 Write = WritePosition.load(std::memory_order_acquire);
+	return int32(Write - Read);
+}
+
+FAudioRingBufferFormat FAudioRingBuffer::GetFormat() const
+{
+	return UnpackFormat(ActiveFormat.load(std::memory_order_relaxed));
+}
+
+bool FAudioRingBuffer::GetRequestedFormat(FAudioRingBufferFormat& OutFormat) const
+{
+	const int64 Requested = RequestedFormat.load(std::memory_order_acquire);
+	if (Requested == 0 || Requested == ActiveFormat.load(std::memory_order_relaxed)) {
+		return false;
+	}
+
+	OutFormat = UnpackFormat(Requested);
+	return true;
+}
+
+bool FAudioRingBuffer::ApplyRequestedFormat(const FAudioRingBufferFormat& Format)
+{
+	// Switch first, then check the request still stands. The producer only writes in the active format and stores its
+	// request before writing in any other, so if the request is still Format every write in the old format finished
+	// before it was stored and is discarded below. Otherwise the caller sets up for the new request and switches again.
+	const int64 Packed = PackFormat(Format.SampleRate, Format.NumChannels);
+	ActiveFormat.store(Packed, std::memory_order_seq_cst);
+	int64 Expected = Packed;
+	const bool bApplied = RequestedFormat.compare_exchange_strong(Expected, Packed, std::memory_order_seq_cst);
+
+	ReadPosition.store(WritePosition.load(std::memory_order_acquire), std::memory_order_release);
+	return bApplied;
+}
+
+int32 FAudioRingBuffer::GetCapacity() const
+{
+	return Capacity;
+}
+
+void FAudioRingBuffer::Reset()
+{
+	WritePosition.store(0, std::memory_order_relaxed);
+	ReadPosition.store(0, std::memory_order_relaxed);
+	ActiveFormat.store(0, std::memory_order_relaxed);
+	RequestedFormat.store(0, std::memory_order_relaxed);
+	ClockSequence.store(0, std::memory_order_relaxed);
+}
+
+FAudioRingBufferStats FAudioRingBuffer::GetStats() const
+{
+	FAudioRingBufferStats Stats;
+	Stats.FramesWritten = int64(WritePosition.load(std::memory_order_relaxed));
+	Stats.FramesRead = int64(ReadPosition.load(std::memory_order_relaxed));
+	Stats.NumOverflows = NumOverflows.load(std::memory_order_relaxed);
+	Stats.DroppedFrames = DroppedFrames.load(std::memory_order_relaxed);
+	Stats.FormatChangeDroppedFrames = FormatChangeDroppedFrames.load(std::memory_order_relaxed);
+	Stats.HighWaterMark = HighWaterMark.load(std::memory_order_relaxed);
+	return Stats;
+}
+
+int64 FAudioRingBuffer::PackFormat(int32 SampleRate, int32 NumChannels)
+{
+	return (int64(NumChannels) << 32) | int64(uint32(SampleRate));
+}
+
+FAudioRingBufferFormat FAudioRingBuffer::UnpackFormat(int64 PackedFormat)
+{
+	FAudioRingBufferFormat Format;
+	Format.SampleRate = int32(PackedFormat & 0xFFFFFFFF);
+	Format.NumChannels = int32(PackedFormat >> 32);
+	return Format;
+}
+
+float* FAudioRingBuffer::GetPlane(int32 Channel)
+{
+	return Samples.GetData() + Channel * Capacity;
+}
@@ -0,0 +1,439 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "ColorConversion.h"
+#include "ColorConversionKernels.h"
+#include "DataStructures.h"
+#include "RTMP.h"
+#include "HAL/IConsoleManager.h"
+#include "Math/RandomStream.h"
+#include "Async/ParallelFor.h"
+#include "Async/TaskGraphInterfaces.h"
+
+#if PLATFORM_CPU_X86_FAMILY
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+extern "C" {
+#include <libswscale/swscale.h>
+}
+
+namespace RTMPVideo
+{
+	// Smallest slice worth a task, a few hundred microseconds of scalar conversion at 1080p.
+	static const int32 MinSliceRows = 128;
+
+	// Weights are the matrix rows scaled by 256 (by 219/255 and 224/255 for limited range) and rounded so each
+	// luma row sums to its scale and each chroma row to 0.
+	static const FYUVCoefficients BT601Limited = {
+		{ 66, 129, 25, 16 * 256 + 128 },
+		{ -38, -74, 112, 128 * 256 + 128 },
+		{ 112, -94, -18, 128 * 256 + 128 },
+	};
+
+	static const FYUVCoefficients BT601Full = {
+		{ 77, 150, 29, 128 },
+		{ -43, -85, 128, 128 * 256 + 128 },
+		{ 128, -107, -21, 128 * 256 + 128 },
+	};
+
+	static const FYUVCoefficients BT709Limited = {
+		{ 47, 157, 16, 16 * 256 + 128 },
+		{ -26, -86, 112, 128 * 256 + 128 },
+		{ 112, -102, -10, 128 * 256 + 128 },
+	};
+
+	static const FYUVCoefficients BT709Full = {
+		{ 54, 183, 19, 128 },
+		{ -29, -99, 128, 128 * 256 + 128 },
+		{ 128, -116, -12, 128 * 256 + 128 },
+	};
+
+	static FORCEINLINE uint8 ToYUV(int32 R, int32 G, int32 B, const int32* Row)
+	{
+		return (uint8)FMath::Clamp((R * Row[0] + G * Row[1] + B * Row[2] + Row[3]) >> 8, 0, 255);
+	}
+
+	const FYUVCoefficients& GetYUVCoefficients(ERTMPColorMatrix Matrix, ERTMPColorRange Range)
+	{
+		if (Matrix == ERTMPColorMatrix::BT709) {
+			return Range == ERTMPColorRange::Full ? BT709Full : BT709Limited;
+		}
+		return Range == ERTMPColorRange::Full ? BT601Full : BT601Limited;
+	}
+
+	int32 GetFrameSize(ERTMPFrameFormat Format, int32 Width, int32 Height)
+	{
+		return Format == ERTMPFrameFormat::BGRA ? Width * Height * 4 : Width * Height * 3 / 2;
+	}
+
+	FYUV420Planes GetPackedPlanes(uint8* Buffer, ERTMPFrameFormat Format, int32 Width, int32 Height)
+	{
+		check(Format != ERTMPFrameFormat::BGRA);
+
+		FYUV420Planes Planes;
+		Planes.Y = Buffer;
+		Planes.YPitch = Width;
+
+		uint8* Chroma = Buffer + Width * Height;
+		if (Format == ERTMPFrameFormat::NV12) {
+			Planes.U = Chroma;
+			Planes.V = Chroma + 1;
+			Planes.UPitch = Width;
+			Planes.VPitch = Width;
+			Planes.ChromaStep = 2;
+		}
+		else {
+			Planes.U = Chroma;
+			Planes.V = Chroma + Width * Height / 4;
+			Planes.UPitch = Width / 2;
+			Planes.VPitch = Width / 2;
+			Planes.ChromaStep = 1;
+		}
+
+		return Planes;
+	}
+
+	void Kernels::ConvertRowPairScalar(const uint8* Row0, const uint8* Row1, uint8* Y0, uint8* Y1, uint8* U, uint8* V, int32 ChromaStep,
+		int32 FirstBlock, int32 EndBlock, const FYUVCoefficients& Coefficients)
+	{
+		for (int32 BlockX = FirstBlock; BlockX < EndBlock; ++BlockX)
+		{
+			const uint8* P00 = Row0 + BlockX * 8;
+			const uint8* P10 = P00 + 4;
+			const uint8* P01 = Row1 + BlockX * 8;
+			const uint8* P11 = P01 + 4;
+
+			Y0[BlockX * 2] = ToYUV(P00[2], P00[1], P00[0], Coefficients.Y);
+			Y0[BlockX * 2 + 1] = ToYUV(P10[2], P10[1], P10[0], Coefficients.Y);
+			Y1[BlockX * 2] = ToYUV(P01[2], P01[1], P01[0], Coefficients.Y);
+			Y1[BlockX * 2 + 1] = ToYUV(P11[2], P11[1], P11[0], Coefficients.Y);
+
+			const int32 R = (P00[2] + P10[2] + P01[2] + P11[2] + 2) >> 2;
+			const int32 G = (P00[1] + P10[1] + P01[1] + P11[1] + 2) >> 2;
+			const int32 B = (P00[0] + P10[0] + P01[0] + P11[0] + 2) >> 2;
+			U[BlockX * ChromaStep] = ToYUV(R, G, B, Coefficients.U);
+			V[BlockX * ChromaStep] = ToYUV(R, G, B, Coefficients.V);
+		}
+	}
+
+	void ConvertBGRAToYUV420Reference(const uint8* BGRA, int32 BGRAPitch, int32 Width, int32 Height, const FYUV420Planes& Planes, const FYUVCoefficients& Coefficients)
+	{
+		check((Width & 1) == 0 && (Height & 1) == 0);
+
+		for (int32 BlockY = 0; BlockY < Height / 2; ++BlockY)
+		{
+			const uint8* Row0 = BGRA + (BlockY * 2) * BGRAPitch;
+			uint8* Y0 = Planes.Y + (BlockY * 2) * Planes.YPitch;
+			Kernels::ConvertRowPairScalar(Row0, Row0 + BGRAPitch, Y0, Y0 + Planes.YPitch,
+				Planes.U + BlockY * Planes.UPitch, Planes.V + BlockY * Planes.VPitch, Planes.ChromaStep, 0, Width / 2, Coefficients);
+		}
+	}
+
+	/** Instruction sets usable by this process, the OS has to save the wider registers too */
+	static bool DetectColorKernelSupport(ERTMPColorKernel Kernel)
+	{
+		if (Kernel == ERTMPColorKernel::Scalar) {
+			return true;
+		}
+
+#if PLATFORM_CPU_X86_FAMILY
+		uint32 Leaf1[4] = { 0 };
+		uint32 Leaf7[4] = { 0 };
+		uint64 EnabledState = 0;
+
+#if defined(_MSC_VER)
+		int32 Info[4];
+		__cpuid(Info, 0);
+		const uint32 MaxLeaf = Info[0];
+		__cpuid(Info, 1);
+		FMemory::Memcpy(Leaf1, Info, sizeof(Leaf1));
+		if (MaxLeaf >= 7) {
+			__cpuidex(Info, 7, 0);
+			FMemory::Memcpy(Leaf7, Info, sizeof(Leaf7));
+		}
+		const bool bOSXSave = (Leaf1[2] & (1u << 27)) != 0;
+		if (bOSXSave) {
+			EnabledState = _xgetbv(0);
+		}
+#else
+		const uint32 MaxLeaf = __get_cpuid_max(0, nullptr);
+		__cpuid(1, Leaf1[0], Leaf1[1], Leaf1[2], Leaf1[3]);
+		if (MaxLeaf >= 7) {
+			__cpuid_count(7, 0, Leaf7[0], Leaf7[1], Leaf7[2], Leaf7[3]);
+		}
+		const bool bOSXSave = (Leaf1[2] & (1u << 27)) != 0;
+		if (bOSXSave) {
+			uint32 Low, High;
+			__asm__ volatile("xgetbv" : "=a"(Low), "=d"(High) : "c"(0));
+			EnabledState = ((uint64)High << 32) | Low;
+		}
+#endif
+
+		// XMM and YMM state, then the opmask and upper ZMM state
+		const bool bAVXState = (EnabledState & 0x6) == 0x6;
+		const bool bAVX512State = bAVXState && (EnabledState & 0xE0) == 0xE0;
+
+		switch (Kernel)
+		{
+		case ERTMPColorKernel::SSE41:
+			return (Leaf1[2] & (1u << 19)) != 0;
+		case ERTMPColorKernel::AVX2:
+			return bAVXState && (Leaf7[1] & (1u << 5)) != 0;
+		case ERTMPColorKernel::AVX512:
+			// AVX512F and AVX512BW
+			return bAVX512State && (Leaf7[1] & (1u << 16)) != 0 && (Leaf7[1] & (1u << 30)) != 0;
+		default:
+			break;
+		}
+#endif
+
+		return false;
+	}
+
+	static Kernels::FConvertFunction GetKernelFunction(ERTMPColorKernel Kernel)
+	{
+		switch (Kernel)
+		{
+#if PLATFORM_CPU_X86_FAMILY
+		case ERTMPColorKernel::SSE41:
+			return &Kernels::ConvertSSE41;
+		case ERTMPColorKernel::AVX2:
+			return &Kernels::ConvertAVX2;
+		case ERTMPColorKernel::AVX512:
+			return &Kernels::ConvertAVX512;
+#endif
+		default:
+			return &ConvertBGRAToYUV420Reference;
+		}
+	}
+
+	bool IsColorKernelSupported(ERTMPColorKernel Kernel)
+	{
+		static const struct FSupport
+		{
+			bool bSupported[(int32)ERTMPColorKernel::Num];
+
+			FSupport()
+			{
+				for (int32 Index = 0; Index < (int32)ERTMPColorKernel::Num; ++Index)
+				{
+					bSupported[Index] = DetectColorKernelSupport((ERTMPColorKernel)Index);
+				}
+			}
+		} Support;
+
+		return Kernel < ERTMPColorKernel::Num && Support.bSupported[(int32)Kernel];
+	}
+
+	ERTMPColorKernel GetBestColorKernel()
+	{
+		static const ERTMPColorKernel BestKernel = []()
+		{
+			for (int32 Index = (int32)ERTMPColorKernel::Num - 1; Index > 0; --Index)
+			{
+				if (IsColorKernelSupported((ERTMPColorKernel)Index)) {
+					return (ERTMPColorKernel)Index;
+				}
+			}
+			return ERTMPColorKernel::Scalar;
+		}();
+
+		return BestKernel;
+	}
+
+	const TCHAR* GetColorKernelName(ERTMPColorKernel Kernel)
+	{
+		switch (Kernel)
+		{
+		case ERTMPColorKernel::Scalar: return TEXT("Scalar");
+		case ERTMPColorKernel::SSE41: return TEXT("SSE4.1");
+		case ERTMPColorKernel::AVX2: return TEXT("AVX2");
+		case ERTMPColorKernel::AVX512: return TEXT("AVX-512");
+		default: return TEXT("Unknown");
+		}
+	}
+
+	void ConvertBGRAToYUV420(ERTMPColorKernel Kernel, const uint8* BGRA, int32 BGRAPitch, int32 Width, int32 Height, const FYUV420Planes& Planes, const FYUVCoefficients& Coefficients)
+	{
+		check((Width & 1) == 0 && (Height & 1) == 0);
+		check(Planes.ChromaStep == 1 || Planes.ChromaStep == 2);
+		check(IsColorKernelSupported(Kernel));
+
+		GetKernelFunction(Kernel)(BGRA, BGRAPitch, Width, Height, Planes, Coefficients);
+	}
+
+	void ConvertBGRAToYUV420(const uint8* BGRA, int32 BGRAPitch, int32 Width, int32 Height, const FYUV420Planes& Planes, const FYUVCoefficients& Coefficients)
+	{
+		static const Kernels::FConvertFunction BestFunction = GetKernelFunction(GetBestColorKernel());
+
+		check((Width & 1) == 0 && (Height & 1) == 0);
+		BestFunction(BGRA, BGRAPitch, Width, Height, Planes, Coefficients);
+	}
+
+	void ConvertBGRAToYUV420Sliced(const uint8* BGRA, int32 BGRAPitch, int32 Width, int32 Height, const FYUV420Planes& Planes, const FYUVCoefficients& Coefficients, int32 NumSlices)
+	{
+		check((Width & 1) == 0 && (Height & 1) == 0);
+
+		const int32 NumBlockRows = Height / 2;
+		NumSlices = FMath::Clamp(NumSlices, 1, FMath::Max(NumBlockRows, 1));
+		if (NumSlices == 1) {
+			ConvertBGRAToYUV420(BGRA, BGRAPitch, Width, Height, Planes, Coefficients);
+			return;
+		}
+
+		ParallelFor(NumSlices, [&](int32 Slice)
+		{
+			const int32 FirstBlockRow = NumBlockRows * Slice / NumSlices;
+			const int32 EndBlockRow = NumBlockRows * (Slice + 1) / NumSlices;
+
+			FYUV420Planes SlicePlanes = Planes;
+			SlicePlanes.Y += FirstBlockRow * 2 * Planes.YPitch;
+			SlicePlanes.U += FirstBlockRow * Planes.UPitch;
+			SlicePlanes.V += FirstBlockRow * Planes.VPitch;
+
+			ConvertBGRAToYUV420(BGRA + FirstBlockRow * 2 * BGRAPitch, BGRAPitch, Width, (EndBlockRow - FirstBlockRow) * 2, SlicePlanes, Coefficients);
+		});
+	}
+
+	int32 GetDefaultConversionSlices(int32 Height)
+	{
+		// The thread calling ParallelFor converts a slice too.
+		const int32 NumThreads = FTaskGraphInterface::Get().GetNumWorkerThreads() + 1;
+		return FMath::Clamp(Height / MinSliceRows, 1, NumThreads);
+	}
+
+	bool ParseEvenFrameSize(const TArray<FString>& Args, int32 DefaultWidth, int32 DefaultHeight, const TCHAR* What, int32& OutWidth, int32& OutHeight)
+	{
+		OutWidth = Args.Num() > 0 ? FCString::Atoi(*Args[0]) : DefaultWidth;
+		OutHeight = Args.Num() > 1 ? FCString::Atoi(*Args[1]) : DefaultHeight;
+		if (OutWidth <= 0 || OutHeight <= 0 || (OutWidth & 1) != 0 || (OutHeight & 1) != 0) {
+			UE_LOG(LogRTMP, Error, TEXT("%s needs a positive even size, got %dx%d."), What, OutWidth, OutHeight);
+			return false;
+		}
+		return true;
+	}
+
+	void FillRandomBGRA(TArray<uint8>& OutPixels, int32 Width, int32 Height)
+	{
+		OutPixels.SetNumUninitialized(Width * Height * 4);
+		FRandomStream Random(Width * Height);
+		for (uint8& Value : OutPixels)
+		{
+			Value = (uint8)Random.RandRange(0, 255);
+		}
+	}
+
+	/**
+	 * Times every supported kernel and swscale on random pixels, checking the kernels against the reference.
+	 * swscale output is not compared, its rounding and chroma siting differ.
+	 */
+	static void BenchmarkColorConversion(const TArray<FString>& Args)
+	{
+		int32 Width = 0;
+		int32 Height = 0;
+		if (!ParseEvenFrameSize(Args, 1920, 1080, TEXT("Colour conversion benchmark"), Width, Height)) {
+			return;
+		}
+		const int32 NumIterations = Args.Num() > 2 ? FMath::Max(FCString::Atoi(*Args[2]), 1) : 100;
+
+		TArray<uint8> Pixels;
+		FillRandomBGRA(Pixels, Width, Height);
+
+		const FYUVCoefficients& Coefficients = GetYUVCoefficients(ERTMPColorMatrix::BT709, ERTMPColorRange::Limited);
+		const int32 FrameSize = GetFrameSize(ERTMPFrameFormat::I420, Width, Height);
+
+		UE_LOG(LogRTMP, Display, TEXT("BGRA -> YUV 4:2:0 at %dx%d, %d iterations, dispatching to %s:"), Width, Height, NumIterations, GetColorKernelName(GetBestColorKernel()));
+		UE_LOG(LogRTMP, Display, TEXT("  %-24s %10s %10s %8s"), TEXT("Path"), TEXT("ms/frame"), TEXT("Mpix/s"), TEXT("Result"));
+
+		auto LogRow = [Width, Height, NumIterations](const TCHAR* Name, double Seconds, const TCHAR* Result)
+		{
+			const double SecondsPerFrame = Seconds / NumIterations;
+			UE_LOG(LogRTMP, Display, TEXT("  %-24s %10.3f %10.1f %8s"), Name, SecondsPerFrame * 1000.0, Width * Height / SecondsPerFrame / 1000000.0, Result);
+		};
+
+		for (ERTMPFrameFormat Format : { ERTMPFrameFormat::I420, ERTMPFrameFormat::NV12 })
+		{
+			TArray<uint8> Expected;
+			Expected.SetNumUninitialized(FrameSize);
+			ConvertBGRAToYUV420Reference(Pixels.GetData(), Width * 4, Width, Height, GetPackedPlanes(Expected.GetData(), Format, Width, Height), Coefficients);
+
+			TArray<uint8> Output;
+			Output.SetNumUninitialized(FrameSize);
+			const FYUV420Planes Planes = GetPackedPlanes(Output.GetData(), Format, Width, Height);
+
+			for (int32 Index = 0; Index < (int32)ERTMPColorKernel::Num; ++Index)
+			{
+				const ERTMPColorKernel Kernel = (ERTMPColorKernel)Index;
+				if (!IsColorKernelSupported(Kernel)) {
+					continue;
+				}
+
+				FMemory::Memzero(Output.GetData(), FrameSize);
+				const double StartTime = FPlatformTime::Seconds();
+				for (int32 Iteration = 0; Iteration < NumIterations; ++Iteration)
+				{
+					ConvertBGRAToYUV420(Kernel, Pixels.GetData(), Width * 4, Width, Height, Planes, Coefficients);
+				}
+				const double Seconds = FPlatformTime::Seconds() - StartTime;
+
+				const bool bMatches = FMemory::Memcmp(Output.GetData(), Expected.GetData(), FrameSize) == 0;
+				const FString Name = FString::Printf(TEXT("%s %s"), GetColorKernelName(Kernel), Format == ERTMPFrameFormat::I420 ? TEXT("I420") : TEXT("NV12"));
+				LogRow(*Name, Seconds, bMatches ? TEXT("match") : TEXT("MISMATCH"));
+			}
+
+			const int32 NumSlices = GetDefaultConversionSlices(Height);
+			if (NumSlices > 1) {
+				FMemory::Memzero(Output.GetData(), FrameSize);
+				const double StartTime = FPlatformTime::Seconds();
+				for (int32 Iteration = 0; Iteration < NumIterations; ++Iteration)
+				{
+					ConvertBGRAToYUV420Sliced(Pixels.GetData(), Width * 4, Width, Height, Planes, Coefficients, NumSlices);
+				}
+				const double Seconds = FPlatformTime::Seconds() - StartTime;
+
+				const bool bMatches = FMemory::Memcmp(Output.GetData(), Expected.GetData(), FrameSize) == 0;
+				const FString Name = FString::Printf(TEXT("%s %s x%d slices"), GetColorKernelName(GetBestColorKernel()), Format == ERTMPFrameFormat::I420 ? TEXT("I420") : TEXT("NV12"), NumSlices);
+				LogRow(*Name, Seconds, bMatches ? TEXT("match") : TEXT("MISMATCH"));
+			}
+		}
+
+		TArray<uint8> Output;
+		Output.SetNumUninitialized(FrameSize);
+		const FYUV420Planes Planes = GetPackedPlanes(Output.GetData(), ERTMPFrameFormat::I420, Width, Height);
+		uint8* DestData[4] = { Planes.Y, Planes.U, Planes.V, nullptr };
+		int32 DestPitch[4] = { Planes.YPitch, Planes.UPitch, Planes.VPitch, 0 };
+		const uint8* SourceData[4] = { Pixels.GetData(), nullptr, nullptr, nullptr };
+		int32 SourcePitch[4] = { Width * 4, 0, 0, 0 };
+
+		const TPair<int32, const TCHAR*> ScaleFlags[] = {
+			{ SWS_BICUBIC, TEXT("swscale bicubic I420") },
+			{ SWS_FAST_BILINEAR, TEXT("swscale fast bilinear I420") },
+		};
+		for (const TPair<int32, const TCHAR*>& Flags : ScaleFlags)
+		{
+			SwsContext* Context = sws_getContext(Width, Height, AV_PIX_FMT_BGRA, Width, Height, AV_PIX_FMT_YUV420P, Flags.Key, nullptr, nullptr, nullptr);
+			if (!Context) {
+				continue;
+			}
+
+			const double StartTime = FPlatformTime::Seconds();
+			for (int32 Iteration = 0; Iteration < NumIterations; ++Iteration)
+			{
+				sws_scale(Context, SourceData, SourcePitch, 0, Height, DestData, DestPitch);
+			}
+			LogRow(Flags.Value, FPlatformTime::Seconds() - StartTime, TEXT("-"));
+
+			sws_freeContext(Context);
+		}
+	}
+
+	static FAutoConsoleCommand BenchmarkColorConversionCommand(
+		TEXT("RTMP.BenchmarkColorConversion"),
+		TEXT("Times the BGRA to I420/NV12 kernels, single threaded and sliced, against swscale on random pixels. Usage: RTMP.BenchmarkColorConversion [Width] [Height] [Iterations]"),
+		FConsoleCommandWithArgsDelegate::CreateStatic(&BenchmarkColorConversion));
+}
@@ -0,0 +1,25 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "ColorConversion.h"
+
+namespace RTMPVideo
+{
+	namespace Kernels
+	{
+		typedef void (*FConvertFunction)(const uint8* BGRA, int32 BGRAPitch, int32 Width, int32 Height, const FYUV420Planes& Planes, const FYUVCoefficients& Coefficients);
+
+		/** Scalar conversion of the 2x2 blocks [FirstBlock, EndBlock) of one row pair, the vector kernels use it for their tails */
+		void ConvertRowPairScalar(const uint8* Row0, const uint8* Row1, uint8* Y0, uint8* Y1, uint8* U, uint8* V, int32 ChromaStep,
+			int32 FirstBlock, int32 EndBlock, const FYUVCoefficients& Coefficients);
+
+#if PLATFORM_CPU_X86_FAMILY
+		/** Vector kernels, only call them when the CPU supports the instruction set. ChromaStep must be 1 or 2 */
+		void ConvertSSE41(const uint8* BGRA, int32 BGRAPitch, int32 Width, int32 Height, const FYUV420Planes& Planes, const FYUVCoefficients& Coefficients);
+		void ConvertAVX2(const uint8* BGRA, int32 BGRAPitch, int32 Width, int32 Height, const FYUV420Planes& Planes, const FYUVCoefficients& Coefficients);
+		void ConvertAVX512(const uint8* BGRA, int32 BGRAPitch, int32 Width, int32 Height, const FYUV420Planes& Planes, const FYUVCoefficients& Coefficients);
+#endif
+	}
+}
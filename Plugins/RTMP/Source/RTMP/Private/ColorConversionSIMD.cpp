@@ -0,0 +1,329 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "ColorConversionKernels.h"
+
+#if PLATFORM_CPU_X86_FAMILY
+
+#include <immintrin.h>
+
+// MSVC accepts any intrinsic, GCC and Clang only inside functions built for the instruction set.
+#if defined(__clang__) || defined(__GNUC__)
+#define RTMP_TARGET_SSE41 __attribute__((target("sse4.1")))
+#define RTMP_TARGET_AVX2 __attribute__((target("avx2")))
+#define RTMP_TARGET_AVX512 __attribute__((target("avx512f,avx512bw")))
+#else
+#define RTMP_TARGET_SSE41
+#define RTMP_TARGET_AVX2
+#define RTMP_TARGET_AVX512
+#endif
+
+/**
+ * All kernels follow the reference bit for bit: pixels are widened to 16 bit, multiplied with the 16 bit
+ * coefficients into 32 bit sums (madd), offset, shifted right by 8 and saturated to bytes.
+ * Coefficient vectors are laid out B, G, R, 0 to match the BGRA pixel order.
+ */
+namespace RTMPVideo
+{
+	namespace Kernels
+	{
+		static FORCEINLINE void StoreInt32(uint8* Dest, int32 Value)
+		{
+			FMemory::Memcpy(Dest, &Value, sizeof(Value));
+		}
+
+		// SSE4.1: 8 pixels of a row pair per iteration
+
+		RTMP_TARGET_SSE41 static FORCEINLINE __m128i LoadCoefficientsSSE41(const int32* Row)
+		{
+			return _mm_setr_epi16(Row[2], Row[1], Row[0], 0, Row[2], Row[1], Row[0], 0);
+		}
+
+		/** Two 16 bit pixels per register in, 8 luma bytes in the low half out */
+		RTMP_TARGET_SSE41 static FORCEINLINE __m128i LumaSSE41(__m128i P01, __m128i P23, __m128i P45, __m128i P67, __m128i Coefficients, __m128i Offset)
+		{
+			__m128i Sum03 = _mm_hadd_epi32(_mm_madd_epi16(P01, Coefficients), _mm_madd_epi16(P23, Coefficients));
+			__m128i Sum47 = _mm_hadd_epi32(_mm_madd_epi16(P45, Coefficients), _mm_madd_epi16(P67, Coefficients));
+			Sum03 = _mm_srai_epi32(_mm_add_epi32(Sum03, Offset), 8);
+			Sum47 = _mm_srai_epi32(_mm_add_epi32(Sum47, Offset), 8);
+			return _mm_packus_epi16(_mm_packs_epi32(Sum03, Sum47), _mm_setzero_si128());
+		}
+
+		/** Two averaged blocks per register in, 4 chroma values as 32 bit out */
+		RTMP_TARGET_SSE41 static FORCEINLINE __m128i ChromaSSE41(__m128i Blocks01, __m128i Blocks23, __m128i Coefficients, __m128i Offset)
+		{
+			const __m128i Sum = _mm_hadd_epi32(_mm_madd_epi16(Blocks01, Coefficients), _mm_madd_epi16(Blocks23, Coefficients));
+			return _mm_srai_epi32(_mm_add_epi32(Sum, Offset), 8);
+		}
+
+		RTMP_TARGET_SSE41 void ConvertSSE41(const uint8* BGRA, int32 BGRAPitch, int32 Width, int32 Height, const FYUV420Planes& Planes, const FYUVCoefficients& Coefficients)
+		{
+			const __m128i YCoefficients = LoadCoefficientsSSE41(Coefficients.Y);
+			const __m128i UCoefficients = LoadCoefficientsSSE41(Coefficients.U);
+			const __m128i VCoefficients = LoadCoefficientsSSE41(Coefficients.V);
+			const __m128i YOffset = _mm_set1_epi32(Coefficients.Y[3]);
+			const __m128i UOffset = _mm_set1_epi32(Coefficients.U[3]);
+			const __m128i VOffset = _mm_set1_epi32(Coefficients.V[3]);
+			const __m128i Two = _mm_set1_epi16(2);
+
+			const int32 NumBlocks = Width / 2;
+			const int32 NumVectorBlocks = NumBlocks & ~3;
+
+			for (int32 BlockY = 0; BlockY < Height / 2; ++BlockY)
+			{
+				const uint8* Row0 = BGRA + (BlockY * 2) * BGRAPitch;
+				const uint8* Row1 = Row0 + BGRAPitch;
+				uint8* Y0 = Planes.Y + (BlockY * 2) * Planes.YPitch;
+				uint8* Y1 = Y0 + Planes.YPitch;
+				uint8* U = Planes.U + BlockY * Planes.UPitch;
+				uint8* V = Planes.V + BlockY * Planes.VPitch;
+
+				for (int32 Block = 0; Block < NumVectorBlocks; Block += 4)
+				{
+					const __m128i Row0Lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(Row0 + Block * 8));
+					const __m128i Row0Hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(Row0 + Block * 8 + 16));
+					const __m128i Row1Lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(Row1 + Block * 8));
+					const __m128i Row1Hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(Row1 + Block * 8 + 16));
+
+					const __m128i R0P01 = _mm_cvtepu8_epi16(Row0Lo);
+					const __m128i R0P23 = _mm_cvtepu8_epi16(_mm_srli_si128(Row0Lo, 8));
+					const __m128i R0P45 = _mm_cvtepu8_epi16(Row0Hi);
+					const __m128i R0P67 = _mm_cvtepu8_epi16(_mm_srli_si128(Row0Hi, 8));
+					const __m128i R1P01 = _mm_cvtepu8_epi16(Row1Lo);
+					const __m128i R1P23 = _mm_cvtepu8_epi16(_mm_srli_si128(Row1Lo, 8));
+					const __m128i R1P45 = _mm_cvtepu8_epi16(Row1Hi);
+					const __m128i R1P67 = _mm_cvtepu8_epi16(_mm_srli_si128(Row1Hi, 8));
+
+					_mm_storel_epi64(reinterpret_cast<__m128i*>(Y0 + Block * 2), LumaSSE41(R0P01, R0P23, R0P45, R0P67, YCoefficients, YOffset));
+					_mm_storel_epi64(reinterpret_cast<__m128i*>(Y1 + Block * 2), LumaSSE41(R1P01, R1P23, R1P45, R1P67, YCoefficients, YOffset));
+
+					// Vertical sums, then the two pixels of each block added in the low half.
+					__m128i Sum01 = _mm_add_epi16(R0P01, R1P01);
+					__m128i Sum23 = _mm_add_epi16(R0P23, R1P23);
+					__m128i Sum45 = _mm_add_epi16(R0P45, R1P45);
+					__m128i Sum67 = _mm_add_epi16(R0P67, R1P67);
+					Sum01 = _mm_add_epi16(Sum01, _mm_srli_si128(Sum01, 8));
+					Sum23 = _mm_add_epi16(Sum23, _mm_srli_si128(Sum23, 8));
+					Sum45 = _mm_add_epi16(Sum45, _mm_srli_si128(Sum45, 8));
+					Sum67 = _mm_add_epi16(Sum67, _mm_srli_si128(Sum67, 8));
+
+					const __m128i Blocks01 = _mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi64(Sum01, Sum23), Two), 2);
+					const __m128i Blocks23 = _mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi64(Sum45, Sum67), Two), 2);
+
+					const __m128i U4 = ChromaSSE41(Blocks01, Blocks23, UCoefficients, UOffset);
+					const __m128i V4 = ChromaSSE41(Blocks01, Blocks23, VCoefficients, VOffset);
+
+					// U0-3 V0-3 as bytes
+					const __m128i UV = _mm_packus_epi16(_mm_packs_epi32(U4, V4), _mm_setzero_si128());
+					if (Planes.ChromaStep == 2) {
+						_mm_storel_epi64(reinterpret_cast<__m128i*>(U + Block * 2), _mm_unpacklo_epi8(UV, _mm_srli_si128(UV, 4)));
+					}
+					else {
+						StoreInt32(U + Block, _mm_cvtsi128_si32(UV));
+						StoreInt32(V + Block, _mm_extract_epi32(UV, 1));
+					}
+				}
+
+				ConvertRowPairScalar(Row0, Row1, Y0, Y1, U, V, Planes.ChromaStep, NumVectorBlocks, NumBlocks, Coefficients);
+			}
+		}
+
+		// AVX2: 16 pixels of a row pair per iteration. Most 256 bit instructions work per 128 bit lane,
+		// results are put back in order with cross lane permutes.
+
+		RTMP_TARGET_AVX2 static FORCEINLINE __m256i LoadCoefficientsAVX2(const int32* Row)
+		{
+			return _mm256_setr_epi16(Row[2], Row[1], Row[0], 0, Row[2], Row[1], Row[0], 0, Row[2], Row[1], Row[0], 0, Row[2], Row[1], Row[0], 0);
+		}
+
+		/** Four 16 bit pixels per register in, 16 luma bytes out */
+		RTMP_TARGET_AVX2 static FORCEINLINE __m128i LumaAVX2(const __m256i* Pixels, __m256i Coefficients, __m256i Offset)
+		{
+			// hadd leaves pixels as 0 1 4 5 | 2 3 6 7, swapping the middle 64 bit quarters restores the order
+			__m256i Sum07 = _mm256_hadd_epi32(_mm256_madd_epi16(Pixels[0], Coefficients), _mm256_madd_epi16(Pixels[1], Coefficients));
+			__m256i Sum815 = _mm256_hadd_epi32(_mm256_madd_epi16(Pixels[2], Coefficients), _mm256_madd_epi16(Pixels[3], Coefficients));
+			Sum07 = _mm256_permute4x64_epi64(Sum07, _MM_SHUFFLE(3, 1, 2, 0));
+			Sum815 = _mm256_permute4x64_epi64(Sum815, _MM_SHUFFLE(3, 1, 2, 0));
+			Sum07 = _mm256_srai_epi32(_mm256_add_epi32(Sum07, Offset), 8);
+			Sum815 = _mm256_srai_epi32(_mm256_add_epi32(Sum815, Offset), 8);
+
+			const __m256i Words = _mm256_permute4x64_epi64(_mm256_packs_epi32(Sum07, Sum815), _MM_SHUFFLE(3, 1, 2, 0));
+			const __m256i Bytes = _mm256_permute4x64_epi64(_mm256_packus_epi16(Words, Words), _MM_SHUFFLE(3, 1, 2, 0));
+			return _mm256_castsi256_si128(Bytes);
+		}
+
+		/** Averaged blocks as 0 2 | 1 3 and 4 6 | 5 7 in, 8 chroma values as 32 bit out */
+		RTMP_TARGET_AVX2 static FORCEINLINE __m256i ChromaAVX2(__m256i Blocks0213, __m256i Blocks4657, __m256i Coefficients, __m256i Offset)
+		{
+			__m256i Sum = _mm256_hadd_epi32(_mm256_madd_epi16(Blocks0213, Coefficients), _mm256_madd_epi16(Blocks4657, Coefficients));
+			Sum = _mm256_permutevar8x32_epi32(Sum, _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7));
+			return _mm256_srai_epi32(_mm256_add_epi32(Sum, Offset), 8);
+		}
+
+		RTMP_TARGET_AVX2 void ConvertAVX2(const uint8* BGRA, int32 BGRAPitch, int32 Width, int32 Height, const FYUV420Planes& Planes, const FYUVCoefficients& Coefficients)
+		{
+			const __m256i YCoefficients = LoadCoefficientsAVX2(Coefficients.Y);
+			const __m256i UCoefficients = LoadCoefficientsAVX2(Coefficients.U);
+			const __m256i VCoefficients = LoadCoefficientsAVX2(Coefficients.V);
+			const __m256i YOffset = _mm256_set1_epi32(Coefficients.Y[3]);
+			const __m256i UOffset = _mm256_set1_epi32(Coefficients.U[3]);
+			const __m256i VOffset = _mm256_set1_epi32(Coefficients.V[3]);
+			const __m256i Two = _mm256_set1_epi16(2);
+
+			const int32 NumBlocks = Width / 2;
+			const int32 NumVectorBlocks = NumBlocks & ~7;
+
+			for (int32 BlockY = 0; BlockY < Height / 2; ++BlockY)
+			{
+				const uint8* Row0 = BGRA + (BlockY * 2) * BGRAPitch;
+				const uint8* Row1 = Row0 + BGRAPitch;
+				uint8* Y0 = Planes.Y + (BlockY * 2) * Planes.YPitch;
+				uint8* Y1 = Y0 + Planes.YPitch;
+				uint8* U = Planes.U + BlockY * Planes.UPitch;
+				uint8* V = Planes.V + BlockY * Planes.VPitch;
+
+				for (int32 Block = 0; Block < NumVectorBlocks; Block += 8)
+				{
+					// Pixels 4k .. 4k + 3 widened to 16 bit, two per lane
+					__m256i Row0Pixels[4];
+					__m256i Row1Pixels[4];
+					for (int32 Index = 0; Index < 4; ++Index)
+					{
+						Row0Pixels[Index] = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(Row0 + Block * 8 + Index * 16)));
+						Row1Pixels[Index] = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(Row1 + Block * 8 + Index * 16)));
+					}
+
+					_mm_storeu_si128(reinterpret_cast<__m128i*>(Y0 + Block * 2), LumaAVX2(Row0Pixels, YCoefficients, YOffset));
+					_mm_storeu_si128(reinterpret_cast<__m128i*>(Y1 + Block * 2), LumaAVX2(Row1Pixels, YCoefficients, YOffset));
+
+					// Block 2k in the low half of lane 0, block 2k + 1 in the low half of lane 1
+					__m256i Sums[4];
+					for (int32 Index = 0; Index < 4; ++Index)
+					{
+						const __m256i Sum = _mm256_add_epi16(Row0Pixels[Index], Row1Pixels[Index]);
+						Sums[Index] = _mm256_add_epi16(Sum, _mm256_srli_si256(Sum, 8));
+					}
+
+					const __m256i Blocks0213 = _mm256_srli_epi16(_mm256_add_epi16(_mm256_unpacklo_epi64(Sums[0], Sums[1]), Two), 2);
+					const __m256i Blocks4657 = _mm256_srli_epi16(_mm256_add_epi16(_mm256_unpacklo_epi64(Sums[2], Sums[3]), Two), 2);
+
+					const __m256i U8 = ChromaAVX2(Blocks0213, Blocks4657, UCoefficients, UOffset);
+					const __m256i V8 = ChromaAVX2(Blocks0213, Blocks4657, VCoefficients, VOffset);
+
+					// U0-7 in lane 0 and V0-7 in lane 1 as words, then bytes
+					const __m256i UVWords = _mm256_permute4x64_epi64(_mm256_packs_epi32(U8, V8), _MM_SHUFFLE(3, 1, 2, 0));
+					const __m256i UVBytes = _mm256_packus_epi16(UVWords, UVWords);
+					const __m128i UBytes = _mm256_castsi256_si128(UVBytes);
+					const __m128i VBytes = _mm256_extracti128_si256(UVBytes, 1);
+
+					if (Planes.ChromaStep == 2) {
+						_mm_storeu_si128(reinterpret_cast<__m128i*>(U + Block * 2), _mm_unpacklo_epi8(UBytes, VBytes));
+					}
+					else {
+						_mm_storel_epi64(reinterpret_cast<__m128i*>(U + Block), UBytes);
+						_mm_storel_epi64(reinterpret_cast<__m128i*>(V + Block), VBytes);
+					}
+				}
+
+				ConvertRowPairScalar(Row0, Row1, Y0, Y1, U, V, Planes.ChromaStep, NumVectorBlocks, NumBlocks, Coefficients);
+			}
+		}
+
+		// AVX-512: 32 pixels of a row pair per iteration. Pixels are summed in place within each 64 bit element
+		// and compacted with vpmovqd, which avoids the per lane horizontal adds.
+
+		RTMP_TARGET_AVX512 static FORCEINLINE __m512i LoadCoefficientsAVX512(const int32* Row)
+		{
+			const int64 Packed = (int64)(uint16)Row[2] | ((int64)(uint16)Row[1] << 16) | ((int64)(uint16)Row[0] << 32);
+			return _mm512_set1_epi64(Packed);
+		}
+
+		/** One BGRA quadruple of 16 bit values per 64 bit element in, their weighted sums as 8 ordered 32 bit values out */
+		RTMP_TARGET_AVX512 static FORCEINLINE __m256i WeightedSumAVX512(__m512i Quadruples, __m512i Coefficients)
+		{
+			const __m512i Products = _mm512_madd_epi16(Quadruples, Coefficients);
+			return _mm512_cvtepi64_epi32(_mm512_add_epi32(Products, _mm512_srli_epi64(Products, 32)));
+		}
+
+		/** 16 weighted sums in, 16 offset, shifted and saturated bytes out */
+		RTMP_TARGET_AVX512 static FORCEINLINE __m128i ToBytesAVX512(__m256i Sums0, __m256i Sums1, __m512i Offset)
+		{
+			__m512i Sums = _mm512_inserti64x4(_mm512_castsi256_si512(Sums0), Sums1, 1);
+			Sums = _mm512_srai_epi32(_mm512_add_epi32(Sums, Offset), 8);
+			return _mm512_cvtusepi32_epi8(_mm512_max_epi32(Sums, _mm512_setzero_si512()));
+		}
+
+		RTMP_TARGET_AVX512 void ConvertAVX512(const uint8* BGRA, int32 BGRAPitch, int32 Width, int32 Height, const FYUV420Planes& Planes, const FYUVCoefficients& Coefficients)
+		{
+			const __m512i YCoefficients = LoadCoefficientsAVX512(Coefficients.Y);
+			const __m512i UCoefficients = LoadCoefficientsAVX512(Coefficients.U);
+			const __m512i VCoefficients = LoadCoefficientsAVX512(Coefficients.V);
+			const __m512i YOffset = _mm512_set1_epi32(Coefficients.Y[3]);
+			const __m512i UOffset = _mm512_set1_epi32(Coefficients.U[3]);
+			const __m512i VOffset = _mm512_set1_epi32(Coefficients.V[3]);
+			const __m512i Two = _mm512_set1_epi16(2);
+			const __m512i EvenQuadwords = _mm512_setr_epi64(0, 2, 4, 6, 8, 10, 12, 14);
+
+			const int32 NumBlocks = Width / 2;
+			const int32 NumVectorBlocks = NumBlocks & ~15;
+
+			for (int32 BlockY = 0; BlockY < Height / 2; ++BlockY)
+			{
+				const uint8* Row0 = BGRA + (BlockY * 2) * BGRAPitch;
+				const uint8* Row1 = Row0 + BGRAPitch;
+				uint8* Y0 = Planes.Y + (BlockY * 2) * Planes.YPitch;
+				uint8* Y1 = Y0 + Planes.YPitch;
+				uint8* U = Planes.U + BlockY * Planes.UPitch;
+				uint8* V = Planes.V + BlockY * Planes.VPitch;
+
+				for (int32 Block = 0; Block < NumVectorBlocks; Block += 16)
+				{
+					// Pixels 8k .. 8k + 7 widened to 16 bit, one per 64 bit element
+					__m512i Row0Pixels[4];
+					__m512i Row1Pixels[4];
+					for (int32 Index = 0; Index < 4; ++Index)
+					{
+						Row0Pixels[Index] = _mm512_cvtepu8_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(Row0 + Block * 8 + Index * 32)));
+						Row1Pixels[Index] = _mm512_cvtepu8_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(Row1 + Block * 8 + Index * 32)));
+					}
+
+					for (int32 Half = 0; Half < 2; ++Half)
+					{
+						const __m128i Luma0 = ToBytesAVX512(WeightedSumAVX512(Row0Pixels[Half * 2], YCoefficients), WeightedSumAVX512(Row0Pixels[Half * 2 + 1], YCoefficients), YOffset);
+						const __m128i Luma1 = ToBytesAVX512(WeightedSumAVX512(Row1Pixels[Half * 2], YCoefficients), WeightedSumAVX512(Row1Pixels[Half * 2 + 1], YCoefficients), YOffset);
+						_mm_storeu_si128(reinterpret_cast<__m128i*>(Y0 + Block * 2 + Half * 16), Luma0);
+						_mm_storeu_si128(reinterpret_cast<__m128i*>(Y1 + Block * 2 + Half * 16), Luma1);
+					}
+
+					// Each 128 bit lane ends up with one block sum in its low 64 bits
+					__m512i Sums[4];
+					for (int32 Index = 0; Index < 4; ++Index)
+					{
+						const __m512i Sum = _mm512_add_epi16(Row0Pixels[Index], Row1Pixels[Index]);
+						Sums[Index] = _mm512_add_epi16(Sum, _mm512_bsrli_epi128(Sum, 8));
+					}
+
+					// Blocks 0-7 and 8-15, one per 64 bit element
+					const __m512i Blocks07 = _mm512_srli_epi16(_mm512_add_epi16(_mm512_permutex2var_epi64(Sums[0], EvenQuadwords, Sums[1]), Two), 2);
+					const __m512i Blocks815 = _mm512_srli_epi16(_mm512_add_epi16(_mm512_permutex2var_epi64(Sums[2], EvenQuadwords, Sums[3]), Two), 2);
+
+					const __m128i UBytes = ToBytesAVX512(WeightedSumAVX512(Blocks07, UCoefficients), WeightedSumAVX512(Blocks815, UCoefficients), UOffset);
+					const __m128i VBytes = ToBytesAVX512(WeightedSumAVX512(Blocks07, VCoefficients), WeightedSumAVX512(Blocks815, VCoefficients), VOffset);
+
+					if (Planes.ChromaStep == 2) {
+						_mm_storeu_si128(reinterpret_cast<__m128i*>(U + Block * 2), _mm_unpacklo_epi8(UBytes, VBytes));
+						_mm_storeu_si128(reinterpret_cast<__m128i*>(U + Block * 2 + 16), _mm_unpackhi_epi8(UBytes, VBytes));
+					}
+					else {
+						_mm_storeu_si128(reinterpret_cast<__m128i*>(U + Block), UBytes);
+						_mm_storeu_si128(reinterpret_cast<__m128i*>(V + Block), VBytes);
+					}
+				}
+
+				ConvertRowPairScalar(Row0, Row1, Y0, Y1, U, V, Planes.ChromaStep, NumVectorBlocks, NumBlocks, Coefficients);
+			}
+		}
+	}
+}
+
+#endif // PLATFORM_CPU_X86_FAMILY
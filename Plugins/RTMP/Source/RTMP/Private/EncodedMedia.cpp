@@ -0,0 +1,128 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "EncodedMedia.h"
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavutil/frame.h>
+}
+
+void FAVFrameDeleter::operator()(AVFrame* Frame) const
+{
+	av_frame_free(&Frame);
+}
+
+void FAVPacketDeleter::operator()(AVPacket* Packet) const
+{
+	av_packet_free(&Packet);
+}
+
+FAVPacketPool::FAVPacketPool(int32 MaxFree)
+	: FreePackets(FMath::Max(MaxFree, 1), ERTMPQueueOverflowPolicy::DropNewest)
+	, NumAllocated(0)
+{
+}
+
+FAVPacketPtr FAVPacketPool::Acquire()
+{
+	FAVPacketPtr Packet;
+	if (!FreePackets.Dequeue(Packet)) {
+		Packet.Reset(av_packet_alloc());
+		NumAllocated.Increment();
+	}
+	return Packet;
+}
+
+void FAVPacketPool::Release(FAVPacketPtr&& Packet)
+{
+	if (!Packet.IsValid()) {
+		return;
+	}
+
+	av_packet_unref(Packet.Get());
+	// A full pool leaves the packet with the caller, freed when it goes out of scope.
+	FreePackets.Enqueue(MoveTemp(Packet));
+}
+
+int64 FAVPacketPool::GetNumAllocated() const
+{
+	return NumAllocated.GetValue();
+}
+
+namespace RTMPVideo
+{
+	/** Checks one NAL unit, returns false once a reference slice is found */
+	static bool CheckNalUnit(const uint8* Nal, int32 Size, bool& bOutHasSlice)
+	{
+		if (Size <= 0) {
+			return true;
+		}
+
+		// nal_ref_idc in bits 5-6, nal_unit_type in bits 0-4. Types 1 and 5 are coded slices, IDR slices are always references.
+		const int32 NalRefIdc = (Nal[0] >> 5) & 0x03;
+		const int32 NalType = Nal[0] & 0x1F;
+		if (NalType == 1 || NalType == 5) {
+			bOutHasSlice = true;
+			return NalType == 1 && NalRefIdc == 0;
+		}
+		return true;
+	}
+
+	bool IsNonReferenceH264AccessUnit(const uint8* Data, int32 Size)
+	{
+		if (Data == nullptr || Size < 4) {
+			return false;
+		}
+
+		bool bHasSlice = false;
+
+		const bool bAnnexB = (Data[0] == 0 && Data[1] == 0 && Data[2] == 1) || (Data[0] == 0 && Data[1] == 0 && Data[2] == 0 && Data[3] == 1);
+		if (bAnnexB) {
+			int32 NalStart = -1;
+			for (int32 Index = 0; Index + 2 < Size; ++Index)
+			{
+				if (Data[Index] != 0 || Data[Index + 1] != 0 || Data[Index + 2] != 1) {
+					continue;
+				}
+
+				if (NalStart >= 0) {
+					// Zero bytes before the start code belong to it (or are trailing zeros), not to the NAL unit.
+					int32 NalEnd = Index;
+					while (NalEnd > NalStart && Data[NalEnd - 1] == 0)
+					{
+						--NalEnd;
+					}
+					if (!CheckNalUnit(Data + NalStart, NalEnd - NalStart, bHasSlice)) {
+						return false;
+					}
+				}
+
+				NalStart = Index + 3;
+				Index += 2;
+			}
+
+			if (NalStart >= 0 && !CheckNalUnit(Data + NalStart, Size - NalStart, bHasSlice)) {
+				return false;
+			}
+		}
+		else {
+			int32 Offset = 0;
+			while (Offset + 4 <= Size)
+			{
+				const int32 NalSize = (int32(Data[Offset]) << 24) | (int32(Data[Offset + 1]) << 16) | (int32(Data[Offset + 2]) << 8) | int32(Data[Offset + 3]);
+				Offset += 4;
+				if (NalSize < 0 || NalSize > Size - Offset) {
+					return false;
+				}
+
+				if (!CheckNalUnit(Data + Offset, NalSize, bHasSlice)) {
+					return false;
+				}
+				Offset += NalSize;
+			}
+		}
+
+		return bHasSlice;
+	}
+}
@@ -0,0 +1,65 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "FramePacer.h"
+
+namespace RTMPFramePacer
+{
+	// Fraction of a slot a present may come early and still claim the next slot. When the present rate
+	// matches the capture rate (e.g. 60 Hz vsync at 60 fps) presents land close to slot boundaries and
+	// scheduling jitter would otherwise alternate between skipping and duplicating frames.
+	static const double EarlyTolerance = 0.25;
+}
+
+FFramePacer::FFramePacer()
+	: FrameRate(30, 1)
+	, StartSeconds(0.0)
+	, LastSlot(INDEX_NONE)
+{
+}
+
+void FFramePacer::Start(const FFrameRate& InFrameRate, double InStartSeconds)
+{
+	check(InFrameRate.IsValid());
+
+	FrameRate = InFrameRate;
+	StartSeconds = InStartSeconds;
+	LastSlot = INDEX_NONE;
+
+	NumCaptured.Reset();
+	NumSkipped.Reset();
+	NumDuplicated.Reset();
+}
+
+int64 FFramePacer::Tick(double Seconds)
+{
+	// Position on the slot timeline, computed from the rational rate so 30000/1001 stays exact.
+	const double SlotPosition = FMath::Max(Seconds - StartSeconds, 0.0) * FrameRate.Numerator / FrameRate.Denominator;
+
+	int64 Slot = (int64)FMath::FloorToDouble(SlotPosition);
+	if (Slot <= LastSlot) {
+		if (SlotPosition + RTMPFramePacer::EarlyTolerance < LastSlot + 1) {
+			NumSkipped.Increment();
+			return INDEX_NONE;
+		}
+
+		Slot = LastSlot + 1;
+	}
+
+	if (LastSlot != INDEX_NONE && Slot > LastSlot + 1) {
+		NumDuplicated.Add(Slot - LastSlot - 1);
+	}
+
+	LastSlot = Slot;
+	NumCaptured.Increment();
+	return Slot;
+}
+
+FFramePacerStats FFramePacer::GetStats() const
+{
+	FFramePacerStats Stats;
+	Stats.NumCaptured = NumCaptured.GetValue();
+	Stats.NumSkipped = NumSkipped.GetValue();
+	Stats.NumDuplicated = NumDuplicated.GetValue();
+	return Stats;
+}
@@ -0,0 +1,105 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "FramePool.h"
+#include "Misc/ScopeLock.h"
+
+FPooledFrameBuffer::FPooledFrameBuffer(FFramePool* InOwner, int32 InSize)
+	: Owner(InOwner)
+{
+	Data.SetNumUninitialized(InSize);
+}
+
+uint32 FPooledFrameBuffer::AddRef() const
+{
+	return uint32(NumRefs.Increment());
+}
+
+uint32 FPooledFrameBuffer::Release() const
+{
+	const int32 Refs = NumRefs.Decrement();
+	check(Refs >= 0);
+
+	if (Refs == 0) {
+		Owner->Recycle(const_cast<FPooledFrameBuffer*>(this));
+	}
+
+	return uint32(Refs);
+}
+
+uint32 FPooledFrameBuffer::GetRefCount() const
+{
+	return uint32(NumRefs.GetValue());
+}
+
+FFramePool::FFramePool(int32 NumBuffers, int32 InBufferSize)
+	: BufferSize(InBufferSize)
+{
+	check(NumBuffers > 0 && InBufferSize > 0);
+
+	AllBuffers.Reserve(NumBuffers);
+	FreeBuffers.Reserve(NumBuffers);
+	for (int32 Index = 0; Index < NumBuffers; ++Index)
+	{
+		FPooledFrameBuffer* Buffer = new FPooledFrameBuffer(this, BufferSize);
+		AllBuffers.Add(Buffer);
+		FreeBuffers.Add(Buffer);
+	}
+}
+
+FFramePool::~FFramePool()
+{
+	ensureMsgf(GetNumFreeBuffers() == AllBuffers.Num(), TEXT("Frame pool destroyed while %d buffers are still referenced."), AllBuffers.Num() - GetNumFreeBuffers());
+
+	for (FPooledFrameBuffer* Buffer : AllBuffers)
+	{
+		delete Buffer;
+	}
+
+	AllBuffers.Empty();
+	FreeBuffers.Empty();
+}
+
+FPooledFrameBufferRef FFramePool::Acquire()
+{
+	FPooledFrameBuffer* Buffer = nullptr;
+	{
+		FScopeLock Lock(&FreeBuffersCS);
+		if (FreeBuffers.Num() > 0) {
+			Buffer = FreeBuffers.Pop(false);
+		}
+	}
+
+	if (Buffer == nullptr) {
+		NumExhausted.Increment();
+	}
+
+	return FPooledFrameBufferRef(Buffer);
+}
+
+int32 FFramePool::GetBufferSize() const
+{
+	return BufferSize;
+}
+
+int32 FFramePool::GetNumBuffers() const
+{
+	return AllBuffers.Num();
+}
+
+int32 FFramePool::GetNumFreeBuffers() const
+{
+	FScopeLock Lock(&FreeBuffersCS);
+	return FreeBuffers.Num();
+}
+
+int64 FFramePool::GetNumExhausted() const
+{
+	return NumExhausted.GetValue();
+}
+
+void FFramePool::Recycle(FPooledFrameBuffer* Buffer)
+{
+	FScopeLock Lock(&FreeBuffersCS);
+	FreeBuffers.Push(Buffer);
+}
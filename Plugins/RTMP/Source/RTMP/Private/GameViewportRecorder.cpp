@@ -5,6 +5,9 @@
 #include "Framework/Application/SlateApplication.h"
 #include "Slate/SceneViewport.h"
 #include "Engine/GameEngine.h"
+#include "RenderingThread.h"
+#include "RHICommandList.h"
+#include "RHIDefinitions.h"
 
 #if WITH_EDITOR
 #include "Editor.h"
@@ -14,11 +17,21 @@
 
 DEFINE_LOG_CATEGORY(LogGameViewportRecorder);
 
-FGameViewportRecorder::FGameViewportRecorder(const FIntPoint& RecordResolution)
+namespace GameViewportRecorder
 {
-	bInitialized = SetupBackBufferCapturer(RecordResolution);
-	CaptureFrameInterval = std::chrono::milliseconds(0);
-	LastFrameTime = std::chrono::steady_clock::now();
+	// Waiting on a readback for longer than this counts as a render thread stall.
+	static const int64 StallThresholdMicroseconds = 1000;
+
+	static const int32 MaxSurfaces = 8;
+}
+
+FGameViewportRecorder::FGameViewportRecorder(const FIntPoint& RecordResolution, int32 InNumSurfaces, int32 InFrameGrabLatency, ERTMPReadbackMode InReadbackMode, ERTMPFrameFormat InOutputFormat,
+	ERTMPColorMatrix InColorMatrix, ERTMPColorRange InColorRange)
+	: MediaClock(nullptr)
+	, ReadbackMode(InReadbackMode)
+	, OutputFormat(ERTMPFrameFormat::BGRA)
+{
+	bInitialized = SetupBackBufferCapturer(RecordResolution, InNumSurfaces, InFrameGrabLatency, InOutputFormat, RTMPVideo::GetYUVCoefficients(InColorMatrix, InColorRange));
 }
 
 FGameViewportRecorder::~FGameViewportRecorder()
@@ -35,7 +48,7 @@ bool FGameViewportRecorder::IsInitialized() const
 	return bInitialized;
 }
 
-bool FGameViewportRecorder::StartRecord(int32 InCaptureRate)
+bool FGameViewportRecorder::StartRecord(const FFrameRate& InCaptureRate, const FMediaClock& InMediaClock)
 {
 	if (!bInitialized) {
 		return false;
@@ -51,7 +64,20 @@ bool FGameViewportRecorder::StartRecord(int32 InCaptureRate)
 		return false;
 	}
 
-	CaptureFrameInterval = std::chrono::milliseconds(1000 / InCaptureRate);
+	if (!InCaptureRate.IsValid() || InCaptureRate.Numerator <= 0) {
+		UE_LOG(LogGameViewportRecorder, Warning, TEXT("Invalid capture rate %d/%d, can not start record."), InCaptureRate.Numerator, InCaptureRate.Denominator);
+		return false;
+	}
+
+	// Not registered to the backbuffer delegate yet, the render thread can not be using the pacer.
+	MediaClock = &InMediaClock;
+	FramePacer.Start(InCaptureRate, 0.0);
+
+	NumCaptures.Reset();
+	NumStalls.Reset();
+	TotalStallMicroseconds.Reset();
+	MaxStallMicroseconds.Reset();
+	NumBusyDrops.Reset();
 
 	OnBackBufferReadyToPresent = FSlateApplication::Get().GetRenderer()->OnBackBufferReadyToPresent().AddRaw(this, &FGameViewportRecorder::OnBackBufferReadyToPresentCallback);
 
@@ -60,23 +86,58 @@ bool FGameViewportRecorder::StartRecord(int32 InCaptureRate)
 
 void FGameViewportRecorder::StopRecord()
 {
-	for (FResolveSurface& Surface : Surfaces)
-	{
-		// Empty threaded operation.
-		Surface.Surface.BlockUntilAvailable();
+	FSlateApplication::Get().GetRenderer()->OnBackBufferReadyToPresent().RemoveAll(this);
+	OnBackBufferReadyToPresent.Reset();
+
+	// Let a capture running on the render thread finish, copies still in flight are simply never read back.
+	FlushRenderingCommands();
+
+	const FFramePacerStats PacingStats = FramePacer.GetStats();
+	UE_LOG(LogGameViewportRecorder, Log, TEXT("Recorded at %.3f fps: %lld frames captured, %lld skipped, %lld duplicated."),
+		FramePacer.GetFrameRate().AsDecimal(), PacingStats.NumCaptured, PacingStats.NumSkipped, PacingStats.NumDuplicated);
+
+	const FViewportReadbackStats ReadbackStats = GetReadbackStats();
+	if (ReadbackMode == ERTMPReadbackMode::Polled) {
+		UE_LOG(LogGameViewportRecorder, Log, TEXT("Polled readback with %d surfaces: %lld captures, %lld dropped on busy surfaces, render thread stalled %lld times, %.2fms total, %.2fms max."),
+			Surfaces.Num(), ReadbackStats.NumCaptures, ReadbackStats.NumBusyDrops, ReadbackStats.NumStalls, ReadbackStats.TotalStallTime * 1000.0, ReadbackStats.MaxStallTime * 1000.0);
+	}
+	else {
+		UE_LOG(LogGameViewportRecorder, Log, TEXT("Readback with %d surfaces and %d frames latency: render thread stalled %lld of %lld captures, %.2fms total, %.2fms max."),
+			Surfaces.Num(), FrameGrabLatency, ReadbackStats.NumStalls, ReadbackStats.NumCaptures, ReadbackStats.TotalStallTime * 1000.0, ReadbackStats.MaxStallTime * 1000.0);
 	}
+}
 
-	FSlateApplication::Get().GetRenderer()->OnBackBufferReadyToPresent().RemoveAll(this);
+FFramePacerStats FGameViewportRecorder::GetPacingStats() const
+{
+	return FramePacer.GetStats();
 }
 
-bool FGameViewportRecorder::SetupBackBufferCapturer(FIntPoint Resolution)
+ERTMPFrameFormat FGameViewportRecorder::GetOutputFormat() const
+{
+	return OutputFormat;
+}
+
+FViewportReadbackStats FGameViewportRecorder::GetReadbackStats() const
+{
+	FViewportReadbackStats Stats;
+	Stats.NumCaptures = NumCaptures.GetValue();
+	Stats.NumStalls = NumStalls.GetValue();
+	Stats.TotalStallTime = TotalStallMicroseconds.GetValue() / 1000000.0;
+	Stats.MaxStallTime = MaxStallMicroseconds.GetValue() / 1000000.0;
+	Stats.NumBusyDrops = NumBusyDrops.GetValue();
+	return Stats;
+}
+
+bool FGameViewportRecorder::SetupBackBufferCapturer(FIntPoint Resolution, int32 NumSurfaces, int32 InFrameGrabLatency, ERTMPFrameFormat InOutputFormat,
+	const FYUVCoefficients& YUVCoefficients)
 {
 	TargetSize = Resolution;
 
 	CurrentFrameIndex = 0;
+	ReadbackFrameIndex = 0;
 	TargetWindowPtr = nullptr;
 
-	uint32 NumSurfaces = 3;
+	NumSurfaces = FMath::Clamp(NumSurfaces, 1, GameViewportRecorder::MaxSurfaces);
 
 	TSharedPtr<FSceneViewport> SceneViewport;
 
@@ -158,16 +219,34 @@ bool FGameViewportRecorder::SetupBackBufferCapturer(FIntPoint Resolution)
 	FVector2D AbsoluteSize = InnerWindowGeometry.GetAbsoluteSize();
 	WindowSize = FIntPoint(AbsoluteSize.X, AbsoluteSize.Y);
 
+	// The conversion pass works on 2x2 blocks and needs compute shaders, otherwise the encoder converts on the CPU.
+	OutputFormat = InOutputFormat;
+	if (OutputFormat != ERTMPFrameFormat::BGRA) {
+		if ((Resolution.X & 1) != 0 || (Resolution.Y & 1) != 0) {
+			UE_LOG(LogGameViewportRecorder, Warning, TEXT("GPU colour conversion needs an even resolution, %dx%d is read back as BGRA."), Resolution.X, Resolution.Y);
+			OutputFormat = ERTMPFrameFormat::BGRA;
+		}
+		else if (!RHISupportsComputeShaders(GMaxRHIShaderPlatform)) {
+			UE_LOG(LogGameViewportRecorder, Warning, TEXT("Compute shaders are not supported, frames are read back as BGRA."));
+			OutputFormat = ERTMPFrameFormat::BGRA;
+		}
+	}
+
 	// This can never be reallocated
 	Surfaces.Reserve(NumSurfaces);
-	for (uint32 Index = 0; Index < NumSurfaces; ++Index)
+	for (int32 Index = 0; Index < NumSurfaces; ++Index)
 	{
-		Surfaces.Emplace(EPixelFormat::PF_B8G8R8A8, Resolution);
+		Surfaces.Emplace(EPixelFormat::PF_B8G8R8A8, Resolution, OutputFormat);
 		Surfaces.Last().Surface.SetCaptureRect(CaptureRect);
 		Surfaces.Last().Surface.SetWindowSize(WindowSize);
+		Surfaces.Last().Surface.SetYUVCoefficients(YUVCoefficients);
 	}
 
-	FrameGrabLatency = 0;
+	// Reading back further than the ring is deep would read a surface that is being resolved into.
+	FrameGrabLatency = FMath::Clamp(InFrameGrabLatency, 0, NumSurfaces - 1);
+	if (FrameGrabLatency != InFrameGrabLatency) {
+		UE_LOG(LogGameViewportRecorder, Warning, TEXT("Frame grab latency %d does not fit %d readback surfaces, using %d."), InFrameGrabLatency, NumSurfaces, FrameGrabLatency);
+	}
 
 	// Ensure textures are setup
 	FlushRenderingCommands();
@@ -184,41 +263,96 @@ void FGameViewportRecorder::OnBackBufferReadyToPresentCallback(SWindow& SlateWin
 
 	check(IsInRenderingThread());
 
-	std::chrono::steady_clock::time_point NowTime = std::chrono::steady_clock::now();
-	std::chrono::milliseconds LastFramePassedTime = std::chrono::duration_cast<std::chrono::milliseconds>(NowTime - LastFrameTime);
-	if (LastFramePassedTime < CaptureFrameInterval)
+	// Taken before any readback work so the timestamp is not skewed by GPU latency.
+	const double CaptureTime = FPlatformTime::Seconds();
+
+	FRHICommandListImmediate& RHICmdList = FRHICommandListExecutor::GetImmediateCommandList();
+
+	if (ReadbackMode == ERTMPReadbackMode::Polled) {
+		// Hand over every copy the GPU finished, in capture order, on every present so frames leave as early as possible.
+		while (Surfaces[ReadbackFrameIndex].Surface.IsReadbackReady())
+		{
+			ReadBackSurface(RHICmdList, ReadbackFrameIndex);
+			ReadbackFrameIndex = (ReadbackFrameIndex + 1) % Surfaces.Num();
+		}
+	}
+
+	const int64 FrameIndex = FramePacer.Tick(MediaClock->PlatformToMediaTime(CaptureTime));
+	if (FrameIndex == INDEX_NONE)
 	{
 		return;
 	}
 
-	LastFrameTime = NowTime;
+	FResolveSurface* NextFrameTarget = &Surfaces[CurrentFrameIndex];
+
+	if (ReadbackMode == ERTMPReadbackMode::Polled) {
+		// Surfaces are resolved and read back in ring order, the next one is only busy when all of them are.
+		if (NextFrameTarget->Surface.IsInFlight()) {
+			NumBusyDrops.Increment();
+			return;
+		}
+
+		NumCaptures.Increment();
+		NextFrameTarget->CaptureTime = CaptureTime;
+		NextFrameTarget->FrameIndex = FrameIndex;
+		NextFrameTarget->Surface.Resolve(RHICmdList, BackBuffer);
+
+		CurrentFrameIndex = (CurrentFrameIndex + 1) % Surfaces.Num();
+		return;
+	}
 
 	const int32 PrevCaptureIndexOffset = FMath::Clamp(FrameGrabLatency, 0, Surfaces.Num() - 1);
 	const int32 ThisCaptureIndex = CurrentFrameIndex;
 	const int32 PrevCaptureIndex = (CurrentFrameIndex - PrevCaptureIndexOffset) < 0 ? Surfaces.Num() - (PrevCaptureIndexOffset - CurrentFrameIndex) : (CurrentFrameIndex - PrevCaptureIndexOffset);
 
-	FResolveSurface* NextFrameTarget = &Surfaces[ThisCaptureIndex];
-	NextFrameTarget->Surface.BlockUntilAvailable();
-
-	NextFrameTarget->Surface.Initialize();
+	// Only happens with a latency of the whole ring depth, which SetupBackBufferCapturer does not allow.
+	if (NextFrameTarget->Surface.IsInFlight()) {
+		ReadBackSurface(RHICmdList, ThisCaptureIndex);
+	}
 
-	FViewportSurfaceReader* PrevFrameTarget = &Surfaces[PrevCaptureIndex].Surface;
+	NumCaptures.Increment();
+	NextFrameTarget->CaptureTime = CaptureTime;
+	NextFrameTarget->FrameIndex = FrameIndex;
+	NextFrameTarget->Surface.Resolve(RHICmdList, BackBuffer);
 
-	//If the latency is 0, then we are asking to readback the frame we are currently queuing immediately. 
-	if (!PrevFrameTarget->WasEverQueued() && (PrevCaptureIndexOffset > 0))
-	{
-		PrevFrameTarget = nullptr;
+	// If the latency is 0, then we are asking to readback the frame we are currently queuing immediately.
+	// With latency the pixels read back belong to the previous surface, so do the capture time and slot.
+	if (Surfaces[PrevCaptureIndex].Surface.IsInFlight()) {
+		ReadBackSurface(RHICmdList, PrevCaptureIndex);
 	}
 
-	Surfaces[ThisCaptureIndex].Surface.ResolveRenderTarget(PrevFrameTarget, BackBuffer, [=](FColor* ColorBuffer, int32 Width, int32 Height) {
+	CurrentFrameIndex = (CurrentFrameIndex + 1) % Surfaces.Num();
+}
+
+void FGameViewportRecorder::ReadBackSurface(FRHICommandListImmediate& RHICmdList, int32 SurfaceIndex)
+{
+	FResolveSurface& Source = Surfaces[SurfaceIndex];
+
+	const double WaitTime = Source.Surface.ReadBack(RHICmdList, [this, &Source, SurfaceIndex](const uint8* Data, int32 Pitch) {
 		// Handle the frame
-		OnFrameReady(ThisCaptureIndex, ColorBuffer, Width, Height);
+		OnFrameReady(SurfaceIndex, Data, Pitch, Source.CaptureTime, Source.FrameIndex);
 		});
 
-	CurrentFrameIndex = (CurrentFrameIndex + 1) % Surfaces.Num();
+	const int64 StallMicroseconds = (int64)(WaitTime * 1000000.0);
+	if (StallMicroseconds > GameViewportRecorder::StallThresholdMicroseconds) {
+		NumStalls.Increment();
+	}
+	TotalStallMicroseconds.Add(StallMicroseconds);
+	if (StallMicroseconds > MaxStallMicroseconds.GetValue()) {
+		MaxStallMicroseconds.Set(StallMicroseconds);
+	}
 }
 
-void FGameViewportRecorder::OnFrameReady(int32 SurfaceIndex, FColor* ColorBuffer, int32 Width, int32 Height)
+void FGameViewportRecorder::OnFrameReady(int32 SurfaceIndex, const uint8* Data, int32 Pitch, double CaptureTime, int64 FrameIndex)
 {
-	OnViewportRecorded.Broadcast(ColorBuffer, Width, Height);
+	FViewportRecordedFrame Frame;
+	Frame.Data = Data;
+	Frame.Pitch = Pitch;
+	Frame.Width = TargetSize.X;
+	Frame.Height = TargetSize.Y;
+	Frame.Format = OutputFormat;
+	Frame.CaptureTime = CaptureTime;
+	Frame.FrameIndex = FrameIndex;
+
+	OnViewportRecorded.Broadcast(Frame);
 }
@@ -0,0 +1,346 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "HLSOutputSink.h"
+#include "RTMP.h"
+#include "HAL/FileManager.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+
+#if PLATFORM_WINDOWS
+#include "Windows/WindowsHWrapper.h"
+#else
+#include <stdio.h>
+#endif
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/dict.h>
+#include <libavutil/mem.h>
+}
+
+namespace RTMPHLSOutput
+{
+	static const int32 MuxedIOBufferSize = 64 * 1024;
+
+	/** Segments deleted only this many segments after leaving the playlist, players may still fetch them from an older playlist */
+	static const int32 RetiredSegmentsKept = 2;
+
+	/** Players keep PART-HOLD-BACK from the live edge, three parts is the minimum the spec recommends */
+	static const double PartHoldBackParts = 3.0;
+
+	/** Parts of segments further than this many target durations from the live edge are no longer listed */
+	static const int32 PartListTargetDurations = 3;
+
+	/**
+	 * Renames Source over Destination in one step, readers see either file but never none. IFileManager::Move deletes
+	 * the destination first, a player polling the playlist could find it missing in between.
+	 */
+	static bool ReplaceFile(const FString& Destination, const FString& Source)
+	{
+		const FString AbsoluteDestination = IFileManager::Get().ConvertToAbsolutePathForExternalAppForWrite(*Destination);
+		const FString AbsoluteSource = IFileManager::Get().ConvertToAbsolutePathForExternalAppForWrite(*Source);
+#if PLATFORM_WINDOWS
+		return MoveFileExW(*AbsoluteSource, *AbsoluteDestination, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+		return rename(TCHAR_TO_UTF8(*AbsoluteSource), TCHAR_TO_UTF8(*AbsoluteDestination)) == 0;
+#endif
+	}
+}
+
+FHLSOutputSink::FHLSOutputSink(const FRTMPOutputSink& InConfig, FAVPacketPool& InPacketPool)
+	: FOutputSink(InConfig, InPacketPool)
+	, MuxedIO(nullptr)
+	, NextSequence(0)
+	, SegmentStartDts(AV_NOPTS_VALUE)
+	, PartStartDts(AV_NOPTS_VALUE)
+	, LastVideoDts(AV_NOPTS_VALUE)
+	, bPartIndependent(false)
+	, TargetDuration(1)
+	, PartTarget(0.0)
+	, FrameSeconds(0.0)
+	, NumParts(0)
+	, NumDeletedSegments(0)
+{
+	Directory = FPaths::GetPath(Config.Url);
+	BaseName = FPaths::GetBaseFilename(Config.Url);
+}
+
+FHLSOutputSink::~FHLSOutputSink()
+{
+	// The base destructor would close the custom IO context as a file.
+	Close();
+}
+
+bool FHLSOutputSink::AddStreams(const AVCodecContext* VideoCodecCtx, const AVCodecContext* AudioCodecCtx, int32 MuxQueueCapacity, float DefaultBacklogSeconds, int32 TotalBitrate)
+{
+	if (!FOutputSink::AddStreams(VideoCodecCtx, AudioCodecCtx, MuxQueueCapacity, DefaultBacklogSeconds, TotalBitrate)) {
+		return false;
+	}
+
+	// Fragments are cut by hand, one per part. No trailer, the index would end up in the last segment.
+	av_dict_set(&MuxerOptions, "movflags", "frag_custom+empty_moov+default_base_moof", 0);
+
+	// Parts are whole frames, so none ever exceeds the part target. A segment ends at the first keyframe after the segment
+	// duration and keyframes come at least once per GOP, so no segment gets a GOP longer than that.
+	FrameSeconds = av_q2d(av_inv_q(VideoCodecCtx->framerate));
+	const int32 PartFrames = FMath::Max(FMath::CeilToInt(Config.PartSeconds / FrameSeconds - 0.01), 1);
+	PartTarget = PartFrames * FrameSeconds;
+	const double GOPSeconds = VideoCodecCtx->gop_size > 0 ? VideoCodecCtx->gop_size * FrameSeconds : Config.SegmentSeconds;
+	TargetDuration = FMath::Max(FMath::CeilToInt(Config.SegmentSeconds + GOPSeconds - FrameSeconds), 1);
+
+	UE_LOG(LogRTMP, Log, TEXT("LL-HLS output '%s': %.2fs segments starting at keyframes (target duration %ds), %.3fs parts, %d segments in the playlist."),
+		*Config.Url, Config.SegmentSeconds, TargetDuration, PartTarget, FMath::Max(Config.PlaylistSegments, 2));
+	return true;
+}
+
+bool FHLSOutputSink::OpenOutput()
+{
+	if (Config.Url.IsEmpty() || !IFileManager::Get().MakeDirectory(*Directory, true)) {
+		Fail(TEXT("Cloud not create the directory of"), 0);
+		return false;
+	}
+
+	// The muxer writes into memory, parts go to the segment files from there.
+	uint8* Buffer = static_cast<uint8*>(av_malloc(RTMPHLSOutput::MuxedIOBufferSize));
+	MuxedIO = Buffer != nullptr ? avio_alloc_context(Buffer, RTMPHLSOutput::MuxedIOBufferSize, 1, this, nullptr, &FHLSOutputSink::WriteMuxedData, nullptr) : nullptr;
+	if (MuxedIO == nullptr) {
+		av_free(Buffer);
+		Fail(TEXT("Cloud not allocate the IO context of"), AVERROR(ENOMEM));
+		return false;
+	}
+
+	FormatCtx->pb = MuxedIO;
+	FormatCtx->flags |= AVFMT_FLAG_CUSTOM_IO;
+	return true;
+}
+
+bool FHLSOutputSink::OnHeaderWritten()
+{
+	// With an empty moov the header is the whole initialization segment.
+	avio_flush(MuxedIO);
+	const FString InitPath = Directory / BaseName + TEXT("_init.mp4");
+	if (!FFileHelper::SaveArrayToFile(MuxedData, *InitPath)) {
+		Fail(TEXT("Cloud not write the initialization segment of"), 0);
+		return false;
+	}
+	MuxedData.Reset();
+
+	return WritePlaylist(false);
+}
+
+void FHLSOutputSink::WritePacket(FEncodedPacket& Packet)
+{
+	AVPacket* Muxed = Packet.Packet.Get();
+	if (Packet.bVideo) {
+		// Segments have to start with a keyframe, anything before the first one is dropped.
+		if (SegmentStartDts == AV_NOPTS_VALUE) {
+			if (!Packet.bKeyframe) {
+				return;
+			}
+			StartSegment(Muxed->dts);
+		}
+		else {
+			const double HalfFrame = FrameSeconds * 0.5;
+			const bool bEndsSegment = Packet.bKeyframe && ToSeconds(Muxed->dts - SegmentStartDts) >= Config.SegmentSeconds - HalfFrame;
+			const bool bEndsPart = bEndsSegment || ToSeconds(Muxed->dts - PartStartDts) >= PartTarget - HalfFrame;
+			if (bEndsPart && !CutPart(Muxed->dts, bEndsSegment)) {
+				return;
+			}
+			if (bEndsSegment) {
+				StartSegment(Muxed->dts);
+			}
+			else if (bEndsPart) {
+				bPartIndependent = Packet.bKeyframe;
+			}
+		}
+		LastVideoDts = Muxed->dts;
+	}
+	else if (SegmentStartDts == AV_NOPTS_VALUE) {
+		return;
+	}
+
+	// Not interleaved, a part holds what arrived before its cut. The fragment is written out when the part is cut.
+	const int32 Result = av_write_frame(FormatCtx, Muxed);
+	if (Result < 0) {
+		Fail(TEXT("Cloud not write to"), Result);
+	}
+}
+
+void FHLSOutputSink::CloseOutput(bool bClean)
+{
+	if (bClean && SegmentStartDts != AV_NOPTS_VALUE && LastVideoDts != AV_NOPTS_VALUE) {
+		// The last frame lasts one frame interval.
+		const int64 EndDts = LastVideoDts + FMath::Max(av_rescale_q(1, av_inv_q(VideoStream->avg_frame_rate), VideoStream->time_base), int64(1));
+		if (CutPart(EndDts, true)) {
+			WritePlaylist(true);
+		}
+	}
+	SegmentFile.Reset();
+
+	if (MuxedIO != nullptr) {
+		av_freep(&MuxedIO->buffer);
+		avio_context_free(&MuxedIO);
+		FormatCtx->pb = nullptr;
+	}
+	MuxedData.Empty();
+
+	if (NextSequence > 0) {
+		UE_LOG(LogRTMP, Log, TEXT("LL-HLS output '%s': %lld segments in %lld parts, %lld old segments deleted."), *Config.Url, NextSequence, NumParts, NumDeletedSegments);
+	}
+}
+
+int FHLSOutputSink::WriteMuxedData(void* Opaque, uint8* Data, int Size)
+{
+	FHLSOutputSink* Sink = static_cast<FHLSOutputSink*>(Opaque);
+	Sink->MuxedData.Append(Data, Size);
+	return Size;
+}
+
+void FHLSOutputSink::StartSegment(int64 Dts)
+{
+	FSegment& Segment = Segments.AddDefaulted_GetRef();
+	Segment.Sequence = NextSequence++;
+
+	SegmentFile.Reset(IFileManager::Get().CreateFileWriter(*GetSegmentPath(Segment.Sequence)));
+	if (!SegmentFile) {
+		Fail(TEXT("Cloud not create a segment file of"), 0);
+	}
+
+	SegmentStartDts = Dts;
+	PartStartDts = Dts;
+	bPartIndependent = true;
+}
+
+bool FHLSOutputSink::CutPart(int64 EndDts, bool bEndsSegment)
+{
+	const int32 Result = av_write_frame(FormatCtx, nullptr);
+	if (Result < 0) {
+		Fail(TEXT("Cloud not write a fragment to"), Result);
+		return false;
+	}
+	avio_flush(MuxedIO);
+
+	FPart Part;
+	Part.Duration = ToSeconds(EndDts - PartStartDts);
+	Part.bIndependent = bPartIndependent;
+	if (!AppendMuxedData(Part)) {
+		return false;
+	}
+
+	FSegment& Segment = Segments.Last();
+	Segment.Duration += Part.Duration;
+	Segment.Size += Part.Size;
+	Segment.Parts.Add(Part);
+	++NumParts;
+	PartStartDts = EndDts;
+
+	if (bEndsSegment) {
+		Segment.bComplete = true;
+		SegmentFile.Reset();
+		PruneSegments();
+	}
+
+	return WritePlaylist(false);
+}
+
+bool FHLSOutputSink::AppendMuxedData(FPart& Part)
+{
+	if (!SegmentFile) {
+		return false;
+	}
+
+	Part.Offset = Segments.Last().Size;
+	Part.Size = MuxedData.Num();
+	// Advertised in the playlist right after, the whole part has to be in the file by then.
+	SegmentFile->Serialize(MuxedData.GetData(), MuxedData.Num());
+	SegmentFile->Flush();
+	MuxedData.Reset();
+
+	if (SegmentFile->IsError()) {
+		Fail(TEXT("Cloud not write a segment of"), 0);
+		return false;
+	}
+	return true;
+}
+
+void FHLSOutputSink::PruneSegments()
+{
+	const int32 PlaylistSegments = FMath::Max(Config.PlaylistSegments, 2);
+	while (Segments.Num() > PlaylistSegments && Segments[0].bComplete)
+	{
+		RetiredSequences.Add(Segments[0].Sequence);
+		Segments.RemoveAt(0);
+	}
+
+	while (RetiredSequences.Num() > RTMPHLSOutput::RetiredSegmentsKept)
+	{
+		IFileManager::Get().Delete(*GetSegmentPath(RetiredSequences[0]), false, false, true);
+		RetiredSequences.RemoveAt(0);
+		++NumDeletedSegments;
+	}
+}
+
+bool FHLSOutputSink::WritePlaylist(bool bEnded)
+{
+	FString Playlist = TEXT("#EXTM3U\n#EXT-X-VERSION:6\n");
+	Playlist += FString::Printf(TEXT("#EXT-X-TARGETDURATION:%d\n"), TargetDuration);
+	Playlist += FString::Printf(TEXT("#EXT-X-SERVER-CONTROL:PART-HOLD-BACK=%.3f\n"), PartTarget * RTMPHLSOutput::PartHoldBackParts);
+	Playlist += FString::Printf(TEXT("#EXT-X-PART-INF:PART-TARGET=%.3f\n"), PartTarget);
+	Playlist += FString::Printf(TEXT("#EXT-X-MEDIA-SEQUENCE:%lld\n"), Segments.Num() > 0 ? Segments[0].Sequence : NextSequence);
+	Playlist += FString::Printf(TEXT("#EXT-X-MAP:URI=\"%s_init.mp4\"\n"), *BaseName);
+
+	// Parts only matter near the live edge, older segments are listed whole.
+	double SecondsToLiveEdge = 0.0;
+	for (const FSegment& Segment : Segments)
+	{
+		SecondsToLiveEdge += Segment.Duration;
+	}
+
+	for (const FSegment& Segment : Segments)
+	{
+		const FString Name = GetSegmentName(Segment.Sequence);
+		if (SecondsToLiveEdge <= TargetDuration * RTMPHLSOutput::PartListTargetDurations) {
+			for (const FPart& Part : Segment.Parts)
+			{
+				Playlist += FString::Printf(TEXT("#EXT-X-PART:DURATION=%.5f,URI=\"%s\",BYTERANGE=\"%lld@%lld\"%s\n"),
+					Part.Duration, *Name, Part.Size, Part.Offset, Part.bIndependent ? TEXT(",INDEPENDENT=YES") : TEXT(""));
+			}
+		}
+		if (Segment.bComplete) {
+			Playlist += FString::Printf(TEXT("#EXTINF:%.5f,\n%s\n"), Segment.Duration, *Name);
+		}
+		SecondsToLiveEdge -= Segment.Duration;
+	}
+
+	if (bEnded) {
+		Playlist += TEXT("#EXT-X-ENDLIST\n");
+	}
+
+	// Replaced by a rename, a player never reads a half written playlist.
+	const FString PlaylistPath = Directory / BaseName + TEXT(".m3u8");
+	const FString TempPath = PlaylistPath + TEXT(".tmp");
+	if (!FFileHelper::SaveStringToFile(Playlist, *TempPath, FFileHelper::EEncodingOptions::ForceUTF8WithoutBOM)
+		|| !RTMPHLSOutput::ReplaceFile(PlaylistPath, TempPath)) {
+		Fail(TEXT("Cloud not update the playlist of"), 0);
+		return false;
+	}
+
+	return true;
+}
+
+FString FHLSOutputSink::GetSegmentPath(int64 Sequence) const
+{
+	return Directory / GetSegmentName(Sequence);
+}
+
+FString FHLSOutputSink::GetSegmentName(int64 Sequence) const
+{
+	return FString::Printf(TEXT("%s_%lld.m4s"), *BaseName, Sequence);
+}
+
+double FHLSOutputSink::ToSeconds(int64 Ticks) const
+{
+	return Ticks * av_q2d(VideoStream->time_base);
+}
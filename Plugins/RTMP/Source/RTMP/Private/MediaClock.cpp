@@ -0,0 +1,118 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "MediaClock.h"
+
+namespace RTMPMediaClock
+{
+	// Weight of a new offset sample, submix callbacks are jittered by the audio render thread scheduling.
+	static const double OffsetSmoothing = 0.02;
+
+	// Drift is only reported once enough time passed for it to be meaningful.
+	static const double MinDriftMeasureSeconds = 10.0;
+}
+
+FMediaClock::FMediaClock()
+	: MappingSequence(0)
+	, Offset(0.0)
+	, Origin(0.0)
+	, DriftPPM(0.0)
+	, NumAudioAnchors(0)
+	, bHasFirstAnchor(false)
+	, FirstAnchorPlatformSeconds(0.0)
+	, FirstAnchorOffset(0.0)
+	, SmoothedOffset(0.0)
+{
+}
+
+void FMediaClock::Start()
+{
+	bHasFirstAnchor = false;
+	FirstAnchorPlatformSeconds = 0.0;
+	FirstAnchorOffset = 0.0;
+	SmoothedOffset = 0.0;
+
+	MappingSequence.store(MappingSequence.load(std::memory_order_relaxed) + 2, std::memory_order_relaxed);
+	Offset.store(0.0, std::memory_order_relaxed);
+	Origin.store(FPlatformTime::Seconds(), std::memory_order_relaxed);
+	DriftPPM.store(0.0, std::memory_order_relaxed);
+	NumAudioAnchors.store(0, std::memory_order_release);
+}
+
+void FMediaClock::AddAudioAnchor(double AudioClock, double PlatformSeconds)
+{
+	const double SampleOffset = AudioClock - PlatformSeconds;
+	double NewOrigin = Origin.load(std::memory_order_relaxed);
+
+	if (!bHasFirstAnchor) {
+		// Move the origin into the audio clock domain without a jump in media time.
+		bHasFirstAnchor = true;
+		FirstAnchorPlatformSeconds = PlatformSeconds;
+		FirstAnchorOffset = SampleOffset;
+		SmoothedOffset = SampleOffset;
+		NewOrigin += SampleOffset;
+	}
+	else {
+		SmoothedOffset += (SampleOffset - SmoothedOffset) * RTMPMediaClock::OffsetSmoothing;
+
+		const double Elapsed = PlatformSeconds - FirstAnchorPlatformSeconds;
+		if (Elapsed >= RTMPMediaClock::MinDriftMeasureSeconds) {
+			DriftPPM.store((SmoothedOffset - FirstAnchorOffset) / Elapsed * 1000000.0, std::memory_order_relaxed);
+		}
+	}
+
+	// Odd sequence while the mapping is being updated, readers retry.
+	const uint32 Sequence = MappingSequence.load(std::memory_order_relaxed);
+	MappingSequence.store(Sequence + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	Offset.store(SmoothedOffset, std::memory_order_relaxed);
+	Origin.store(NewOrigin, std::memory_order_relaxed);
+	MappingSequence.store(Sequence + 2, std::memory_order_release);
+
+	NumAudioAnchors.fetch_add(1, std::memory_order_relaxed);
+}
+
+double FMediaClock::PlatformToMediaTime(double PlatformSeconds) const
+{
+	double CurrentOffset = 0.0;
+	double CurrentOrigin = 0.0;
+	ReadMapping(CurrentOffset, CurrentOrigin);
+
+	return PlatformSeconds + CurrentOffset - CurrentOrigin;
+}
+
+double FMediaClock::AudioToMediaTime(double AudioClock) const
+{
+	double CurrentOffset = 0.0;
+	double CurrentOrigin = 0.0;
+	ReadMapping(CurrentOffset, CurrentOrigin);
+
+	return AudioClock - CurrentOrigin;
+}
+
+double FMediaClock::Now() const
+{
+	return PlatformToMediaTime(FPlatformTime::Seconds());
+}
+
+FMediaClockStats FMediaClock::GetStats() const
+{
+	FMediaClockStats Stats;
+	double CurrentOrigin = 0.0;
+	ReadMapping(Stats.AudioClockOffset, CurrentOrigin);
+	Stats.DriftPPM = DriftPPM.load(std::memory_order_relaxed);
+	Stats.NumAudioAnchors = NumAudioAnchors.load(std::memory_order_relaxed);
+	return Stats;
+}
+
+void FMediaClock::ReadMapping(double& OutOffset, double& OutOrigin) const
+{
+	uint32 Sequence = 0;
+	do
+	{
+		Sequence = MappingSequence.load(std::memory_order_acquire);
+		OutOffset = Offset.load(std::memory_order_relaxed);
+		OutOrigin = Origin.load(std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_acquire);
+	} while ((Sequence & 1) != 0 || Sequence != MappingSequence.load(std::memory_order_relaxed));
+}
@@ -0,0 +1,362 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "OutputSink.h"
+#include "RTMP.h"
+#include "HLSOutputSink.h"
+#include "SRTOutputSink.h"
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/dict.h>
+#include <libavutil/error.h>
+}
+
+namespace RTMPOutputSink
+{
+	/** Cues of about 12 hours with 1s GOPs fit, a larger index is written at the end instead */
+	static const int32 MatroskaIndexSpace = 1024 * 1024;
+
+	/** Seven TS packets, the usual datagram payload that fits any ethernet MTU with the IP, UDP and SRT headers */
+	static const int32 TSDatagramSize = 7 * 188;
+
+	/** Smallest UDP send buffer, in case the latency window is tiny */
+	static const int32 MinUDPBufferSize = 64 * 1024;
+
+	static bool IsUDPUrl(const FString& Url)
+	{
+		return Url.StartsWith(TEXT("udp://"));
+	}
+
+	static bool IsSRTUrl(const FString& Url)
+	{
+		return Url.StartsWith(TEXT("srt://"));
+	}
+
+	/** ffmpeg muxer of the container, null to guess it from the URL */
+	static const char* GetMuxerName(ERTMPOutputContainer Container, const FString& Url)
+	{
+		switch (Container)
+		{
+		case ERTMPOutputContainer::FLV: return "flv";
+		case ERTMPOutputContainer::FragmentedMP4: return "mp4";
+		case ERTMPOutputContainer::LowLatencyHLS: return "mp4";
+		case ERTMPOutputContainer::Matroska: return "matroska";
+		case ERTMPOutputContainer::MPEGTS: return "mpegts";
+		default:
+			// Network URLs have no extension to guess the muxer from.
+			if (Url.StartsWith(TEXT("rtmp://")) || Url.StartsWith(TEXT("rtmps://"))) {
+				return "flv";
+			}
+			return IsUDPUrl(Url) || IsSRTUrl(Url) ? "mpegts" : nullptr;
+		}
+	}
+}
+
+FOutputSink::FOutputSink(const FRTMPOutputSink& InConfig, FAVPacketPool& InPacketPool)
+	: Config(InConfig)
+	, PacketPool(InPacketPool)
+	, FormatCtx(nullptr)
+	, VideoStream(nullptr)
+	, AudioStream(nullptr)
+	, MuxerOptions(nullptr)
+	, StreamBitrate(0)
+	, bHeaderSent(false)
+{
+}
+
+FOutputSink::~FOutputSink()
+{
+	Close();
+}
+
+TUniquePtr<FOutputSink> FOutputSink::Create(const FRTMPOutputSink& InConfig, FAVPacketPool& InPacketPool)
+{
+	if (InConfig.Container == ERTMPOutputContainer::LowLatencyHLS) {
+		return MakeUnique<FHLSOutputSink>(InConfig, InPacketPool);
+	}
+#if WITH_LIBSRT
+	// Without libsrt in the module SRT goes through ffmpeg's srt protocol, if this ffmpeg was built with it.
+	if (RTMPOutputSink::IsSRTUrl(InConfig.Url)) {
+		return MakeUnique<FSRTOutputSink>(InConfig, InPacketPool);
+	}
+#endif
+	return MakeUnique<FOutputSink>(InConfig, InPacketPool);
+}
+
+bool FOutputSink::Init()
+{
+	if (avformat_alloc_output_context2(&FormatCtx, nullptr, RTMPOutputSink::GetMuxerName(Config.Container, Config.Url), TCHAR_TO_ANSI(*Config.Url)) < 0 || FormatCtx == nullptr) {
+		UE_LOG(LogRTMP, Error, TEXT("Cloud not allocate output format context for '%s'."), *Config.Url);
+		return false;
+	}
+
+	return true;
+}
+
+bool FOutputSink::WantsGlobalHeader() const
+{
+	return FormatCtx != nullptr && (FormatCtx->oformat->flags & AVFMT_GLOBALHEADER) != 0;
+}
+
+const AVOutputFormat* FOutputSink::GetOutputFormat() const
+{
+	return FormatCtx != nullptr ? FormatCtx->oformat : nullptr;
+}
+
+bool FOutputSink::AddStreams(const AVCodecContext* VideoCodecCtx, const AVCodecContext* AudioCodecCtx, int32 MuxQueueCapacity, float DefaultBacklogSeconds, int32 TotalBitrate)
+{
+	VideoStream = avformat_new_stream(FormatCtx, nullptr);
+	AudioStream = avformat_new_stream(FormatCtx, nullptr);
+	if (VideoStream == nullptr || AudioStream == nullptr
+		|| avcodec_parameters_from_context(VideoStream->codecpar, VideoCodecCtx) < 0
+		|| avcodec_parameters_from_context(AudioStream->codecpar, AudioCodecCtx) < 0) {
+		UE_LOG(LogRTMP, Error, TEXT("Cloud not create the streams of output '%s'."), *Config.Url);
+		return false;
+	}
+	// Only a hint, the muxer picks its own time base in avformat_write_header.
+	VideoStream->time_base = VideoCodecCtx->time_base;
+	VideoStream->avg_frame_rate = VideoCodecCtx->framerate;
+	AudioStream->time_base = { 1, AudioCodecCtx->sample_rate };
+	StreamBitrate = TotalBitrate;
+
+	// While the mux queue skips a GOP only audio arrives, don't hold it back longer than the backlog the queue allows.
+	const float BacklogSeconds = FMath::Max(Config.MaxBacklogSeconds > 0.0f ? Config.MaxBacklogSeconds : DefaultBacklogSeconds, 0.1f);
+	FormatCtx->max_interleave_delta = int64(BacklogSeconds * AV_TIME_BASE);
+
+	switch (Config.Container)
+	{
+	case ERTMPOutputContainer::FragmentedMP4:
+		// A moov without samples up front and a fragment per GOP, so every finished GOP is playable on its own. Closing
+		// cleanly moves a sidx for the whole file to the front, seeking then needs no pass over the fragments.
+		av_dict_set(&MuxerOptions, "movflags", "frag_keyframe+empty_moov+default_base_moof+global_sidx", 0);
+		break;
+	case ERTMPOutputContainer::Matroska:
+	{
+		// Clusters are only written once complete, one per GOP keeps what a crash can lose to the GOP being written.
+		const double GOPSeconds = VideoCodecCtx->gop_size > 0 ? VideoCodecCtx->gop_size * av_q2d(av_inv_q(VideoCodecCtx->framerate)) : 1.0;
+		av_dict_set_int(&MuxerOptions, "cluster_time_limit", FMath::Max(int64(GOPSeconds * 1000.0), int64(1)), 0);
+		av_dict_set_int(&MuxerOptions, "reserve_index_space", RTMPOutputSink::MatroskaIndexSpace, 0);
+		break;
+	}
+	default:
+		break;
+	}
+
+	Writer = MakeUnique<FPacketWriter>(TEXT("RTMP Mux ") + Config.Url, MuxQueueCapacity, int64(BacklogSeconds * TotalBitrate / 8),
+		[this](FEncodedPacket& Packet) { MuxPacket(Packet); });
+
+	av_dump_format(FormatCtx, 0, TCHAR_TO_ANSI(*Config.Url), 1);
+	return true;
+}
+
+bool FOutputSink::Start()
+{
+	if (!OpenOutput()) {
+		return false;
+	}
+
+	const int32 Result = avformat_write_header(FormatCtx, &MuxerOptions);
+	if (Result < 0) {
+		Fail(TEXT("Error occurred when writing the header of"), Result);
+		return false;
+	}
+	bHeaderSent = true;
+
+	// Whatever is left is an option this ffmpeg's muxer doesn't know.
+	const AVDictionaryEntry* Unused = nullptr;
+	while ((Unused = av_dict_get(MuxerOptions, "", Unused, AV_DICT_IGNORE_SUFFIX)) != nullptr)
+	{
+		UE_LOG(LogRTMP, Warning, TEXT("Muxer of '%s' ignored option %s=%s."), *Config.Url, UTF8_TO_TCHAR(Unused->key), UTF8_TO_TCHAR(Unused->value));
+	}
+
+	if (!OnHeaderWritten()) {
+		return false;
+	}
+
+	if (!Writer->Start()) {
+		Fail(TEXT("Cloud not create the writer thread of"), 0);
+		return false;
+	}
+
+	return true;
+}
+
+bool FOutputSink::PushPacket(const AVPacket& Packet, const AVRational& CodecTimeBase, bool bVideo, bool bKeyframe, bool bDisposable)
+{
+	if (!bHeaderSent || bFailed) {
+		return false;
+	}
+
+	// The encoded data is shared with the other outputs, only the timestamps are this output's own.
+	FAVPacketPtr Reference = PacketPool.Acquire();
+	if (!Reference.IsValid()) {
+		return false;
+	}
+	if (av_packet_ref(Reference.Get(), &Packet) < 0) {
+		PacketPool.Release(MoveTemp(Reference));
+		return false;
+	}
+
+	AVStream* Stream = bVideo ? VideoStream : AudioStream;
+	av_packet_rescale_ts(Reference.Get(), CodecTimeBase, Stream->time_base);
+	Reference->stream_index = Stream->index;
+
+	FEncodedPacket Queued;
+	Queued.Packet = MoveTemp(Reference);
+	Queued.bVideo = bVideo;
+	Queued.bKeyframe = bKeyframe;
+	Queued.bDisposable = bDisposable;
+	return Writer->Push(MoveTemp(Queued));
+}
+
+bool FOutputSink::ConsumeKeyframeRequest()
+{
+	return Writer && !bFailed && Writer->ConsumeKeyframeRequest();
+}
+
+void FOutputSink::MuxPacket(FEncodedPacket& Packet)
+{
+	// Packets queued before the output failed are dropped without touching the muxer again.
+	if (!bFailed) {
+		WritePacket(Packet);
+		if (FormatCtx->pb != nullptr) {
+			BytesSent.Set(avio_tell(FormatCtx->pb));
+		}
+	}
+
+	PacketPool.Release(MoveTemp(Packet.Packet));
+}
+
+bool FOutputSink::OpenOutput()
+{
+	if (FormatCtx->oformat->flags & AVFMT_NOFILE) {
+		return true;
+	}
+
+	// A stalled connection fails the write after the timeout instead of blocking the writer thread for good.
+	AVDictionary* Options = nullptr;
+	if (Config.TimeoutSeconds > 0.0f) {
+		av_dict_set_int(&Options, "rw_timeout", int64(Config.TimeoutSeconds * 1000000.0), 0);
+	}
+	if (RTMPOutputSink::IsUDPUrl(Config.Url)) {
+		// Nothing is resent, a lost datagram costs the few TS packets in it. The socket buffers the latency window, once
+		// that is full the writer blocks and the mux queue drops like it does for a backed up RTMP connection.
+		av_dict_set_int(&Options, "pkt_size", RTMPOutputSink::TSDatagramSize, 0);
+		av_dict_set_int(&Options, "buffer_size", FMath::Max(int64(Config.LatencySeconds * StreamBitrate / 8), int64(RTMPOutputSink::MinUDPBufferSize)), 0);
+	}
+	else if (RTMPOutputSink::IsSRTUrl(Config.Url)) {
+		// Live mode: lost packets are resent until they would arrive later than the latency window, then dropped.
+		av_dict_set(&Options, "transtype", "live", 0);
+		av_dict_set_int(&Options, "latency", int64(Config.LatencySeconds * 1000000.0), 0);
+		av_dict_set_int(&Options, "payload_size", RTMPOutputSink::TSDatagramSize, 0);
+	}
+	const int32 Result = avio_open2(&FormatCtx->pb, TCHAR_TO_ANSI(*Config.Url), AVIO_FLAG_WRITE, nullptr, &Options);
+	av_dict_free(&Options);
+	if (Result < 0) {
+		Fail(TEXT("Cloud not open output"), Result);
+		return false;
+	}
+
+	return true;
+}
+
+bool FOutputSink::OnHeaderWritten()
+{
+	return true;
+}
+
+void FOutputSink::WritePacket(FEncodedPacket& Packet)
+{
+	// Takes over the packet data, interleaving audio and video by dts. Blocks while the connection is backed up.
+	const int32 Result = av_interleaved_write_frame(FormatCtx, Packet.Packet.Get());
+	if (Result < 0 && Result != AVERROR(EAGAIN)) {
+		Fail(TEXT("Cloud not write to"), Result);
+	}
+	// A keyframe closed the fragment or cluster of the GOP before it, get that out of the IO buffer as well.
+	else if (Packet.bVideo && Packet.bKeyframe && FormatCtx->pb != nullptr) {
+		avio_flush(FormatCtx->pb);
+	}
+}
+
+void FOutputSink::CloseOutput(bool bClean)
+{
+	if (bClean) {
+		av_write_trailer(FormatCtx);
+	}
+	if (!(FormatCtx->oformat->flags & AVFMT_NOFILE)) {
+		avio_closep(&FormatCtx->pb);
+	}
+}
+
+void FOutputSink::GetTransportStats(FTransportStats& OutStats) const
+{
+}
+
+void FOutputSink::Fail(const TCHAR* What, int32 Error)
+{
+	char ErrorString[AV_ERROR_MAX_STRING_SIZE] = { 0 };
+	av_strerror(Error, ErrorString, AV_ERROR_MAX_STRING_SIZE);
+	UE_LOG(LogRTMP, Error, TEXT("%s '%s' (%s), dropping its packets from now on, the other outputs carry on."), What, *Config.Url, UTF8_TO_TCHAR(ErrorString));
+	bFailed = true;
+}
+
+void FOutputSink::Close()
+{
+	// A failed output would only fail again on every queued packet.
+	if (Writer) {
+		Writer->Shutdown(!bFailed);
+	}
+
+	if (FormatCtx != nullptr) {
+		CloseOutput(bHeaderSent && !bFailed);
+		avformat_free_context(FormatCtx);
+		FormatCtx = nullptr;
+		VideoStream = nullptr;
+		AudioStream = nullptr;
+	}
+	av_dict_free(&MuxerOptions);
+
+	bHeaderSent = false;
+}
+
+void FOutputSink::Abort()
+{
+	if (Writer) {
+		Writer->Shutdown(false);
+	}
+
+	// The muxer's own buffers go with the context, the IO buffer is emptied so closing doesn't write it out.
+	if (FormatCtx != nullptr && FormatCtx->pb != nullptr) {
+		FormatCtx->pb->buf_ptr = FormatCtx->pb->buffer;
+		FormatCtx->pb->buf_ptr_max = FormatCtx->pb->buffer;
+	}
+	bHeaderSent = false;
+
+	Close();
+}
+
+bool FOutputSink::HasFailed() const
+{
+	return bFailed;
+}
+
+const FString& FOutputSink::GetUrl() const
+{
+	return Config.Url;
+}
+
+FOutputSinkStats FOutputSink::GetStats() const
+{
+	FOutputSinkStats Stats;
+	Stats.Url = Config.Url;
+	if (Writer) {
+		Stats.Mux = Writer->GetStats();
+		Stats.MuxQueue = Writer->GetQueueStats();
+	}
+	Stats.Transport.BytesSent = BytesSent.GetValue();
+	GetTransportStats(Stats.Transport);
+	Stats.bFailed = bFailed;
+	return Stats;
+}
@@ -0,0 +1,208 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "PacketQueue.h"
+#include "HAL/PlatformTime.h"
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
+
+FPacketQueue::FPacketQueue(int32 InCapacity, int64 InMaxBacklogBytes)
+	: Capacity(InCapacity)
+	, MaxBacklogBytes(InMaxBacklogBytes)
+	, QueuedBytes(0)
+	, bWaitingForKeyframe(false)
+	, bKeyframeRequested(false)
+{
+	check(InCapacity > 0);
+	// One over capacity, the newest packet is added before the backlog is shrunk.
+	Packets.Reserve(InCapacity + 1);
+}
+
+bool FPacketQueue::Enqueue(FEncodedPacket&& Packet)
+{
+	if (!Packet.Packet.IsValid()) {
+		return false;
+	}
+
+	FScopeLock Lock(&CriticalSection);
+
+	// Everything after a dropped GOP references frames the output never got.
+	if (Packet.bVideo && bWaitingForKeyframe) {
+		if (!Packet.bKeyframe) {
+			++Stats.NumDroppedGOPFrames;
+			return false;
+		}
+		bWaitingForKeyframe = false;
+	}
+
+	QueuedBytes += Packet.Packet->size;
+
+	FQueuedPacket& Queued = Packets.AddDefaulted_GetRef();
+	Queued.Packet = MoveTemp(Packet);
+	Queued.EnqueueTime = FPlatformTime::Seconds();
+	++Stats.NumEnqueued;
+
+	ShrinkBacklog();
+
+	Stats.HighWaterMark = FMath::Max(Stats.HighWaterMark, Packets.Num());
+	Stats.MaxQueuedBytes = FMath::Max(Stats.MaxQueuedBytes, QueuedBytes);
+	return true;
+}
+
+bool FPacketQueue::Dequeue(FEncodedPacket& OutPacket, double& OutEnqueueTime)
+{
+	FScopeLock Lock(&CriticalSection);
+	if (Packets.Num() == 0) {
+		return false;
+	}
+
+	OutPacket = MoveTemp(Packets[0].Packet);
+	OutEnqueueTime = Packets[0].EnqueueTime;
+	QueuedBytes -= OutPacket.Packet->size;
+	Packets.RemoveAt(0, 1, false);
+	return true;
+}
+
+void FPacketQueue::Empty()
+{
+	FScopeLock Lock(&CriticalSection);
+	Packets.Reset();
+	QueuedBytes = 0;
+	bWaitingForKeyframe = false;
+	bKeyframeRequested = false;
+}
+
+bool FPacketQueue::ConsumeKeyframeRequest()
+{
+	FScopeLock Lock(&CriticalSection);
+	const bool bRequested = bKeyframeRequested;
+	bKeyframeRequested = false;
+	return bRequested;
+}
+
+int32 FPacketQueue::Num() const
+{
+	FScopeLock Lock(&CriticalSection);
+	return Packets.Num();
+}
+
+int32 FPacketQueue::GetCapacity() const
+{
+	return Capacity;
+}
+
+int64 FPacketQueue::GetQueuedBytes() const
+{
+	FScopeLock Lock(&CriticalSection);
+	return QueuedBytes;
+}
+
+FPacketQueueStats FPacketQueue::GetStats() const
+{
+	FScopeLock Lock(&CriticalSection);
+	return Stats;
+}
+
+bool FPacketQueue::IsOverLimit(int64 ExemptBytes) const
+{
+	return Packets.Num() > Capacity || QueuedBytes - ExemptBytes > MaxBacklogBytes;
+}
+
+void FPacketQueue::ShrinkBacklog()
+{
+	if (!IsOverLimit()) {
+		return;
+	}
+
+	// Non-reference frames first, oldest first, nothing else depends on them.
+	for (int32 Index = 0; Index < Packets.Num() && IsOverLimit();)
+	{
+		const FEncodedPacket& Packet = Packets[Index].Packet;
+		if (Packet.bVideo && Packet.bDisposable) {
+			RemovePacket(Index);
+			++Stats.NumDroppedDisposable;
+			continue;
+		}
+		++Index;
+	}
+
+	if (!IsOverLimit()) {
+		return;
+	}
+
+	// Then whole GOPs, the output skips ahead to the newest queued IDR frame.
+	int32 NewestKeyframe = INDEX_NONE;
+	for (int32 Index = Packets.Num() - 1; Index >= 0; --Index)
+	{
+		if (Packets[Index].Packet.bVideo && Packets[Index].Packet.bKeyframe) {
+			NewestKeyframe = Index;
+			break;
+		}
+	}
+
+	if (NewestKeyframe != INDEX_NONE) {
+		int32 NumRemoved = 0;
+		for (int32 Index = NewestKeyframe - 1; Index >= 0; --Index)
+		{
+			if (Packets[Index].Packet.bVideo) {
+				RemovePacket(Index);
+				++NumRemoved;
+			}
+		}
+
+		if (NumRemoved > 0) {
+			Stats.NumDroppedGOPFrames += NumRemoved;
+			++Stats.NumGOPSkips;
+		}
+
+		if (!IsOverLimit()) {
+			return;
+		}
+	}
+
+	// Even the newest GOP is too much, drop all queued video and restart at the next IDR frame. The newest IDR frame
+	// stays whatever its size, else a keyframe larger than the limit, forced one included, would be dropped every time.
+	int32 NumRemoved = 0;
+	bool bKeptKeyframe = false;
+	int64 ExemptBytes = 0;
+	for (int32 Index = Packets.Num() - 1; Index >= 0; --Index)
+	{
+		const FEncodedPacket& Packet = Packets[Index].Packet;
+		if (!Packet.bVideo) {
+			continue;
+		}
+		if (Packet.bKeyframe && !bKeptKeyframe) {
+			bKeptKeyframe = true;
+			ExemptBytes = Packet.Packet->size;
+			continue;
+		}
+		RemovePacket(Index);
+		++NumRemoved;
+	}
+
+	if (NumRemoved > 0) {
+		Stats.NumDroppedGOPFrames += NumRemoved;
+		++Stats.NumGOPSkips;
+		bWaitingForKeyframe = true;
+		bKeyframeRequested = true;
+	}
+
+	// Only audio left besides the kept IDR frame, the uplink cannot even keep up with that.
+	for (int32 Index = 0; Index < Packets.Num() && IsOverLimit(ExemptBytes);)
+	{
+		if (Packets[Index].Packet.bVideo) {
+			++Index;
+			continue;
+		}
+		RemovePacket(Index);
+		++Stats.NumDroppedAudio;
+	}
+}
+
+void FPacketQueue::RemovePacket(int32 Index)
+{
+	QueuedBytes -= Packets[Index].Packet.Packet->size;
+	Packets.RemoveAt(Index, 1, false);
+}
@@ -0,0 +1,144 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "PacketWriter.h"
+#include "HAL/Event.h"
+#include "HAL/PlatformProcess.h"
+#include "HAL/PlatformTime.h"
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
+
+FPacketWriter::FPacketWriter(const FString& InName, int32 Capacity, int64 MaxBacklogBytes, FWriteFunction InWrite)
+	: Name(InName)
+	, Queue(Capacity, MaxBacklogBytes)
+	, Write(MoveTemp(InWrite))
+	, Thread(nullptr)
+	, bDrainOnStop(false)
+	, NumWritten(0)
+	, TotalDepth(0)
+	, TotalQueueTime(0.0)
+	, MaxQueueTime(0.0)
+	, TotalWriteTime(0.0)
+	, MaxWriteTime(0.0)
+{
+	WakeupEvent = FPlatformProcess::GetSynchEventFromPool(false);
+}
+
+FPacketWriter::~FPacketWriter()
+{
+	Shutdown(false);
+
+	FPlatformProcess::ReturnSynchEventToPool(WakeupEvent);
+	WakeupEvent = nullptr;
+}
+
+bool FPacketWriter::Start(EThreadPriority Priority)
+{
+	check(Thread == nullptr);
+
+	bStopRequested = false;
+	Thread = FRunnableThread::Create(this, *Name, 0, Priority);
+	return Thread != nullptr;
+}
+
+bool FPacketWriter::Push(FEncodedPacket&& Packet)
+{
+	if (!Queue.Enqueue(MoveTemp(Packet))) {
+		return false;
+	}
+
+	WakeupEvent->Trigger();
+	return true;
+}
+
+void FPacketWriter::Shutdown(bool bDrain)
+{
+	if (Thread != nullptr) {
+		bDrainOnStop = bDrain;
+		bStopRequested = true;
+		WakeupEvent->Trigger();
+
+		Thread->WaitForCompletion();
+		delete Thread;
+		Thread = nullptr;
+	}
+
+	Queue.Empty();
+}
+
+bool FPacketWriter::ConsumeKeyframeRequest()
+{
+	return Queue.ConsumeKeyframeRequest();
+}
+
+FPipelineStageStats FPacketWriter::GetStats() const
+{
+	const FPacketQueueStats QueueStats = Queue.GetStats();
+
+	FPipelineStageStats Stats;
+	Stats.NumDropped = QueueStats.NumDroppedDisposable + QueueStats.NumDroppedGOPFrames + QueueStats.NumDroppedAudio;
+	Stats.Capacity = Queue.GetCapacity();
+	Stats.Depth = Queue.Num();
+	Stats.HighWaterMark = QueueStats.HighWaterMark;
+
+	FScopeLock Lock(&StatsCS);
+	Stats.NumProcessed = NumWritten;
+	Stats.MaxQueueTime = MaxQueueTime;
+	Stats.MaxProcessTime = MaxWriteTime;
+	if (NumWritten > 0) {
+		Stats.AverageDepth = double(TotalDepth) / NumWritten;
+		Stats.AverageQueueTime = TotalQueueTime / NumWritten;
+		Stats.AverageProcessTime = TotalWriteTime / NumWritten;
+	}
+	return Stats;
+}
+
+FPacketQueueStats FPacketWriter::GetQueueStats() const
+{
+	return Queue.GetStats();
+}
+
+uint32 FPacketWriter::Run()
+{
+	while (true)
+	{
+		FEncodedPacket Packet;
+		double EnqueueTime = 0.0;
+		if (Queue.Dequeue(Packet, EnqueueTime)) {
+			if (bStopRequested && !bDrainOnStop) {
+				break;
+			}
+
+			const int32 Depth = Queue.Num() + 1;
+			const double StartTime = FPlatformTime::Seconds();
+			Write(Packet);
+			const double EndTime = FPlatformTime::Seconds();
+
+			FScopeLock Lock(&StatsCS);
+			++NumWritten;
+			TotalDepth += Depth;
+			TotalQueueTime += StartTime - EnqueueTime;
+			MaxQueueTime = FMath::Max(MaxQueueTime, StartTime - EnqueueTime);
+			TotalWriteTime += EndTime - StartTime;
+			MaxWriteTime = FMath::Max(MaxWriteTime, EndTime - StartTime);
+			continue;
+		}
+
+		if (bStopRequested) {
+			break;
+		}
+
+		// Push and Shutdown trigger the event, nothing to do until then.
+		WakeupEvent->Wait();
+	}
+
+	return 0;
+}
+
+void FPacketWriter::Stop()
+{
+	bStopRequested = true;
+	WakeupEvent->Trigger();
+}
@@ -15,6 +15,7 @@ DEFINE_LOG_CATEGORY(LogRTMP);
 void FRTMPModule::StartupModule()
 {
 	bInitialized = false;
+	LibSRTHandle = nullptr;
 	// This code will execute after your module is loaded into memory(nullptr) the exact timing is specified in the .uplugin file per-module
 	InitLibraryHandles();
 
@@ -117,6 +118,15 @@ void FRTMPModule::InitLibraryHandles()
 		return;
 	}
 
+#if WITH_LIBSRT
+	// Delay loaded like the ffmpeg libraries, from its own ThirdParty folder.
+	LibSRTHandle = LoadDependencyLibrary(TEXT("srt.dll"), TEXT("srt"));
+	if (LibSRTHandle == nullptr) {
+		UE_LOG(LogRTMP, Error, TEXT("Load dependecy dll failed."));
+		return;
+	}
+#endif
+
 	bInitialized = true;
 }
 
@@ -124,6 +134,11 @@ void FRTMPModule::UnloadHandledLibraries()
 {
 	bInitialized = false;
 
+	if (LibSRTHandle != nullptr) {
+		FPlatformProcess::FreeDllHandle(LibSRTHandle);
+		LibSRTHandle = nullptr;
+	}
+
 	if (AVDeviceHandle != nullptr) {
 		FPlatformProcess::FreeDllHandle(AVDeviceHandle);
 		AVDeviceHandle = nullptr;
@@ -195,7 +210,7 @@ void FRTMPModule::UnloadHandledLibraries()
 	//}
 }
 
-void* FRTMPModule::LoadDependencyLibrary(const FString& DLLName)
+void* FRTMPModule::LoadDependencyLibrary(const FString& DLLName, const TCHAR* LibraryDir)
 {
 	FString baseDir = IPluginManager::Get().FindPlugin("RTMP")->GetBaseDir();
 
@@ -207,7 +222,7 @@ void* FRTMPModule::LoadDependencyLibrary(const FString& DLLName)
 	bIsDebug = false;
 #endif
 
-	FString dllDir = FPaths::Combine(*baseDir, TEXT("ThirdParty/ffmpeg/bin/"), bIsDebug ? TEXT("x64_Debug") : TEXT("x64_Release"));
+	FString dllDir = FPaths::Combine(*baseDir, TEXT("ThirdParty"), LibraryDir, TEXT("bin"), bIsDebug ? TEXT("x64_Debug") : TEXT("x64_Release"));
 
 	FString dllFilename = FPaths::Combine(*dllDir, *DLLName);
 
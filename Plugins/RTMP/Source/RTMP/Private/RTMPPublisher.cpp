@@ -3,7 +3,14 @@
 
 #include "RTMPPublisher.h"
 #include "Misc/ScopeExit.h"
+#include "HAL/Event.h"
+#include "HAL/PlatformProcess.h"
 #include "GameViewportRecorder.h"
+#include "FramePool.h"
+#include "AudioRingBuffer.h"
+#include "AudioResampler.h"
+#include "VideoEncoderSettings.h"
+#include "VideoEncoderBackend.h"
 
 extern "C" {
 #include <libavutil/avassert.h>
@@ -13,26 +20,92 @@ extern "C" {
 #include <libavutil/timestamp.h>
 #include <libavformat/avformat.h>
 #include <libswscale/swscale.h>
-#include <libswresample/swresample.h>
 #include <libavutil/error.h>
+#include <libavutil/imgutils.h>
 }
 
 DEFINE_LOG_CATEGORY(LogRTMPPublisher);
 DEFINE_LOG_CATEGORY(LogFFMPEGEncoder_Video);
 DEFINE_LOG_CATEGORY(LogFFMPEGEncoder_Audio);
 
+namespace RTMPPublisher
+{
+	// Pooled frames referenced outside of the queue: the one being converted and the one being captured.
+	static const int32 NumFramesOutsideQueue = 2;
+
+	// Encoder frames outside of the encode queue: the one being converted into and the one being encoded.
+	static const int32 NumEncoderFramesOutsideQueue = 2;
+
+	static void LogStageStats(const TCHAR* StageName, const FPipelineStageStats& Stats)
+	{
+		UE_LOG(LogRTMPPublisher, Log, TEXT("%s stage: %lld processed, %lld dropped, depth %.2f average %d/%d max, queued %.2fms average %.2fms max, processing %.2fms average %.2fms max, producers blocked %.3fs."),
+			StageName, Stats.NumProcessed, Stats.NumDropped, Stats.AverageDepth, Stats.HighWaterMark, Stats.Capacity,
+			Stats.AverageQueueTime * 1000.0, Stats.MaxQueueTime * 1000.0, Stats.AverageProcessTime * 1000.0, Stats.MaxProcessTime * 1000.0, Stats.BlockedTime);
+	}
+
+	// Audio pts further behind the media clock than this are re-anchored.
+	static const double MaxAudioPtsError = 0.1;
+
+	// Shortest wait for new audio, encoders with tiny frames would spin otherwise.
+	static const double MinAudioWaitSeconds = 0.005;
+
+	// Frames the video encoder can hold on to at most, x264 lookahead is up to 250 frames plus B-frames and threads.
+	static const int32 MaxVideoEncoderDelay = 512;
+
+	// Packets the encoders and the writer hold on to besides the queued ones.
+	static const int32 NumPacketsOutsideQueue = 4;
+
+	// Weight of a new sample in the smoothed A/V sync stats.
+	static const double SyncStatsSmoothing = 0.05;
+
+	// Submix audio the encode thread may lag behind before new audio gets dropped.
+	static const int32 AudioBufferSeconds = 2;
+
+	/** Encoder channel layout for the configured channel count, AAC only knows a few layouts */
+	static uint64 GetAudioChannelLayout(int32 ChannelCount)
+	{
+		switch (ChannelCount)
+		{
+		case 1: return AV_CH_LAYOUT_MONO;
+		case 2: return AV_CH_LAYOUT_STEREO;
+		case 6: return AV_CH_LAYOUT_5POINT1_BACK;
+		case 8: return AV_CH_LAYOUT_7POINT1_WIDE_BACK;
+		default:
+			UE_LOG(LogFFMPEGEncoder_Audio, Warning, TEXT("Unsupported audio channel count %d, using stereo."), ChannelCount);
+			return AV_CH_LAYOUT_STEREO;
+		}
+	}
+}
+
 FRTMPPublisher::FRTMPPublisher()
 	: bInitialized(false)
 	, bHeaderSent(false)
+	, bAudioPtsAnchored(false)
 	, ViewportRecorder(nullptr)
-	, EncodeThread(nullptr)
+	, AudioEncodeThread(nullptr)
+	, AudioWakeupEvent(nullptr)
+	, TotalAudioLatency(0.0)
+	, TotalAudioEncodeTime(0.0)
+	, NumVideoFramesSent(0)
+	, TotalVideoEncodeLatency(0.0)
+	, NextLadderKeyframePts(0)
+	, LadderGOPFrames(1)
+	, NextConversionPts(0)
+	, NumConversionSlices(1)
 {
 	//av_register_all();
 	avformat_network_init();
+
+	AudioWakeupEvent = FPlatformProcess::GetSynchEventFromPool(false);
 }
 
 FRTMPPublisher::~FRTMPPublisher()
 {
+	if (AudioWakeupEvent != nullptr) {
+		FPlatformProcess::ReturnSynchEventToPool(AudioWakeupEvent);
+		AudioWakeupEvent = nullptr;
+	}
+
 	avformat_network_deinit();
 }
 
@@ -42,29 +115,25 @@ bool FRTMPPublisher::Init()
 		return false;
 	}
 
-	bStopEncodeThread = false;
+	bStopAudioEncodeThread = false;
 	return true;
 }
 
 uint32 FRTMPPublisher::Run()
 {
-	//FTimespan VideoIntervalTime = FTimespan::FromMilliseconds(1000.0f / PublisherConfig.Framerate);
-	//FDateTime LastVideoTime = FDateTime::Now();
-	//FDateTime LastAudioTime = FDateTime::Now();
-	while (!bStopEncodeThread)
+	// Video runs through the pipeline stages, this thread only encodes audio. It never waits on video,
+	// packets of both streams are put in timestamp order by the muxer on the mux writer thread.
+	const FTimespan AudioFrameInterval = FTimespan::FromSeconds(FMath::Max(double(AudioStream.Frame->nb_samples) / AudioStream.CodecCtx->sample_rate, RTMPPublisher::MinAudioWaitSeconds));
+
+	while (!bStopAudioEncodeThread)
 	{
-		if (av_compare_ts(VideoStream.NextPts, VideoStream.CodecCtx->time_base, AudioStream.NextPts, AudioStream.CodecCtx->time_base) >= 0) {
-			SendAudioFrame();
+		// Drain every complete frame the submix delivered so far.
+		if (SendAudioFrame()) {
+			continue;
 		}
 
-		//av_compare_ts(VideoStream.NextPts, VideoStream.CodecCtx->time_base, AudioStream.NextPts, AudioStream.CodecCtx->time_base) <= 0;
-		/*FDateTime NowTime = FDateTime::Now();
-		FTimespan VideoPassedTime = NowTime - LastVideoTime;
-		if (VideoPassedTime >= VideoIntervalTime) {
-			SendVideoFrame();
-			LastVideoTime = NowTime;
-		}*/
-		SendVideoFrame();
+		// Nothing to encode, sleep until new audio data arrives.
+		AudioWakeupEvent->Wait(AudioFrameInterval);
 	}
 
 	return 0;
@@ -72,28 +141,24 @@ uint32 FRTMPPublisher::Run()
 
 void FRTMPPublisher::Stop()
 {
-	bStopEncodeThread = true;
+	bStopAudioEncodeThread = true;
+	AudioWakeupEvent->Trigger();
 }
 
 void FRTMPPublisher::OnNewSubmixBuffer(const USoundSubmix* OwningSubmix, float* AudioData, int32 NumSamples, int32 NumChannels, const int32 SampleRate, double AudioClock)
 {
-	Audio::AlignedFloatBuffer InData;
-	InData.Append(AudioData, NumSamples);
-	Audio::TSampleBuffer<float> FloatBuffer(InData, NumChannels, SampleRate);
-
-	if (FloatBuffer.GetNumChannels() != 2)
-	{
-		FloatBuffer.MixBufferToChannels(2);
+	if (NumChannels <= 0) {
+		return;
 	}
-	FloatBuffer.Clamp();
 
-	Audio::TSampleBuffer<int16> PCMData;
-	PCMData = FloatBuffer;
+	MediaClock.AddAudioAnchor(AudioClock, FPlatformTime::Seconds());
 
-	{
-		FScopeLock Lock(&AudioSubmixBufferCS);
-		AudioSubmixBuffer.Append(reinterpret_cast<const uint8*>(PCMData.GetData()), PCMData.GetNumSamples() * sizeof(*PCMData.GetData()));
-	}
+	// Deinterleave straight into the ring planes, nothing is allocated on the audio render thread.
+	// Audio is kept in the submix format, conversion to the encoder format happens on the audio encode thread.
+	// Fails when the encoder is too far behind or the device format just changed, the buffer is dropped rather than
+	// waiting on the audio render thread. A format change is picked up by the audio encode thread, so it is woken either way.
+	AudioSubmixBuffer->WriteInterleaved(AudioData, NumSamples / NumChannels, NumChannels, SampleRate, AudioClock);
+	AudioWakeupEvent->Trigger();
 }
 
 bool FRTMPPublisher::Setup(const FRTMPPublisherConfig& Config)
@@ -105,21 +170,82 @@ bool FRTMPPublisher::Setup(const FRTMPPublisherConfig& Config)
 
 	PublisherConfig = Config;
 
-	ViewportRecorder = MakeShared<class FGameViewportRecorder>(FIntPoint(PublisherConfig.Width, PublisherConfig.Height));
+	// Every rung is scaled from the one above it, so sizes only shrink down the ladder.
+	FIntPoint RungAboveSize(PublisherConfig.Width, PublisherConfig.Height);
+	for (const FRTMPRendition& Rendition : PublisherConfig.Renditions)
+	{
+		if (Rendition.StreamUrl.IsEmpty() || Rendition.Width <= 0 || Rendition.Height <= 0 || (Rendition.Width & 1) != 0 || (Rendition.Height & 1) != 0
+			|| Rendition.Width > RungAboveSize.X || Rendition.Height > RungAboveSize.Y) {
+			UE_LOG(LogRTMPPublisher, Error, TEXT("Rendition %dx%d needs a stream URL and an even size no larger than the %dx%d above it."),
+				Rendition.Width, Rendition.Height, RungAboveSize.X, RungAboveSize.Y);
+			return false;
+		}
+		RungAboveSize = FIntPoint(Rendition.Width, Rendition.Height);
+	}
+
+	PublisherConfig.VideoQueueCapacity = FMath::Max(PublisherConfig.VideoQueueCapacity, 1);
+
+	PublisherConfig.EncodeQueueCapacity = FMath::Max(PublisherConfig.EncodeQueueCapacity, 1);
+	PublisherConfig.MuxQueueCapacity = FMath::Max(PublisherConfig.MuxQueueCapacity, 1);
+
+	// Only the capture queue drops, the stages after it block their producer so no converted frame or packet is lost.
+	ConvertStage = MakeUnique<TPipelineStage<FEncodeFramePayload>>(TEXT("RTMP Video Convert"), PublisherConfig.VideoQueueCapacity, PublisherConfig.VideoQueueOverflowPolicy,
+		[this](FEncodeFramePayload& RawData) { ConvertVideoFrame(RawData); });
+	EncodeStage = MakeUnique<TPipelineStage<FConvertedVideoFrame>>(TEXT("RTMP Video Encode"), PublisherConfig.EncodeQueueCapacity, ERTMPQueueOverflowPolicy::BlockProducer,
+		[this](FConvertedVideoFrame& Converted) { EncodeVideoFrame(Converted); });
+	// Every output queue holds its own references, up to a full queue each.
+	const int32 NumOutputQueues = 1 + PublisherConfig.AdditionalOutputs.Num() + PublisherConfig.Renditions.Num();
+	PacketPool = MakeUnique<FAVPacketPool>((PublisherConfig.MuxQueueCapacity + RTMPPublisher::NumPacketsOutsideQueue) * NumOutputQueues);
+	AudioSubmixBuffer = MakeUnique<FAudioRingBuffer>(FMath::Max(PublisherConfig.SampleRate, 48000) * RTMPPublisher::AudioBufferSeconds);
+
+	// x264 takes I420 (yuv420p), which the recorder can produce on the GPU.
+	const ERTMPFrameFormat CaptureFormat = PublisherConfig.bGPUColorConversion ? ERTMPFrameFormat::I420 : ERTMPFrameFormat::BGRA;
+	ViewportRecorder = MakeShared<class FGameViewportRecorder>(FIntPoint(PublisherConfig.Width, PublisherConfig.Height),
+		PublisherConfig.ReadbackSurfaceCount, PublisherConfig.FrameGrabLatency, PublisherConfig.ReadbackMode, CaptureFormat,
+		PublisherConfig.ColorMatrix, PublisherConfig.ColorRange);
+
+	const int32 FrameSize = RTMPVideo::GetFrameSize(ViewportRecorder->GetOutputFormat(), PublisherConfig.Width, PublisherConfig.Height);
+	FramePool = MakeUnique<FFramePool>(PublisherConfig.VideoQueueCapacity + RTMPPublisher::NumFramesOutsideQueue, FrameSize);
 
 	ViewportRecorder->OnViewportRecordedCallback().AddRaw(this, &FRTMPPublisher::OnViewportRecorded);
 
-	FString CombinedUrl = Config.StreamUrl;
-	
-	int32 Result = avformat_alloc_output_context2(&OutputFormatCtx, NULL, "flv", TCHAR_TO_ANSI(*CombinedUrl));
-	if (Result < 0) {
-		UE_LOG(LogRTMPPublisher, Error, TEXT("Cloud not allocate output format context."));
+	// The stream URL first, then the additional outputs, all of them muxing the same encoded packets.
+	FRTMPOutputSink StreamOutput;
+	StreamOutput.Url = PublisherConfig.StreamUrl;
+	StreamOutput.Container = ERTMPOutputContainer::FLV;
+	TArray<FRTMPOutputSink> OutputConfigs = PublisherConfig.AdditionalOutputs;
+	OutputConfigs.Insert(StreamOutput, 0);
+	for (const FRTMPOutputSink& OutputConfig : OutputConfigs)
+	{
+		const TUniquePtr<FOutputSink>& Output = Outputs.Add_GetRef(FOutputSink::Create(OutputConfig, *PacketPool));
+		if (OutputConfig.Url.IsEmpty() || !Output->Init()) {
+			UE_LOG(LogRTMPPublisher, Error, TEXT("Cloud not set up output '%s'."), *OutputConfig.Url);
+			Shutdown();
+			return false;
+		}
+	}
+
+	const FVideoEncoderBackend& VideoBackend = RTMPVideo::GetEncoderBackend(PublisherConfig.VideoEncoder);
+	if (!VideoBackend.IsAvailable()) {
+		UE_LOG(LogRTMPPublisher, Error, TEXT("Video encoder %s (%s) is not part of this ffmpeg build."),
+			RTMPVideo::GetEncoderBackendName(PublisherConfig.VideoEncoder), UTF8_TO_TCHAR(VideoBackend.GetEncoderName()));
+		Shutdown();
 		return false;
 	}
 
-	OutputFormat = OutputFormatCtx->oformat;
+	// Every output format needs a tag for the codec, FLV only has one for H.264.
+	for (const TUniquePtr<FOutputSink>& Output : Outputs)
+	{
+		if (!VideoBackend.CanMuxInto(Output->GetOutputFormat())) {
+			UE_LOG(LogRTMPPublisher, Error, TEXT("%s output '%s' cannot carry %s video from %s, pick an encoder it supports."),
+				UTF8_TO_TCHAR(Output->GetOutputFormat()->name), *Output->GetUrl(), UTF8_TO_TCHAR(avcodec_get_name(VideoBackend.FindEncoder()->id)),
+				RTMPVideo::GetEncoderBackendName(PublisherConfig.VideoEncoder));
+			Shutdown();
+			return false;
+		}
+	}
 
-	if (!AddStream(VideoStream, &VideoCodec, AV_CODEC_ID_H264) || !AddStream(AudioStream, &AudioCodec, AV_CODEC_ID_AAC)) {
+	if (!AddStream(VideoStream, &VideoCodec, VideoBackend.FindEncoder()->id) || !AddStream(AudioStream, &AudioCodec, AV_CODEC_ID_AAC)) {
 		Shutdown();
 		return false;
 	}
@@ -129,65 +255,111 @@ bool FRTMPPublisher::Setup(const FRTMPPublisherConfig& Config)
 		return false;
 	}
 
+	for (const TUniquePtr<FOutputSink>& Output : Outputs)
+	{
+		if (!Output->AddStreams(VideoStream.CodecCtx, AudioStream.CodecCtx, PublisherConfig.MuxQueueCapacity, PublisherConfig.MaxMuxBacklogSeconds,
+			PublisherConfig.VideoBitrate + PublisherConfig.AudioBitrate)) {
+			Shutdown();
+			return false;
+		}
+	}
+
+	// Renditions share the audio encoder, its packets are referenced into every output.
+	for (const FRTMPRendition& Rendition : PublisherConfig.Renditions)
+	{
+		const TUniquePtr<FRenditionOutput>& Output = Renditions.Add_GetRef(MakeUnique<FRenditionOutput>(Rendition, *PacketPool));
+		if (!Output->Setup(PublisherConfig, AudioStream.CodecCtx)) {
+			Shutdown();
+			return false;
+		}
+	}
+
 	bInitialized = true;
 
-	av_dump_format(OutputFormatCtx, 0, TCHAR_TO_ANSI(*CombinedUrl), 1);
-	
 	return true;
 }
 
 bool FRTMPPublisher::StartPublish()
 {
 	if (!bInitialized) {
+		UE_LOG(LogRTMPPublisher, Error, TEXT("RTMP publisher is not set up."));
+		return false;
+	}
+	if (bHeaderSent) {
 		UE_LOG(LogRTMPPublisher, Log, TEXT("RTMP publisher is already running."));
 		return true;
 	}
 
-	FString CombinedUrl = PublisherConfig.StreamUrl;
-
-	if (OutputFormat->flags & AVFMT_NOFILE) {
-		UE_LOG(LogRTMPPublisher, Error, TEXT("Output format flags has AVFMT_NOFILE."));
-		return false;
-	}
-
+	// Whatever started before a failure is stopped again, writer threads, connections and files included.
+	bool bStarted = false;
+	ON_SCOPE_EXIT
+	{
+		if (!bStarted) {
+			Shutdown();
+		}
+	};
 
-	int32 Result = avio_open(&OutputFormatCtx->pb, TCHAR_TO_ANSI(*CombinedUrl), AVIO_FLAG_WRITE);
-	if (Result < 0) {
-		UE_LOG(LogRTMPPublisher, Error, TEXT("Cloud not open output file."));
-		return false;
+	// An output that can't be opened is left out, publishing only fails when none of them could be.
+	int32 NumStartedOutputs = 0;
+	for (const TUniquePtr<FOutputSink>& Output : Outputs)
+	{
+		if (Output->Start()) {
+			++NumStartedOutputs;
+		}
 	}
-
-	Result = avformat_write_header(OutputFormatCtx, nullptr);
-	if (Result < 0) {
-		UE_LOG(LogRTMPPublisher, Error, TEXT("Error occurred when opening output file."));
+	if (NumStartedOutputs == 0) {
+		UE_LOG(LogRTMPPublisher, Error, TEXT("Cloud not open any output."));
 		return false;
 	}
 
 	bHeaderSent = true;
 
+	// Media time zero, audio and capture timestamps are relative to this point.
+	MediaClock.Start();
+
 	FAudioDevice* AudioDevice = GEngine->GetMainAudioDeviceRaw();
 	if (AudioDevice) {
 		AudioDevice->RegisterSubmixBufferListener(this);
 	}
 
-	if (!ViewportRecorder->StartRecord(PublisherConfig.Framerate)) {
+	for (const TUniquePtr<FRenditionOutput>& Rendition : Renditions)
+	{
+		if (!Rendition->Start()) {
+			return false;
+		}
+	}
+
+	// Downstream stages first, so every stage has a consumer by the time its producer starts. The outputs' writers already run.
+	if (!EncodeStage->Start() || !ConvertStage->Start()) {
+		UE_LOG(LogRTMPPublisher, Error, TEXT("Cloud not create the video pipeline threads."));
+		return false;
+	}
+
+	// Slots count in media time from zero like the audio pts, a slot's index is the video pts of the frame captured into it.
+	// Both streams follow the audio device clock, so its drift against the platform clock can't pull them apart.
+	if (!ViewportRecorder->StartRecord(PublisherConfig.GetFrameRate(), MediaClock)) {
 		UE_LOG(LogRTMPPublisher, Error, TEXT("Cloud not start to record game viewport."));
 		return false;
 	}
-	
-	StartRecordTime = FDateTime::Now();
 
-	EncodeThread = FRunnableThread::Create(this, TEXT("RTMP Publisher"));
-	if (EncodeThread == nullptr) {
-		UE_LOG(LogRTMPPublisher, Error, TEXT("Cloud not create new thread to publish."));
+	// Audio encoding is cheap and what listeners notice first, let it preempt the video threads.
+	AudioEncodeThread = FRunnableThread::Create(this, TEXT("RTMP Audio Encode"), 0, TPri_AboveNormal);
+	if (AudioEncodeThread == nullptr) {
+		UE_LOG(LogRTMPPublisher, Error, TEXT("Cloud not create the audio encode thread."));
 		return false;
 	}
 
+	bStarted = true;
 	return true;
 }
 
 void FRTMPPublisher::Shutdown()
 {
+	// Never leave the render thread waiting on a queue nobody drains anymore
+	if (ConvertStage) {
+		ConvertStage->ReleaseProducers();
+	}
+
 	// Clear viewport recorder
 	if (ViewportRecorder) {
 		ViewportRecorder->StopRecord();
@@ -200,38 +372,134 @@ void FRTMPPublisher::Shutdown()
 		AudioDevice->UnregisterSubmixBufferListener(this);
 	}
 
-	// Stop encode thread
-	if (EncodeThread != nullptr) {
-		EncodeThread->Kill(true);
-		EncodeThread->WaitForCompletion();
-		EncodeThread = nullptr;
+	// Stop audio encode thread
+	if (AudioEncodeThread != nullptr) {
+		AudioEncodeThread->Kill(true);
+		AudioEncodeThread->WaitForCompletion();
+		delete AudioEncodeThread;
+		AudioEncodeThread = nullptr;
 	}
 
-	if (bHeaderSent) {
-		av_write_trailer(OutputFormatCtx);
+	// Producers are stopped, let every stage finish what it already has in upstream order so the
+	// frames captured last still make it into the output.
+	FRTMPPipelineStats PipelineStats;
+	if (ConvertStage) {
+		ConvertStage->Shutdown(true);
+		PipelineStats.Convert = ConvertStage->GetStats();
 	}
-
-	if (VideoStream.Stream	 != nullptr) {
-		CloseStream(VideoStream);
+	if (EncodeStage) {
+		EncodeStage->Shutdown(true);
+		PipelineStats.Encode = EncodeStage->GetStats();
+	}
+	for (const TUniquePtr<FRenditionOutput>& Rendition : Renditions)
+	{
+		Rendition->FinishVideo();
 	}
 
-	if (AudioStream.Stream != nullptr) {
-		CloseStream(AudioStream);
+	// Encode the audio still buffered and flush both encoders, every frame that went in comes out before the trailer.
+	// The encode threads are gone, the encoders are only touched from here now.
+	if (bHeaderSent) {
+		while (SendAudioFrame())
+		{
+		}
+
+		EncodeFrame(VideoStream, nullptr);
+		EncodeFrame(AudioStream, nullptr);
 	}
 
-	if (!(OutputFormat->flags & AVFMT_NOFILE)) {
-		avio_closep(&OutputFormatCtx->pb);
+	// Before the packet pool, the outputs and renditions return their packets to it.
+	for (const TUniquePtr<FOutputSink>& Output : Outputs)
+	{
+		Output->Close();
+		PipelineStats.Outputs.Add(Output->GetStats());
+	}
+	for (const TUniquePtr<FRenditionOutput>& Rendition : Renditions)
+	{
+		Rendition->Close();
+	}
+	Outputs.Empty();
+	Renditions.Empty();
+	ConvertStage.Reset();
+	EncodeStage.Reset();
+	FreeVideoFrames.Reset();
+	if (PacketPool) {
+		UE_LOG(LogRTMPPublisher, Log, TEXT("Packet pool allocated %lld packets."), PacketPool->GetNumAllocated());
+		PacketPool.Reset();
 	}
 
-	avformat_free_context(OutputFormatCtx);
+	CloseStream(VideoStream);
+	CloseStream(AudioStream);
 
 	// Clear publisher status
 	bInitialized = false;
 	bHeaderSent = false;
-	StartRecordTime = 0;
-	VideoFrameQueue.Empty();
-	AudioSubmixBuffer.Empty();
-	FrozenFrame = FEncodeFramePayload();
+	bAudioPtsAnchored = false;
+
+	const FMediaClockStats ClockStats = GetMediaClockStats();
+	const FAVSyncStats AVSyncStats = GetSyncStats();
+	UE_LOG(LogRTMPPublisher, Log, TEXT("Media clock: audio clock offset %.6fs, drift %.2f ppm over %lld anchors."),
+		ClockStats.AudioClockOffset, ClockStats.DriftPPM, ClockStats.NumAudioAnchors);
+	UE_LOG(LogRTMPPublisher, Log, TEXT("A/V sync: video pts error %.2fms, audio pts error %.2fms, lip-sync offset %.2fms, %d audio resyncs."),
+		AVSyncStats.VideoTimestampError * 1000.0, AVSyncStats.AudioTimestampError * 1000.0, AVSyncStats.LipSyncOffset * 1000.0, AVSyncStats.NumAudioResyncs);
+	{
+		FScopeLock Lock(&SyncStatsCS);
+		SyncStats = FAVSyncStats();
+	}
+	{
+		FScopeLock Lock(&AudioEncodeStatsCS);
+		UE_LOG(LogRTMPPublisher, Log, TEXT("Audio encode: %lld frames, latency %.2fms average %.2fms max, encoding %.3fms average %.3fms max."),
+			AudioEncodeStats.NumFrames, AudioEncodeStats.AverageLatency * 1000.0, AudioEncodeStats.MaxLatency * 1000.0,
+			AudioEncodeStats.AverageEncodeTime * 1000.0, AudioEncodeStats.MaxEncodeTime * 1000.0);
+		AudioEncodeStats = FAudioEncodeStats();
+		TotalAudioLatency = 0.0;
+		TotalAudioEncodeTime = 0.0;
+	}
+	{
+		FScopeLock Lock(&VideoEncodeStatsCS);
+		const double FrameInterval = PublisherConfig.GetFrameRate().AsInterval();
+		UE_LOG(LogRTMPPublisher, Log, TEXT("Video encode: %lld frames, encoder latency %.2fms average %.2fms max (frame interval %.2fms, exceeded by %lld frames), up to %d frames delay."),
+			VideoEncodeStats.NumFrames, VideoEncodeStats.AverageLatency * 1000.0, VideoEncodeStats.MaxLatency * 1000.0, FrameInterval * 1000.0,
+			VideoEncodeStats.NumOverFrameInterval, VideoEncodeStats.MaxDelayFrames);
+		VideoEncodeStats = FVideoEncodeStats();
+		TotalVideoEncodeLatency = 0.0;
+	}
+	RTMPPublisher::LogStageStats(TEXT("Convert"), PipelineStats.Convert);
+	RTMPPublisher::LogStageStats(TEXT("Encode"), PipelineStats.Encode);
+	for (const FOutputSinkStats& OutputStats : PipelineStats.Outputs)
+	{
+		RTMPPublisher::LogStageStats(*(TEXT("Mux ") + OutputStats.Url), OutputStats.Mux);
+		UE_LOG(LogRTMPPublisher, Log, TEXT("Mux queue %s: dropped %lld non-reference frames, %lld frames in %d GOP skips and %lld audio packets, most queued %lld bytes%s."),
+			*OutputStats.Url, OutputStats.MuxQueue.NumDroppedDisposable, OutputStats.MuxQueue.NumDroppedGOPFrames, OutputStats.MuxQueue.NumGOPSkips,
+			OutputStats.MuxQueue.NumDroppedAudio, OutputStats.MuxQueue.MaxQueuedBytes, OutputStats.bFailed ? TEXT(", output failed") : TEXT(""));
+		if (OutputStats.Transport.bConnectionStats) {
+			UE_LOG(LogRTMPPublisher, Log, TEXT("Transport %s: %lld bytes sent at %.2f Mbps, round trip %.1fms, %lld packets retransmitted, %lld lost, %lld dropped too late, %lld bytes (%.0fms) unacknowledged."),
+				*OutputStats.Url, OutputStats.Transport.BytesSent, OutputStats.Transport.SendRateMbps, OutputStats.Transport.RoundTripTime * 1000.0,
+				OutputStats.Transport.NumRetransmitted, OutputStats.Transport.NumLost, OutputStats.Transport.NumDropped, OutputStats.Transport.SendBufferBytes,
+				OutputStats.Transport.SendBufferSeconds * 1000.0);
+		}
+	}
+	UE_LOG(LogRTMPPublisher, Log, TEXT("Video conversion used %d slices."), NumConversionSlices);
+	NextConversionPts = 0;
+	NextLadderKeyframePts = 0;
+	// The ring itself stays alive until the next Setup, the audio render thread may still be writing to it.
+	if (AudioSubmixBuffer) {
+		const FAudioRingBufferStats AudioStats = AudioSubmixBuffer->GetStats();
+		UE_LOG(LogRTMPPublisher, Log, TEXT("Audio submix buffer: %lld frames written, %lld overflows (%lld frames dropped), %lld frames dropped on format changes, high-water mark %d/%d frames."),
+			AudioStats.FramesWritten, AudioStats.NumOverflows, AudioStats.DroppedFrames, AudioStats.FormatChangeDroppedFrames, AudioStats.HighWaterMark, AudioSubmixBuffer->GetCapacity());
+	}
+
+	if (AudioResampler) {
+		const FAudioResamplerStats ResamplerStats = AudioResampler->GetStats();
+		UE_LOG(LogRTMPPublisher, Log, TEXT("Audio resampler: %d format changes, last submix format %d Hz %d channels%s, %lld frames in, %lld frames out."),
+			ResamplerStats.NumFormatChanges, ResamplerStats.InputFormat.SampleRate, ResamplerStats.InputFormat.NumChannels,
+			ResamplerStats.bPassthrough ? TEXT(" (passthrough)") : TEXT(""), ResamplerStats.FramesIn, ResamplerStats.FramesOut);
+		AudioResampler.Reset();
+	}
+
+	if (FramePool) {
+		UE_LOG(LogRTMPPublisher, Log, TEXT("Frame pool exhausted %lld times."), FramePool->GetNumExhausted());
+		FramePool.Reset();
+	}
 }
 
 bool FRTMPPublisher::IsInitialized() const
@@ -239,14 +507,80 @@ bool FRTMPPublisher::IsInitialized() const
 	return bInitialized;
 }
 
+FMediaClockStats FRTMPPublisher::GetMediaClockStats() const
+{
+	return MediaClock.GetStats();
+}
+
+FAVSyncStats FRTMPPublisher::GetSyncStats() const
+{
+	FScopeLock Lock(&SyncStatsCS);
+	return SyncStats;
+}
+
+void FRTMPPublisher::RecordVideoEncodeLatency(int64 Pts)
+{
+	// AV_NOPTS_VALUE is negative as well, neither indexes the ring.
+	if (Pts < 0) {
+		return;
+	}
+	const FVideoEncoderInput& Input = VideoEncoderInputs[Pts % VideoEncoderInputs.Num()];
+	if (Input.Pts != Pts) {
+		return;
+	}
+
+	const double Latency = FPlatformTime::Seconds() - Input.SendTime;
+	const int32 DelayFrames = int32(NumVideoFramesSent - 1 - Input.Sequence);
+
+	FScopeLock Lock(&VideoEncodeStatsCS);
+	++VideoEncodeStats.NumFrames;
+	TotalVideoEncodeLatency += Latency;
+	VideoEncodeStats.AverageLatency = TotalVideoEncodeLatency / VideoEncodeStats.NumFrames;
+	VideoEncodeStats.MaxLatency = FMath::Max(VideoEncodeStats.MaxLatency, Latency);
+	VideoEncodeStats.MaxDelayFrames = FMath::Max(VideoEncodeStats.MaxDelayFrames, DelayFrames);
+	if (Latency > PublisherConfig.GetFrameRate().AsInterval()) {
+		++VideoEncodeStats.NumOverFrameInterval;
+	}
+}
+
+FVideoEncodeStats FRTMPPublisher::GetVideoEncodeStats() const
+{
+	FScopeLock Lock(&VideoEncodeStatsCS);
+	return VideoEncodeStats;
+}
+
+FAudioEncodeStats FRTMPPublisher::GetAudioEncodeStats() const
+{
+	FScopeLock Lock(&AudioEncodeStatsCS);
+	return AudioEncodeStats;
+}
+
+FRTMPPipelineStats FRTMPPublisher::GetPipelineStats() const
+{
+	FRTMPPipelineStats Stats;
+	if (ConvertStage) {
+		Stats.Convert = ConvertStage->GetStats();
+	}
+	if (EncodeStage) {
+		Stats.Encode = EncodeStage->GetStats();
+	}
+	for (const TUniquePtr<FOutputSink>& Output : Outputs)
+	{
+		Stats.Outputs.Add(Output->GetStats());
+	}
+	for (const TUniquePtr<FRenditionOutput>& Rendition : Renditions)
+	{
+		Stats.Renditions.Add(Rendition->GetStats());
+	}
+	return Stats;
+}
+
 bool FRTMPPublisher::AddStream(FOutputStream& Stream, struct AVCodec** Codec, enum AVCodecID CodecId)
 {
 	AVCodecContext* CodecCtx;
-	if (CodecId == AV_CODEC_ID_H264) {
-		//*Codec = avcodec_find_encoder_by_name("h264_nvenc");
-		//if (*Codec == nullptr) {
-			*Codec = avcodec_find_encoder(CodecId);
-		//}
+	// Several encoders can produce the video codec, use the configured one rather than whichever ffmpeg registered first.
+	if (&Stream == &VideoStream) {
+		*Codec = RTMPVideo::GetEncoderBackend(PublisherConfig.VideoEncoder).FindEncoder();
 	}
 	else {
 		*Codec = avcodec_find_encoder(CodecId);
@@ -256,13 +590,13 @@ bool FRTMPPublisher::AddStream(FOutputStream& Stream, struct AVCodec** Codec, en
 		return false;
 	}
 
-	Stream.Stream = avformat_new_stream(OutputFormatCtx, nullptr);
-	if (Stream.Stream == nullptr) {
-		UE_LOG(LogRTMPPublisher, Error, TEXT("Cloud not allocate stream."));
-		return false;
+	// One encoder for every output, codec parameters go in the container header as soon as any output wants them there.
+	bool bGlobalHeader = false;
+	for (const TUniquePtr<FOutputSink>& Output : Outputs)
+	{
+		bGlobalHeader |= Output->WantsGlobalHeader();
 	}
 
-	Stream.Stream->id = OutputFormatCtx->nb_streams - 1;
 	CodecCtx = avcodec_alloc_context3(*Codec);
 	if (CodecCtx == nullptr) {
 		UE_LOG(LogRTMPPublisher, Error, TEXT("Cloud not alloc an encoding context."));
@@ -278,61 +612,28 @@ bool FRTMPPublisher::AddStream(FOutputStream& Stream, struct AVCodec** Codec, en
 		CodecCtx->sample_fmt =AV_SAMPLE_FMT_FLTP;
 		CodecCtx->bit_rate = PublisherConfig.AudioBitrate;
 		CodecCtx->sample_rate = PublisherConfig.SampleRate;
-		CodecCtx->channel_layout = AV_CH_LAYOUT_STEREO;
+		CodecCtx->channel_layout = RTMPPublisher::GetAudioChannelLayout(PublisherConfig.ChannelCount);
 		CodecCtx->channels = av_get_channel_layout_nb_channels(CodecCtx->channel_layout);
 
-		if (OutputFormatCtx->oformat->flags & AVFMT_GLOBALHEADER) {
+		if (bGlobalHeader) {
 			CodecCtx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
 		}
-
-		if (avcodec_parameters_from_context(Stream.Stream->codecpar, CodecCtx) < 0)
-		{
-			return false;
-		}
-
-		Stream.Stream->time_base = { 1, CodecCtx->sample_rate };
 		break;
 	}
 	case AVMEDIA_TYPE_VIDEO:
 	{
-		CodecCtx->bit_rate = PublisherConfig.VideoBitrate;
-		//CodecCtx->rc_min_rate = CodecCtx->bit_rate;
-		//CodecCtx->rc_max_rate = CodecCtx->bit_rate;
-		//CodecCtx->bit_rate_tolerance = CodecCtx->bit_rate;
-		//CodecCtx->rc_buffer_size = CodecCtx->bit_rate;
-		CodecCtx->width = PublisherConfig.Width;
-		CodecCtx->height = PublisherConfig.Height;
-
-		CodecCtx->time_base = { 1, PublisherConfig.Framerate };
-		CodecCtx->framerate = { PublisherConfig.Framerate, 1 };
 		CodecCtx->frame_number = 1;
-		CodecCtx->codec_type = AVMEDIA_TYPE_VIDEO;
-		CodecCtx->gop_size = 12;
-		CodecCtx->pix_fmt = AV_PIX_FMT_YUV420P;
-		CodecCtx->profile = FF_PROFILE_H264_BASELINE;
-		CodecCtx->me_range = 16;
-		CodecCtx->max_b_frames = 2;
-		CodecCtx->qcompress = 0.8;
-		CodecCtx->max_qdiff = 4;
-		CodecCtx->level = 30;
-		CodecCtx->qmin = 18;
-		CodecCtx->qmax = 28;
-
-		av_opt_set(CodecCtx->priv_data, "preset", "ultrafast", 0);
-		//av_opt_set(CodecCtx->priv_data, "profile", "baseline", 0);
-		av_opt_set(CodecCtx->priv_data, "tune", "zerolatency", 0);
-
-		if (OutputFormatCtx->oformat->flags & AVFMT_GLOBALHEADER) {
-			CodecCtx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
-		}
 
-		if (avcodec_parameters_from_context(Stream.Stream->codecpar, CodecCtx) < 0)
-		{
-			return false;
-		}
+		// Renditions of a ladder only switch cleanly where all of them have a keyframe.
+		const FVideoEncoderSettings EncoderSettings = RTMPVideo::ConfigureVideoEncoder(CodecCtx, PublisherConfig, PublisherConfig.Width, PublisherConfig.Height,
+			PublisherConfig.VideoBitrate, PublisherConfig.Renditions.Num() > 0);
+		UE_LOG(LogFFMPEGEncoder_Video, Log, TEXT("%s with the %s encoder profile: %s."), RTMPVideo::GetEncoderBackendName(PublisherConfig.VideoEncoder),
+			RTMPVideo::GetEncoderProfileName(PublisherConfig.EncoderProfile), *RTMPVideo::DescribeEncoderSettings(EncoderSettings));
+		LadderGOPFrames = CodecCtx->gop_size;
 
-		Stream.Stream->time_base = { 1, PublisherConfig.Framerate };
-		Stream.Stream->avg_frame_rate = CodecCtx->framerate;
+		if (bGlobalHeader) {
+			CodecCtx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+		}
 
 		break;
 	}
@@ -341,7 +642,6 @@ bool FRTMPPublisher::AddStream(FOutputStream& Stream, struct AVCodec** Codec, en
 	}
 
 	//CodecCtx->codec_tag = 0;
-	//Stream.Stream->codecpar->codec_tag = 0;
 
 	return true;
 }
@@ -355,22 +655,23 @@ bool FRTMPPublisher::OpenVideoStream()
 		return false;
 	}
 
-	VideoStream.Frame = AllocPicture(CodecCtx->pix_fmt, CodecCtx->width, CodecCtx->height);
-	if (VideoStream.Frame == nullptr) {
-		UE_LOG(LogRTMPPublisher, Error, TEXT("Cloud not allocate video frame."));
-		return false;
+	// Converted frames circulate between the convert and encode stages, allocated once here.
+	const int32 NumEncoderFrames = PublisherConfig.EncodeQueueCapacity + RTMPPublisher::NumEncoderFramesOutsideQueue;
+	FreeVideoFrames = MakeUnique<TBoundedQueue<FAVFramePtr>>(NumEncoderFrames, ERTMPQueueOverflowPolicy::DropNewest);
+	for (int32 Index = 0; Index < NumEncoderFrames; ++Index)
+	{
+		FAVFramePtr Frame(AllocPicture(CodecCtx->pix_fmt, CodecCtx->width, CodecCtx->height));
+		if (!Frame.IsValid()) {
+			UE_LOG(LogRTMPPublisher, Error, TEXT("Cloud not allocate video frame."));
+			return false;
+		}
+		FreeVideoFrames->Enqueue(MoveTemp(Frame));
 	}
 
-	VideoStream.TempFrame = AllocPicture(AV_PIX_FMT_BGRA, CodecCtx->width, CodecCtx->height);
-	if (VideoStream.TempFrame == nullptr) {
-		UE_LOG(LogRTMPPublisher, Error, TEXT("Cloud not allocate temporary picture."));
-		return false;
-	}
+	VideoEncoderInputs.SetNum(RTMPPublisher::MaxVideoEncoderDelay);
+	NumVideoFramesSent = 0;
 
-	if (avcodec_parameters_from_context(VideoStream.Stream->codecpar, CodecCtx) < 0) {
-		UE_LOG(LogRTMPPublisher, Error, TEXT("Cloud not copy the stream parameters."));
-		return false;
-	}
+	NumConversionSlices = PublisherConfig.ColorConversionSlices > 0 ? PublisherConfig.ColorConversionSlices : RTMPVideo::GetDefaultConversionSlices(CodecCtx->height);
 
 	return true;
 }
@@ -392,31 +693,18 @@ bool FRTMPPublisher::OpenAudioStream()
 		SamplesCount = CodecCtx->frame_size;
 	}
 
-	AudioStream.Frame = AllocAudioFrame(CodecCtx->sample_fmt, CodecCtx->channel_layout, CodecCtx->sample_rate, SamplesCount);
-	AudioStream.TempFrame = AllocAudioFrame(AV_SAMPLE_FMT_S16, CodecCtx->channel_layout, CodecCtx->sample_rate, SamplesCount);
-
-	if (avcodec_parameters_from_context(AudioStream.Stream->codecpar, CodecCtx) < 0) {
-		UE_LOG(LogRTMPPublisher, Error, TEXT("Cloud not copy the stream parameters."));
+	if (CodecCtx->sample_fmt != AV_SAMPLE_FMT_FLTP) {
+		UE_LOG(LogRTMPPublisher, Error, TEXT("Currently only support fltp audio encoders."));
 		return false;
 	}
 
-	AudioStream.SwrCtx = swr_alloc();
-	if (AudioStream.SwrCtx == nullptr) {
-		UE_LOG(LogRTMPPublisher, Error, TEXT("Cloud not allocate resampler context."));
+	AudioStream.Frame = AllocAudioFrame(CodecCtx->sample_fmt, CodecCtx->channel_layout, CodecCtx->sample_rate, SamplesCount);
+	if (AudioStream.Frame == nullptr) {
 		return false;
 	}
 
-	av_opt_set_int(AudioStream.SwrCtx, "in_channel_count", CodecCtx->channels, 0);
-	av_opt_set_int(AudioStream.SwrCtx, "in_sample_rate", CodecCtx->sample_rate, 0);
-	av_opt_set_int(AudioStream.SwrCtx, "in_sample_fmt", AV_SAMPLE_FMT_S16, 0);
-	av_opt_set_int(AudioStream.SwrCtx, "out_channel_count", CodecCtx->channels, 0);
-	av_opt_set_int(AudioStream.SwrCtx, "out_sample_rate", CodecCtx->sample_rate, 0);
-	av_opt_set_int(AudioStream.SwrCtx, "out_sample_fmt", CodecCtx->sample_fmt, 0);
-
-	if (swr_init(AudioStream.SwrCtx) < 0) {
-		UE_LOG(LogRTMPPublisher, Error, TEXT("Failed to initialize the resampling context."));
-		return false;
-	}
+	// Submix audio is planar float already, it only needs resampling/remixing when the device format differs.
+	AudioResampler = MakeUnique<FAudioResampler>(CodecCtx->sample_rate, CodecCtx->channel_layout);
 
 	return true;
 }
@@ -480,156 +768,313 @@ void FRTMPPublisher::CloseStream(FOutputStream& Stream)
 		sws_freeContext(Stream.SwsCtx);
 		Stream.SwsCtx = nullptr;
 	}
-	if (Stream.SwrCtx != nullptr) {
-		swr_free(&Stream.SwrCtx);
-		Stream.SwrCtx = nullptr;
-	}
 
 	Stream.SamplesCount = 0;
 	Stream.NextPts = 0;
 }
 
-bool FRTMPPublisher::SendVideoFrame()
+void FRTMPPublisher::ConvertVideoFrame(FEncodeFramePayload& RawData)
 {
-	AVCodecContext* CodecCtx = VideoStream.CodecCtx;
-
-	if (av_frame_make_writable(VideoStream.Frame) < 0) {
-		UE_LOG(LogFFMPEGEncoder_Video, Error, TEXT("Cloud not make frame writable."));
-		return false;
+	if (!RawData.Buffer.IsValid()) {
+		return;
 	}
 
-	if (VideoStream.SwsCtx == nullptr) {
-		VideoStream.SwsCtx = sws_getContext(CodecCtx->width, CodecCtx->height, AV_PIX_FMT_BGRA,
-			CodecCtx->width, CodecCtx->height, CodecCtx->pix_fmt,
-			SWS_BICUBIC, nullptr, nullptr, nullptr);
-		if (VideoStream.SwsCtx == nullptr) {
-			UE_LOG(LogFFMPEGEncoder_Video, Error, TEXT("Cloud not initialize the conversion context."));
-			return false;
-		}
+	// Slots only ever increase at capture, anything else would make the encoder reject the pts.
+	if (RawData.FrameIndex < NextConversionPts) {
+		UE_LOG(LogFFMPEGEncoder_Video, Warning, TEXT("Captured frame %lld is older than the last encoded one, skipped."), RawData.FrameIndex);
+		return;
 	}
 
-	if (CodecCtx->pix_fmt != AV_PIX_FMT_YUV420P) {
-		UE_LOG(LogFFMPEGEncoder_Video, Error, TEXT("Currently only support yuv40p data."));
-		return false;
+	FConvertedVideoFrame Converted;
+	if (!FreeVideoFrames->Dequeue(Converted.Frame)) {
+		UE_LOG(LogFFMPEGEncoder_Video, Error, TEXT("No free encoder frame, captured frame %lld dropped."), RawData.FrameIndex);
+		return;
 	}
 
-	FEncodeFramePayload RawData;
-	{
-		//FScopeLock Lock(&VideoFrameQueueCS);
-		if (VideoFrameQueue.IsEmpty()) {
-			return false;
-		}
+	if (av_frame_make_writable(Converted.Frame.Get()) < 0 || !FillVideoFrame(RawData, Converted.Frame.Get())) {
+		UE_LOG(LogFFMPEGEncoder_Video, Error, TEXT("Cloud not convert captured frame %lld."), RawData.FrameIndex);
+		FreeVideoFrames->Enqueue(MoveTemp(Converted.Frame));
+		return;
+	}
 
-		FTimespan CurrentFrameTimestamp = FTimespan::FromMilliseconds(1000.0f / PublisherConfig.Framerate * (VideoStream.NextPts + 1));
+	// The capture buffer is free again as soon as the conversion is done.
+	Converted.FrameIndex = RawData.FrameIndex;
+	Converted.Timestamp = RawData.Timestamp;
+	RawData.Buffer.SafeRelease();
+	NextConversionPts = Converted.FrameIndex + 1;
 
-		FEncodeFramePayload PeekedData;
-		while (VideoFrameQueue.Peek(PeekedData))
-		{
-			if (PeekedData.Timestamp <= CurrentFrameTimestamp) {
-				VideoFrameQueue.Dequeue(PeekedData);
-				continue;
-			}
-			else {
-				if (!FrozenFrame.Data.IsValidIndex(0) && !PeekedData.Data.IsValidIndex(0)) {
-					VideoFrameQueue.Dequeue(PeekedData);
-				}
-				break;
-			}
-		}
+	// One keyframe decision for every rung. A mux queue that dropped a GOP gets its IDR frame on all renditions, and the
+	// ladder cadence follows capture slots, the encoders' own frame counts drift apart from them when slots are skipped.
+	bool bForceKeyframe = false;
+	for (const TUniquePtr<FOutputSink>& Output : Outputs)
+	{
+		bForceKeyframe |= Output->ConsumeKeyframeRequest();
+	}
+	for (const TUniquePtr<FRenditionOutput>& Rendition : Renditions)
+	{
+		bForceKeyframe |= Rendition->ConsumeKeyframeRequest();
+	}
+	if (Renditions.Num() > 0 && Converted.FrameIndex >= NextLadderKeyframePts) {
+		bForceKeyframe = true;
+	}
+	if (bForceKeyframe) {
+		NextLadderKeyframePts = Converted.FrameIndex + LadderGOPFrames;
+	}
+	Converted.bForceKeyframe = bForceKeyframe;
 
-		if (PeekedData.Data.IsValidIndex(0)) {
-			FrozenFrame = PeekedData;
+	// Each rung is scaled from the one above it, the smaller the source the cheaper the scale.
+	TArray<FConvertedVideoFrame, TInlineAllocator<4>> Scaled;
+	const AVFrame* Source = Converted.Frame.Get();
+	for (const TUniquePtr<FRenditionOutput>& Rendition : Renditions)
+	{
+		FConvertedVideoFrame Level;
+		if (!Rendition->ScaleFrame(*Source, Level)) {
+			UE_LOG(LogFFMPEGEncoder_Video, Error, TEXT("Cloud not scale captured frame %lld for rendition %dx%d, skipped on the rungs below."),
+				Converted.FrameIndex, Rendition->GetRendition().Width, Rendition->GetRendition().Height);
+			break;
 		}
+		Level.FrameIndex = Converted.FrameIndex;
+		Level.Timestamp = Converted.Timestamp;
+		Level.bForceKeyframe = bForceKeyframe;
+		Source = Level.Frame.Get();
+		Scaled.Add(MoveTemp(Level));
+	}
 
-		RawData = FrozenFrame;
+	EncodeStage->Push(MoveTemp(Converted));
+	for (int32 Index = 0; Index < Scaled.Num(); ++Index)
+	{
+		Renditions[Index]->PushFrame(MoveTemp(Scaled[Index]));
 	}
-	VideoStream.TempFrame->data[0] = RawData.Data.GetData();
-	VideoStream.TempFrame->linesize[0] = RawData.Width * 4;
-	
-	sws_scale(VideoStream.SwsCtx, VideoStream.TempFrame->data, VideoStream.TempFrame->linesize, 0, CodecCtx->height, VideoStream.Frame->data, VideoStream.Frame->linesize);
+}
 
-	VideoStream.Frame->pts = VideoStream.NextPts++;
-	
-	if (avcodec_send_frame(CodecCtx, VideoStream.Frame) < 0) {
-		UE_LOG(LogFFMPEGEncoder_Video, Error, TEXT("Error encoding video frame."));
-		return false;
+bool FRTMPPublisher::FillVideoFrame(const FEncodeFramePayload& RawData, AVFrame* Frame)
+{
+	if (RawData.Format == ERTMPFrameFormat::I420) {
+		// Converted on the GPU already, only the planes need to be copied into the encoder frame.
+		const FYUV420Planes Planes = RTMPVideo::GetPackedPlanes(RawData.Buffer->GetData(), RawData.Format, RawData.Width, RawData.Height);
+		av_image_copy_plane(Frame->data[0], Frame->linesize[0], Planes.Y, Planes.YPitch, RawData.Width, RawData.Height);
+		av_image_copy_plane(Frame->data[1], Frame->linesize[1], Planes.U, Planes.UPitch, RawData.Width / 2, RawData.Height / 2);
+		av_image_copy_plane(Frame->data[2], Frame->linesize[2], Planes.V, Planes.VPitch, RawData.Width / 2, RawData.Height / 2);
+	}
+	else {
+		// Straight into the encoder frame with the SIMD kernels, bit identical to the GPU conversion.
+		// OnViewportRecorded only lets frames of the stream resolution through, nothing needs rescaling.
+		check(RawData.Width == VideoStream.CodecCtx->width && RawData.Height == VideoStream.CodecCtx->height);
+		FYUV420Planes Planes;
+		Planes.Y = Frame->data[0];
+		Planes.U = Frame->data[1];
+		Planes.V = Frame->data[2];
+		Planes.YPitch = Frame->linesize[0];
+		Planes.UPitch = Frame->linesize[1];
+		Planes.VPitch = Frame->linesize[2];
+		RTMPVideo::ConvertBGRAToYUV420Sliced(RawData.Buffer->GetData(), RawData.Width * 4, RawData.Width, RawData.Height, Planes,
+			RTMPVideo::GetYUVCoefficients(PublisherConfig.ColorMatrix, PublisherConfig.ColorRange), NumConversionSlices);
 	}
 
-	AVPacket Packet = { 0 };
-	av_init_packet(&Packet);
-	if (avcodec_receive_packet(CodecCtx, &Packet) < 0) {
-		UE_LOG(LogFFMPEGEncoder_Video, Error, TEXT("Cloud not find useful packet."));
-		return false;
+	return true;
+}
+
+void FRTMPPublisher::EncodeVideoFrame(FConvertedVideoFrame& Converted)
+{
+	AVCodecContext* CodecCtx = VideoStream.CodecCtx;
+	AVFrame* Frame = Converted.Frame.Get();
+
+	// Slots without a captured frame are simply left out, the previous frame stays on screen until the next pts.
+	Frame->pts = Converted.FrameIndex;
+	VideoStream.NextPts = Converted.FrameIndex + 1;
+
+	// A mux queue dropped the rest of a GOP or the ladder is due for a keyframe, see ConvertVideoFrame.
+	Frame->pict_type = Converted.bForceKeyframe ? AV_PICTURE_TYPE_I : AV_PICTURE_TYPE_NONE;
+
+	{
+		// The pacer counts slots on the media clock as well, so this stays within about a slot however far the audio device drifts.
+		const double VideoPtsError = Converted.FrameIndex * PublisherConfig.GetFrameRate().AsInterval() - Converted.Timestamp.GetTotalSeconds();
+
+		FScopeLock Lock(&SyncStatsCS);
+		SyncStats.VideoTimestampError += (VideoPtsError - SyncStats.VideoTimestampError) * RTMPPublisher::SyncStatsSmoothing;
+		SyncStats.LipSyncOffset = SyncStats.VideoTimestampError - SyncStats.AudioTimestampError;
 	}
 
-	return SendFrameInternal(&CodecCtx->time_base, VideoStream.Stream, &Packet) == 0;
+	FVideoEncoderInput& Input = VideoEncoderInputs[Frame->pts % VideoEncoderInputs.Num()];
+	Input.Pts = Frame->pts;
+	Input.Sequence = NumVideoFramesSent++;
+	Input.SendTime = FPlatformTime::Seconds();
+
+	EncodeFrame(VideoStream, Frame);
+
+	// The encoder keeps its own reference to the picture, av_frame_make_writable copies it if it's still in use.
+	FreeVideoFrames->Enqueue(MoveTemp(Converted.Frame));
 }
 
-bool FRTMPPublisher::SendAudioFrame()
+bool FRTMPPublisher::EncodeFrame(FOutputStream& Stream, AVFrame* Frame)
 {
-	int32 FrameBytes = AudioStream.TempFrame->nb_samples * AudioStream.CodecCtx->channels * 2;
+	const bool bVideo = &Stream == &VideoStream;
+
+	// Every packet is received after each frame, so the encoder never refuses input with EAGAIN.
+	int32 Result = avcodec_send_frame(Stream.CodecCtx, Frame);
+	if (Result < 0 && Result != AVERROR_EOF) {
+		if (bVideo) {
+			UE_LOG(LogFFMPEGEncoder_Video, Error, TEXT("Error sending a frame to the encoder."));
+		}
+		else {
+			UE_LOG(LogFFMPEGEncoder_Audio, Error, TEXT("Error sending a frame to the encoder."));
+		}
+		return false;
+	}
+
+	// B-frames and lookahead delay packets, one frame in can mean none or several out.
+	while (true)
 	{
-		FScopeLock Lock(&AudioSubmixBufferCS);
-		if (AudioSubmixBuffer.Num() < FrameBytes) {
+		FAVPacketPtr Packet = PacketPool->Acquire();
+		if (!Packet.IsValid()) {
+			return false;
+		}
+
+		Result = avcodec_receive_packet(Stream.CodecCtx, Packet.Get());
+		if (Result == AVERROR(EAGAIN) || Result == AVERROR_EOF) {
+			PacketPool->Release(MoveTemp(Packet));
+			return true;
+		}
+		if (Result < 0) {
+			if (bVideo) {
+				UE_LOG(LogFFMPEGEncoder_Video, Error, TEXT("Error receiving a packet from the encoder."));
+			}
+			else {
+				UE_LOG(LogFFMPEGEncoder_Audio, Error, TEXT("Error receiving a packet from the encoder."));
+			}
+			PacketPool->Release(MoveTemp(Packet));
 			return false;
 		}
 
-		FMemory::Memcpy(AudioStream.TempFrame->data[0], AudioSubmixBuffer.GetData(), FrameBytes);
+		if (bVideo) {
+			RecordVideoEncodeLatency(Packet->pts);
+		}
+		else {
+			for (const TUniquePtr<FRenditionOutput>& Rendition : Renditions)
+			{
+				Rendition->PushAudioPacket(*Packet, Stream.CodecCtx);
+			}
+		}
 
-		AudioSubmixBuffer.RemoveAt(0, FrameBytes);
+		QueuePacket(Stream, MoveTemp(Packet));
+	}
+}
+
+bool FRTMPPublisher::QueuePacket(FOutputStream& Stream, FAVPacketPtr&& Packet)
+{
+	// Classified once, every output drops by the same rules but decides on its own backlog.
+	const bool bVideo = &Stream == &VideoStream;
+	const bool bKeyframe = (Packet->flags & AV_PKT_FLAG_KEY) != 0;
+	const bool bDisposable = bVideo && !bKeyframe && ((Packet->flags & AV_PKT_FLAG_DISPOSABLE) != 0
+		|| (Stream.CodecCtx->codec_id == AV_CODEC_ID_H264 && RTMPVideo::IsNonReferenceH264AccessUnit(Packet->data, Packet->size)));
+
+	bool bQueued = false;
+	for (const TUniquePtr<FOutputSink>& Output : Outputs)
+	{
+		bQueued |= Output->PushPacket(*Packet, Stream.CodecCtx->time_base, bVideo, bKeyframe, bDisposable);
 	}
 
-	int32 DST_NB_Samples = av_rescale_rnd(swr_get_delay(AudioStream.SwrCtx, AudioStream.CodecCtx->sample_rate) + AudioStream.TempFrame->nb_samples,
-		AudioStream.CodecCtx->sample_rate, AudioStream.CodecCtx->sample_rate, AV_ROUND_UP);
+	PacketPool->Release(MoveTemp(Packet));
+	return bQueued;
+}
 
+bool FRTMPPublisher::SendAudioFrame()
+{
 	if (av_frame_make_writable(AudioStream.Frame) < 0) {
 		UE_LOG(LogFFMPEGEncoder_Audio, Error, TEXT("Cloud not make dst frame writable."));
 		return false;
 	}
 
-	if (swr_convert(AudioStream.SwrCtx, AudioStream.Frame->data, DST_NB_Samples, (const uint8**)AudioStream.TempFrame->data, AudioStream.TempFrame->nb_samples) < 0) {
-		UE_LOG(LogFFMPEGEncoder_Audio, Error, TEXT("Cloud not convert source frame to dst frame."));
+	double AudioClock = 0.0;
+	if (!AudioResampler->ReadFrame(*AudioSubmixBuffer, AudioStream.Frame, AudioClock)) {
 		return false;
 	}
 
-	AudioStream.Frame->pts = av_rescale_q(AudioStream.SamplesCount, { 1, AudioStream.CodecCtx->sample_rate }, AudioStream.CodecCtx->time_base);
-	AudioStream.SamplesCount += DST_NB_Samples;
-	//AudioStream.NextPts++;
+	// Audio pts follow the sample count, anchored on the media clock. They are re-anchored when audio
+	// got lost (ring overflow, device format change) but never step backwards.
+	const int32 SampleRate = AudioStream.CodecCtx->sample_rate;
+	const double FrameMediaTime = MediaClock.AudioToMediaTime(AudioClock);
+	double AudioPtsError = double(AudioStream.SamplesCount) / SampleRate - FrameMediaTime;
+	if (!bAudioPtsAnchored || AudioPtsError < -RTMPPublisher::MaxAudioPtsError) {
+		AudioStream.SamplesCount = FMath::Max(AudioStream.SamplesCount, int64(FMath::RoundToDouble(FrameMediaTime * SampleRate)));
+		AudioPtsError = double(AudioStream.SamplesCount) / SampleRate - FrameMediaTime;
+
+		if (bAudioPtsAnchored) {
+			FScopeLock Lock(&SyncStatsCS);
+			++SyncStats.NumAudioResyncs;
+		}
+		bAudioPtsAnchored = true;
+	}
 
-	int32 Result = avcodec_send_frame(AudioStream.CodecCtx, AudioStream.Frame);
-	if (Result < 0) {
-		UE_LOG(LogFFMPEGEncoder_Audio, Error, TEXT("Error sending a frame to the encoder."));
-		return false;
+	{
+		FScopeLock Lock(&SyncStatsCS);
+		SyncStats.AudioTimestampError += (AudioPtsError - SyncStats.AudioTimestampError) * RTMPPublisher::SyncStatsSmoothing;
+		SyncStats.LipSyncOffset = SyncStats.VideoTimestampError - SyncStats.AudioTimestampError;
 	}
 
-	AVPacket Packet;
-	FMemory::Memset(Packet, 0);
-	av_init_packet(&Packet);
+	AudioStream.Frame->pts = av_rescale_q(AudioStream.SamplesCount, { 1, AudioStream.CodecCtx->sample_rate }, AudioStream.CodecCtx->time_base);
+	AudioStream.SamplesCount += AudioStream.Frame->nb_samples;
+
+	const double EncodeStartTime = FPlatformTime::Seconds();
+	const bool bEncoded = EncodeFrame(AudioStream, AudioStream.Frame);
+	const double EncodeTime = FPlatformTime::Seconds() - EncodeStartTime;
 
-	if (avcodec_receive_packet(AudioStream.CodecCtx, &Packet) < 0) {
-		UE_LOG(LogFFMPEGEncoder_Audio, Error, TEXT("Cloud not find useful packet."));
-		return false;
+	// Measured against the last sample of the frame, the earliest it could have been encoded.
+	const double Latency = MediaClock.Now() - (FrameMediaTime + double(AudioStream.Frame->nb_samples) / SampleRate);
+	{
+		FScopeLock Lock(&AudioEncodeStatsCS);
+		++AudioEncodeStats.NumFrames;
+		TotalAudioLatency += Latency;
+		TotalAudioEncodeTime += EncodeTime;
+		AudioEncodeStats.AverageLatency = TotalAudioLatency / AudioEncodeStats.NumFrames;
+		AudioEncodeStats.MaxLatency = FMath::Max(AudioEncodeStats.MaxLatency, Latency);
+		AudioEncodeStats.AverageEncodeTime = TotalAudioEncodeTime / AudioEncodeStats.NumFrames;
+		AudioEncodeStats.MaxEncodeTime = FMath::Max(AudioEncodeStats.MaxEncodeTime, EncodeTime);
 	}
 
-	return SendFrameInternal(&AudioStream.CodecCtx->time_base, AudioStream.Stream, &Packet) == 0;
+	return bEncoded;
 }
 
-bool FRTMPPublisher::SendFrameInternal(const struct AVRational* TimeBase, struct AVStream* Stream, struct AVPacket* Packet)
+void FRTMPPublisher::OnViewportRecorded(const FViewportRecordedFrame& Frame)
 {
-	av_packet_rescale_ts(Packet, *TimeBase, Stream->time_base);
-	Packet->stream_index = Stream->index;
-
-	return av_interleaved_write_frame(OutputFormatCtx, Packet) == 0;
-}
+	const int32 TargetWidth = PublisherConfig.Width;
+	const int32 TargetHeight = PublisherConfig.Height;
+	if (Frame.Width != TargetWidth || Frame.Height != TargetHeight) {
+		UE_LOG(LogFFMPEGEncoder_Video, Warning, TEXT("Recorded frame %dx%d does not match the stream resolution, skipped."), Frame.Width, Frame.Height);
+		return;
+	}
 
-void FRTMPPublisher::OnViewportRecorded(const FColor* ColorBuffer, uint32 Width, uint32 Height)
-{
 	FEncodeFramePayload Payload;
-	Payload.Timestamp = FDateTime::Now() - StartRecordTime;
-	Payload.Data.Append((uint8*)ColorBuffer, Width * Height * 4);
-	Payload.Width = Width;
-	Payload.Height = Height;
+	Payload.Buffer = FramePool->Acquire();
+	if (!Payload.Buffer.IsValid()) {
+		UE_LOG(LogFFMPEGEncoder_Video, Verbose, TEXT("Frame pool exhausted, recorded frame dropped."));
+		return;
+	}
 
-	//FScopeLock Lock(&VideoFrameQueueCS);
-	VideoFrameQueue.Enqueue(Payload);
+	// YUV frames come as one image of 1.5x the height with one byte per sample, which copies just like BGRA rows.
+	const bool bIsBGRA = Frame.Format == ERTMPFrameFormat::BGRA;
+	const int32 RowBytes = bIsBGRA ? TargetWidth * 4 : TargetWidth;
+	const int32 NumRows = bIsBGRA ? TargetHeight : TargetHeight * 3 / 2;
+
+	// The mapped readback surface may be padded, only copy the visible part of every row.
+	uint8* Dest = Payload.Buffer->GetData();
+	if (Frame.Pitch == RowBytes) {
+		FMemory::Memcpy(Dest, Frame.Data, RowBytes * NumRows);
+	}
+	else {
+		for (int32 Row = 0; Row < NumRows; ++Row)
+		{
+			FMemory::Memcpy(Dest + Row * RowBytes, Frame.Data + Row * Frame.Pitch, RowBytes);
+		}
+	}
+
+	Payload.Format = Frame.Format;
+	Payload.Timestamp = FTimespan::FromSeconds(MediaClock.PlatformToMediaTime(Frame.CaptureTime));
+	Payload.Width = TargetWidth;
+	Payload.Height = TargetHeight;
+	Payload.FrameIndex = Frame.FrameIndex;
+
+	if (!ConvertStage->Push(MoveTemp(Payload))) {
+		UE_LOG(LogFFMPEGEncoder_Video, Verbose, TEXT("Video frame queue is full, recorded frame dropped."));
+	}
 }
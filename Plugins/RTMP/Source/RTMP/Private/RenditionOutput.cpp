@@ -0,0 +1,262 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "RenditionOutput.h"
+#include "VideoEncoderBackend.h"
+#include "RTMP.h"
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libswscale/swscale.h>
+}
+
+namespace RTMPRendition
+{
+	// Encoder frames outside of the encode queue: the one being scaled into and the one being encoded.
+	static const int32 NumEncoderFramesOutsideQueue = 2;
+}
+
+FRenditionOutput::FRenditionOutput(const FRTMPRendition& InRendition, FAVPacketPool& InPacketPool)
+	: Rendition(InRendition)
+	, PacketPool(InPacketPool)
+	, VideoCodecCtx(nullptr)
+	, ScaleCtx(nullptr)
+	, bStarted(false)
+{
+}
+
+FRenditionOutput::~FRenditionOutput()
+{
+	Close();
+}
+
+bool FRenditionOutput::Setup(const FRTMPPublisherConfig& Config, const AVCodecContext* AudioCodecCtx)
+{
+	FRTMPOutputSink OutputConfig;
+	OutputConfig.Url = Rendition.StreamUrl;
+	Output = MakeUnique<FOutputSink>(OutputConfig, PacketPool);
+	if (!Output->Init()) {
+		return false;
+	}
+
+	const FVideoEncoderBackend& Backend = RTMPVideo::GetEncoderBackend(Config.VideoEncoder);
+	if (!Backend.CanMuxInto(Output->GetOutputFormat())) {
+		UE_LOG(LogRTMP, Error, TEXT("The output of rendition %dx%d can't carry %s video."), Rendition.Width, Rendition.Height, RTMPVideo::GetEncoderBackendName(Config.VideoEncoder));
+		return false;
+	}
+
+	AVCodec* Codec = Backend.FindEncoder();
+	VideoCodecCtx = Codec != nullptr ? avcodec_alloc_context3(Codec) : nullptr;
+	if (VideoCodecCtx == nullptr) {
+		UE_LOG(LogRTMP, Error, TEXT("Cloud not alloc an encoding context for rendition %dx%d."), Rendition.Width, Rendition.Height);
+		return false;
+	}
+
+	const FVideoEncoderSettings Settings = RTMPVideo::ConfigureVideoEncoder(VideoCodecCtx, Config, Rendition.Width, Rendition.Height, Rendition.VideoBitrate, true);
+	if (Output->WantsGlobalHeader()) {
+		VideoCodecCtx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+	}
+	if (avcodec_open2(VideoCodecCtx, Codec, nullptr) < 0) {
+		UE_LOG(LogRTMP, Error, TEXT("Cloud not open video codec for rendition %dx%d."), Rendition.Width, Rendition.Height);
+		return false;
+	}
+	UE_LOG(LogRTMP, Log, TEXT("Rendition %dx%d: %s."), Rendition.Width, Rendition.Height, *RTMPVideo::DescribeEncoderSettings(Settings));
+
+	if (!Output->AddStreams(VideoCodecCtx, AudioCodecCtx, Config.MuxQueueCapacity, Config.MaxMuxBacklogSeconds, Rendition.VideoBitrate + Config.AudioBitrate)) {
+		return false;
+	}
+
+	const int32 NumEncoderFrames = Config.EncodeQueueCapacity + RTMPRendition::NumEncoderFramesOutsideQueue;
+	FreeVideoFrames = MakeUnique<TBoundedQueue<FAVFramePtr>>(NumEncoderFrames, ERTMPQueueOverflowPolicy::DropNewest);
+	for (int32 Index = 0; Index < NumEncoderFrames; ++Index)
+	{
+		FAVFramePtr Frame(av_frame_alloc());
+		if (!Frame.IsValid()) {
+			return false;
+		}
+		Frame->format = VideoCodecCtx->pix_fmt;
+		Frame->width = VideoCodecCtx->width;
+		Frame->height = VideoCodecCtx->height;
+		if (av_frame_get_buffer(Frame.Get(), 0) < 0) {
+			UE_LOG(LogRTMP, Error, TEXT("Cloud not allocate frame data for rendition %dx%d."), Rendition.Width, Rendition.Height);
+			return false;
+		}
+		FreeVideoFrames->Enqueue(MoveTemp(Frame));
+	}
+
+	const FString Name = FString::Printf(TEXT("%dx%d"), Rendition.Width, Rendition.Height);
+	EncodeStage = MakeUnique<TPipelineStage<FConvertedVideoFrame>>(TEXT("RTMP Video Encode ") + Name, Config.EncodeQueueCapacity, ERTMPQueueOverflowPolicy::BlockProducer,
+		[this](FConvertedVideoFrame& Converted) { EncodeVideoFrame(Converted); });
+
+	return true;
+}
+
+bool FRenditionOutput::Start()
+{
+	// An output that can't be opened only takes this rung down, its encode thread keeps taking frames and drops them.
+	Output->Start();
+
+	if (!EncodeStage->Start()) {
+		UE_LOG(LogRTMP, Error, TEXT("Cloud not create the encode thread of rendition %dx%d."), Rendition.Width, Rendition.Height);
+		return false;
+	}
+	bStarted = true;
+
+	return true;
+}
+
+bool FRenditionOutput::ScaleFrame(const AVFrame& Source, FConvertedVideoFrame& OutFrame)
+{
+	if (!FreeVideoFrames->Dequeue(OutFrame.Frame)) {
+		return false;
+	}
+
+	AVFrame* Frame = OutFrame.Frame.Get();
+	if (av_frame_make_writable(Frame) < 0) {
+		FreeVideoFrames->Enqueue(MoveTemp(OutFrame.Frame));
+		return false;
+	}
+
+	// YUV to YUV with the same matrix and range, sws only resamples. The rung above is at most 2x larger, bilinear keeps up.
+	if (ScaleCtx == nullptr) {
+		ScaleCtx = sws_getContext(Source.width, Source.height, AVPixelFormat(Source.format), Frame->width, Frame->height, AVPixelFormat(Frame->format),
+			SWS_BILINEAR, nullptr, nullptr, nullptr);
+		if (ScaleCtx == nullptr) {
+			UE_LOG(LogRTMP, Error, TEXT("Cloud not initialize the scaling context of rendition %dx%d."), Rendition.Width, Rendition.Height);
+			FreeVideoFrames->Enqueue(MoveTemp(OutFrame.Frame));
+			return false;
+		}
+	}
+
+	sws_scale(ScaleCtx, Source.data, Source.linesize, 0, Source.height, Frame->data, Frame->linesize);
+	return true;
+}
+
+void FRenditionOutput::PushFrame(FConvertedVideoFrame&& Frame)
+{
+	EncodeStage->Push(MoveTemp(Frame));
+}
+
+void FRenditionOutput::PushAudioPacket(const AVPacket& Packet, const AVCodecContext* AudioCodecCtx)
+{
+	if (bStarted) {
+		Output->PushPacket(Packet, AudioCodecCtx->time_base, false, false, false);
+	}
+}
+
+bool FRenditionOutput::ConsumeKeyframeRequest()
+{
+	return Output && Output->ConsumeKeyframeRequest();
+}
+
+void FRenditionOutput::EncodeVideoFrame(FConvertedVideoFrame& Converted)
+{
+	// Nothing left to encode for once the output failed.
+	if (Output->HasFailed()) {
+		FreeVideoFrames->Enqueue(MoveTemp(Converted.Frame));
+		return;
+	}
+
+	AVFrame* Frame = Converted.Frame.Get();
+	Frame->pts = Converted.FrameIndex;
+	Frame->pict_type = Converted.bForceKeyframe ? AV_PICTURE_TYPE_I : AV_PICTURE_TYPE_NONE;
+
+	EncodeFrame(Frame);
+
+	FreeVideoFrames->Enqueue(MoveTemp(Converted.Frame));
+}
+
+void FRenditionOutput::EncodeFrame(AVFrame* Frame)
+{
+	int32 Result = avcodec_send_frame(VideoCodecCtx, Frame);
+	if (Result < 0 && Result != AVERROR_EOF) {
+		UE_LOG(LogRTMP, Error, TEXT("Error sending a frame to the encoder of rendition %dx%d."), Rendition.Width, Rendition.Height);
+		return;
+	}
+
+	while (true)
+	{
+		FAVPacketPtr Packet = PacketPool.Acquire();
+		if (!Packet.IsValid()) {
+			return;
+		}
+
+		Result = avcodec_receive_packet(VideoCodecCtx, Packet.Get());
+		if (Result < 0) {
+			if (Result != AVERROR(EAGAIN) && Result != AVERROR_EOF) {
+				UE_LOG(LogRTMP, Error, TEXT("Error receiving a packet from the encoder of rendition %dx%d."), Rendition.Width, Rendition.Height);
+			}
+			PacketPool.Release(MoveTemp(Packet));
+			return;
+		}
+
+		const bool bKeyframe = (Packet->flags & AV_PKT_FLAG_KEY) != 0;
+		const bool bDisposable = !bKeyframe && ((Packet->flags & AV_PKT_FLAG_DISPOSABLE) != 0
+			|| (VideoCodecCtx->codec_id == AV_CODEC_ID_H264 && RTMPVideo::IsNonReferenceH264AccessUnit(Packet->data, Packet->size)));
+		if (bKeyframe) {
+			NumKeyframes.Increment();
+		}
+
+		Output->PushPacket(*Packet, VideoCodecCtx->time_base, true, bKeyframe, bDisposable);
+		PacketPool.Release(MoveTemp(Packet));
+	}
+}
+
+void FRenditionOutput::FinishVideo()
+{
+	if (EncodeStage) {
+		EncodeStage->Shutdown(true);
+	}
+
+	if (bStarted) {
+		EncodeFrame(nullptr);
+	}
+}
+
+void FRenditionOutput::Close()
+{
+	if (EncodeStage) {
+		EncodeStage->Shutdown(false);
+	}
+	if (Output) {
+		Output->Close();
+
+		const FRenditionStats Stats = GetStats();
+		UE_LOG(LogRTMP, Log, TEXT("Rendition %dx%d: %lld frames encoded, %lld keyframes, %lld packets written, dropped %lld non-reference frames and %lld frames in %d GOP skips%s."),
+			Rendition.Width, Rendition.Height, Stats.Encode.NumProcessed, Stats.NumKeyframes, Stats.Output.Mux.NumProcessed,
+			Stats.Output.MuxQueue.NumDroppedDisposable, Stats.Output.MuxQueue.NumDroppedGOPFrames, Stats.Output.MuxQueue.NumGOPSkips,
+			Stats.Output.bFailed ? TEXT(", output failed") : TEXT(""));
+	}
+
+	EncodeStage.Reset();
+	Output.Reset();
+	FreeVideoFrames.Reset();
+
+	if (VideoCodecCtx != nullptr) {
+		avcodec_free_context(&VideoCodecCtx);
+	}
+	if (ScaleCtx != nullptr) {
+		sws_freeContext(ScaleCtx);
+		ScaleCtx = nullptr;
+	}
+
+	bStarted = false;
+}
+
+FRenditionStats FRenditionOutput::GetStats() const
+{
+	FRenditionStats Stats;
+	if (EncodeStage) {
+		Stats.Encode = EncodeStage->GetStats();
+	}
+	if (Output) {
+		Stats.Output = Output->GetStats();
+	}
+	Stats.NumKeyframes = NumKeyframes.GetValue();
+	return Stats;
+}
+
+const FRTMPRendition& FRenditionOutput::GetRendition() const
+{
+	return Rendition;
+}
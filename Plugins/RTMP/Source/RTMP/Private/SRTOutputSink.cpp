@@ -0,0 +1,244 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "SRTOutputSink.h"
+
+#if WITH_LIBSRT
+
+#include "RTMP.h"
+#include "GenericPlatform/GenericPlatformHttp.h"
+#include "Misc/ScopeExit.h"
+#include "Misc/ScopeLock.h"
+
+#if PLATFORM_WINDOWS
+#include "Windows/AllowWindowsPlatformTypes.h"
+#endif
+#include <srt/srt.h>
+#if PLATFORM_WINDOWS
+#include "Windows/HideWindowsPlatformTypes.h"
+#endif
+
+extern "C" {
+#include <libavformat/avformat.h>
+#include <libavutil/error.h>
+#include <libavutil/mem.h>
+}
+
+namespace RTMPSRTOutput
+{
+	/** Seven TS packets per message, the payload SRT's live mode is tuned for */
+	static const int32 PayloadSize = 7 * 188;
+
+	/** SRT itself doesn't go below this, it has to fit a few round trips on a LAN */
+	static const int32 MinLatencyMs = 20;
+
+	/** srt://host:port?streamid=...&passphrase=..., the host may be a bracketed IPv6 address */
+	static bool ParseUrl(const FString& Url, FString& OutHost, FString& OutPort, TMap<FString, FString>& OutOptions)
+	{
+		FString Address = Url.RightChop(6);
+		FString Query;
+		int32 QueryStart = INDEX_NONE;
+		if (Address.FindChar(TEXT('?'), QueryStart)) {
+			Query = Address.RightChop(QueryStart + 1);
+			Address.LeftInline(QueryStart);
+		}
+		if (!Address.Split(TEXT(":"), &OutHost, &OutPort, ESearchCase::CaseSensitive, ESearchDir::FromEnd) || OutHost.IsEmpty() || OutPort.IsEmpty()) {
+			return false;
+		}
+		if (OutHost.StartsWith(TEXT("[")) && OutHost.EndsWith(TEXT("]"))) {
+			OutHost = OutHost.Mid(1, OutHost.Len() - 2);
+		}
+
+		TArray<FString> Pairs;
+		Query.ParseIntoArray(Pairs, TEXT("&"));
+		for (const FString& Pair : Pairs)
+		{
+			FString Key;
+			FString Value;
+			if (Pair.Split(TEXT("="), &Key, &Value)) {
+				OutOptions.Add(Key, FGenericPlatformHttp::UrlDecode(Value));
+			}
+		}
+		return true;
+	}
+}
+
+FSRTOutputSink::FSRTOutputSink(const FRTMPOutputSink& InConfig, FAVPacketPool& InPacketPool)
+	: FOutputSink(InConfig, InPacketPool)
+	, Socket(SRT_INVALID_SOCK)
+	, bStartedUp(false)
+	, MuxedIO(nullptr)
+{
+}
+
+FSRTOutputSink::~FSRTOutputSink()
+{
+	// The base destructor would close the custom IO context as a file.
+	Close();
+}
+
+bool FSRTOutputSink::OpenOutput()
+{
+	FString Host;
+	FString Port;
+	TMap<FString, FString> Options;
+	if (!RTMPSRTOutput::ParseUrl(Config.Url, Host, Port, Options)) {
+		Fail(TEXT("Cloud not parse the address of"), AVERROR(EINVAL));
+		return false;
+	}
+
+	if (srt_startup() < 0) {
+		FailSRT(TEXT("Cloud not start libsrt for"));
+		return false;
+	}
+	bStartedUp = true;
+
+	addrinfo Hints = {};
+	Hints.ai_family = AF_UNSPEC;
+	Hints.ai_socktype = SOCK_DGRAM;
+	addrinfo* Addresses = nullptr;
+	if (getaddrinfo(TCHAR_TO_ANSI(*Host), TCHAR_TO_ANSI(*Port), &Hints, &Addresses) != 0 || Addresses == nullptr) {
+		Fail(TEXT("Cloud not resolve the host of"), AVERROR(EINVAL));
+		return false;
+	}
+	ON_SCOPE_EXIT
+	{
+		freeaddrinfo(Addresses);
+	};
+
+	{
+		FScopeLock Lock(&SocketCS);
+		Socket = srt_create_socket();
+	}
+	if (Socket == SRT_INVALID_SOCK) {
+		FailSRT(TEXT("Cloud not create the socket of"));
+		return false;
+	}
+
+	// Live mode first, it resets the other options to its defaults. Writes block while the send buffer is full, a
+	// stalled connection fails them after the timeout like rw_timeout does for the other outputs.
+	const SRT_TRANSTYPE TransType = SRTT_LIVE;
+	const int32 LatencyMs = FMath::Max(int32(Config.LatencySeconds * 1000.0f), RTMPSRTOutput::MinLatencyMs);
+	const int32 PayloadSize = RTMPSRTOutput::PayloadSize;
+	const bool bBlockingSend = true;
+	const int32 TimeoutMs = Config.TimeoutSeconds > 0.0f ? int32(Config.TimeoutSeconds * 1000.0f) : -1;
+	bool bOptionsSet = srt_setsockflag(Socket, SRTO_TRANSTYPE, &TransType, sizeof(TransType)) != SRT_ERROR
+		&& srt_setsockflag(Socket, SRTO_LATENCY, &LatencyMs, sizeof(LatencyMs)) != SRT_ERROR
+		&& srt_setsockflag(Socket, SRTO_PAYLOADSIZE, &PayloadSize, sizeof(PayloadSize)) != SRT_ERROR
+		&& srt_setsockflag(Socket, SRTO_SNDSYN, &bBlockingSend, sizeof(bBlockingSend)) != SRT_ERROR
+		&& srt_setsockflag(Socket, SRTO_SNDTIMEO, &TimeoutMs, sizeof(TimeoutMs)) != SRT_ERROR;
+	if (bOptionsSet && TimeoutMs > 0) {
+		bOptionsSet = srt_setsockflag(Socket, SRTO_CONNTIMEO, &TimeoutMs, sizeof(TimeoutMs)) != SRT_ERROR;
+	}
+	for (const TPair<FString, SRT_SOCKOPT>& StringOption : { TPair<FString, SRT_SOCKOPT>(TEXT("streamid"), SRTO_STREAMID), TPair<FString, SRT_SOCKOPT>(TEXT("passphrase"), SRTO_PASSPHRASE) })
+	{
+		if (const FString* Value = Options.Find(StringOption.Key)) {
+			const FTCHARToUTF8 Utf8Value(**Value);
+			bOptionsSet = bOptionsSet && srt_setsockflag(Socket, StringOption.Value, Utf8Value.Get(), Utf8Value.Length()) != SRT_ERROR;
+		}
+	}
+	if (!bOptionsSet) {
+		FailSRT(TEXT("Cloud not set the socket options of"));
+		return false;
+	}
+
+	if (srt_connect(Socket, Addresses->ai_addr, int(Addresses->ai_addrlen)) == SRT_ERROR) {
+		FailSRT(TEXT("Cloud not connect to"));
+		return false;
+	}
+
+	// Filled to exactly one message before it is written out, the muxer's writes go out as whole datagrams.
+	uint8* Buffer = static_cast<uint8*>(av_malloc(RTMPSRTOutput::PayloadSize));
+	MuxedIO = Buffer != nullptr ? avio_alloc_context(Buffer, RTMPSRTOutput::PayloadSize, 1, this, nullptr, &FSRTOutputSink::WriteToSocket, nullptr) : nullptr;
+	if (MuxedIO == nullptr) {
+		av_free(Buffer);
+		Fail(TEXT("Cloud not allocate the IO context of"), AVERROR(ENOMEM));
+		return false;
+	}
+	MuxedIO->max_packet_size = RTMPSRTOutput::PayloadSize;
+
+	FormatCtx->pb = MuxedIO;
+	FormatCtx->flags |= AVFMT_FLAG_CUSTOM_IO;
+
+	UE_LOG(LogRTMP, Log, TEXT("SRT output '%s' connected, latency %dms."), *Config.Url, LatencyMs);
+	return true;
+}
+
+void FSRTOutputSink::CloseOutput(bool bClean)
+{
+	if (bClean) {
+		av_write_trailer(FormatCtx);
+	}
+	if (MuxedIO != nullptr) {
+		av_freep(&MuxedIO->buffer);
+		avio_context_free(&MuxedIO);
+		FormatCtx->pb = nullptr;
+	}
+
+	{
+		FScopeLock Lock(&SocketCS);
+		if (Socket != SRT_INVALID_SOCK) {
+			ReadSocketStats(ClosedStats);
+			srt_close(Socket);
+			Socket = SRT_INVALID_SOCK;
+		}
+	}
+
+	if (bStartedUp) {
+		srt_cleanup();
+		bStartedUp = false;
+	}
+}
+
+void FSRTOutputSink::GetTransportStats(FTransportStats& OutStats) const
+{
+	FScopeLock Lock(&SocketCS);
+	if (Socket != SRT_INVALID_SOCK) {
+		ReadSocketStats(OutStats);
+	}
+	else if (ClosedStats.bConnectionStats) {
+		const int64 BytesSent = OutStats.BytesSent;
+		OutStats = ClosedStats;
+		OutStats.BytesSent = BytesSent;
+	}
+}
+
+void FSRTOutputSink::ReadSocketStats(FTransportStats& OutStats) const
+{
+	SRT_TRACEBSTATS Perf;
+	if (srt_bstats(Socket, &Perf, 0) == SRT_ERROR) {
+		return;
+	}
+
+	OutStats.bConnectionStats = true;
+	OutStats.RoundTripTime = Perf.msRTT / 1000.0;
+	OutStats.NumRetransmitted = Perf.pktRetransTotal;
+	OutStats.NumLost = Perf.pktSndLossTotal;
+	OutStats.NumDropped = Perf.pktSndDropTotal;
+	OutStats.SendBufferBytes = Perf.byteSndBuf;
+	OutStats.SendBufferSeconds = Perf.msSndBuf / 1000.0;
+	OutStats.SendRateMbps = Perf.mbpsSendRate;
+}
+
+int FSRTOutputSink::WriteToSocket(void* Opaque, uint8* Data, int Size)
+{
+	FSRTOutputSink* Sink = static_cast<FSRTOutputSink*>(Opaque);
+	for (int Offset = 0; Offset < Size; Offset += RTMPSRTOutput::PayloadSize)
+	{
+		const int MessageSize = FMath::Min(Size - Offset, int(RTMPSRTOutput::PayloadSize));
+		if (srt_sendmsg2(Sink->Socket, reinterpret_cast<const char*>(Data + Offset), MessageSize, nullptr) == SRT_ERROR) {
+			// The muxer fails the output with its own error, this is the reason.
+			UE_LOG(LogRTMP, Warning, TEXT("SRT output '%s' could not send (%s)."), *Sink->Config.Url, UTF8_TO_TCHAR(srt_getlasterror_str()));
+			return AVERROR(EIO);
+		}
+	}
+	return Size;
+}
+
+void FSRTOutputSink::FailSRT(const TCHAR* What)
+{
+	UE_LOG(LogRTMP, Error, TEXT("%s '%s' (%s), dropping its packets from now on, the other outputs carry on."), What, *Config.Url, UTF8_TO_TCHAR(srt_getlasterror_str()));
+	bFailed = true;
+}
+
+#endif
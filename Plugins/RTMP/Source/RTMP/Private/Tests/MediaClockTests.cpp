@@ -0,0 +1,51 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "Misc/AutomationTest.h"
+#include "MediaClock.h"
+#include "FramePacer.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FRTMPVideoFollowsAudioClockTest, "RTMP.MediaClock.VideoFollowsAudioClock", EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+/**
+ * Three hours of 60 Hz presents captured at 30 fps while the audio device runs 100ppm fast. Without the pacer on the
+ * media clock the video pts would end up over a second behind the audio pts.
+ */
+bool FRTMPVideoFollowsAudioClockTest::RunTest(const FString& Parameters)
+{
+	const FFrameRate CaptureRate(30, 1);
+	const double PresentInterval = 1.0 / 60.0;
+	const double AudioRate = 1.0 + 100.0 / 1000000.0;
+	const int64 NumPresents = 3 * 60 * 60 * 60;
+
+	FMediaClock MediaClock;
+	MediaClock.Start();
+	FFramePacer FramePacer;
+	FramePacer.Start(CaptureRate, 0.0);
+
+	const double StartPlatformSeconds = FPlatformTime::Seconds();
+	const double StartAudioClock = 1000.0;
+	double MaxError = 0.0;
+	for (int64 Present = 0; Present < NumPresents; ++Present)
+	{
+		const double PlatformSeconds = StartPlatformSeconds + Present * PresentInterval;
+		const double AudioClock = StartAudioClock + Present * PresentInterval * AudioRate;
+		MediaClock.AddAudioAnchor(AudioClock, PlatformSeconds);
+
+		const int64 Slot = FramePacer.Tick(MediaClock.PlatformToMediaTime(PlatformSeconds));
+		if (Slot != INDEX_NONE) {
+			// Video pts against the audio pts of the samples played at the same moment.
+			MaxError = FMath::Max(MaxError, FMath::Abs(Slot * CaptureRate.AsInterval() - MediaClock.AudioToMediaTime(AudioClock)));
+		}
+	}
+
+	const FFramePacerStats Stats = FramePacer.GetStats();
+	TestTrue(TEXT("Video pts stay within a slot of the audio pts"), MaxError <= CaptureRate.AsInterval());
+	TestTrue(TEXT("Every slot is captured"), Stats.NumCaptured > 0 && Stats.NumDuplicated == 0);
+	TestTrue(TEXT("The drift is measured"), FMath::IsNearlyEqual(MediaClock.GetStats().DriftPPM, 100.0, 1.0));
+	return true;
+}
+
+#endif
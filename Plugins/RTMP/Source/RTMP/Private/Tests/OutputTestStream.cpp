@@ -0,0 +1,173 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "OutputTestStream.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+#include "RTMP.h"
+#include "VideoEncoderBackend.h"
+#include "HAL/PlatformProcess.h"
+#include "HAL/PlatformTime.h"
+#include "Misc/ScopeExit.h"
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavutil/channel_layout.h>
+}
+
+namespace RTMPOutputTests
+{
+	int64 StreamTestOutput(const FRTMPOutputSink& OutputConfig, double Seconds, bool bRealTime, bool bKill, int32& OutGOPFrames, FOutputSinkStats& OutStats)
+	{
+		FRTMPPublisherConfig Config;
+		Config.Width = TestWidth;
+		Config.Height = TestHeight;
+		Config.Framerate = TestFramerate;
+		Config.VideoBitrate = TestVideoBitrate;
+		Config.ChannelCount = 2;
+		Config.SampleRate = TestSampleRate;
+		Config.AudioBitrate = TestAudioBitrate;
+
+		AVCodec* VideoCodec = RTMPVideo::GetEncoderBackend(Config.VideoEncoder).FindEncoder();
+		AVCodec* AudioCodec = avcodec_find_encoder(AV_CODEC_ID_AAC);
+		if (VideoCodec == nullptr || AudioCodec == nullptr) {
+			UE_LOG(LogRTMP, Error, TEXT("Output test needs the %s and AAC encoders."), RTMPVideo::GetEncoderBackendName(Config.VideoEncoder));
+			return -1;
+		}
+
+		FAVPacketPool PacketPool(64);
+		const TUniquePtr<FOutputSink> Output = FOutputSink::Create(OutputConfig, PacketPool);
+
+		AVCodecContext* VideoCodecCtx = avcodec_alloc_context3(VideoCodec);
+		AVCodecContext* AudioCodecCtx = avcodec_alloc_context3(AudioCodec);
+		AVFrame* VideoFrame = av_frame_alloc();
+		AVFrame* AudioFrame = av_frame_alloc();
+		AVPacket* Packet = av_packet_alloc();
+		ON_SCOPE_EXIT
+		{
+			av_packet_free(&Packet);
+			av_frame_free(&AudioFrame);
+			av_frame_free(&VideoFrame);
+			avcodec_free_context(&AudioCodecCtx);
+			avcodec_free_context(&VideoCodecCtx);
+		};
+
+		if (!Output->Init()) {
+			return -1;
+		}
+
+		RTMPVideo::ConfigureVideoEncoder(VideoCodecCtx, Config, TestWidth, TestHeight, TestVideoBitrate, false);
+		AudioCodecCtx->sample_fmt = AV_SAMPLE_FMT_FLTP;
+		AudioCodecCtx->bit_rate = TestAudioBitrate;
+		AudioCodecCtx->sample_rate = TestSampleRate;
+		AudioCodecCtx->channel_layout = AV_CH_LAYOUT_STEREO;
+		AudioCodecCtx->channels = 2;
+		if (Output->WantsGlobalHeader()) {
+			VideoCodecCtx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+			AudioCodecCtx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+		}
+		if (avcodec_open2(VideoCodecCtx, VideoCodec, nullptr) < 0 || avcodec_open2(AudioCodecCtx, AudioCodec, nullptr) < 0) {
+			UE_LOG(LogRTMP, Error, TEXT("Output test could not open the encoders."));
+			return -1;
+		}
+		OutGOPFrames = VideoCodecCtx->gop_size;
+
+		VideoFrame->format = VideoCodecCtx->pix_fmt;
+		VideoFrame->width = TestWidth;
+		VideoFrame->height = TestHeight;
+		AudioFrame->format = AudioCodecCtx->sample_fmt;
+		AudioFrame->nb_samples = AudioCodecCtx->frame_size;
+		AudioFrame->channel_layout = AudioCodecCtx->channel_layout;
+		AudioFrame->sample_rate = TestSampleRate;
+		if (av_frame_get_buffer(VideoFrame, 0) < 0 || av_frame_get_buffer(AudioFrame, 0) < 0) {
+			return -1;
+		}
+
+		if (!Output->AddStreams(VideoCodecCtx, AudioCodecCtx, 1024, OutputConfig.MaxBacklogSeconds, TestVideoBitrate + TestAudioBitrate) || !Output->Start()) {
+			return -1;
+		}
+
+		int64 NumPushed = 0;
+		int64 NumVideoPushed = 0;
+		auto PushPackets = [&](AVCodecContext* CodecCtx, bool bVideo)
+		{
+			while (avcodec_receive_packet(CodecCtx, Packet) == 0)
+			{
+				if (Output->PushPacket(*Packet, CodecCtx->time_base, bVideo, (Packet->flags & AV_PKT_FLAG_KEY) != 0, false)) {
+					++NumPushed;
+					NumVideoPushed += bVideo ? 1 : 0;
+				}
+				av_packet_unref(Packet);
+			}
+		};
+
+		// Audio up to each video frame's time first so the muxer gets both in timestamp order.
+		const int64 NumFrames = int64(Seconds * TestFramerate);
+		const double StartTime = FPlatformTime::Seconds();
+		int64 NumSamples = 0;
+		for (int64 FrameNumber = 0; FrameNumber < NumFrames; ++FrameNumber)
+		{
+			const double Ahead = double(FrameNumber) / TestFramerate - (FPlatformTime::Seconds() - StartTime);
+			if (bRealTime && Ahead > 0.0) {
+				FPlatformProcess::Sleep(float(Ahead));
+			}
+
+			while (NumSamples * TestFramerate < (FrameNumber + 1) * TestSampleRate)
+			{
+				av_frame_make_writable(AudioFrame);
+				for (int32 Channel = 0; Channel < AudioCodecCtx->channels; ++Channel)
+				{
+					FMemory::Memzero(AudioFrame->data[Channel], AudioFrame->nb_samples * sizeof(float));
+				}
+				AudioFrame->pts = NumSamples;
+				NumSamples += AudioFrame->nb_samples;
+				avcodec_send_frame(AudioCodecCtx, AudioFrame);
+				PushPackets(AudioCodecCtx, false);
+			}
+
+			// A gradient scrolling diagonally, every frame differs from the one before.
+			av_frame_make_writable(VideoFrame);
+			for (int32 Y = 0; Y < TestHeight; ++Y)
+			{
+				uint8* Row = VideoFrame->data[0] + Y * VideoFrame->linesize[0];
+				for (int32 X = 0; X < TestWidth; ++X)
+				{
+					Row[X] = uint8(X + Y + FrameNumber * 4);
+				}
+			}
+			for (int32 Plane = 1; Plane < 3; ++Plane)
+			{
+				for (int32 Y = 0; Y < TestHeight / 2; ++Y)
+				{
+					FMemory::Memset(VideoFrame->data[Plane] + Y * VideoFrame->linesize[Plane], 128, TestWidth / 2);
+				}
+			}
+			VideoFrame->pts = FrameNumber;
+			avcodec_send_frame(VideoCodecCtx, VideoFrame);
+			PushPackets(VideoCodecCtx, true);
+		}
+
+		if (bKill) {
+			// Once the writer caught up, all the recording can lack is what the container itself hadn't written out yet.
+			const double WaitStartTime = FPlatformTime::Seconds();
+			while (Output->GetStats().Mux.NumProcessed < NumPushed && FPlatformTime::Seconds() - WaitStartTime < 10.0)
+			{
+				FPlatformProcess::Sleep(0.01f);
+			}
+			Output->Abort();
+		}
+		else {
+			avcodec_send_frame(VideoCodecCtx, nullptr);
+			PushPackets(VideoCodecCtx, true);
+			avcodec_send_frame(AudioCodecCtx, nullptr);
+			PushPackets(AudioCodecCtx, false);
+			Output->Close();
+		}
+
+		OutStats = Output->GetStats();
+		return NumVideoPushed;
+	}
+}
+
+#endif
@@ -0,0 +1,28 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "OutputSink.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+namespace RTMPOutputTests
+{
+	/** Synthetic stream the output tests write: 640x360 at 30 fps with the LowLatency profile's GOP, silent stereo AAC */
+	static const int32 TestWidth = 640;
+	static const int32 TestHeight = 360;
+	static const int32 TestFramerate = 30;
+	static const int32 TestVideoBitrate = 1000000;
+	static const int32 TestSampleRate = 48000;
+	static const int32 TestAudioBitrate = 128000;
+
+	/**
+	 * Streams Seconds of the synthetic stream through the output, as fast as it encodes or in real time, then closes the
+	 * output or aborts it like a crash right after the writer caught up. Returns the video packets handed to the writer,
+	 * -1 if the output couldn't be set up. OutStats are the output's once closed.
+	 */
+	int64 StreamTestOutput(const FRTMPOutputSink& OutputConfig, double Seconds, bool bRealTime, bool bKill, int32& OutGOPFrames, FOutputSinkStats& OutStats);
+}
+
+#endif
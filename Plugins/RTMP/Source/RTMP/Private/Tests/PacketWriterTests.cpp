@@ -0,0 +1,304 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "PacketWriter.h"
+#include "Misc/AutomationTest.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+#include "Async/Async.h"
+#include "HAL/PlatformProcess.h"
+#include "HAL/PlatformTime.h"
+#include "HAL/ThreadSafeBool.h"
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avio.h>
+}
+
+namespace RTMPPacketWriterTests
+{
+	/** Synthetic stream for the throttled sink test: 30 fps, IDR every 30 frames, every other frame non-reference, 48 kHz AAC sized audio */
+	static const double TestFrameRate = 30.0;
+	static const int32 TestGOPSize = 30;
+	static const int32 TestKeyframeSize = 60000;
+	static const int32 TestReferenceFrameSize = 12000;
+	static const int32 TestDisposableFrameSize = 6000;
+	static const double TestAudioPacketRate = 48000.0 / 1024.0;
+	static const int32 TestAudioPacketSize = 400;
+
+	/** Pushes taking longer than this would hold the encoder back */
+	static const double MaxTestPushSeconds = 0.002;
+
+	/**
+	 * Packet payload of the test stream: frame number and the reference frame it depends on,
+	 * so the sink side can tell whether everything written would decode.
+	 */
+	struct FTestPacketHeader
+	{
+		int64 FrameNumber;
+		int64 ReferenceFrame;
+	};
+
+	static FAVPacketPtr MakeTestPacket(int32 Size, const FTestPacketHeader& Header)
+	{
+		FAVPacketPtr Packet(av_packet_alloc());
+		if (!Packet.IsValid() || av_new_packet(Packet.Get(), Size) < 0) {
+			return FAVPacketPtr();
+		}
+		FMemory::Memzero(Packet->data, Size);
+		FMemory::Memcpy(Packet->data, &Header, sizeof(Header));
+		return Packet;
+	}
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FRTMPThrottledSinkTest, "RTMP.PacketWriter.ThrottledSink", EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+/**
+ * Streams a synthetic real time stream through a FPacketWriter into a local TCP sink that reads at a throttled rate,
+ * checking that pushing never stalls the producer and that the written video always decodes.
+ */
+bool FRTMPThrottledSinkTest::RunTest(const FString& Parameters)
+{
+	using namespace RTMPPacketWriterTests;
+
+	const int32 UplinkKbps = 2000;
+	const double Duration = 10.0;
+	const int32 Port = 19350;
+	const double MaxBacklogSeconds = 1.0;
+
+	const int64 StreamBitsPerSecond = int64(((TestKeyframeSize + (TestGOPSize / 2) * TestDisposableFrameSize + (TestGOPSize / 2 - 1) * TestReferenceFrameSize) * TestFrameRate / TestGOPSize
+		+ TestAudioPacketSize * TestAudioPacketRate) * 8.0);
+
+	AddInfo(FString::Printf(TEXT("%.1fs of a %lld kbps stream into a %d kbps sink on port %d."), Duration, StreamBitsPerSecond / 1000, UplinkKbps, Port));
+
+	const FString SinkUrl = FString::Printf(TEXT("tcp://127.0.0.1:%d?listen=1&listen_timeout=5000&recv_buffer_size=16384"), Port);
+	const FString WriterUrl = FString::Printf(TEXT("tcp://127.0.0.1:%d?send_buffer_size=16384"), Port);
+
+	FThreadSafeBool bSinkListening = false;
+	TFuture<int64> SinkResult = Async(EAsyncExecution::Thread, [SinkUrl, UplinkKbps, &bSinkListening]() -> int64
+	{
+		AVIOContext* Sink = nullptr;
+		bSinkListening = true;
+		if (avio_open2(&Sink, TCHAR_TO_ANSI(*SinkUrl), AVIO_FLAG_READ, nullptr, nullptr) < 0) {
+			return -1;
+		}
+
+		// Reads at the uplink rate until the writer disconnects.
+		const double BytesPerSecond = UplinkKbps * 1000.0 / 8.0;
+		const double StartTime = FPlatformTime::Seconds();
+		int64 BytesRead = 0;
+		uint8 Buffer[4096];
+		while (true)
+		{
+			const int32 Read = avio_read(Sink, Buffer, sizeof(Buffer));
+			if (Read <= 0) {
+				break;
+			}
+			BytesRead += Read;
+
+			const double Ahead = BytesRead / BytesPerSecond - (FPlatformTime::Seconds() - StartTime);
+			if (Ahead > 0.0) {
+				FPlatformProcess::Sleep((float)Ahead);
+			}
+		}
+
+		avio_closep(&Sink);
+		return BytesRead;
+	});
+
+	while (!bSinkListening)
+	{
+		FPlatformProcess::Sleep(0.001f);
+	}
+
+	AVIOContext* Output = nullptr;
+	for (int32 Attempt = 0; Attempt < 50 && Output == nullptr; ++Attempt)
+	{
+		if (avio_open2(&Output, TCHAR_TO_ANSI(*WriterUrl), AVIO_FLAG_WRITE, nullptr, nullptr) < 0) {
+			Output = nullptr;
+			FPlatformProcess::Sleep(0.02f);
+		}
+	}
+	if (Output == nullptr) {
+		AddError(FString::Printf(TEXT("Could not connect to the sink on port %d."), Port));
+		SinkResult.Wait();
+		return false;
+	}
+
+	// Written on the writer thread only.
+	int64 LastWrittenReference = -1;
+	int64 NumUndecodable = 0;
+	int64 NumVideoWritten = 0;
+
+	const int64 MaxBacklogBytes = int64(MaxBacklogSeconds * StreamBitsPerSecond / 8);
+	FPacketWriter Writer(TEXT("RTMP Test Writer"), 256, MaxBacklogBytes, [&](FEncodedPacket& Packet)
+	{
+		if (Packet.bVideo) {
+			FTestPacketHeader Header;
+			FMemory::Memcpy(&Header, Packet.Packet->data, sizeof(Header));
+			if (!Packet.bKeyframe && Header.ReferenceFrame != LastWrittenReference) {
+				++NumUndecodable;
+			}
+			if (!Packet.bDisposable) {
+				LastWrittenReference = Header.FrameNumber;
+			}
+			++NumVideoWritten;
+		}
+
+		avio_write(Output, Packet.Packet->data, Packet.Packet->size);
+		avio_flush(Output);
+	});
+	Writer.Start();
+
+	double MaxPushTime = 0.0;
+	int64 NumFrames = 0;
+	int64 NumAudioPackets = 0;
+	int64 LastReference = -1;
+	const double StartTime = FPlatformTime::Seconds();
+	while (true)
+	{
+		const double MediaTime = FMath::Min(NumFrames / TestFrameRate, NumAudioPackets / TestAudioPacketRate);
+		if (MediaTime >= Duration) {
+			break;
+		}
+
+		const double Wait = MediaTime - (FPlatformTime::Seconds() - StartTime);
+		if (Wait > 0.0) {
+			FPlatformProcess::Sleep((float)Wait);
+		}
+
+		FEncodedPacket Packet;
+		if (NumFrames / TestFrameRate <= NumAudioPackets / TestAudioPacketRate) {
+			const int32 GOPIndex = NumFrames % TestGOPSize;
+			Packet.bVideo = true;
+			Packet.bKeyframe = GOPIndex == 0;
+			Packet.bDisposable = !Packet.bKeyframe && (GOPIndex % 2) == 1;
+
+			const int32 Size = Packet.bKeyframe ? TestKeyframeSize : (Packet.bDisposable ? TestDisposableFrameSize : TestReferenceFrameSize);
+			Packet.Packet = MakeTestPacket(Size, FTestPacketHeader{ NumFrames, Packet.bKeyframe ? -1 : LastReference });
+			if (!Packet.bDisposable) {
+				LastReference = NumFrames;
+			}
+			++NumFrames;
+		}
+		else {
+			Packet.Packet = MakeTestPacket(TestAudioPacketSize, FTestPacketHeader{ -1, -1 });
+			++NumAudioPackets;
+		}
+
+		const double PushStartTime = FPlatformTime::Seconds();
+		Writer.Push(MoveTemp(Packet));
+		MaxPushTime = FMath::Max(MaxPushTime, FPlatformTime::Seconds() - PushStartTime);
+	}
+	const double ProduceTime = FPlatformTime::Seconds() - StartTime;
+
+	Writer.Shutdown(false);
+	avio_closep(&Output);
+	const int64 BytesRead = SinkResult.Get();
+
+	const FPipelineStageStats Stats = Writer.GetStats();
+	const FPacketQueueStats QueueStats = Writer.GetQueueStats();
+	AddInfo(FString::Printf(TEXT("Produced %lld frames and %lld audio packets in %.2fs (%.2fs of media), longest push %.3fms."),
+		NumFrames, NumAudioPackets, ProduceTime, Duration, MaxPushTime * 1000.0));
+	AddInfo(FString::Printf(TEXT("Wrote %lld packets (%lld video), sink read %lld bytes, longest write %.1fms, longest queue wait %.1fms."),
+		Stats.NumProcessed, NumVideoWritten, BytesRead, Stats.MaxProcessTime * 1000.0, Stats.MaxQueueTime * 1000.0));
+	AddInfo(FString::Printf(TEXT("Dropped %lld non-reference frames, %lld frames in %d GOP skips, %lld audio packets, queue high-water mark %d packets / %lld bytes."),
+		QueueStats.NumDroppedDisposable, QueueStats.NumDroppedGOPFrames, QueueStats.NumGOPSkips, QueueStats.NumDroppedAudio, QueueStats.HighWaterMark, QueueStats.MaxQueuedBytes));
+
+	TestTrue(TEXT("The sink was reached"), BytesRead > 0);
+	TestTrue(TEXT("The sink is slower than the stream, so the queue had to drop"), QueueStats.NumDroppedDisposable + QueueStats.NumDroppedGOPFrames > 0);
+	TestTrue(TEXT("Pushing never stalls the producer"), MaxPushTime < MaxTestPushSeconds);
+	TestTrue(TEXT("The producer kept real time"), ProduceTime < Duration + 0.5);
+	TestEqual(TEXT("Written frames with a missing reference"), NumUndecodable, int64(0));
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FRTMPOversizedKeyframeTest, "RTMP.PacketWriter.OversizedKeyframe", EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+/**
+ * Feeds a queue whose byte limit is half an IDR frame while the writer takes one packet every other frame, forcing an
+ * IDR frame whenever the queue asks for one like the video encoder does. Video has to keep coming out and decode.
+ */
+bool FRTMPOversizedKeyframeTest::RunTest(const FString& Parameters)
+{
+	using namespace RTMPPacketWriterTests;
+
+	const int64 NumFrames = 10 * TestGOPSize;
+	const int64 MaxBacklogBytes = TestKeyframeSize / 2;
+	FPacketQueue Queue(256, MaxBacklogBytes);
+
+	int64 LastWrittenReference = -1;
+	int64 NumUndecodable = 0;
+	int64 NumVideoWritten = 0;
+	int64 NumKeyframesWritten = 0;
+	int64 NumWrittenAfterSkip = 0;
+	auto WriteOne = [&]()
+	{
+		FEncodedPacket Packet;
+		double EnqueueTime = 0.0;
+		if (!Queue.Dequeue(Packet, EnqueueTime) || !Packet.bVideo) {
+			return;
+		}
+
+		FTestPacketHeader Header;
+		FMemory::Memcpy(&Header, Packet.Packet->data, sizeof(Header));
+		if (!Packet.bKeyframe && Header.ReferenceFrame != LastWrittenReference) {
+			++NumUndecodable;
+		}
+		if (!Packet.bDisposable) {
+			LastWrittenReference = Header.FrameNumber;
+		}
+		++NumVideoWritten;
+		NumKeyframesWritten += Packet.bKeyframe ? 1 : 0;
+		NumWrittenAfterSkip += Queue.GetStats().NumGOPSkips > 0 ? 1 : 0;
+	};
+
+	int64 LastReference = -1;
+	int32 GOPIndex = 0;
+	bool bForceKeyframe = false;
+	int64 NumForcedKeyframes = 0;
+	for (int64 FrameNumber = 0; FrameNumber < NumFrames; ++FrameNumber)
+	{
+		FEncodedPacket Packet;
+		Packet.bVideo = true;
+		Packet.bKeyframe = GOPIndex == 0 || bForceKeyframe;
+		if (Packet.bKeyframe) {
+			NumForcedKeyframes += GOPIndex != 0 ? 1 : 0;
+			GOPIndex = 0;
+			bForceKeyframe = false;
+		}
+		Packet.bDisposable = !Packet.bKeyframe && (GOPIndex % 2) == 1;
+		GOPIndex = (GOPIndex + 1) % TestGOPSize;
+
+		const int32 Size = Packet.bKeyframe ? TestKeyframeSize : (Packet.bDisposable ? TestDisposableFrameSize : TestReferenceFrameSize);
+		Packet.Packet = MakeTestPacket(Size, FTestPacketHeader{ FrameNumber, Packet.bKeyframe ? -1 : LastReference });
+		if (!Packet.bDisposable) {
+			LastReference = FrameNumber;
+		}
+		Queue.Enqueue(MoveTemp(Packet));
+
+		if (Queue.ConsumeKeyframeRequest()) {
+			bForceKeyframe = true;
+		}
+		if (FrameNumber % 2 == 1) {
+			WriteOne();
+		}
+	}
+	while (Queue.Num() > 0)
+	{
+		WriteOne();
+	}
+
+	const FPacketQueueStats QueueStats = Queue.GetStats();
+	AddInfo(FString::Printf(TEXT("Wrote %lld frames (%lld keyframes, %lld after the first GOP skip), %d GOP skips, %lld forced keyframes."),
+		NumVideoWritten, NumKeyframesWritten, NumWrittenAfterSkip, QueueStats.NumGOPSkips, NumForcedKeyframes));
+
+	TestTrue(TEXT("The queue skipped a GOP"), QueueStats.NumGOPSkips > 0);
+	TestTrue(TEXT("The queue asked for a keyframe"), NumForcedKeyframes > 0);
+	TestTrue(TEXT("Video restarts after a GOP skip"), NumWrittenAfterSkip > 0);
+	TestEqual(TEXT("Written frames with a missing reference"), NumUndecodable, int64(0));
+	return true;
+}
+
+#endif
@@ -0,0 +1,201 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "OutputTestStream.h"
+#include "Misc/AutomationTest.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+#include "HAL/FileManager.h"
+#include "Misc/Paths.h"
+#include "Misc/ScopeExit.h"
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/log.h>
+}
+
+namespace RTMPOutputTests
+{
+	/** Video frames the muxer may hold back while interleaving them with audio, on top of the GOP being written */
+	static const int32 MaxInterleavedFrames = 2;
+
+	struct FTestContainer
+	{
+		ERTMPOutputContainer Container;
+		const TCHAR* Name;
+		const TCHAR* Extension;
+		/** Finds a seek position without reading through the file once closed cleanly */
+		bool bIndexed;
+	};
+
+	static const FTestContainer TestContainers[] =
+	{
+		{ ERTMPOutputContainer::FragmentedMP4, TEXT("FragmentedMP4"), TEXT("mp4"), true },
+		{ ERTMPOutputContainer::Matroska, TEXT("Matroska"), TEXT("mkv"), true },
+		{ ERTMPOutputContainer::MPEGTS, TEXT("MPEGTS"), TEXT("ts"), false },
+	};
+
+	/** What a player gets out of a recording */
+	struct FRecordingCheck
+	{
+		int64 FileSize = 0;
+		int64 NumVideoPackets = 0;
+		int64 NumKeyframes = 0;
+		int64 NumDecodedFrames = 0;
+		int64 NumDecodeErrors = 0;
+		double Duration = 0.0;
+		/** Read from the file to open it and seek to three quarters of it */
+		int64 SeekBytesRead = 0;
+	};
+
+	/** Reads the recording back like a player: decodes every video frame, then opens it again and seeks to three quarters of it */
+	static bool CheckRecording(const FString& Path, FRecordingCheck& OutCheck)
+	{
+		OutCheck.FileSize = IFileManager::Get().FileSize(*Path);
+
+		// The demuxer logs errors on a recording cut off by a crash, which would fail the test. What the player gets out of it is checked instead.
+		const int32 LogLevel = av_log_get_level();
+		av_log_set_level(AV_LOG_FATAL);
+
+		AVFormatContext* FormatCtx = nullptr;
+		AVCodecContext* DecoderCtx = nullptr;
+		AVFrame* Frame = av_frame_alloc();
+		AVPacket* Packet = av_packet_alloc();
+		ON_SCOPE_EXIT
+		{
+			av_packet_free(&Packet);
+			av_frame_free(&Frame);
+			avcodec_free_context(&DecoderCtx);
+			avformat_close_input(&FormatCtx);
+			av_log_set_level(LogLevel);
+		};
+
+		if (avformat_open_input(&FormatCtx, TCHAR_TO_ANSI(*Path), nullptr, nullptr) < 0 || avformat_find_stream_info(FormatCtx, nullptr) < 0) {
+			return false;
+		}
+		const int32 VideoIndex = av_find_best_stream(FormatCtx, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+		if (VideoIndex < 0) {
+			return false;
+		}
+		const AVStream* Stream = FormatCtx->streams[VideoIndex];
+		const AVRational TimeBase = Stream->time_base;
+		const AVCodec* Decoder = avcodec_find_decoder(Stream->codecpar->codec_id);
+		DecoderCtx = Decoder != nullptr ? avcodec_alloc_context3(Decoder) : nullptr;
+		if (DecoderCtx == nullptr || avcodec_parameters_to_context(DecoderCtx, Stream->codecpar) < 0 || avcodec_open2(DecoderCtx, Decoder, nullptr) < 0) {
+			return false;
+		}
+
+		auto ReceiveFrames = [&]()
+		{
+			while (avcodec_receive_frame(DecoderCtx, Frame) == 0)
+			{
+				++OutCheck.NumDecodedFrames;
+				OutCheck.NumDecodeErrors += Frame->decode_error_flags != 0 ? 1 : 0;
+				av_frame_unref(Frame);
+			}
+		};
+
+		int64 FirstPts = AV_NOPTS_VALUE;
+		int64 LastPts = AV_NOPTS_VALUE;
+		while (av_read_frame(FormatCtx, Packet) >= 0)
+		{
+			if (Packet->stream_index == VideoIndex) {
+				++OutCheck.NumVideoPackets;
+				OutCheck.NumKeyframes += (Packet->flags & AV_PKT_FLAG_KEY) != 0 ? 1 : 0;
+				if (Packet->pts != AV_NOPTS_VALUE) {
+					FirstPts = FirstPts == AV_NOPTS_VALUE ? Packet->pts : FMath::Min(FirstPts, Packet->pts);
+					LastPts = LastPts == AV_NOPTS_VALUE ? Packet->pts : FMath::Max(LastPts, Packet->pts);
+				}
+				if (avcodec_send_packet(DecoderCtx, Packet) < 0) {
+					++OutCheck.NumDecodeErrors;
+				}
+				ReceiveFrames();
+			}
+			av_packet_unref(Packet);
+		}
+		avcodec_send_packet(DecoderCtx, nullptr);
+		ReceiveFrames();
+		if (FirstPts == AV_NOPTS_VALUE) {
+			return false;
+		}
+		OutCheck.Duration = (LastPts - FirstPts) * av_q2d(TimeBase);
+
+		// Without probing the streams, a player that jumps straight into the recording reads the header, the index and the target.
+		avformat_close_input(&FormatCtx);
+		if (avformat_open_input(&FormatCtx, TCHAR_TO_ANSI(*Path), nullptr, nullptr) < 0 || VideoIndex >= int32(FormatCtx->nb_streams)) {
+			return false;
+		}
+		const int64 SeekPts = FirstPts + (LastPts - FirstPts) * 3 / 4;
+		if (av_seek_frame(FormatCtx, VideoIndex, SeekPts, AVSEEK_FLAG_BACKWARD) < 0 || av_read_frame(FormatCtx, Packet) < 0) {
+			return false;
+		}
+		av_packet_unref(Packet);
+		OutCheck.SeekBytesRead = FormatCtx->pb->bytes_read;
+
+		return true;
+	}
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FRTMPRecordingCrashTest, "RTMP.Output.RecordingCrash", EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+/**
+ * Records the synthetic stream in every container twice: once aborted like a crash mid-stream, checking the file
+ * still decodes and lost at most the GOP being written, once closed cleanly, checking seeking reads a small part of it.
+ */
+bool FRTMPRecordingCrashTest::RunTest(const FString& Parameters)
+{
+	using namespace RTMPOutputTests;
+
+	const double Seconds = 10.0;
+	const FString Directory = FPaths::ConvertRelativePathToFull(FPaths::AutomationTransientDir() / TEXT("RTMP"));
+	IFileManager::Get().MakeDirectory(*Directory, true);
+
+	for (const FTestContainer& TestContainer : TestContainers)
+	{
+		for (const bool bKill : { true, false })
+		{
+			const FString What = FString::Printf(TEXT("%s %s"), TestContainer.Name, bKill ? TEXT("killed") : TEXT("closed"));
+			const FString Path = Directory / FString::Printf(TEXT("RecordingTest_%s.%s"), bKill ? TEXT("Killed") : TEXT("Closed"), TestContainer.Extension);
+			IFileManager::Get().Delete(*Path, false, true, true);
+
+			FRTMPOutputSink OutputConfig;
+			OutputConfig.Url = Path;
+			OutputConfig.Container = TestContainer.Container;
+			// The file keeps up easily, the backlog only has to be large enough that nothing is ever dropped.
+			OutputConfig.MaxBacklogSeconds = float(Seconds + 1.0);
+
+			int32 GOPFrames = 0;
+			FOutputSinkStats Stats;
+			const int64 NumVideoPushed = StreamTestOutput(OutputConfig, Seconds, false, bKill, GOPFrames, Stats);
+			if (!TestTrue(FString::Printf(TEXT("%s: recorded"), *What), NumVideoPushed >= 0)) {
+				continue;
+			}
+
+			FRecordingCheck Check;
+			const bool bOpened = CheckRecording(Path, Check);
+			const int64 NumLost = NumVideoPushed - Check.NumVideoPackets;
+			AddInfo(FString::Printf(TEXT("%s: %lld bytes, %lld of %lld frames (%.2fs, %lld keyframes), %lld decoded with %lld errors, seeking read %lld bytes"),
+				*What, Check.FileSize, Check.NumVideoPackets, NumVideoPushed, Check.Duration, Check.NumKeyframes, Check.NumDecodedFrames, Check.NumDecodeErrors,
+				Check.SeekBytesRead));
+
+			TestTrue(FString::Printf(TEXT("%s: opens"), *What), bOpened);
+			TestTrue(FString::Printf(TEXT("%s: decodes"), *What), Check.NumDecodedFrames > 0);
+			TestEqual(FString::Printf(TEXT("%s: decode errors"), *What), Check.NumDecodeErrors, int64(0));
+			if (bKill) {
+				TestTrue(FString::Printf(TEXT("%s: lost at most one GOP (%lld frames lost, GOP %d frames)"), *What, NumLost, GOPFrames), NumLost <= GOPFrames + MaxInterleavedFrames);
+			}
+			else {
+				TestEqual(FString::Printf(TEXT("%s: frames lost"), *What), NumLost, int64(0));
+				if (TestContainer.bIndexed) {
+					TestTrue(FString::Printf(TEXT("%s: seeks without reading through the file"), *What), Check.SeekBytesRead > 0 && Check.SeekBytesRead < Check.FileSize / 4);
+				}
+			}
+		}
+	}
+
+	return true;
+}
+
+#endif
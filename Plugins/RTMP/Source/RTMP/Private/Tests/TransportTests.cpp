@@ -0,0 +1,172 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "OutputTestStream.h"
+#include "Misc/AutomationTest.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+#include "Async/Async.h"
+#include "HAL/PlatformProcess.h"
+#include "HAL/ThreadSafeBool.h"
+
+extern "C" {
+#include <libavformat/avformat.h>
+#include <libavutil/error.h>
+}
+
+namespace RTMPOutputTests
+{
+	/** Loopback transport test: where the sender streams to and where the receiver stand-in listens */
+	struct FTestTransport
+	{
+		const TCHAR* Name;
+		const TCHAR* SenderUrl;
+		const TCHAR* ReceiverUrl;
+		/** Opening the receiver only returns once the sender connected */
+		bool bOpenWaitsForSender;
+	};
+
+	/** %d is the port, the receiver gives up after two seconds without data */
+	static const FTestTransport TestTransports[] =
+	{
+		{ TEXT("UDP"), TEXT("udp://127.0.0.1:%d"), TEXT("udp://127.0.0.1:%d?timeout=2000000&buffer_size=4194304"), false },
+		{ TEXT("SRT"), TEXT("srt://127.0.0.1:%d"), TEXT("srt://127.0.0.1:%d?mode=listener&transtype=live&timeout=2000000&listen_timeout=10000000"), true },
+	};
+
+	/** What arrived at the receiver, checked against the TS packet headers */
+	struct FTSReceiveCheck
+	{
+		int64 NumBytes = 0;
+		int64 NumTSPackets = 0;
+		int64 NumSyncErrors = 0;
+		/** Gaps in a PID's continuity counter, each one is at least one lost TS packet */
+		int64 NumContinuityErrors = 0;
+
+		TMap<int32, uint8> ContinuityCounters;
+		/** Start of a TS packet split across reads */
+		TArray<uint8> Partial;
+
+		void Receive(const uint8* Data, int32 Size)
+		{
+			NumBytes += Size;
+			Partial.Append(Data, Size);
+
+			int32 Offset = 0;
+			for (; Offset + 188 <= Partial.Num(); Offset += 188)
+			{
+				const uint8* TSPacket = Partial.GetData() + Offset;
+				++NumTSPackets;
+				if (TSPacket[0] != 0x47) {
+					++NumSyncErrors;
+					continue;
+				}
+
+				// Only packets with a payload count up, null packets don't count at all.
+				const int32 PID = ((TSPacket[1] & 0x1f) << 8) | TSPacket[2];
+				const bool bHasPayload = (TSPacket[3] & 0x10) != 0;
+				const uint8 Counter = TSPacket[3] & 0x0f;
+				if (PID == 0x1fff || !bHasPayload) {
+					continue;
+				}
+				if (const uint8* LastCounter = ContinuityCounters.Find(PID)) {
+					NumContinuityErrors += Counter != ((*LastCounter + 1) & 0x0f) && Counter != *LastCounter ? 1 : 0;
+				}
+				ContinuityCounters.Add(PID, Counter);
+			}
+			Partial.RemoveAt(0, Offset, false);
+		}
+	};
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FRTMPTransportLoopbackTest, "RTMP.Output.TransportLoopback", EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+/**
+ * Streams the synthetic stream in real time as MPEG-TS over each transport to a receiver on the loopback interface,
+ * which checks every TS packet arrived in order. Over loopback nothing is lost, a gap means the sender dropped data.
+ */
+bool FRTMPTransportLoopbackTest::RunTest(const FString& Parameters)
+{
+	using namespace RTMPOutputTests;
+
+	const double Seconds = 5.0;
+	const int32 Port = 19360;
+
+	for (const FTestTransport& TestTransport : TestTransports)
+	{
+		FRTMPOutputSink OutputConfig;
+		OutputConfig.Url = FString::Printf(TestTransport.SenderUrl, Port);
+		OutputConfig.MaxBacklogSeconds = float(Seconds + 1.0);
+		// The receiver plays with the sender's latency window, UDP ignores the option.
+		const FString ReceiverUrl = FString::Printf(TestTransport.ReceiverUrl, Port)
+			+ FString::Printf(TEXT("&latency=%lld"), int64(OutputConfig.LatencySeconds * 1000000.0));
+
+		// The receiver stand-in always goes through ffmpeg's protocol.
+		if (avio_find_protocol_name(TCHAR_TO_ANSI(*ReceiverUrl)) == nullptr) {
+			AddWarning(FString::Printf(TEXT("%s: ffmpeg is built without the protocol, skipped."), TestTransport.Name));
+			continue;
+		}
+
+		// The check and the receiver's error are only read once the receiver is done.
+		FTSReceiveCheck Check;
+		FString ReceiverError;
+		FThreadSafeBool bReceiverReady = false;
+		TFuture<bool> ReceiverResult = Async(EAsyncExecution::Thread, [ReceiverUrl, &TestTransport, &Check, &ReceiverError, &bReceiverReady]() -> bool
+		{
+			AVIOContext* Receiver = nullptr;
+			bReceiverReady = TestTransport.bOpenWaitsForSender;
+			const int32 Result = avio_open2(&Receiver, TCHAR_TO_ANSI(*ReceiverUrl), AVIO_FLAG_READ, nullptr, nullptr);
+			bReceiverReady = true;
+			if (Result < 0) {
+				char ErrorString[AV_ERROR_MAX_STRING_SIZE] = { 0 };
+				av_strerror(Result, ErrorString, AV_ERROR_MAX_STRING_SIZE);
+				ReceiverError = UTF8_TO_TCHAR(ErrorString);
+				return false;
+			}
+
+			// Until the sender disconnects or nothing arrived for the timeout.
+			uint8 Buffer[16 * 188];
+			while (true)
+			{
+				const int32 Read = avio_read_partial(Receiver, Buffer, sizeof(Buffer));
+				if (Read <= 0) {
+					break;
+				}
+				Check.Receive(Buffer, Read);
+			}
+
+			avio_closep(&Receiver);
+			return true;
+		});
+
+		while (!bReceiverReady)
+		{
+			FPlatformProcess::Sleep(0.001f);
+		}
+
+		int32 GOPFrames = 0;
+		FOutputSinkStats Stats;
+		const int64 NumVideoPushed = StreamTestOutput(OutputConfig, Seconds, true, false, GOPFrames, Stats);
+		const bool bReceived = ReceiverResult.Get();
+		TestTrue(FString::Printf(TEXT("%s: streamed to %s"), TestTransport.Name, *OutputConfig.Url), NumVideoPushed >= 0 && !Stats.bFailed);
+		if (!TestTrue(FString::Printf(TEXT("%s: receiver opened %s (%s)"), TestTransport.Name, *ReceiverUrl, *ReceiverError), bReceived)) {
+			continue;
+		}
+
+		AddInfo(FString::Printf(TEXT("%s: sent %lld bytes (%lld frames), received %lld bytes in %lld TS packets"),
+			TestTransport.Name, Stats.Transport.BytesSent, NumVideoPushed, Check.NumBytes, Check.NumTSPackets));
+		if (Stats.Transport.bConnectionStats) {
+			AddInfo(FString::Printf(TEXT("%s: round trip %.2fms, %lld packets retransmitted, %lld lost, %lld dropped too late"),
+				TestTransport.Name, Stats.Transport.RoundTripTime * 1000.0, Stats.Transport.NumRetransmitted, Stats.Transport.NumLost, Stats.Transport.NumDropped));
+		}
+
+		TestTrue(FString::Printf(TEXT("%s: something was sent"), TestTransport.Name), Stats.Transport.BytesSent > 0);
+		TestTrue(FString::Printf(TEXT("%s: every byte sent arrived"), TestTransport.Name), Check.NumBytes >= Stats.Transport.BytesSent);
+		TestEqual(FString::Printf(TEXT("%s: sync errors"), TestTransport.Name), Check.NumSyncErrors, int64(0));
+		TestEqual(FString::Printf(TEXT("%s: continuity errors"), TestTransport.Name), Check.NumContinuityErrors, int64(0));
+	}
+
+	return true;
+}
+
+#endif
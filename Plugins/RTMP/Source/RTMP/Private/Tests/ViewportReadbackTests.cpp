@@ -0,0 +1,96 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "ViewportReadbackSurface.h"
+#include "DataStructures.h"
+#include "Misc/AutomationTest.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+#include "RenderingThread.h"
+#include "RHICommandList.h"
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FRTMPGPUColorConversionTest, "RTMP.ViewportReadback.GPUColorConversion", EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+/**
+ * Resolves random pixels through the GPU conversion path and compares the result with the CPU reference, for every
+ * format, matrix and range. Integer math on both sides makes any difference a bug, run with -warp to check it on the
+ * software renderer.
+ */
+bool FRTMPGPUColorConversionTest::RunTest(const FString& Parameters)
+{
+	const int32 Width = 1280;
+	const int32 Height = 720;
+
+	if (!RHISupportsComputeShaders(GMaxRHIShaderPlatform)) {
+		AddWarning(TEXT("Compute shaders are not supported, nothing to verify."));
+		return true;
+	}
+
+	TArray<uint8> Pixels;
+	RTMPVideo::FillRandomBGRA(Pixels, Width, Height);
+
+	struct FConversionResult
+	{
+		FString Name;
+		int32 NumMismatches = 0;
+		int32 FirstMismatch = INDEX_NONE;
+	};
+	// Only read once the render thread is flushed.
+	TArray<FConversionResult> Results;
+
+	ENQUEUE_RENDER_COMMAND(RTMPVerifyGPUColorConversion)(
+		[&Pixels, &Results, Width, Height](FRHICommandListImmediate& RHICmdList)
+		{
+			FRHIResourceCreateInfo CreateInfo;
+			FTexture2DRHIRef SourceTexture = RHICreateTexture2D(Width, Height, PF_B8G8R8A8, 1, 1, TexCreate_ShaderResource, CreateInfo);
+			RHIUpdateTexture2D(SourceTexture, 0, FUpdateTextureRegion2D(0, 0, 0, 0, Width, Height), Width * 4, Pixels.GetData());
+
+			for (int32 Index = 0; Index < 8; ++Index)
+			{
+				const ERTMPFrameFormat Format = (Index & 1) != 0 ? ERTMPFrameFormat::NV12 : ERTMPFrameFormat::I420;
+				const ERTMPColorMatrix Matrix = (Index & 2) != 0 ? ERTMPColorMatrix::BT709 : ERTMPColorMatrix::BT601;
+				const ERTMPColorRange Range = (Index & 4) != 0 ? ERTMPColorRange::Full : ERTMPColorRange::Limited;
+				const FYUVCoefficients& Coefficients = RTMPVideo::GetYUVCoefficients(Matrix, Range);
+
+				TArray<uint8> Expected;
+				Expected.SetNumUninitialized(RTMPVideo::GetFrameSize(Format, Width, Height));
+				RTMPVideo::ConvertBGRAToYUV420Reference(Pixels.GetData(), Width * 4, Width, Height,
+					RTMPVideo::GetPackedPlanes(Expected.GetData(), Format, Width, Height), Coefficients);
+
+				// Same size as the source, the resolve copies the pixels unfiltered.
+				FViewportReadbackSurface Surface(PF_B8G8R8A8, FIntPoint(Width, Height), Format);
+				Surface.SetYUVCoefficients(Coefficients);
+				Surface.Resolve(RHICmdList, SourceTexture);
+
+				FConversionResult& Result = Results.AddDefaulted_GetRef();
+				Result.Name = FString::Printf(TEXT("%s %s %s"), Format == ERTMPFrameFormat::I420 ? TEXT("I420") : TEXT("NV12"),
+					Matrix == ERTMPColorMatrix::BT709 ? TEXT("BT.709") : TEXT("BT.601"), Range == ERTMPColorRange::Full ? TEXT("full range") : TEXT("limited range"));
+				Surface.ReadBack(RHICmdList, [&](const uint8* Data, int32 Pitch) {
+					for (int32 Row = 0; Row < Height * 3 / 2; ++Row)
+					{
+						for (int32 Column = 0; Column < Width; ++Column)
+						{
+							if (Data[Row * Pitch + Column] != Expected[Row * Width + Column]) {
+								if (Result.FirstMismatch == INDEX_NONE) {
+									Result.FirstMismatch = Row * Width + Column;
+								}
+								++Result.NumMismatches;
+							}
+						}
+					}
+					});
+			}
+		});
+	FlushRenderingCommands();
+
+	TestEqual(TEXT("Conversions read back"), Results.Num(), 8);
+	for (const FConversionResult& Result : Results)
+	{
+		TestEqual(FString::Printf(TEXT("GPU %s conversion bytes differing from the CPU reference (first at offset %d)"), *Result.Name, Result.FirstMismatch),
+			Result.NumMismatches, 0);
+	}
+	return true;
+}
+
+#endif
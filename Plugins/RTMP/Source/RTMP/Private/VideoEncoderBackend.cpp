@@ -0,0 +1,498 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "VideoEncoderBackend.h"
+#include "RTMP.h"
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/opt.h>
+}
+
+namespace RTMPVideo
+{
+	// x264 presets from slowest to fastest, other encoders map the position to their own speed scale.
+	static const TCHAR* const SpeedPresets[] = { TEXT("placebo"), TEXT("veryslow"), TEXT("slower"), TEXT("slow"), TEXT("medium"),
+		TEXT("fast"), TEXT("faster"), TEXT("veryfast"), TEXT("superfast"), TEXT("ultrafast") };
+	static const int32 MaxPresetSpeed = UE_ARRAY_COUNT(SpeedPresets) - 1;
+
+	/** Position of the x264 preset in SpeedPresets, medium for names x264 does not know */
+	static int32 GetPresetSpeed(const FString& Preset)
+	{
+		for (int32 Index = 0; Index < UE_ARRAY_COUNT(SpeedPresets); ++Index)
+		{
+			if (Preset.Equals(SpeedPresets[Index], ESearchCase::IgnoreCase)) {
+				return Index;
+			}
+		}
+		return 4;
+	}
+
+	/** Maps the preset speed onto an encoder's own range, MinValue being the slowest */
+	static int32 MapPresetSpeed(const FString& Preset, int32 MinValue, int32 MaxValue)
+	{
+		return MinValue + FMath::RoundToInt(float(GetPresetSpeed(Preset)) * (MaxValue - MinValue) / MaxPresetSpeed);
+	}
+
+	/** x264 CRF (0-51) on an encoder's quantizer scale, keeping the relative quality */
+	static int32 MapCRF(float CRF, int32 MaxValue)
+	{
+		return FMath::Clamp(FMath::RoundToInt(CRF * MaxValue / 51.0f), 0, MaxValue);
+	}
+
+	static int32 GetGOPFrames(const FVideoEncoderSettings& Settings, const FFrameRate& FrameRate)
+	{
+		return FMath::Max(FMath::RoundToInt(Settings.GOPSeconds * FrameRate.AsDecimal()), 1);
+	}
+
+	/** Options differ between ffmpeg versions, a missing one is logged rather than failing the stream */
+	static void SetEncoderOption(AVCodecContext* CodecCtx, const char* Name, const char* Value)
+	{
+		if (av_opt_set(CodecCtx->priv_data, Name, Value, 0) < 0) {
+			UE_LOG(LogRTMP, Warning, TEXT("%s does not take option %s=%s."), UTF8_TO_TCHAR(CodecCtx->codec->name), UTF8_TO_TCHAR(Name), UTF8_TO_TCHAR(Value));
+		}
+	}
+
+	static void SetEncoderOption(AVCodecContext* CodecCtx, const char* Name, int64 Value)
+	{
+		if (av_opt_set_int(CodecCtx->priv_data, Name, Value, 0) < 0) {
+			UE_LOG(LogRTMP, Warning, TEXT("%s does not take option %s=%lld."), UTF8_TO_TCHAR(CodecCtx->codec->name), UTF8_TO_TCHAR(Name), Value);
+		}
+	}
+
+	class FX264EncoderBackend : public FVideoEncoderBackend
+	{
+	public:
+		virtual ERTMPVideoEncoderBackend GetType() const override { return ERTMPVideoEncoderBackend::X264; }
+		virtual const char* GetEncoderName() const override { return "libx264"; }
+
+		virtual FVideoEncoderCapabilities GetCapabilities() const override
+		{
+			FVideoEncoderCapabilities Capabilities;
+			Capabilities.bBFrames = true;
+			Capabilities.bLookahead = true;
+			Capabilities.bConstantQuality = true;
+			Capabilities.bIntraRefresh = true;
+			Capabilities.bSlicedThreads = true;
+			Capabilities.bZeroDelay = true;
+			Capabilities.bSceneCutControl = true;
+			return Capabilities;
+		}
+
+		virtual void ApplySettings(AVCodecContext* CodecCtx, const FVideoEncoderSettings& Settings, const FFrameRate& FrameRate) const override
+		{
+			SetEncoderOption(CodecCtx, "preset", TCHAR_TO_ANSI(*Settings.Preset));
+			if (!Settings.Tune.IsEmpty()) {
+				SetEncoderOption(CodecCtx, "tune", TCHAR_TO_ANSI(*Settings.Tune));
+			}
+			if (!Settings.Profile.IsEmpty()) {
+				SetEncoderOption(CodecCtx, "profile", TCHAR_TO_ANSI(*Settings.Profile));
+			}
+
+			// Applied after preset and tune by libx264, so they win over what zerolatency implies.
+			CodecCtx->gop_size = GetGOPFrames(Settings, FrameRate);
+			CodecCtx->max_b_frames = Settings.BFrames;
+			SetEncoderOption(CodecCtx, "rc-lookahead", Settings.Lookahead);
+			// The refresh sweeps across the picture once per GOP.
+			SetEncoderOption(CodecCtx, "intra-refresh", Settings.bIntraRefresh ? 1 : 0);
+			if (Settings.bAlignedKeyframes) {
+				SetEncoderOption(CodecCtx, "x264-params", "scenecut=0");
+			}
+
+			// libx264 only uses sliced threads when the thread type is exactly slice, the default frame | slice means frame threads.
+			CodecCtx->thread_count = Settings.Threads;
+			CodecCtx->thread_type = Settings.bSlicedThreads ? FF_THREAD_SLICE : FF_THREAD_FRAME;
+
+			switch (Settings.RateControl)
+			{
+			case ERTMPRateControl::CRF:
+				CodecCtx->bit_rate = 0;
+				av_opt_set_double(CodecCtx->priv_data, "crf", Settings.CRF, 0);
+				break;
+			case ERTMPRateControl::CBR:
+				CodecCtx->bit_rate = Settings.Bitrate;
+				SetEncoderOption(CodecCtx, "nal-hrd", "cbr");
+				break;
+			case ERTMPRateControl::VBV:
+				CodecCtx->bit_rate = Settings.Bitrate;
+				break;
+			}
+			CodecCtx->rc_max_rate = Settings.MaxBitrate;
+			CodecCtx->rc_buffer_size = Settings.BufferSize;
+
+			// Keyframes requested after the mux queue dropped a GOP must be IDR frames, decoding restarts there.
+			SetEncoderOption(CodecCtx, "forced-idr", 1);
+		}
+	};
+
+	class FOpenH264EncoderBackend : public FVideoEncoderBackend
+	{
+	public:
+		virtual ERTMPVideoEncoderBackend GetType() const override { return ERTMPVideoEncoderBackend::OpenH264; }
+		virtual const char* GetEncoderName() const override { return "libopenh264"; }
+
+		virtual FVideoEncoderCapabilities GetCapabilities() const override
+		{
+			FVideoEncoderCapabilities Capabilities;
+			Capabilities.bSlicedThreads = true;
+			Capabilities.bZeroDelay = true;
+			return Capabilities;
+		}
+
+		virtual void ApplySettings(AVCodecContext* CodecCtx, const FVideoEncoderSettings& Settings, const FFrameRate& FrameRate) const override
+		{
+			// OpenH264 has no presets, its only profiles are constrained baseline and, without B-frames, main and high.
+			const bool bBaseline = Settings.Profile.IsEmpty() || Settings.Profile.Equals(TEXT("baseline"), ESearchCase::IgnoreCase);
+			SetEncoderOption(CodecCtx, "profile", bBaseline ? "constrained_baseline" : TCHAR_TO_ANSI(*Settings.Profile.ToLower()));
+			SetEncoderOption(CodecCtx, "cabac", bBaseline ? 0 : 1);
+			// Skipped frames would leave holes in the capture cadence, the rate control has to hit the bitrate without them.
+			SetEncoderOption(CodecCtx, "allow_skip_frames", 0);
+
+			CodecCtx->gop_size = GetGOPFrames(Settings, FrameRate);
+			CodecCtx->max_b_frames = 0;
+
+			// Threads always work on slices of the same frame, one slice per thread.
+			CodecCtx->thread_count = Settings.Threads;
+			if (Settings.bSlicedThreads) {
+				CodecCtx->slices = Settings.Threads > 0 ? Settings.Threads : FMath::Min(FPlatformMisc::NumberOfCores(), 4);
+			}
+
+			CodecCtx->bit_rate = Settings.Bitrate;
+			CodecCtx->rc_max_rate = Settings.MaxBitrate;
+			CodecCtx->rc_buffer_size = Settings.BufferSize;
+		}
+	};
+
+	class FX265EncoderBackend : public FVideoEncoderBackend
+	{
+	public:
+		virtual ERTMPVideoEncoderBackend GetType() const override { return ERTMPVideoEncoderBackend::X265; }
+		virtual const char* GetEncoderName() const override { return "libx265"; }
+
+		virtual FVideoEncoderCapabilities GetCapabilities() const override
+		{
+			FVideoEncoderCapabilities Capabilities;
+			Capabilities.bBFrames = true;
+			Capabilities.bLookahead = true;
+			Capabilities.bConstantQuality = true;
+			Capabilities.bIntraRefresh = true;
+			Capabilities.bZeroDelay = true;
+			Capabilities.bSceneCutControl = true;
+			return Capabilities;
+		}
+
+		virtual void ApplySettings(AVCodecContext* CodecCtx, const FVideoEncoderSettings& Settings, const FFrameRate& FrameRate) const override
+		{
+			// x265 shares the x264 preset names, but only some of the tunes. Every 8 bit 4:2:0 H.264 profile is HEVC main.
+			static const TCHAR* const X265Tunes[] = { TEXT("psnr"), TEXT("ssim"), TEXT("grain"), TEXT("zerolatency"), TEXT("fastdecode"), TEXT("animation") };
+			SetEncoderOption(CodecCtx, "preset", TCHAR_TO_ANSI(*Settings.Preset));
+			for (const TCHAR* Tune : X265Tunes)
+			{
+				if (Settings.Tune.Equals(Tune, ESearchCase::IgnoreCase)) {
+					SetEncoderOption(CodecCtx, "tune", TCHAR_TO_ANSI(Tune));
+				}
+			}
+			SetEncoderOption(CodecCtx, "profile", "main");
+
+			CodecCtx->gop_size = GetGOPFrames(Settings, FrameRate);
+			CodecCtx->max_b_frames = Settings.BFrames;
+
+			TArray<FString> Params;
+			Params.Add(FString::Printf(TEXT("rc-lookahead=%d"), Settings.Lookahead));
+			if (Settings.bIntraRefresh) {
+				Params.Add(TEXT("intra-refresh=1"));
+			}
+			if (Settings.bAlignedKeyframes) {
+				Params.Add(TEXT("scenecut=0"));
+			}
+			// x265 threads work on whole frames in parallel, each one in flight is a frame of delay.
+			if (Settings.BFrames == 0 && Settings.Lookahead == 0) {
+				Params.Add(TEXT("frame-threads=1"));
+			}
+			if (Settings.Threads > 0) {
+				Params.Add(FString::Printf(TEXT("pools=%d"), Settings.Threads));
+			}
+
+			switch (Settings.RateControl)
+			{
+			case ERTMPRateControl::CRF:
+				// x265 CRF 28 looks about like x264 CRF 23.
+				CodecCtx->bit_rate = 0;
+				av_opt_set_double(CodecCtx->priv_data, "crf", FMath::Clamp(Settings.CRF + 5.0f, 0.0f, 51.0f), 0);
+				break;
+			case ERTMPRateControl::CBR:
+				CodecCtx->bit_rate = Settings.Bitrate;
+				Params.Add(TEXT("strict-cbr=1"));
+				break;
+			case ERTMPRateControl::VBV:
+				CodecCtx->bit_rate = Settings.Bitrate;
+				break;
+			}
+			CodecCtx->rc_max_rate = Settings.MaxBitrate;
+			CodecCtx->rc_buffer_size = Settings.BufferSize;
+
+			SetEncoderOption(CodecCtx, "x265-params", TCHAR_TO_ANSI(*FString::Join(Params, TEXT(":"))));
+			SetEncoderOption(CodecCtx, "forced-idr", 1);
+		}
+	};
+
+	class FSVTAV1EncoderBackend : public FVideoEncoderBackend
+	{
+	public:
+		virtual ERTMPVideoEncoderBackend GetType() const override { return ERTMPVideoEncoderBackend::SVTAV1; }
+		virtual const char* GetEncoderName() const override { return "libsvtav1"; }
+
+		virtual FVideoEncoderCapabilities GetCapabilities() const override
+		{
+			// The prediction structure is always hierarchical, frames are reordered whatever the settings.
+			FVideoEncoderCapabilities Capabilities;
+			Capabilities.bLookahead = true;
+			Capabilities.bConstantQuality = true;
+			Capabilities.bSceneCutControl = true;
+			return Capabilities;
+		}
+
+		virtual void ApplySettings(AVCodecContext* CodecCtx, const FVideoEncoderSettings& Settings, const FFrameRate& FrameRate) const override
+		{
+			// Presets run from 0 (slowest) to 8.
+			SetEncoderOption(CodecCtx, "preset", MapPresetSpeed(Settings.Preset, 0, 8));
+			SetEncoderOption(CodecCtx, "la_depth", Settings.Lookahead);
+			SetEncoderOption(CodecCtx, "sc_detection", Settings.bAlignedKeyframes ? 0 : 1);
+
+			CodecCtx->gop_size = GetGOPFrames(Settings, FrameRate);
+			CodecCtx->thread_count = Settings.Threads;
+
+			switch (Settings.RateControl)
+			{
+			case ERTMPRateControl::CRF:
+				CodecCtx->bit_rate = 0;
+				SetEncoderOption(CodecCtx, "rc", "cqp");
+				SetEncoderOption(CodecCtx, "qp", MapCRF(Settings.CRF, 63));
+				break;
+			case ERTMPRateControl::CBR:
+				CodecCtx->bit_rate = Settings.Bitrate;
+				SetEncoderOption(CodecCtx, "rc", "cvbr");
+				break;
+			case ERTMPRateControl::VBV:
+				CodecCtx->bit_rate = Settings.Bitrate;
+				SetEncoderOption(CodecCtx, "rc", "vbr");
+				break;
+			}
+			CodecCtx->rc_max_rate = Settings.MaxBitrate;
+			CodecCtx->rc_buffer_size = Settings.BufferSize;
+
+			SetEncoderOption(CodecCtx, "forced-idr", 1);
+		}
+	};
+
+	class FVPXEncoderBackend : public FVideoEncoderBackend
+	{
+	public:
+		virtual ERTMPVideoEncoderBackend GetType() const override { return ERTMPVideoEncoderBackend::VPX; }
+		virtual const char* GetEncoderName() const override { return "libvpx-vp9"; }
+
+		virtual FVideoEncoderCapabilities GetCapabilities() const override
+		{
+			// Hidden alt-ref frames take the place of B-frames, they come with any lookahead.
+			FVideoEncoderCapabilities Capabilities;
+			Capabilities.bLookahead = true;
+			Capabilities.bConstantQuality = true;
+			Capabilities.bSlicedThreads = true;
+			Capabilities.bZeroDelay = true;
+			Capabilities.bSceneCutControl = true;
+			return Capabilities;
+		}
+
+		virtual void ApplySettings(AVCodecContext* CodecCtx, const FVideoEncoderSettings& Settings, const FFrameRate& FrameRate) const override
+		{
+			// Without lookahead the realtime deadline with cpu-used 5 to 8, otherwise good quality with 0 to 5.
+			const bool bRealtime = Settings.Lookahead == 0;
+			SetEncoderOption(CodecCtx, "deadline", bRealtime ? "realtime" : "good");
+			SetEncoderOption(CodecCtx, "cpu-used", bRealtime ? MapPresetSpeed(Settings.Preset, 5, 8) : MapPresetSpeed(Settings.Preset, 0, 5));
+			SetEncoderOption(CodecCtx, "lag-in-frames", FMath::Min(Settings.Lookahead, 25));
+			SetEncoderOption(CodecCtx, "auto-alt-ref", Settings.Lookahead > 0 ? 1 : 0);
+
+			CodecCtx->gop_size = GetGOPFrames(Settings, FrameRate);
+			// libvpx places keyframes anywhere between the minimum and maximum distance.
+			if (Settings.bAlignedKeyframes) {
+				CodecCtx->keyint_min = CodecCtx->gop_size;
+			}
+			// Row based threading splits every frame, it never holds frames back.
+			CodecCtx->thread_count = Settings.Threads > 0 ? Settings.Threads : FMath::Min(FPlatformMisc::NumberOfCores(), 8);
+			SetEncoderOption(CodecCtx, "row-mt", 1);
+
+			switch (Settings.RateControl)
+			{
+			case ERTMPRateControl::CRF:
+				// A bitrate turns constant quality into constrained quality.
+				CodecCtx->bit_rate = Settings.MaxBitrate;
+				SetEncoderOption(CodecCtx, "crf", MapCRF(Settings.CRF, 63));
+				break;
+			case ERTMPRateControl::CBR:
+				// libvpx switches to CBR when the minimum and maximum rates equal the bitrate.
+				CodecCtx->bit_rate = Settings.Bitrate;
+				CodecCtx->rc_min_rate = Settings.Bitrate;
+				break;
+			case ERTMPRateControl::VBV:
+				CodecCtx->bit_rate = Settings.Bitrate;
+				break;
+			}
+			CodecCtx->rc_max_rate = Settings.RateControl == ERTMPRateControl::CBR ? Settings.Bitrate : Settings.MaxBitrate;
+			CodecCtx->rc_buffer_size = Settings.BufferSize;
+		}
+	};
+
+	const FVideoEncoderBackend& GetEncoderBackend(ERTMPVideoEncoderBackend Backend)
+	{
+		static const FX264EncoderBackend X264;
+		static const FOpenH264EncoderBackend OpenH264;
+		static const FX265EncoderBackend X265;
+		static const FSVTAV1EncoderBackend SVTAV1;
+		static const FVPXEncoderBackend VPX;
+
+		switch (Backend)
+		{
+		case ERTMPVideoEncoderBackend::OpenH264: return OpenH264;
+		case ERTMPVideoEncoderBackend::X265: return X265;
+		case ERTMPVideoEncoderBackend::SVTAV1: return SVTAV1;
+		case ERTMPVideoEncoderBackend::VPX: return VPX;
+		default: return X264;
+		}
+	}
+
+	const TCHAR* GetEncoderBackendName(ERTMPVideoEncoderBackend Backend)
+	{
+		switch (Backend)
+		{
+		case ERTMPVideoEncoderBackend::X264: return TEXT("x264");
+		case ERTMPVideoEncoderBackend::OpenH264: return TEXT("OpenH264");
+		case ERTMPVideoEncoderBackend::X265: return TEXT("x265");
+		case ERTMPVideoEncoderBackend::SVTAV1: return TEXT("SVT-AV1");
+		case ERTMPVideoEncoderBackend::VPX: return TEXT("VP9");
+		default: return TEXT("Unknown");
+		}
+	}
+
+	TArray<ERTMPVideoEncoderBackend> GetEncoderBackends()
+	{
+		return { ERTMPVideoEncoderBackend::X264, ERTMPVideoEncoderBackend::OpenH264, ERTMPVideoEncoderBackend::X265,
+			ERTMPVideoEncoderBackend::SVTAV1, ERTMPVideoEncoderBackend::VPX };
+	}
+
+	FString DescribeEncoderCapabilities(const FVideoEncoderCapabilities& Capabilities)
+	{
+		TArray<FString> Features;
+		if (Capabilities.bBFrames) {
+			Features.Add(TEXT("B-frames"));
+		}
+		if (Capabilities.bLookahead) {
+			Features.Add(TEXT("lookahead"));
+		}
+		if (Capabilities.bConstantQuality) {
+			Features.Add(TEXT("CRF"));
+		}
+		if (Capabilities.bIntraRefresh) {
+			Features.Add(TEXT("intra refresh"));
+		}
+		if (Capabilities.bSlicedThreads) {
+			Features.Add(TEXT("sliced threads"));
+		}
+		Features.Add(Capabilities.bZeroDelay ? TEXT("zero delay") : TEXT("always reorders"));
+		return FString::Join(Features, TEXT(", "));
+	}
+
+	FVideoEncoderSettings ConfigureVideoEncoder(AVCodecContext* CodecCtx, const FRTMPPublisherConfig& Config, int32 Width, int32 Height, int32 VideoBitrate, bool bAlignedKeyframes)
+	{
+		CodecCtx->width = Width;
+		CodecCtx->height = Height;
+
+		// Video pts are capture slot indices, one tick per frame at the (possibly NTSC) capture rate.
+		const FFrameRate FrameRate = Config.GetFrameRate();
+		CodecCtx->time_base = { FrameRate.Denominator, FrameRate.Numerator };
+		CodecCtx->framerate = { FrameRate.Numerator, FrameRate.Denominator };
+		CodecCtx->codec_type = AVMEDIA_TYPE_VIDEO;
+		CodecCtx->pix_fmt = AV_PIX_FMT_YUV420P;
+		// Tag the stream with the matrix the frames are converted with, players assume BT.601 limited otherwise.
+		const bool bBT709 = Config.ColorMatrix == ERTMPColorMatrix::BT709;
+		CodecCtx->colorspace = bBT709 ? AVCOL_SPC_BT709 : AVCOL_SPC_SMPTE170M;
+		CodecCtx->color_primaries = bBT709 ? AVCOL_PRI_BT709 : AVCOL_PRI_SMPTE170M;
+		CodecCtx->color_trc = bBT709 ? AVCOL_TRC_BT709 : AVCOL_TRC_SMPTE170M;
+		CodecCtx->color_range = Config.ColorRange == ERTMPColorRange::Full ? AVCOL_RANGE_JPEG : AVCOL_RANGE_MPEG;
+
+		// Absolute peak rates are meant for the configured bitrate, other rungs of the ladder get their share.
+		FRTMPVideoEncoderOverrides Overrides = Config.EncoderOverrides;
+		if (VideoBitrate != Config.VideoBitrate && Config.VideoBitrate > 0) {
+			const double Scale = double(VideoBitrate) / Config.VideoBitrate;
+			Overrides.MaxBitrate = int32(Overrides.MaxBitrate * Scale);
+			Overrides.BufferSize = int32(Overrides.BufferSize * Scale);
+		}
+
+		// Preset, GOP, B-frames and rate control come from the encoder profile, level is left to the encoder.
+		const FVideoEncoderBackend& Backend = GetEncoderBackend(Config.VideoEncoder);
+		FVideoEncoderSettings Settings = ResolveEncoderSettings(Config.EncoderProfile, Overrides, VideoBitrate, FrameRate);
+		Settings.bAlignedKeyframes = bAlignedKeyframes;
+		Settings = Backend.AdaptSettings(Settings, VideoBitrate);
+		Backend.ApplySettings(CodecCtx, Settings, FrameRate);
+		return Settings;
+	}
+}
+
+AVCodec* FVideoEncoderBackend::FindEncoder() const
+{
+	return avcodec_find_encoder_by_name(GetEncoderName());
+}
+
+bool FVideoEncoderBackend::IsAvailable() const
+{
+	return FindEncoder() != nullptr;
+}
+
+bool FVideoEncoderBackend::CanMuxInto(const AVOutputFormat* OutputFormat) const
+{
+	const AVCodec* Encoder = FindEncoder();
+	return Encoder != nullptr && OutputFormat != nullptr && avformat_query_codec(OutputFormat, Encoder->id, FF_COMPLIANCE_NORMAL) == 1;
+}
+
+FVideoEncoderSettings FVideoEncoderBackend::AdaptSettings(const FVideoEncoderSettings& Settings, int32 VideoBitrate) const
+{
+	const FVideoEncoderCapabilities Capabilities = GetCapabilities();
+	const TCHAR* Name = RTMPVideo::GetEncoderBackendName(GetType());
+	FVideoEncoderSettings Adapted = Settings;
+
+	if (!Capabilities.bBFrames && Adapted.BFrames > 0) {
+		UE_LOG(LogRTMP, Warning, TEXT("%s has no B-frames, encoding without the %d configured."), Name, Adapted.BFrames);
+		Adapted.BFrames = 0;
+	}
+	if (!Capabilities.bLookahead && Adapted.Lookahead > 0) {
+		UE_LOG(LogRTMP, Warning, TEXT("%s has no lookahead, encoding without the %d frames configured."), Name, Adapted.Lookahead);
+		Adapted.Lookahead = 0;
+	}
+	if (!Capabilities.bIntraRefresh && Adapted.bIntraRefresh) {
+		UE_LOG(LogRTMP, Warning, TEXT("%s has no intra refresh, encoding with regular keyframes."), Name);
+		Adapted.bIntraRefresh = false;
+	}
+	if (!Capabilities.bSlicedThreads && Adapted.bSlicedThreads) {
+		UE_LOG(LogRTMP, Log, TEXT("%s has no sliced threads, using its own threading."), Name);
+		Adapted.bSlicedThreads = false;
+	}
+	if (!Capabilities.bConstantQuality && Adapted.RateControl == ERTMPRateControl::CRF) {
+		UE_LOG(LogRTMP, Warning, TEXT("%s has no constant quality mode, encoding VBV at %d kbps instead."), Name, VideoBitrate / 1000);
+		Adapted.RateControl = ERTMPRateControl::VBV;
+		Adapted.Bitrate = VideoBitrate;
+		Adapted.MaxBitrate = Adapted.MaxBitrate > 0 ? Adapted.MaxBitrate : int32(FMath::Min(int64(VideoBitrate) * 3 / 2, int64(MAX_int32)));
+		Adapted.BufferSize = Adapted.BufferSize > 0 ? Adapted.BufferSize : Adapted.MaxBitrate;
+	}
+	if (Adapted.bAlignedKeyframes && Adapted.bIntraRefresh) {
+		UE_LOG(LogRTMP, Warning, TEXT("Renditions can only be switched at IDR frames, encoding with regular keyframes instead of intra refresh."));
+		Adapted.bIntraRefresh = false;
+	}
+	if (Adapted.bAlignedKeyframes && !Capabilities.bSceneCutControl) {
+		UE_LOG(LogRTMP, Warning, TEXT("%s may add keyframes at scene cuts, renditions can miss switching points."), Name);
+	}
+	if (!Capabilities.bZeroDelay && Adapted.BFrames == 0 && Adapted.Lookahead == 0) {
+		UE_LOG(LogRTMP, Warning, TEXT("%s always reorders frames, expect several frames of encoder delay."), Name);
+	}
+
+	return Adapted;
+}
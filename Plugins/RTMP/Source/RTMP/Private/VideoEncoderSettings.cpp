@@ -0,0 +1,457 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "VideoEncoderSettings.h"
+#include "VideoEncoderBackend.h"
+#include "HAL/IConsoleManager.h"
+#include "Misc/ScopeExit.h"
+#include "HAL/PlatformTime.h"
+#include "Math/RandomStream.h"
+#include "RTMP.h"
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavutil/frame.h>
+}
+
+namespace RTMPVideo
+{
+	FVideoEncoderSettings GetProfileEncoderSettings(ERTMPEncoderProfile Profile, int32 VideoBitrate, const FFrameRate& FrameRate)
+	{
+		FVideoEncoderSettings Settings;
+		Settings.Bitrate = VideoBitrate;
+
+		switch (Profile)
+		{
+		case ERTMPEncoderProfile::LowLatency:
+			// zerolatency turns off B-frames, lookahead and frame threading, every frame comes out as soon as it went in.
+			Settings.Preset = TEXT("superfast");
+			Settings.Tune = TEXT("zerolatency");
+			Settings.Profile = TEXT("baseline");
+			Settings.GOPSeconds = 1.0f;
+			Settings.BFrames = 0;
+			Settings.Lookahead = 0;
+			Settings.RateControl = ERTMPRateControl::CBR;
+			Settings.bSlicedThreads = true;
+			break;
+		case ERTMPEncoderProfile::Balanced:
+			Settings.Preset = TEXT("veryfast");
+			Settings.Profile = TEXT("main");
+			Settings.GOPSeconds = 2.0f;
+			Settings.BFrames = 2;
+			Settings.Lookahead = 10;
+			Settings.RateControl = ERTMPRateControl::VBV;
+			break;
+		case ERTMPEncoderProfile::Quality:
+			Settings.Preset = TEXT("medium");
+			Settings.Profile = TEXT("high");
+			Settings.GOPSeconds = 2.0f;
+			Settings.BFrames = 3;
+			Settings.Lookahead = 40;
+			Settings.RateControl = ERTMPRateControl::VBV;
+			break;
+		case ERTMPEncoderProfile::UltraLowLatency:
+			// A VBV buffer of one frame at the average rate caps every frame at its share of the bitrate,
+			// nothing has to be buffered before it can be sent. Intra refresh spreads the keyframe over a GOP.
+			Settings.Preset = TEXT("superfast");
+			Settings.Tune = TEXT("zerolatency");
+			Settings.Profile = TEXT("baseline");
+			Settings.GOPSeconds = 1.0f;
+			Settings.BFrames = 0;
+			Settings.Lookahead = 0;
+			Settings.RateControl = ERTMPRateControl::VBV;
+			Settings.MaxBitrate = VideoBitrate;
+			Settings.BufferSize = FMath::Max(int32(VideoBitrate / FrameRate.AsDecimal()), 1);
+			Settings.bSlicedThreads = true;
+			Settings.bIntraRefresh = true;
+			break;
+		}
+
+		return Settings;
+	}
+
+	FVideoEncoderSettings ResolveEncoderSettings(ERTMPEncoderProfile Profile, const FRTMPVideoEncoderOverrides& Overrides, int32 VideoBitrate, const FFrameRate& FrameRate)
+	{
+		FVideoEncoderSettings Settings = GetProfileEncoderSettings(Profile, VideoBitrate, FrameRate);
+
+		if (Overrides.bOverride_Preset) {
+			Settings.Preset = Overrides.Preset;
+		}
+		if (Overrides.bOverride_Tune) {
+			Settings.Tune = Overrides.Tune;
+		}
+		if (Overrides.bOverride_Profile) {
+			Settings.Profile = Overrides.Profile;
+		}
+		if (Overrides.bOverride_GOPSeconds) {
+			Settings.GOPSeconds = FMath::Max(Overrides.GOPSeconds, 0.1f);
+		}
+		if (Overrides.bOverride_BFrames) {
+			Settings.BFrames = FMath::Clamp(Overrides.BFrames, 0, 16);
+		}
+		if (Overrides.bOverride_Lookahead) {
+			Settings.Lookahead = FMath::Clamp(Overrides.Lookahead, 0, 250);
+		}
+		if (Overrides.bOverride_RateControl) {
+			Settings.RateControl = Overrides.RateControl;
+		}
+		if (Overrides.bOverride_CRF) {
+			Settings.CRF = FMath::Clamp(Overrides.CRF, 0.0f, 51.0f);
+		}
+		if (Overrides.bOverride_Threads) {
+			Settings.Threads = FMath::Max(Overrides.Threads, 0);
+		}
+		if (Overrides.bOverride_SlicedThreads) {
+			Settings.bSlicedThreads = Overrides.bSlicedThreads;
+		}
+		if (Overrides.bOverride_IntraRefresh) {
+			Settings.bIntraRefresh = Overrides.bIntraRefresh;
+		}
+
+		if (Settings.Preset.IsEmpty()) {
+			Settings.Preset = TEXT("medium");
+		}
+
+		if (Settings.BFrames > 0 && Settings.Profile.Equals(TEXT("baseline"), ESearchCase::IgnoreCase)) {
+			UE_LOG(LogRTMP, Warning, TEXT("The baseline profile has no B-frames, encoding without the %d configured."), Settings.BFrames);
+			Settings.BFrames = 0;
+		}
+
+		// Bitrates neither the profile nor the overrides set follow VideoBitrate, one second of buffer at the peak rate.
+		const int32 RequestedMaxBitrate = Overrides.bOverride_MaxBitrate ? FMath::Max(Overrides.MaxBitrate, 0) : Settings.MaxBitrate;
+		const int32 RequestedBufferSize = Overrides.bOverride_BufferSize ? FMath::Max(Overrides.BufferSize, 0) : Settings.BufferSize;
+		switch (Settings.RateControl)
+		{
+		case ERTMPRateControl::CRF:
+			Settings.Bitrate = 0;
+			Settings.MaxBitrate = RequestedMaxBitrate;
+			Settings.BufferSize = RequestedBufferSize > 0 ? RequestedBufferSize : Settings.MaxBitrate;
+			break;
+		case ERTMPRateControl::CBR:
+			Settings.Bitrate = VideoBitrate;
+			Settings.MaxBitrate = VideoBitrate;
+			Settings.BufferSize = RequestedBufferSize > 0 ? RequestedBufferSize : VideoBitrate;
+			break;
+		case ERTMPRateControl::VBV:
+			Settings.Bitrate = VideoBitrate;
+			Settings.MaxBitrate = RequestedMaxBitrate > 0 ? RequestedMaxBitrate : int32(FMath::Min(int64(VideoBitrate) * 3 / 2, int64(MAX_int32)));
+			Settings.BufferSize = RequestedBufferSize > 0 ? RequestedBufferSize : Settings.MaxBitrate;
+			break;
+		}
+
+		return Settings;
+	}
+
+	const TCHAR* GetEncoderProfileName(ERTMPEncoderProfile Profile)
+	{
+		switch (Profile)
+		{
+		case ERTMPEncoderProfile::LowLatency: return TEXT("LowLatency");
+		case ERTMPEncoderProfile::Balanced: return TEXT("Balanced");
+		case ERTMPEncoderProfile::Quality: return TEXT("Quality");
+		case ERTMPEncoderProfile::UltraLowLatency: return TEXT("UltraLowLatency");
+		default: return TEXT("Unknown");
+		}
+	}
+
+	FString DescribeEncoderSettings(const FVideoEncoderSettings& Settings)
+	{
+		FString RateControl;
+		switch (Settings.RateControl)
+		{
+		case ERTMPRateControl::CRF:
+			RateControl = FString::Printf(TEXT("CRF %.1f"), Settings.CRF);
+			break;
+		case ERTMPRateControl::CBR:
+			RateControl = FString::Printf(TEXT("CBR %d kbps"), Settings.Bitrate / 1000);
+			break;
+		case ERTMPRateControl::VBV:
+			RateControl = FString::Printf(TEXT("VBV %d kbps"), Settings.Bitrate / 1000);
+			break;
+		}
+		if (Settings.MaxBitrate > 0) {
+			RateControl += FString::Printf(TEXT(" (max %d kbps, buffer %d kbit)"), Settings.MaxBitrate / 1000, Settings.BufferSize / 1000);
+		}
+
+		return FString::Printf(TEXT("preset %s, tune %s, profile %s, GOP %.2fs%s%s, %d B-frames, lookahead %d, %s, %d threads%s"),
+			*Settings.Preset, Settings.Tune.IsEmpty() ? TEXT("none") : *Settings.Tune, Settings.Profile.IsEmpty() ? TEXT("auto") : *Settings.Profile,
+			Settings.GOPSeconds, Settings.bIntraRefresh ? TEXT(" intra refresh") : TEXT(""), Settings.bAlignedKeyframes ? TEXT(" aligned") : TEXT(""), Settings.BFrames, Settings.Lookahead, *RateControl,
+			Settings.Threads, Settings.bSlicedThreads ? TEXT(" (sliced)") : TEXT(""));
+	}
+
+	/**
+	 * Synthetic picture that scrolls diagonally over a noisy gradient, moving enough to give motion estimation work
+	 * without being pure noise that no bitrate can hold.
+	 */
+	static void FillBenchmarkFrame(AVFrame* Frame, const TArray<uint8>& Texture, int32 TextureSize, int32 FrameNumber)
+	{
+		for (int32 Plane = 0; Plane < 3; ++Plane)
+		{
+			const int32 Shift = Plane == 0 ? 0 : 1;
+			const int32 Width = Frame->width >> Shift;
+			const int32 Height = Frame->height >> Shift;
+			const int32 Offset = (FrameNumber * 2) >> Shift;
+			for (int32 Y = 0; Y < Height; ++Y)
+			{
+				uint8* Row = Frame->data[Plane] + Y * Frame->linesize[Plane];
+				const uint8* TextureRow = Texture.GetData() + ((Y + Offset) % TextureSize) * TextureSize;
+				for (int32 X = 0; X < Width; ++X)
+				{
+					const uint8 Value = TextureRow[(X + Offset) % TextureSize];
+					Row[X] = Plane == 0 ? Value : uint8(128 + ((Value - 128) >> 2));
+				}
+			}
+		}
+	}
+
+	/** Deterministic noisy gradient the benchmark frames scroll over, the same for every encoder */
+	static void MakeBenchmarkTexture(TArray<uint8>& Texture, int32 TextureSize)
+	{
+		Texture.SetNumUninitialized(TextureSize * TextureSize);
+		FRandomStream Random(TextureSize);
+		for (int32 Y = 0; Y < TextureSize; ++Y)
+		{
+			for (int32 X = 0; X < TextureSize; ++X)
+			{
+				Texture[Y * TextureSize + X] = uint8(FMath::Clamp(64 + (X + Y) / 8 + Random.RandRange(-24, 24), 0, 255));
+			}
+		}
+	}
+
+	struct FEncoderBenchmarkResult
+	{
+		double ActualKbps = 0.0;
+		double EncodeFps = 0.0;
+		double AverageFrameTime = 0.0;
+		double MaxFrameTime = 0.0;
+		/** From sending a frame until its packet came out */
+		double AverageLatency = 0.0;
+		int64 MaxDelayFrames = 0;
+		double PeakToAverageSize = 0.0;
+	};
+
+	/** Encodes NumFrames synthetic frames, false if the encoder could not be opened with these settings */
+	static bool RunEncoderBenchmark(const FVideoEncoderBackend& Backend, const FVideoEncoderSettings& Settings, int32 Width, int32 Height, const FFrameRate& FrameRate,
+		int32 NumFrames, const TArray<uint8>& Texture, int32 TextureSize, FEncoderBenchmarkResult& OutResult)
+	{
+		const AVCodec* Codec = Backend.FindEncoder();
+		if (Codec == nullptr) {
+			return false;
+		}
+
+		AVCodecContext* CodecCtx = avcodec_alloc_context3(Codec);
+		AVFrame* Frame = av_frame_alloc();
+		AVPacket* Packet = av_packet_alloc();
+		ON_SCOPE_EXIT
+		{
+			av_packet_free(&Packet);
+			av_frame_free(&Frame);
+			avcodec_free_context(&CodecCtx);
+		};
+
+		CodecCtx->width = Width;
+		CodecCtx->height = Height;
+		CodecCtx->time_base = { FrameRate.Denominator, FrameRate.Numerator };
+		CodecCtx->framerate = { FrameRate.Numerator, FrameRate.Denominator };
+		CodecCtx->pix_fmt = AV_PIX_FMT_YUV420P;
+		Backend.ApplySettings(CodecCtx, Settings, FrameRate);
+		if (avcodec_open2(CodecCtx, Codec, nullptr) < 0) {
+			return false;
+		}
+
+		Frame->format = AV_PIX_FMT_YUV420P;
+		Frame->width = Width;
+		Frame->height = Height;
+		if (av_frame_get_buffer(Frame, 0) < 0) {
+			return false;
+		}
+
+		// Latency is from sending a frame until its packet comes out, the delay counts the frames sent in between.
+		TArray<double> SendTimes;
+		SendTimes.SetNumZeroed(NumFrames);
+		int32 NumSent = 0;
+		int64 NumBytes = 0;
+		int32 NumPackets = 0;
+		int32 MaxPacketSize = 0;
+		double TotalLatency = 0.0;
+		auto Receive = [&]()
+		{
+			while (avcodec_receive_packet(CodecCtx, Packet) == 0)
+			{
+				NumBytes += Packet->size;
+				++NumPackets;
+				MaxPacketSize = FMath::Max(MaxPacketSize, Packet->size);
+				if (Packet->pts >= 0 && Packet->pts < NumSent) {
+					TotalLatency += FPlatformTime::Seconds() - SendTimes[int32(Packet->pts)];
+					OutResult.MaxDelayFrames = FMath::Max(OutResult.MaxDelayFrames, NumSent - 1 - Packet->pts);
+				}
+				av_packet_unref(Packet);
+			}
+		};
+
+		const double StartTime = FPlatformTime::Seconds();
+		for (int32 FrameNumber = 0; FrameNumber < NumFrames; ++FrameNumber)
+		{
+			av_frame_make_writable(Frame);
+			FillBenchmarkFrame(Frame, Texture, TextureSize, FrameNumber);
+			Frame->pts = FrameNumber;
+
+			const double FrameStartTime = FPlatformTime::Seconds();
+			SendTimes[FrameNumber] = FrameStartTime;
+			++NumSent;
+			avcodec_send_frame(CodecCtx, Frame);
+			Receive();
+			OutResult.MaxFrameTime = FMath::Max(OutResult.MaxFrameTime, FPlatformTime::Seconds() - FrameStartTime);
+		}
+		avcodec_send_frame(CodecCtx, nullptr);
+		Receive();
+		// Filling the synthetic frames isn't encoding, but it is cheap next to the encoders and counted the same for all of them.
+		const double Seconds = FPlatformTime::Seconds() - StartTime;
+
+		OutResult.ActualKbps = NumBytes * 8.0 / (NumFrames / FrameRate.AsDecimal()) / 1000.0;
+		OutResult.EncodeFps = NumFrames / Seconds;
+		OutResult.AverageFrameTime = Seconds / NumFrames;
+		OutResult.AverageLatency = NumPackets > 0 ? TotalLatency / NumPackets : 0.0;
+		OutResult.PeakToAverageSize = NumPackets > 0 ? MaxPacketSize / (double(NumBytes) / NumPackets) : 0.0;
+		return true;
+	}
+
+	static void LogBenchmarkHeader(const TCHAR* FirstColumn)
+	{
+		UE_LOG(LogRTMP, Display, TEXT("  %-16s %12s %12s %12s %10s %10s %12s %12s %10s"), FirstColumn, TEXT("Target kbps"), TEXT("Actual kbps"), TEXT("Encode fps"),
+			TEXT("ms/frame"), TEXT("Max ms"), TEXT("Latency ms"), TEXT("Delay frames"), TEXT("Peak/avg"));
+	}
+
+	static void LogBenchmarkResult(const TCHAR* Name, int32 BitrateKbps, const FEncoderBenchmarkResult& Result)
+	{
+		UE_LOG(LogRTMP, Display, TEXT("  %-16s %12d %12.0f %12.1f %10.2f %10.2f %12.2f %12lld %10.1f"), Name, BitrateKbps, Result.ActualKbps, Result.EncodeFps,
+			Result.AverageFrameTime * 1000.0, Result.MaxFrameTime * 1000.0, Result.AverageLatency * 1000.0, Result.MaxDelayFrames, Result.PeakToAverageSize);
+	}
+
+	/** Benchmark arguments shared by the console commands, [Width] [Height] [Framerate] [Frames] */
+	static bool ParseBenchmarkArgs(const TArray<FString>& Args, int32& OutWidth, int32& OutHeight, int32& OutFramerate, int32& OutNumFrames)
+	{
+		OutWidth = Args.Num() > 0 ? FCString::Atoi(*Args[0]) : 1920;
+		OutHeight = Args.Num() > 1 ? FCString::Atoi(*Args[1]) : 1080;
+		OutFramerate = Args.Num() > 2 ? FMath::Max(FCString::Atoi(*Args[2]), 1) : 60;
+		OutNumFrames = Args.Num() > 3 ? FMath::Max(FCString::Atoi(*Args[3]), 1) : 300;
+		if (OutWidth <= 0 || OutHeight <= 0 || (OutWidth & 1) != 0 || (OutHeight & 1) != 0) {
+			UE_LOG(LogRTMP, Error, TEXT("Encoder benchmark needs a positive even size, got %dx%d."), OutWidth, OutHeight);
+			return false;
+		}
+		return true;
+	}
+
+	/** Encodes synthetic frames with every profile at every bitrate, logging encode speed and the bitrate x264 actually produced */
+	static void BenchmarkEncoderProfiles(const TArray<FString>& Args)
+	{
+		int32 Width, Height, Framerate, NumFrames;
+		if (!ParseBenchmarkArgs(Args, Width, Height, Framerate, NumFrames)) {
+			return;
+		}
+		TArray<int32> BitratesKbps;
+		for (int32 Index = 4; Index < Args.Num(); ++Index)
+		{
+			BitratesKbps.Add(FMath::Max(FCString::Atoi(*Args[Index]), 100));
+		}
+		if (BitratesKbps.Num() == 0) {
+			BitratesKbps = { 2500, 4500, 6000, 8000 };
+		}
+
+		const FVideoEncoderBackend& Backend = GetEncoderBackend(ERTMPVideoEncoderBackend::X264);
+		if (!Backend.IsAvailable()) {
+			UE_LOG(LogRTMP, Error, TEXT("Encoder benchmark found no %s encoder."), UTF8_TO_TCHAR(Backend.GetEncoderName()));
+			return;
+		}
+
+		const int32 TextureSize = 512;
+		TArray<uint8> Texture;
+		MakeBenchmarkTexture(Texture, TextureSize);
+
+		const FFrameRate FrameRate(Framerate, 1);
+
+		UE_LOG(LogRTMP, Display, TEXT("H.264 encoder profiles with %s at %dx%d %d fps, %d frames:"), UTF8_TO_TCHAR(Backend.GetEncoderName()), Width, Height, Framerate, NumFrames);
+		LogBenchmarkHeader(TEXT("Profile"));
+
+		const ERTMPEncoderProfile Profiles[] = { ERTMPEncoderProfile::UltraLowLatency, ERTMPEncoderProfile::LowLatency, ERTMPEncoderProfile::Balanced, ERTMPEncoderProfile::Quality };
+		for (const ERTMPEncoderProfile Profile : Profiles)
+		{
+			for (int32 BitrateKbps : BitratesKbps)
+			{
+				const FVideoEncoderSettings Settings = ResolveEncoderSettings(Profile, FRTMPVideoEncoderOverrides(), BitrateKbps * 1000, FrameRate);
+				FEncoderBenchmarkResult Result;
+				if (!RunEncoderBenchmark(Backend, Settings, Width, Height, FrameRate, NumFrames, Texture, TextureSize, Result)) {
+					UE_LOG(LogRTMP, Error, TEXT("  %-16s %12d could not open the encoder."), GetEncoderProfileName(Profile), BitrateKbps);
+					continue;
+				}
+				LogBenchmarkResult(GetEncoderProfileName(Profile), BitrateKbps, Result);
+			}
+
+			UE_LOG(LogRTMP, Display, TEXT("    %s: %s"), GetEncoderProfileName(Profile), *DescribeEncoderSettings(ResolveEncoderSettings(Profile, FRTMPVideoEncoderOverrides(), BitratesKbps[0] * 1000, FrameRate)));
+		}
+	}
+
+	static FAutoConsoleCommand BenchmarkEncoderProfilesCommand(
+		TEXT("RTMP.BenchmarkEncoderProfiles"),
+		TEXT("Encodes a synthetic scrolling picture with every x264 profile at every bitrate and logs encode fps, the bitrate reached, encoder latency and frame size peaks. Usage: RTMP.BenchmarkEncoderProfiles [Width] [Height] [Framerate] [Frames] [Kbps...]"),
+		FConsoleCommandWithArgsDelegate::CreateStatic(&BenchmarkEncoderProfiles));
+
+	/** Encodes the same synthetic frames with every encoder backend the linked ffmpeg has, at one profile and bitrate */
+	static void BenchmarkEncoderBackends(const TArray<FString>& Args)
+	{
+		int32 Width, Height, Framerate, NumFrames;
+		if (!ParseBenchmarkArgs(Args, Width, Height, Framerate, NumFrames)) {
+			return;
+		}
+		const int32 BitrateKbps = Args.Num() > 4 ? FMath::Max(FCString::Atoi(*Args[4]), 100) : 4500;
+		ERTMPEncoderProfile Profile = ERTMPEncoderProfile::LowLatency;
+		if (Args.Num() > 5) {
+			const ERTMPEncoderProfile Profiles[] = { ERTMPEncoderProfile::LowLatency, ERTMPEncoderProfile::Balanced, ERTMPEncoderProfile::Quality, ERTMPEncoderProfile::UltraLowLatency };
+			bool bFound = false;
+			for (const ERTMPEncoderProfile Candidate : Profiles)
+			{
+				if (Args[5].Equals(GetEncoderProfileName(Candidate), ESearchCase::IgnoreCase)) {
+					Profile = Candidate;
+					bFound = true;
+				}
+			}
+			if (!bFound) {
+				UE_LOG(LogRTMP, Error, TEXT("Unknown encoder profile '%s'."), *Args[5]);
+				return;
+			}
+		}
+
+		const int32 TextureSize = 512;
+		TArray<uint8> Texture;
+		MakeBenchmarkTexture(Texture, TextureSize);
+
+		const FFrameRate FrameRate(Framerate, 1);
+		const FVideoEncoderSettings ProfileSettings = ResolveEncoderSettings(Profile, FRTMPVideoEncoderOverrides(), BitrateKbps * 1000, FrameRate);
+
+		UE_LOG(LogRTMP, Display, TEXT("Encoder backends with the %s profile at %dx%d %d fps, %d frames:"), GetEncoderProfileName(Profile), Width, Height, Framerate, NumFrames);
+		LogBenchmarkHeader(TEXT("Encoder"));
+
+		for (const ERTMPVideoEncoderBackend Type : GetEncoderBackends())
+		{
+			const FVideoEncoderBackend& Backend = GetEncoderBackend(Type);
+			if (!Backend.IsAvailable()) {
+				UE_LOG(LogRTMP, Display, TEXT("  %-16s not in this ffmpeg build (%s)."), GetEncoderBackendName(Type), UTF8_TO_TCHAR(Backend.GetEncoderName()));
+				continue;
+			}
+
+			const FVideoEncoderSettings Settings = Backend.AdaptSettings(ProfileSettings, BitrateKbps * 1000);
+			FEncoderBenchmarkResult Result;
+			if (!RunEncoderBenchmark(Backend, Settings, Width, Height, FrameRate, NumFrames, Texture, TextureSize, Result)) {
+				UE_LOG(LogRTMP, Error, TEXT("  %-16s %12d could not open the encoder."), GetEncoderBackendName(Type), BitrateKbps);
+				continue;
+			}
+			LogBenchmarkResult(GetEncoderBackendName(Type), BitrateKbps, Result);
+			UE_LOG(LogRTMP, Display, TEXT("    %s: %s"), GetEncoderBackendName(Type), *DescribeEncoderCapabilities(Backend.GetCapabilities()));
+		}
+	}
+
+	static FAutoConsoleCommand BenchmarkEncoderBackendsCommand(
+		TEXT("RTMP.BenchmarkEncoderBackends"),
+		TEXT("Encodes the same synthetic scrolling picture with every available encoder backend and logs encode fps, the bitrate reached, encoder latency and frame size peaks. Usage: RTMP.BenchmarkEncoderBackends [Width] [Height] [Framerate] [Frames] [Kbps] [Profile]"),
+		FConsoleCommandWithArgsDelegate::CreateStatic(&BenchmarkEncoderBackends));
+}
@@ -0,0 +1,172 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "ViewportReadbackSurface.h"
+#include "DataStructures.h"
+#include "Modules/ModuleManager.h"
+#include "RenderingThread.h"
+#include "RHICommandList.h"
+#include "RHIStaticStates.h"
+#include "PipelineStateCache.h"
+#include "CommonRenderResources.h"
+#include "ScreenRendering.h"
+#include "RendererInterface.h"
+#include "RenderGraphUtils.h"
+#include "RGBToYUVShader.h"
+
+FViewportReadbackSurface::FViewportReadbackSurface(EPixelFormat InPixelFormat, FIntPoint InBufferSize, ERTMPFrameFormat InOutputFormat)
+	: PixelFormat(InPixelFormat)
+	, BufferSize(InBufferSize)
+	, CaptureRect(0, 0, InBufferSize.X, InBufferSize.Y)
+	, WindowSize(InBufferSize)
+	, OutputFormat(InOutputFormat)
+	, YUVCoefficients(RTMPVideo::GetYUVCoefficients(ERTMPColorMatrix::BT601, ERTMPColorRange::Limited))
+	, bInFlight(false)
+{
+	ENQUEUE_RENDER_COMMAND(CreateViewportReadbackSurface)(
+		[this](FRHICommandListImmediate& RHICmdList)
+		{
+			InitRHI();
+		});
+}
+
+void FViewportReadbackSurface::InitRHI()
+{
+	FRHIResourceCreateInfo CreateInfo;
+
+	if (OutputFormat == ERTMPFrameFormat::BGRA) {
+		ResolveTexture = RHICreateTexture2D(BufferSize.X, BufferSize.Y, PixelFormat, 1, 1, TexCreate_RenderTargetable, CreateInfo);
+		ReadbackTexture = RHICreateTexture2D(BufferSize.X, BufferSize.Y, PixelFormat, 1, 1, TexCreate_CPUReadback, CreateInfo);
+	}
+	else {
+		// All three planes in one texture so a single copy and map reads the whole frame back.
+		const int32 YUVHeight = BufferSize.Y * 3 / 2;
+		ResolveTexture = RHICreateTexture2D(BufferSize.X, BufferSize.Y, PixelFormat, 1, 1, TexCreate_RenderTargetable | TexCreate_ShaderResource, CreateInfo);
+		YUVTexture = RHICreateTexture2D(BufferSize.X, YUVHeight, PF_R8_UINT, 1, 1, TexCreate_UAV | TexCreate_ShaderResource, CreateInfo);
+		YUVTextureUAV = RHICreateUnorderedAccessView(YUVTexture, 0);
+		ReadbackTexture = RHICreateTexture2D(BufferSize.X, YUVHeight, PF_R8_UINT, 1, 1, TexCreate_CPUReadback, CreateInfo);
+	}
+	ReadbackFence = RHICreateGPUFence(TEXT("ViewportReadbackFence"));
+}
+
+void FViewportReadbackSurface::Resolve(FRHICommandListImmediate& RHICmdList, FRHITexture2D* SourceBackBuffer)
+{
+	check(IsInRenderingThread());
+	check(!bInFlight);
+
+	static const FName RendererModuleName("Renderer");
+	IRendererModule* RendererModule = &FModuleManager::GetModuleChecked<IRendererModule>(RendererModuleName);
+
+	FRHIRenderPassInfo RPInfo(ResolveTexture, ERenderTargetActions::DontLoad_Store);
+	RHICmdList.BeginRenderPass(RPInfo, TEXT("ViewportReadbackResolve"));
+	{
+		RHICmdList.SetViewport(0, 0, 0.0f, BufferSize.X, BufferSize.Y, 1.0f);
+
+		FGraphicsPipelineStateInitializer GraphicsPSOInit;
+		RHICmdList.ApplyCachedRenderTargets(GraphicsPSOInit);
+		GraphicsPSOInit.BlendState = TStaticBlendState<>::GetRHI();
+		GraphicsPSOInit.RasterizerState = TStaticRasterizerState<>::GetRHI();
+		GraphicsPSOInit.DepthStencilState = TStaticDepthStencilState<false, CF_Always>::GetRHI();
+
+		FGlobalShaderMap* ShaderMap = GetGlobalShaderMap(GMaxRHIFeatureLevel);
+		TShaderMapRef<FScreenVS> VertexShader(ShaderMap);
+		TShaderMapRef<FScreenPS> PixelShader(ShaderMap);
+
+		GraphicsPSOInit.BoundShaderState.VertexDeclarationRHI = GFilterVertexDeclaration.VertexDeclarationRHI;
+		GraphicsPSOInit.BoundShaderState.VertexShaderRHI = VertexShader.GetVertexShader();
+		GraphicsPSOInit.BoundShaderState.PixelShaderRHI = PixelShader.GetPixelShader();
+		GraphicsPSOInit.PrimitiveType = PT_TriangleList;
+
+		SetGraphicsPipelineState(RHICmdList, GraphicsPSOInit);
+
+		// Point sampling when nothing is scaled, the pixels then come out exactly as presented.
+		const FIntPoint SourceSize(SourceBackBuffer->GetSizeX(), SourceBackBuffer->GetSizeY());
+		const bool bUnscaled = SourceSize == WindowSize || SourceSize == BufferSize;
+		if (bUnscaled) {
+			PixelShader->SetParameters(RHICmdList, TStaticSamplerState<SF_Point>::GetRHI(), SourceBackBuffer);
+		}
+		else {
+			PixelShader->SetParameters(RHICmdList, TStaticSamplerState<SF_Bilinear>::GetRHI(), SourceBackBuffer);
+		}
+
+		const float U = float(CaptureRect.Min.X) / float(SourceSize.X);
+		const float V = float(CaptureRect.Min.Y) / float(SourceSize.Y);
+		const float SizeU = float(CaptureRect.Max.X) / float(SourceSize.X) - U;
+		const float SizeV = float(CaptureRect.Max.Y) / float(SourceSize.Y) - V;
+
+		RendererModule->DrawRectangle(
+			RHICmdList,
+			0, 0,
+			BufferSize.X, BufferSize.Y,
+			U, V,
+			SizeU, SizeV,
+			BufferSize,
+			FIntPoint(1, 1),
+			VertexShader,
+			EDRF_Default);
+	}
+	RHICmdList.EndRenderPass();
+
+	// Queued behind the draw, the fence signals once the staging texture holds the pixels.
+	ReadbackFence->Clear();
+	if (OutputFormat == ERTMPFrameFormat::BGRA) {
+		RHICmdList.CopyToResolveTarget(ResolveTexture, ReadbackTexture, FResolveParams());
+	}
+	else {
+		ConvertToYUV(RHICmdList);
+		RHICmdList.CopyTexture(YUVTexture, ReadbackTexture, FRHICopyTextureInfo());
+	}
+	RHICmdList.WriteGPUFence(ReadbackFence);
+
+	bInFlight = true;
+}
+
+void FViewportReadbackSurface::ConvertToYUV(FRHICommandListImmediate& RHICmdList)
+{
+	FRTMPRGBToYUVCS::FParameters Parameters;
+	Parameters.InputTexture = ResolveTexture;
+	Parameters.OutputTexture = YUVTextureUAV;
+	Parameters.Size = BufferSize;
+	Parameters.YCoefficients = FIntVector4(YUVCoefficients.Y[0], YUVCoefficients.Y[1], YUVCoefficients.Y[2], YUVCoefficients.Y[3]);
+	Parameters.UCoefficients = FIntVector4(YUVCoefficients.U[0], YUVCoefficients.U[1], YUVCoefficients.U[2], YUVCoefficients.U[3]);
+	Parameters.VCoefficients = FIntVector4(YUVCoefficients.V[0], YUVCoefficients.V[1], YUVCoefficients.V[2], YUVCoefficients.V[3]);
+	Parameters.bInterleavedChroma = OutputFormat == ERTMPFrameFormat::NV12 ? 1 : 0;
+
+	TShaderMapRef<FRTMPRGBToYUVCS> ComputeShader(GetGlobalShaderMap(GMaxRHIFeatureLevel));
+
+	RHICmdList.TransitionResource(EResourceTransitionAccess::EReadable, ResolveTexture);
+	RHICmdList.TransitionResource(EResourceTransitionAccess::ERWBarrier, EResourceTransitionPipeline::EGfxToCompute, YUVTextureUAV);
+
+	// One thread per 2x2 block
+	FComputeShaderUtils::Dispatch(RHICmdList, ComputeShader, Parameters, FComputeShaderUtils::GetGroupCount(BufferSize / 2, FRTMPRGBToYUVCS::ThreadGroupSize));
+
+	RHICmdList.TransitionResource(EResourceTransitionAccess::EReadable, EResourceTransitionPipeline::EComputeToGfx, YUVTextureUAV);
+}
+
+bool FViewportReadbackSurface::IsReadbackReady() const
+{
+	return bInFlight && ReadbackFence->Poll();
+}
+
+double FViewportReadbackSurface::ReadBack(FRHICommandListImmediate& RHICmdList, TFunctionRef<void(const uint8*, int32)> Callback)
+{
+	check(IsInRenderingThread());
+	check(bInFlight);
+
+	void* ColorData = nullptr;
+	int32 Width = 0;
+	int32 Height = 0;
+
+	const double MapStartTime = FPlatformTime::Seconds();
+	RHICmdList.MapStagingSurface(ReadbackTexture, ColorData, Width, Height);
+	const double MapWaitTime = FPlatformTime::Seconds() - MapStartTime;
+
+	// Width is the row pitch of the mapping in pixels, it may be larger than the surface.
+	const int32 BytesPerPixel = OutputFormat == ERTMPFrameFormat::BGRA ? 4 : 1;
+	Callback(static_cast<const uint8*>(ColorData), Width * BytesPerPixel);
+
+	RHICmdList.UnmapStagingSurface(ReadbackTexture);
+	bInFlight = false;
+
+	return MapWaitTime;
+}
@@ -0,0 +1,17 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+namespace RTMPAudio
+{
+	/**
+	 * Splits interleaved float samples into planes, clamped to [-1, 1].
+	 * Stereo -> stereo and mono -> mono/stereo go through the vectorized path,
+	 * multichannel input (FL FR FC LFE SL SR BL BR) is folded down to the requested channel count, each input channel
+	 * counted once: kept where the output has it, mixed into its neighbours where it doesn't.
+	 * Does not allocate, safe to call on the audio render thread.
+	 */
+	RTMP_API void DeinterleaveToPlanes(const float* Interleaved, int32 NumInputChannels, float* const* OutPlanes, int32 NumOutputChannels, int32 NumFrames);
+}
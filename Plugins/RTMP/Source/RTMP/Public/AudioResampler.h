@@ -0,0 +1,76 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "AudioRingBuffer.h"
+
+struct FAudioResamplerStats
+{
+	/** Submix format currently converted from */
+	FAudioRingBufferFormat InputFormat;
+	/** True when the submix already matches the encoder and samples are copied without conversion */
+	bool bPassthrough = false;
+	int32 NumFormatChanges = 0;
+	int64 FramesIn = 0;
+	int64 FramesOut = 0;
+};
+
+/**
+ * Turns submix audio from the ring buffer into encoder sized FLTP frames.
+ * Keyed off the format the submix actually delivers: when sample rate or channel layout differ from
+ * the encoder the audio goes through swresample (resampling, 5.1/7.1 remixing), and the conversion is
+ * rebuilt whenever the audio device format changes. The audio device clock drives swr compensation so
+ * the output stays in step with the device over long sessions.
+ * Only used from the encode thread.
+ */
+class RTMP_API FAudioResampler
+{
+public:
+	FAudioResampler(int32 InOutSampleRate, uint64 InOutChannelLayout);
+	~FAudioResampler();
+
+	FAudioResampler(const FAudioResampler&) = delete;
+	FAudioResampler& operator=(const FAudioResampler&) = delete;
+
+	/**
+	 * Fills Frame->nb_samples samples of Frame, which must be FLTP in the encoder rate and layout.
+	 * @param OutAudioClock	Audio device clock of the first sample in Frame.
+	 * @return false when not enough audio is buffered yet.
+	 */
+	bool ReadFrame(FAudioRingBuffer& Ring, struct AVFrame* Frame, double& OutAudioClock);
+
+	FAudioResamplerStats GetStats() const;
+
+	/** Channel layout of audio delivered by an audio mixer submix with NumChannels channels */
+	static uint64 GetSubmixChannelLayout(int32 NumChannels);
+
+private:
+	bool Configure(const FAudioRingBufferFormat& Format);
+	bool ConvertReadable(FAudioRingBuffer& Ring);
+	void ReleaseConverter();
+
+	const int32 OutSampleRate;
+	const uint64 OutChannelLayout;
+	const int32 OutNumChannels;
+
+	FAudioRingBufferFormat InputFormat;
+	bool bPassthrough;
+
+	struct SwrContext* SwrCtx;
+
+	/** Converted audio waiting to fill a whole encoder frame */
+	struct AVAudioFifo* OutputFifo;
+	/** Audio clock just past the last sample written to OutputFifo */
+	double OutputFifoEndClock;
+
+	/** Ring plane index feeding each swr input channel, the mixer and ffmpeg order 7.1 differently */
+	int32 InputPlaneOrder[FAudioRingBuffer::MaxChannels];
+
+	/** Planar scratch buffers for ring reads and swr output */
+	TArray<float> InputScratch;
+	TArray<float> OutputScratch;
+	int32 OutputScratchFrames;
+
+	FAudioResamplerStats Stats;
+};
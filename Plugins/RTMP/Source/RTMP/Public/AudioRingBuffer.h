@@ -0,0 +1,116 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+#include <atomic>
+
+struct FAudioRingBufferStats
+{
+	int64 FramesWritten = 0;
+	int64 FramesRead = 0;
+	/** Writes rejected because the ring did not have room for them */
+	int64 NumOverflows = 0;
+	int64 DroppedFrames = 0;
+	/** Writes rejected while the consumer switches to a new submix format */
+	int64 FormatChangeDroppedFrames = 0;
+	/** Highest number of readable frames seen by the producer */
+	int32 HighWaterMark = 0;
+};
+
+/** Sample rate and channel count of the audio stored in the ring */
+struct FAudioRingBufferFormat
+{
+	int32 SampleRate = 0;
+	int32 NumChannels = 0;
+
+	bool IsValid() const { return SampleRate > 0 && NumChannels > 0; }
+};
+
+/**
+ * Fixed capacity single producer / single consumer ring of planar float audio.
+ * The producer hands in interleaved submix samples which are deinterleaved straight into
+ * the channel planes, the consumer copies planes out.
+ * Write is wait-free and allocation free, meant to be called from the audio render thread,
+ * everything else is called from the encode thread. Capacity is rounded up to a power of two.
+ *
+ * The ring stores audio in the format the submix delivers it. When that format changes the producer
+ * drops audio and requests the new format, the consumer drains what is left and then applies it.
+ */
+class RTMP_API FAudioRingBuffer
+{
+public:
+	static const int32 MaxChannels = 8;
+
+	FAudioRingBuffer(int32 InCapacityFrames);
+
+	FAudioRingBuffer(const FAudioRingBuffer&) = delete;
+	FAudioRingBuffer& operator=(const FAudioRingBuffer&) = delete;
+
+	/**
+	 * Producer side. Writes all NumFrames or nothing, returns false when the ring is too full
+	 * or the audio is not in the current ring format.
+	 * @param AudioClock	Audio device clock of the first frame, in seconds.
+	 */
+	bool WriteInterleaved(const float* Interleaved, int32 NumFrames, int32 NumChannels, int32 SampleRate, double AudioClock);
+
+	/** Consumer side. Reads exactly NumFrames into one plane per channel, returns false when fewer are available */
+	bool ReadPlanar(float* const* OutPlanes, int32 NumFrames);
+
+	/** Consumer side. Audio clock of the next frame to read, false until the producer wrote anything */
+	bool GetReadClock(double& OutAudioClock) const;
+
+	/** Frames available to the consumer */
+	int32 NumReadable() const;
+
+	/** Consumer side. Format of the readable frames */
+	FAudioRingBufferFormat GetFormat() const;
+
+	/** Consumer side. True when the producer is waiting for the ring to switch to OutFormat */
+	bool GetRequestedFormat(FAudioRingBufferFormat& OutFormat) const;
+
+	/**
+	 * Consumer side. Discards whatever is still readable and switches the ring to Format, which the consumer is set up
+	 * for. Returns false when the producer requested another format meanwhile, the ring then still needs to switch.
+	 */
+	bool ApplyRequestedFormat(const FAudioRingBufferFormat& Format);
+
+	int32 GetCapacity() const;
+
+	/** Drops everything buffered, only safe while neither side is running */
+	void Reset();
+
+	FAudioRingBufferStats GetStats() const;
+
+private:
+	static int64 PackFormat(int32 SampleRate, int32 NumChannels);
+	static FAudioRingBufferFormat UnpackFormat(int64 PackedFormat);
+
+	float* GetPlane(int32 Channel);
+
+	int32 Capacity;
+	uint32 Mask;
+
+	/** MaxChannels planes of Capacity samples each, only the first NumChannels of the current format are used */
+	TArray<float, TAlignedHeapAllocator<16>> Samples;
+
+	/** Monotonic frame positions, only the owning side stores to its position */
+	alignas(PLATFORM_CACHE_LINE_SIZE) std::atomic<uint64> WritePosition;
+	alignas(PLATFORM_CACHE_LINE_SIZE) std::atomic<uint64> ReadPosition;
+
+	/** Format of the stored frames, owned by the consumer */
+	std::atomic<int64> ActiveFormat;
+	/** Last format seen by the producer, owned by the producer */
+	std::atomic<int64> RequestedFormat;
+
+	/** Audio clock of the frame at ClockAnchorPosition, published by the producer under a sequence lock */
+	std::atomic<uint32> ClockSequence;
+	std::atomic<uint64> ClockAnchorPosition;
+	std::atomic<double> ClockAnchorTime;
+
+	std::atomic<int64> NumOverflows;
+	std::atomic<int64> DroppedFrames;
+	std::atomic<int64> FormatChangeDroppedFrames;
+	std::atomic<int32> HighWaterMark;
+};
@@ -0,0 +1,199 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "HAL/Event.h"
+#include "HAL/PlatformProcess.h"
+#include "HAL/PlatformTime.h"
+#include "Misc/ScopeLock.h"
+#include "DataStructures.h"
+
+struct FBoundedQueueStats
+{
+	/** Elements accepted by the queue */
+	int64 NumEnqueued = 0;
+	/** Elements thrown away by the overflow policy */
+	int64 NumDropped = 0;
+	/** Highest number of elements queued at once */
+	int32 HighWaterMark = 0;
+	/** Total time producers spent blocked on a full queue */
+	double BlockedSeconds = 0.0;
+};
+
+/**
+ * Fixed capacity FIFO queue with a configurable overflow policy.
+ * Storage is allocated once at construction, so enqueueing never allocates.
+ * Thread safe for any number of producers and consumers.
+ */
+template<typename ElementType>
+class TBoundedQueue
+{
+public:
+	TBoundedQueue(int32 InCapacity, ERTMPQueueOverflowPolicy InOverflowPolicy)
+		: OverflowPolicy(InOverflowPolicy)
+		, Head(0)
+		, Count(0)
+		, bReleaseProducers(false)
+	{
+		check(InCapacity > 0);
+		Slots.SetNum(InCapacity);
+		SpaceAvailableEvent = FPlatformProcess::GetSynchEventFromPool(false);
+	}
+
+	~TBoundedQueue()
+	{
+		FPlatformProcess::ReturnSynchEventToPool(SpaceAvailableEvent);
+		SpaceAvailableEvent = nullptr;
+	}
+
+	TBoundedQueue(const TBoundedQueue&) = delete;
+	TBoundedQueue& operator=(const TBoundedQueue&) = delete;
+
+	/**
+	 * Adds an element to the tail of the queue, applying the overflow policy when the queue is full.
+	 * @return false if Element was not queued (dropped as newest, or the producer was released while blocked).
+	 */
+	bool Enqueue(ElementType&& Element)
+	{
+		double BlockStartTime = 0.0;
+
+		while (true)
+		{
+			FScopeLock Lock(&CriticalSection);
+
+			if (BlockStartTime > 0.0) {
+				Stats.BlockedSeconds += FPlatformTime::Seconds() - BlockStartTime;
+				BlockStartTime = 0.0;
+			}
+
+			if (Count == Slots.Num()) {
+				if (OverflowPolicy == ERTMPQueueOverflowPolicy::DropOldest) {
+					Slots[Head] = ElementType();
+					Head = (Head + 1) % Slots.Num();
+					--Count;
+					++Stats.NumDropped;
+				}
+				else if (OverflowPolicy == ERTMPQueueOverflowPolicy::DropNewest || bReleaseProducers) {
+					++Stats.NumDropped;
+					return false;
+				}
+				else {
+					BlockStartTime = FPlatformTime::Seconds();
+				}
+			}
+
+			if (BlockStartTime == 0.0) {
+				Slots[(Head + Count) % Slots.Num()] = MoveTemp(Element);
+				++Count;
+				++Stats.NumEnqueued;
+				Stats.HighWaterMark = FMath::Max(Stats.HighWaterMark, Count);
+				return true;
+			}
+
+			// Wait outside of the lock for the consumer to make room, re-checking periodically
+			// as a single dequeue only wakes one of several blocked producers.
+			FScopeUnlock Unlock(&CriticalSection);
+			SpaceAvailableEvent->Wait(5);
+		}
+	}
+
+	/** Removes the element at the head of the queue */
+	bool Dequeue(ElementType& OutElement)
+	{
+		{
+			FScopeLock Lock(&CriticalSection);
+			if (Count == 0) {
+				return false;
+			}
+
+			OutElement = MoveTemp(Slots[Head]);
+			Slots[Head] = ElementType();
+			Head = (Head + 1) % Slots.Num();
+			--Count;
+		}
+
+		SpaceAvailableEvent->Trigger();
+		return true;
+	}
+
+	/** Copies the element at the head of the queue without removing it */
+	bool Peek(ElementType& OutElement) const
+	{
+		FScopeLock Lock(&CriticalSection);
+		if (Count == 0) {
+			return false;
+		}
+
+		OutElement = Slots[Head];
+		return true;
+	}
+
+	bool IsEmpty() const
+	{
+		FScopeLock Lock(&CriticalSection);
+		return Count == 0;
+	}
+
+	int32 Num() const
+	{
+		FScopeLock Lock(&CriticalSection);
+		return Count;
+	}
+
+	int32 GetCapacity() const
+	{
+		return Slots.Num();
+	}
+
+	/** Drops every queued element, not counted as overflow drops */
+	void Empty()
+	{
+		{
+			FScopeLock Lock(&CriticalSection);
+			for (ElementType& Slot : Slots)
+			{
+				Slot = ElementType();
+			}
+			Head = 0;
+			Count = 0;
+		}
+
+		SpaceAvailableEvent->Trigger();
+	}
+
+	/**
+	 * Stops blocking producers, full queue drops the newest element from now on.
+	 * Must be called before the consumer goes away when using ERTMPQueueOverflowPolicy::BlockProducer.
+	 */
+	void ReleaseProducers()
+	{
+		{
+			FScopeLock Lock(&CriticalSection);
+			bReleaseProducers = true;
+		}
+
+		SpaceAvailableEvent->Trigger();
+	}
+
+	FBoundedQueueStats GetStats() const
+	{
+		FScopeLock Lock(&CriticalSection);
+		return Stats;
+	}
+
+private:
+	const ERTMPQueueOverflowPolicy OverflowPolicy;
+
+	mutable FCriticalSection CriticalSection;
+
+	/** Ring storage, never resized after construction */
+	TArray<ElementType> Slots;
+	int32 Head;
+	int32 Count;
+
+	bool bReleaseProducers;
+	FEvent* SpaceAvailableEvent;
+
+	FBoundedQueueStats Stats;
+};
@@ -0,0 +1,102 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+enum class ERTMPColorMatrix : uint8;
+enum class ERTMPColorRange : uint8;
+
+/** Pixel layout of captured frames, YUV formats are 4:2:0 with planes stored back to back */
+enum class ERTMPFrameFormat : uint8
+{
+	BGRA,
+	/** Y plane, then U and V planes of half width and height */
+	I420,
+	/** Y plane, then one half height plane of interleaved U and V */
+	NV12,
+};
+
+/** Implementations of the CPU BGRA -> YUV conversion, all of them produce identical output */
+enum class ERTMPColorKernel : uint8
+{
+	Scalar,
+	SSE41,
+	AVX2,
+	AVX512,
+	Num
+};
+
+/**
+ * Integer RGB -> YUV matrix.
+ * Each row holds the R, G and B weights in 1/256 units followed by the output offset * 256 + 128 (rounding),
+ * a component is (R * [0] + G * [1] + B * [2] + [3]) >> 8 clamped to a byte. Shared by the GPU and CPU paths.
+ */
+struct FYUVCoefficients
+{
+	int32 Y[4];
+	int32 U[4];
+	int32 V[4];
+};
+
+/** Plane pointers into a YUV 4:2:0 image */
+struct FYUV420Planes
+{
+	uint8* Y = nullptr;
+	uint8* U = nullptr;
+	uint8* V = nullptr;
+	int32 YPitch = 0;
+	int32 UPitch = 0;
+	int32 VPitch = 0;
+	/** Bytes between two chroma samples, 1 for I420 and 2 for NV12 where U and V are interleaved */
+	int32 ChromaStep = 1;
+};
+
+namespace RTMPVideo
+{
+	/** Coefficients of a BT.601 or BT.709 matrix, for limited (16-235) or full (0-255) range output */
+	RTMP_API const FYUVCoefficients& GetYUVCoefficients(ERTMPColorMatrix Matrix, ERTMPColorRange Range);
+
+	/** Bytes taken by a tightly packed frame */
+	RTMP_API int32 GetFrameSize(ERTMPFrameFormat Format, int32 Width, int32 Height);
+
+	/** Plane layout of a tightly packed I420 or NV12 buffer */
+	RTMP_API FYUV420Planes GetPackedPlanes(uint8* Buffer, ERTMPFrameFormat Format, int32 Width, int32 Height);
+
+	/**
+	 * Scalar BGRA -> YUV 4:2:0 conversion, the reference for every other path.
+	 * Chroma is taken from the rounded average of each 2x2 block. Width and Height must be even.
+	 */
+	RTMP_API void ConvertBGRAToYUV420Reference(const uint8* BGRA, int32 BGRAPitch, int32 Width, int32 Height, const FYUV420Planes& Planes, const FYUVCoefficients& Coefficients);
+
+	/** Same as the reference, using the fastest kernel the CPU supports (picked once through CPUID) */
+	RTMP_API void ConvertBGRAToYUV420(const uint8* BGRA, int32 BGRAPitch, int32 Width, int32 Height, const FYUV420Planes& Planes, const FYUVCoefficients& Coefficients);
+
+	/** Same as the reference, using the given kernel which must be supported */
+	RTMP_API void ConvertBGRAToYUV420(ERTMPColorKernel Kernel, const uint8* BGRA, int32 BGRAPitch, int32 Width, int32 Height, const FYUV420Planes& Planes, const FYUVCoefficients& Coefficients);
+
+	/**
+	 * Same as ConvertBGRAToYUV420, split into NumSlices horizontal slices converted in parallel on the task graph.
+	 * Slices are whole 2x2 block rows, one slice converts on the calling thread.
+	 */
+	RTMP_API void ConvertBGRAToYUV420Sliced(const uint8* BGRA, int32 BGRAPitch, int32 Width, int32 Height, const FYUV420Planes& Planes, const FYUVCoefficients& Coefficients, int32 NumSlices);
+
+	/** Slices worth splitting a frame of the given height into on this machine */
+	RTMP_API int32 GetDefaultConversionSlices(int32 Height);
+
+	RTMP_API bool IsColorKernelSupported(ERTMPColorKernel Kernel);
+
+	/** Kernel ConvertBGRAToYUV420 dispatches to */
+	RTMP_API ERTMPColorKernel GetBestColorKernel();
+
+	RTMP_API const TCHAR* GetColorKernelName(ERTMPColorKernel Kernel);
+
+	/**
+	 * Width and height from the first two console arguments, or the defaults when they are missing.
+	 * Logs and returns false unless both are positive and even, the 4:2:0 formats need whole 2x2 blocks.
+	 */
+	RTMP_API bool ParseEvenFrameSize(const TArray<FString>& Args, int32 DefaultWidth, int32 DefaultHeight, const TCHAR* What, int32& OutWidth, int32& OutHeight);
+
+	/** Tightly packed BGRA noise, seeded by the size so every run converts the same pixels */
+	RTMP_API void FillRandomBGRA(TArray<uint8>& OutPixels, int32 Width, int32 Height);
+}
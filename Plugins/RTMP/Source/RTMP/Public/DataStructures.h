@@ -3,14 +3,269 @@
 #pragma once
 
 #include "CoreMinimal.h"
+#include "Misc/FrameRate.h"
+#include "FramePool.h"
+#include "ColorConversion.h"
 #include "DataStructures.generated.h"
 
+UENUM(BlueprintType)
+enum class ERTMPQueueOverflowPolicy : uint8
+{
+	/** Drop the oldest queued element to make room for the new one */
+	DropOldest,
+	/** Drop the new element, keeping what is already queued */
+	DropNewest,
+	/** Block the producer until the consumer makes room */
+	BlockProducer,
+};
+
+UENUM(BlueprintType)
+enum class ERTMPReadbackMode : uint8
+{
+	/** Read back FrameGrabLatency captures after resolving, waiting on the render thread for the GPU copy if needed */
+	Blocking,
+	/** Read back once the GPU copy's fence signaled, a capture finding every surface busy is dropped instead of waiting */
+	Polled,
+};
+
+UENUM(BlueprintType)
+enum class ERTMPColorMatrix : uint8
+{
+	/** SD matrix, what most players assume for untagged streams */
+	BT601,
+	/** HD matrix */
+	BT709,
+};
+
+UENUM(BlueprintType)
+enum class ERTMPColorRange : uint8
+{
+	/** Luma in 16-235 and chroma in 16-240, the broadcast default */
+	Limited,
+	/** All 256 levels */
+	Full,
+};
+
+UENUM(BlueprintType)
+enum class ERTMPEncoderProfile : uint8
+{
+	/** zerolatency tune, no B-frames or lookahead, CBR, 1s GOP. For interactive streams */
+	LowLatency,
+	/** veryfast preset with B-frames and a short lookahead, VBV capped, 2s GOP */
+	Balanced,
+	/** medium preset with a long lookahead, VBV capped, 2s GOP. Needs a lot more CPU */
+	Quality,
+	/**
+	 * For cloud play: LowLatency with periodic intra refresh instead of IDR frames and a VBV buffer of one frame,
+	 * so no frame is much larger than the others and none waits in the encoder
+	 */
+	UltraLowLatency,
+};
+
+/** Video encoders of the linked ffmpeg build, only H.264 ones can be published over RTMP */
+UENUM(BlueprintType)
+enum class ERTMPVideoEncoderBackend : uint8
+{
+	/** libx264, H.264 */
+	X264,
+	/** libopenh264, H.264 without B-frames or constant quality, cheap on weak CPUs */
+	OpenH264,
+	/** libx265, HEVC */
+	X265,
+	/** libsvtav1, AV1 */
+	SVTAV1,
+	/** libvpx-vp9, VP9 */
+	VPX,
+};
+
+/** Container of an output. The file containers are written one GOP at a time, so a crash loses at most the GOP being written */
+UENUM(BlueprintType)
+enum class ERTMPOutputContainer : uint8
+{
+	/** Guessed from the URL's extension, FLV for rtmp:// and MPEG-TS for udp:// and srt:// URLs */
+	Auto,
+	/** What RTMP carries, H.264 only */
+	FLV,
+	/** Fragmented MP4, one fragment per GOP with the sample index moved to the front when closed cleanly */
+	FragmentedMP4,
+	/** Matroska, one cluster per GOP with room for the seek index reserved at the front */
+	Matroska,
+	/** MPEG transport stream, plays from any packet but has no index to seek with */
+	MPEGTS,
+	/**
+	 * CMAF segments and partial segments with a Low-Latency HLS playlist, written next to the playlist the URL names.
+	 * Segments start at keyframes, old ones are deleted
+	 */
+	LowLatencyHLS,
+};
+
+UENUM(BlueprintType)
+enum class ERTMPRateControl : uint8
+{
+	/** Constant quality (CRF), capped by MaxBitrate/BufferSize when set */
+	CRF,
+	/** Constant bitrate at VideoBitrate with HRD signalling, what most ingest servers ask for */
+	CBR,
+	/** Average bitrate of VideoBitrate, peaks capped by MaxBitrate/BufferSize */
+	VBV,
+};
+
+/**
+ * x264 settings on top of the encoder profile, each one only applies when its override flag is set.
+ * Bitrates are in bits per second, 0 derives them from VideoBitrate.
+ */
+USTRUCT(BlueprintType)
+struct FRTMPVideoEncoderOverrides
+{
+	GENERATED_BODY()
+public:
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "RTMP | Encoder", meta = (InlineEditConditionToggle))
+	uint8 bOverride_Preset : 1;
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "RTMP | Encoder", meta = (InlineEditConditionToggle))
+	uint8 bOverride_Tune : 1;
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "RTMP | Encoder", meta = (InlineEditConditionToggle))
+	uint8 bOverride_Profile : 1;
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "RTMP | Encoder", meta = (InlineEditConditionToggle))
+	uint8 bOverride_GOPSeconds : 1;
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "RTMP | Encoder", meta = (InlineEditConditionToggle))
+	uint8 bOverride_BFrames : 1;
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "RTMP | Encoder", meta = (InlineEditConditionToggle))
+	uint8 bOverride_Lookahead : 1;
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "RTMP | Encoder", meta = (InlineEditConditionToggle))
+	uint8 bOverride_RateControl : 1;
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "RTMP | Encoder", meta = (InlineEditConditionToggle))
+	uint8 bOverride_CRF : 1;
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "RTMP | Encoder", meta = (InlineEditConditionToggle))
+	uint8 bOverride_MaxBitrate : 1;
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "RTMP | Encoder", meta = (InlineEditConditionToggle))
+	uint8 bOverride_BufferSize : 1;
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "RTMP | Encoder", meta = (InlineEditConditionToggle))
+	uint8 bOverride_Threads : 1;
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "RTMP | Encoder", meta = (InlineEditConditionToggle))
+	uint8 bOverride_SlicedThreads : 1;
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "RTMP | Encoder", meta = (InlineEditConditionToggle))
+	uint8 bOverride_IntraRefresh : 1;
+
+	// x264 preset, ultrafast to placebo
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "RTMP | Encoder", meta = (EditCondition = "bOverride_Preset"))
+	FString Preset;
+	// x264 tune (zerolatency, film, animation, ...), empty for none
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "RTMP | Encoder", meta = (EditCondition = "bOverride_Tune"))
+	FString Tune;
+	// H.264 profile, baseline, main or high. Baseline has no B-frames
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "RTMP | Encoder", meta = (EditCondition = "bOverride_Profile"))
+	FString Profile;
+	// Seconds between keyframes
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "RTMP | Encoder", meta = (EditCondition = "bOverride_GOPSeconds", ClampMin = "0.1"))
+	float GOPSeconds = 2.0f;
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "RTMP | Encoder", meta = (EditCondition = "bOverride_BFrames", ClampMin = "0", ClampMax = "16"))
+	int32 BFrames = 0;
+	// Frames of rate control lookahead, each one adds a frame of latency
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "RTMP | Encoder", meta = (EditCondition = "bOverride_Lookahead", ClampMin = "0", ClampMax = "250"))
+	int32 Lookahead = 0;
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "RTMP | Encoder", meta = (EditCondition = "bOverride_RateControl"))
+	ERTMPRateControl RateControl = ERTMPRateControl::CBR;
+	// Quality for ERTMPRateControl::CRF, lower is better
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "RTMP | Encoder", meta = (EditCondition = "bOverride_CRF", ClampMin = "0", ClampMax = "51"))
+	float CRF = 23.0f;
+	// VBV maximum rate
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "RTMP | Encoder", meta = (EditCondition = "bOverride_MaxBitrate", ClampMin = "0"))
+	int32 MaxBitrate = 0;
+	// VBV buffer size in bits
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "RTMP | Encoder", meta = (EditCondition = "bOverride_BufferSize", ClampMin = "0"))
+	int32 BufferSize = 0;
+	// x264 threads, 0 picks from the core count
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "RTMP | Encoder", meta = (EditCondition = "bOverride_Threads", ClampMin = "0"))
+	int32 Threads = 0;
+	// Split every frame into slices encoded in parallel instead of encoding several frames at once, no frame threading latency
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "RTMP | Encoder", meta = (EditCondition = "bOverride_SlicedThreads"))
+	bool bSlicedThreads = false;
+	// Refresh the picture with a column of intra blocks sweeping across it once per GOP instead of sending IDR frames
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "RTMP | Encoder", meta = (EditCondition = "bOverride_IntraRefresh"))
+	bool bIntraRefresh = false;
+
+	FRTMPVideoEncoderOverrides()
+		: bOverride_Preset(false)
+		, bOverride_Tune(false)
+		, bOverride_Profile(false)
+		, bOverride_GOPSeconds(false)
+		, bOverride_BFrames(false)
+		, bOverride_Lookahead(false)
+		, bOverride_RateControl(false)
+		, bOverride_CRF(false)
+		, bOverride_MaxBitrate(false)
+		, bOverride_BufferSize(false)
+		, bOverride_Threads(false)
+		, bOverride_SlicedThreads(false)
+		, bOverride_IntraRefresh(false)
+	{
+	}
+};
+
+/** Destination of the encoded streams, muxed and written on its own thread with its own backlog limit */
+USTRUCT(BlueprintType)
+struct FRTMPOutputSink
+{
+	GENERATED_BODY()
+public:
+	// rtmp://, udp://host:port or srt://host:port?streamid=... URL, file path or any other ffmpeg output URL
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "RTMP | Output")
+	FString Url;
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "RTMP | Output")
+	ERTMPOutputContainer Container = ERTMPOutputContainer::Auto;
+	// Seconds of stream allowed to queue up for this output before it drops frames, 0 uses MaxMuxBacklogSeconds
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "RTMP | Output", meta = (ClampMin = "0"))
+	float MaxBacklogSeconds = 0.0f;
+	// Seconds a network write may block before the output is given up on, 0 waits forever
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "RTMP | Output", meta = (ClampMin = "0"))
+	float TimeoutSeconds = 10.0f;
+
+	// udp:// and srt:// outputs (MPEG-TS): how far the receiver plays behind the sender. SRT retransmits lost packets
+	// within it, UDP sizes its send buffer to it
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "RTMP | Output", meta = (ClampMin = "0.02"))
+	float LatencySeconds = 0.5f;
+
+	// LowLatencyHLS: a segment ends at the first keyframe after this many seconds
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "RTMP | Output | HLS", meta = (ClampMin = "0.5"))
+	float SegmentSeconds = 2.0f;
+	// LowLatencyHLS: partial segment duration, rounded up to whole frames. Latency is about three of them
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "RTMP | Output | HLS", meta = (ClampMin = "0.05"))
+	float PartSeconds = 0.333f;
+	// LowLatencyHLS: complete segments listed in the playlist, older ones are deleted shortly after they leave it
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "RTMP | Output | HLS", meta = (ClampMin = "2"))
+	int32 PlaylistSegments = 6;
+};
+
+/**
+ * Lower rung of the encoding ladder, published to its own URL next to the configured stream. It is scaled down from
+ * the rung above it and encoded with the same encoder, profile and keyframe cadence at its own bitrate.
+ */
+USTRUCT(BlueprintType)
+struct FRTMPRendition
+{
+	GENERATED_BODY()
+public:
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "RTMP | Ladder")
+	FString StreamUrl;
+	// At most the size of the rung above, even
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "RTMP | Ladder", meta = (ClampMin = "2"))
+	int32 Width = 1280;
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "RTMP | Ladder", meta = (ClampMin = "2"))
+	int32 Height = 720;
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "RTMP | Ladder")
+	int32 VideoBitrate = 3000000;
+};
+
 struct FEncodeFramePayload
 {
-	TArray<uint8> Data;
+	/** Tightly packed BGRA pixels or YUV planes, shared by reference between the queue and the encoder */
+	FPooledFrameBufferRef Buffer;
+	ERTMPFrameFormat Format;
 	uint32 Width;
 	uint32 Height;
 	FTimespan Timestamp;
+	/** Capture slot assigned by the frame pacer, the frame pts in 1 / capture rate units */
+	int64 FrameIndex;
 };
 
 
@@ -32,8 +287,70 @@ public:
 	int32 Height;
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "RTMP | Config")
 	int32 Framerate;
+	// Capture at Framerate * 1000 / 1001, i.e. 29.97 or 59.94 fps for a Framerate of 30 or 60
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "RTMP | Config")
+	bool bNTSCFramerate = false;
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "RTMP | Config")
 	int32 VideoBitrate;
+	// Encoder the video stream is encoded with, the output format must be able to carry its codec
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "RTMP | Config")
+	ERTMPVideoEncoderBackend VideoEncoder = ERTMPVideoEncoderBackend::X264;
+	// Settings the stream starts from in x264 terms, see ERTMPEncoderProfile. Other encoders map them to their own options
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "RTMP | Config")
+	ERTMPEncoderProfile EncoderProfile = ERTMPEncoderProfile::LowLatency;
+	// Individual settings replacing the profile's
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "RTMP | Config")
+	FRTMPVideoEncoderOverrides EncoderOverrides;
+
+	// Further outputs of the same encoded streams, e.g. a second ingest server or a local archive. Each one has its own
+	// writer thread and backlog, a slow or failed output never holds up the others
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "RTMP | Config")
+	TArray<FRTMPOutputSink> AdditionalOutputs;
+
+	// Lower renditions from largest to smallest, all fed by the one capture. Keyframes of every rendition are forced
+	// onto the same frames, once per GOP, so players can switch between them at any keyframe
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "RTMP | Config")
+	TArray<FRTMPRendition> Renditions;
+
+	// Maximum number of captured frames waiting for the encoder, each one is Width * Height * 4 bytes
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "RTMP | Config", meta = (ClampMin = "1"))
+	int32 VideoQueueCapacity = 4;
+	// What to do with captured frames when the encoder falls behind and the queue is full
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "RTMP | Config")
+	ERTMPQueueOverflowPolicy VideoQueueOverflowPolicy = ERTMPQueueOverflowPolicy::DropOldest;
+	// Maximum number of converted frames waiting for the video encoder, a full queue stalls the convert stage
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "RTMP | Config", meta = (ClampMin = "1"))
+	int32 EncodeQueueCapacity = 2;
+	// Maximum number of encoded audio and video packets waiting to be written to the output
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "RTMP | Config", meta = (ClampMin = "1"))
+	int32 MuxQueueCapacity = 256;
+	// Seconds of stream (at the configured bitrates) allowed to queue up when the connection stalls before frames are dropped
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "RTMP | Config", meta = (ClampMin = "0.1"))
+	float MaxMuxBacklogSeconds = 1.0f;
+
+	// Number of GPU surfaces the backbuffer is resolved into before being read back
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "RTMP | Config", meta = (ClampMin = "1", ClampMax = "8"))
+	int32 ReadbackSurfaceCount = 3;
+	// Frames between resolving a backbuffer and reading it back, at most ReadbackSurfaceCount - 1.
+	// 0 reads back the frame just queued and may stall the render thread on the GPU copy, every extra frame
+	// adds one frame of stream latency but gives the copy that much more time to complete.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "RTMP | Config", meta = (ClampMin = "0", ClampMax = "7"))
+	int32 FrameGrabLatency = 0;
+	// Whether the render thread may wait for GPU readbacks, FrameGrabLatency only applies to blocking readback
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "RTMP | Config")
+	ERTMPReadbackMode ReadbackMode = ERTMPReadbackMode::Blocking;
+	// Convert to YUV with a compute shader before readback, reading back 1.5 instead of 4 bytes per pixel
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "RTMP | Config")
+	bool bGPUColorConversion = true;
+	// RGB -> YUV matrix and range, used by both conversion paths and signalled in the stream
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "RTMP | Config")
+	ERTMPColorMatrix ColorMatrix = ERTMPColorMatrix::BT601;
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "RTMP | Config")
+	ERTMPColorRange ColorRange = ERTMPColorRange::Limited;
+	// Horizontal slices CPU colour conversion is split into across task graph workers, 0 picks from the height and core count.
+	// Conversion runs one frame ahead of the encoder either way.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "RTMP | Config", meta = (ClampMin = "0"))
+	int32 ColorConversionSlices = 0;
 
 	// Audio config
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "RTMP | Config")
@@ -42,4 +359,9 @@ public:
 	int32 SampleRate;
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "RTMP | Config")
 	int32 AudioBitrate;
+
+	FFrameRate GetFrameRate() const
+	{
+		return bNTSCFramerate ? FFrameRate(Framerate * 1000, 1001) : FFrameRate(Framerate, 1);
+	}
 };
@@ -0,0 +1,78 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "HAL/ThreadSafeCounter64.h"
+#include "BoundedQueue.h"
+
+struct AVFrame;
+struct AVPacket;
+
+struct RTMP_API FAVFrameDeleter
+{
+	void operator()(AVFrame* Frame) const;
+};
+
+struct RTMP_API FAVPacketDeleter
+{
+	void operator()(AVPacket* Packet) const;
+};
+
+/** Owning FFmpeg frame and packet pointers, so they can move through queues without leaking when dropped */
+typedef TUniquePtr<AVFrame, FAVFrameDeleter> FAVFramePtr;
+typedef TUniquePtr<AVPacket, FAVPacketDeleter> FAVPacketPtr;
+
+/**
+ * Recycles AVPacket structs between the encoders and the writer, so encoding a frame doesn't allocate one.
+ * Packet data stays reference counted by FFmpeg, only the shells are pooled.
+ */
+class RTMP_API FAVPacketPool
+{
+public:
+	/** MaxFree is the most idle packets kept, more are allocated on demand and freed when released */
+	explicit FAVPacketPool(int32 MaxFree);
+
+	/** Blank packet, from the pool if it has one (thread safe) */
+	FAVPacketPtr Acquire();
+
+	/** Unreferences the packet data and keeps the packet for the next Acquire (thread safe) */
+	void Release(FAVPacketPtr&& Packet);
+
+	/** Packets allocated because the pool was empty */
+	int64 GetNumAllocated() const;
+
+private:
+	TBoundedQueue<FAVPacketPtr> FreePackets;
+	FThreadSafeCounter64 NumAllocated;
+};
+
+/** Captured frame converted into an encoder frame, handed from the convert to the encode stage */
+struct FConvertedVideoFrame
+{
+	FAVFramePtr Frame;
+	/** Capture slot assigned by the frame pacer, becomes the frame pts */
+	int64 FrameIndex = 0;
+	/** Media time the frame was captured at */
+	FTimespan Timestamp;
+	/** Encode as an IDR frame, decided once per frame for every rendition of the ladder */
+	bool bForceKeyframe = false;
+};
+
+/** Encoded audio or video packet on its way to the output, with what the writer needs to decide what it can drop */
+struct FEncodedPacket
+{
+	/** Already rescaled to the stream time base, stream_index set */
+	FAVPacketPtr Packet;
+	bool bVideo = false;
+	/** IDR frame, decoding can restart from here */
+	bool bKeyframe = false;
+	/** No other frame references this one, dropping it only costs this frame */
+	bool bDisposable = false;
+};
+
+namespace RTMPVideo
+{
+	/** True if the H.264 access unit (Annex B or 4 byte length prefixed) has slices and none of them is used for reference */
+	RTMP_API bool IsNonReferenceH264AccessUnit(const uint8* Data, int32 Size);
+}
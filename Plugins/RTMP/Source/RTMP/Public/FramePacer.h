@@ -0,0 +1,51 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Misc/FrameRate.h"
+#include "HAL/ThreadSafeCounter64.h"
+
+struct FFramePacerStats
+{
+	/** Presented frames that were captured into a slot */
+	int64 NumCaptured = 0;
+	/** Presented frames that were not captured because their slot already had a frame */
+	int64 NumSkipped = 0;
+	/** Slots without a presented frame of their own, the previous capture is held over them */
+	int64 NumDuplicated = 0;
+};
+
+/**
+ * Decides which presented frames get captured for a (possibly fractional) capture rate.
+ * Time is divided into slots of exactly FrameRate.AsInterval() seconds counted from Start(), slot
+ * boundaries are derived from the absolute elapsed time so rounding error never accumulates.
+ * Every captured frame is tagged with its slot index, which doubles as its pts in 1 / FrameRate units.
+ */
+class RTMP_API FFramePacer
+{
+public:
+	FFramePacer();
+
+	/** Restarts slot counting at StartSeconds, on whatever clock Tick is given */
+	void Start(const FFrameRate& InFrameRate, double StartSeconds);
+
+	/**
+	 * Called for every presented frame (render thread).
+	 * @return The slot the frame should be captured into, INDEX_NONE if it should not be captured.
+	 */
+	int64 Tick(double Seconds);
+
+	const FFrameRate& GetFrameRate() const { return FrameRate; }
+
+	FFramePacerStats GetStats() const;
+
+private:
+	FFrameRate FrameRate;
+	double StartSeconds;
+	int64 LastSlot;
+
+	FThreadSafeCounter64 NumCaptured;
+	FThreadSafeCounter64 NumSkipped;
+	FThreadSafeCounter64 NumDuplicated;
+};
@@ -0,0 +1,74 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "HAL/ThreadSafeCounter.h"
+#include "HAL/ThreadSafeCounter64.h"
+#include "Templates/RefCounting.h"
+
+class FFramePool;
+
+/**
+ * Capture buffer owned by FFramePool. Reference counted through TRefCountPtr,
+ * the buffer goes back to its pool instead of being freed when the last reference is released.
+ */
+class RTMP_API FPooledFrameBuffer
+{
+public:
+	uint32 AddRef() const;
+	uint32 Release() const;
+	uint32 GetRefCount() const;
+
+	uint8* GetData() { return Data.GetData(); }
+	const uint8* GetData() const { return Data.GetData(); }
+	int32 GetSize() const { return Data.Num(); }
+
+private:
+	friend class FFramePool;
+
+	FPooledFrameBuffer(FFramePool* InOwner, int32 InSize);
+
+	FFramePool* Owner;
+	mutable FThreadSafeCounter NumRefs;
+
+	TArray<uint8, TAlignedHeapAllocator<64>> Data;
+};
+
+typedef TRefCountPtr<FPooledFrameBuffer> FPooledFrameBufferRef;
+
+/**
+ * Fixed set of equally sized frame buffers allocated up front, so the capture -> encode path
+ * does not allocate or copy frames in steady state.
+ * All references must be released before the pool is destroyed.
+ */
+class RTMP_API FFramePool
+{
+public:
+	FFramePool(int32 NumBuffers, int32 BufferSize);
+	~FFramePool();
+
+	/** Returns a free buffer, or an invalid reference when every buffer is in flight (thread safe) */
+	FPooledFrameBufferRef Acquire();
+
+	int32 GetBufferSize() const;
+	int32 GetNumBuffers() const;
+	int32 GetNumFreeBuffers() const;
+
+	/** Number of Acquire calls that failed because the pool was exhausted */
+	int64 GetNumExhausted() const;
+
+private:
+	friend class FPooledFrameBuffer;
+
+	void Recycle(FPooledFrameBuffer* Buffer);
+
+	int32 BufferSize;
+
+	TArray<FPooledFrameBuffer*> AllBuffers;
+
+	mutable FCriticalSection FreeBuffersCS;
+	TArray<FPooledFrameBuffer*> FreeBuffers;
+
+	FThreadSafeCounter64 NumExhausted;
+};
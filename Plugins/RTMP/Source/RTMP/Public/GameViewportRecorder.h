@@ -3,12 +3,43 @@
 #pragma once
 
 #include "CoreMinimal.h"
-#include "FrameGrabber.h"
-
-#include <chrono>
+#include "FramePacer.h"
+#include "MediaClock.h"
+#include "ViewportReadbackSurface.h"
+#include "DataStructures.h"
+#include "HAL/ThreadSafeCounter64.h"
 
 DECLARE_LOG_CATEGORY_EXTERN(LogGameViewportRecorder, Log, All);
-DECLARE_MULTICAST_DELEGATE_ThreeParams(FOnViewportRecorded, const FColor*, uint32, uint32);
+
+/** A frame read back from the GPU, the data is only valid during the callback (called on render thread) */
+struct FViewportRecordedFrame
+{
+	/** BGRA pixels, or YUV 4:2:0 planes laid out as Height * 3 / 2 rows of Width bytes */
+	const uint8* Data;
+	/** Bytes between two rows, may be larger than the visible width */
+	int32 Pitch;
+	int32 Width;
+	int32 Height;
+	ERTMPFrameFormat Format;
+	/** FPlatformTime::Seconds() the backbuffer was captured at */
+	double CaptureTime;
+	/** Capture slot assigned by the frame pacer */
+	int64 FrameIndex;
+};
+
+DECLARE_MULTICAST_DELEGATE_OneParam(FOnViewportRecorded, const FViewportRecordedFrame&);
+
+/** Render thread cost of capturing, times are in seconds */
+struct FViewportReadbackStats
+{
+	int64 NumCaptures = 0;
+	/** Readbacks that waited more than a millisecond for the GPU copy */
+	int64 NumStalls = 0;
+	/** Polled readback only, captures dropped because every surface was still in flight */
+	int64 NumBusyDrops = 0;
+	double TotalStallTime = 0.0;
+	double MaxStallTime = 0.0;
+};
 
 /**
  * 
@@ -16,31 +47,49 @@ DECLARE_MULTICAST_DELEGATE_ThreeParams(FOnViewportRecorded, const FColor*, uint3
 class RTMP_API FGameViewportRecorder
 {
 public:
-	FGameViewportRecorder(const FIntPoint& RecordResolution);
+	FGameViewportRecorder(const FIntPoint& RecordResolution, int32 InNumSurfaces = 3, int32 InFrameGrabLatency = 0,
+		ERTMPReadbackMode InReadbackMode = ERTMPReadbackMode::Blocking, ERTMPFrameFormat InOutputFormat = ERTMPFrameFormat::BGRA,
+		ERTMPColorMatrix InColorMatrix = ERTMPColorMatrix::BT601, ERTMPColorRange InColorRange = ERTMPColorRange::Limited);
 	~FGameViewportRecorder();
 
 	FOnViewportRecorded& OnViewportRecordedCallback();
 
 	bool IsInitialized() const;
 
-	bool StartRecord(int32 InCaptureRate);
+	/**
+	 * Capture slots are counted on the media clock from media time zero, the frame index is the slot.
+	 * The clock has to outlive the recording.
+	 */
+	bool StartRecord(const FFrameRate& InCaptureRate, const FMediaClock& InMediaClock);
 	void StopRecord();
 
+	FFramePacerStats GetPacingStats() const;
+	FViewportReadbackStats GetReadbackStats() const;
+
+	/** Format of the recorded frames, YUV output falls back to BGRA where compute shaders are unavailable */
+	ERTMPFrameFormat GetOutputFormat() const;
+
 protected:
-	bool SetupBackBufferCapturer(FIntPoint Resolution);
+	bool SetupBackBufferCapturer(FIntPoint Resolution, int32 NumSurfaces, int32 InFrameGrabLatency, ERTMPFrameFormat InOutputFormat,
+		const FYUVCoefficients& YUVCoefficients);
 
 	/** Callback for when a backbuffer is ready for reading (called on render thread) */
 	void OnBackBufferReadyToPresentCallback(SWindow& SlateWindow, const FTexture2DRHIRef& BackBuffer);
 
+	/** Reads back a surface and records how long the render thread waited for it (called on render thread) */
+	void ReadBackSurface(FRHICommandListImmediate& RHICmdList, int32 SurfaceIndex);
+
 	/** Called when the specified surface index has been locked for reading with the render target data (called on render thread)  */
-	void OnFrameReady(int32 SurfaceIndex, FColor* ColorBuffer, int32 Width, int32 Height);
+	void OnFrameReady(int32 SurfaceIndex, const uint8* Data, int32 Pitch, double CaptureTime, int64 FrameIndex);
 
 private:
 	bool bInitialized;
 
-	// framerate i.e:33ms = 30fps
-	std::chrono::milliseconds CaptureFrameInterval;
-	std::chrono::steady_clock::time_point LastFrameTime;
+	/** Picks the presented frames to capture, only used on the render thread once recording started */
+	FFramePacer FramePacer;
+
+	/** Clock the pacer is ticked in, so slots follow the audio device clock the audio pts are counted on */
+	const FMediaClock* MediaClock;
 
 	FOnViewportRecorded OnViewportRecorded;
 
@@ -57,18 +106,36 @@ private:
 	/** Array of surfaces that we resolve the viewport RHI to. Fixed allocation - should never be resized */
 	struct FResolveSurface
 	{
-		FResolveSurface(EPixelFormat InPixelFormat, FIntPoint BufferSize) : Surface(InPixelFormat, BufferSize) {}
+		FResolveSurface(EPixelFormat InPixelFormat, FIntPoint BufferSize, ERTMPFrameFormat InOutputFormat) : Surface(InPixelFormat, BufferSize, InOutputFormat) {}
+
+		FViewportReadbackSurface Surface;
 
-		FFramePayloadPtr Payload;
-		FViewportSurfaceReader Surface;
+		/** Platform time the backbuffer resolved into this surface was ready to present */
+		double CaptureTime = 0.0;
+		/** Capture slot the backbuffer resolved into this surface was assigned */
+		int64 FrameIndex = 0;
 	};
 	TArray<FResolveSurface> Surfaces;
 
 	/** Index into the above array to the next surface that we should use - only accessed on main thread */
 	int32 CurrentFrameIndex;
 
+	/** Polled readback only, oldest surface that may still be in flight */
+	int32 ReadbackFrameIndex;
+
 	int32 FrameGrabLatency;
 
+	ERTMPReadbackMode ReadbackMode;
+
+	ERTMPFrameFormat OutputFormat;
+
+	/** Render thread readback stats, times in microseconds */
+	FThreadSafeCounter64 NumCaptures;
+	FThreadSafeCounter64 NumStalls;
+	FThreadSafeCounter64 TotalStallMicroseconds;
+	FThreadSafeCounter64 MaxStallMicroseconds;
+	FThreadSafeCounter64 NumBusyDrops;
+
 	/** The desired target size to resolve frames to */
 	FIntPoint TargetSize;
 };
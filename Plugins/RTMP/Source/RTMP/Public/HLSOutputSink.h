@@ -0,0 +1,99 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "OutputSink.h"
+
+/**
+ * Low-Latency HLS segmenter: muxes the encoded streams into CMAF fragments, one per partial segment, and appends them
+ * to segment files next to the playlist the output URL names. Segments start at keyframes, so every rendition cut from
+ * the same aligned encoder output switches cleanly. The playlist is replaced atomically after every part and segments
+ * that left it are deleted, so a plain HTTP file server can serve the directory as it is.
+ *
+ * Parts are listed as byte ranges of their segment. Blocking playlist reloads and preload hints need a server that
+ * understands them, they are left out.
+ */
+class RTMP_API FHLSOutputSink : public FOutputSink
+{
+public:
+	FHLSOutputSink(const FRTMPOutputSink& InConfig, FAVPacketPool& InPacketPool);
+	virtual ~FHLSOutputSink();
+
+	virtual bool AddStreams(const struct AVCodecContext* VideoCodecCtx, const struct AVCodecContext* AudioCodecCtx, int32 MuxQueueCapacity,
+		float DefaultBacklogSeconds, int32 TotalBitrate) override;
+
+protected:
+	virtual bool OpenOutput() override;
+	virtual bool OnHeaderWritten() override;
+	virtual void WritePacket(FEncodedPacket& Packet) override;
+	virtual void CloseOutput(bool bClean) override;
+
+private:
+	struct FPart
+	{
+		double Duration = 0.0;
+		int64 Offset = 0;
+		int64 Size = 0;
+		/** Starts with a keyframe */
+		bool bIndependent = false;
+	};
+
+	struct FSegment
+	{
+		int64 Sequence = 0;
+		double Duration = 0.0;
+		int64 Size = 0;
+		TArray<FPart> Parts;
+		bool bComplete = false;
+	};
+
+	/** Called by the muxer's IO context with everything it wrote */
+	static int WriteMuxedData(void* Opaque, uint8* Data, int Size);
+
+	void StartSegment(int64 Dts);
+
+	/** Flushes the fragment muxed since the last cut as a part ending at EndDts and updates the playlist */
+	bool CutPart(int64 EndDts, bool bEndsSegment);
+
+	/** Drops complete segments beyond the playlist window, deleting their files once clients are done with them */
+	void PruneSegments();
+
+	bool WritePlaylist(bool bEnded);
+
+	/** Moves what the muxer wrote since the last call to the end of the segment file */
+	bool AppendMuxedData(FPart& Part);
+
+	FString GetSegmentPath(int64 Sequence) const;
+	FString GetSegmentName(int64 Sequence) const;
+
+	double ToSeconds(int64 Ticks) const;
+
+	FString Directory;
+	FString BaseName;
+
+	struct AVIOContext* MuxedIO;
+	/** Written by the muxer since the last part was cut */
+	TArray<uint8> MuxedData;
+
+	TUniquePtr<FArchive> SegmentFile;
+
+	/** Playlist window followed by the segment being written */
+	TArray<FSegment> Segments;
+	/** Left the playlist, deleted once enough newer segments followed */
+	TArray<int64> RetiredSequences;
+	int64 NextSequence;
+
+	/** Video dts in the stream time base, AV_NOPTS_VALUE until the first keyframe */
+	int64 SegmentStartDts;
+	int64 PartStartDts;
+	int64 LastVideoDts;
+	bool bPartIndependent;
+
+	int32 TargetDuration;
+	double PartTarget;
+	double FrameSeconds;
+
+	int64 NumParts;
+	int64 NumDeletedSegments;
+};
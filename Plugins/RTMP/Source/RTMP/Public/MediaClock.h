@@ -0,0 +1,65 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "HAL/PlatformTime.h"
+
+#include <atomic>
+
+struct FMediaClockStats
+{
+	/** Smoothed audio device clock minus platform clock, in seconds */
+	double AudioClockOffset = 0.0;
+	/** Audio device clock rate relative to the platform clock, in parts per million */
+	double DriftPPM = 0.0;
+	int64 NumAudioAnchors = 0;
+};
+
+/**
+ * Shared timeline for audio and video timestamps.
+ * Media time starts at zero on Start() and runs on the audio device clock: every submix buffer anchors
+ * the audio clock against the monotonic platform clock, and platform timestamps (e.g. taken on the
+ * render thread when a backbuffer is captured) are mapped onto the audio clock through the smoothed offset.
+ * Before the first audio anchor media time simply follows the platform clock.
+ */
+class RTMP_API FMediaClock
+{
+public:
+	FMediaClock();
+
+	/** Restarts media time at zero, call before capture and audio callbacks start */
+	void Start();
+
+	/** Audio render thread only. Wait-free */
+	void AddAudioAnchor(double AudioClock, double PlatformSeconds);
+
+	/** Media time, in seconds, of a FPlatformTime::Seconds() timestamp */
+	double PlatformToMediaTime(double PlatformSeconds) const;
+
+	/** Media time, in seconds, of an audio device clock value */
+	double AudioToMediaTime(double AudioClock) const;
+
+	/** Current media time, in seconds */
+	double Now() const;
+
+	FMediaClockStats GetStats() const;
+
+private:
+	/** Reads Offset and Origin consistently */
+	void ReadMapping(double& OutOffset, double& OutOrigin) const;
+
+	/** Media time = platform time + Offset - Origin = audio clock - Origin, published under a sequence lock */
+	std::atomic<uint32> MappingSequence;
+	std::atomic<double> Offset;
+	std::atomic<double> Origin;
+
+	std::atomic<double> DriftPPM;
+	std::atomic<int64> NumAudioAnchors;
+
+	/** Audio thread state */
+	bool bHasFirstAnchor;
+	double FirstAnchorPlatformSeconds;
+	double FirstAnchorOffset;
+	double SmoothedOffset;
+};
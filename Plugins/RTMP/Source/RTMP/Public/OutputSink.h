@@ -0,0 +1,145 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "HAL/ThreadSafeBool.h"
+#include "HAL/ThreadSafeCounter64.h"
+#include "DataStructures.h"
+#include "EncodedMedia.h"
+#include "PacketWriter.h"
+
+/** Network side of an output, connection stats are only known for SRT outputs with libsrt linked into the module */
+struct FTransportStats
+{
+	/** Muxed and handed to the output */
+	int64 BytesSent = 0;
+	bool bConnectionStats = false;
+	/** Seconds, smoothed */
+	double RoundTripTime = 0.0;
+	int64 NumRetransmitted = 0;
+	/** Reported lost by the receiver */
+	int64 NumLost = 0;
+	/** Dropped by the sender for arriving too late to be played */
+	int64 NumDropped = 0;
+	/** Sent but not yet acknowledged */
+	int64 SendBufferBytes = 0;
+	double SendBufferSeconds = 0.0;
+	double SendRateMbps = 0.0;
+};
+
+/** Writer stats of one output */
+struct FOutputSinkStats
+{
+	FString Url;
+	FPipelineStageStats Mux;
+	FPacketQueueStats MuxQueue;
+	FTransportStats Transport;
+	/** Gave up after an error, nothing is written to it anymore */
+	bool bFailed = false;
+};
+
+/**
+ * One destination of the encoded streams with its own muxer, writer thread and backlog limit. Encoded packets are
+ * shared between outputs by reference, so adding one costs a queue and a thread but no encoding. A slow output
+ * only drops its own frames, a failed one stops taking packets while the others carry on.
+ *
+ * What the muxer wrote is flushed to the output at every video keyframe, together with the file containers cutting
+ * a fragment or cluster there, a recording that is never closed still plays up to the last GOP.
+ *
+ * Outputs that write something other than one muxed stream (segments and playlists) override how the output is
+ * opened, written and closed.
+ */
+class RTMP_API FOutputSink
+{
+public:
+	FOutputSink(const FRTMPOutputSink& InConfig, FAVPacketPool& InPacketPool);
+	/** Subclasses overriding CloseOutput call Close in their own destructor */
+	virtual ~FOutputSink();
+
+	/** The output for the configured container */
+	static TUniquePtr<FOutputSink> Create(const FRTMPOutputSink& InConfig, FAVPacketPool& InPacketPool);
+
+	FOutputSink(const FOutputSink&) = delete;
+	FOutputSink& operator=(const FOutputSink&) = delete;
+
+	/** Allocates the muxer, before the encoders are opened since they need to know about WantsGlobalHeader */
+	bool Init();
+
+	/** Codec parameters go in the container header instead of every keyframe */
+	bool WantsGlobalHeader() const;
+
+	/** Muxer allocated by Init */
+	const struct AVOutputFormat* GetOutputFormat() const;
+
+	/** Adds a stream for each opened encoder and creates the writer, the backlog limit is in seconds at the total bitrate */
+	virtual bool AddStreams(const struct AVCodecContext* VideoCodecCtx, const struct AVCodecContext* AudioCodecCtx, int32 MuxQueueCapacity,
+		float DefaultBacklogSeconds, int32 TotalBitrate);
+
+	/** Connects, writes the header and starts the writer thread. On failure the output is marked failed */
+	bool Start();
+
+	/** Queues a reference to the packet, timestamps in the encoder time base. Never blocks, false if it was dropped */
+	bool PushPacket(const struct AVPacket& Packet, const struct AVRational& CodecTimeBase, bool bVideo, bool bKeyframe, bool bDisposable);
+
+	/** See FPacketQueue::ConsumeKeyframeRequest */
+	bool ConsumeKeyframeRequest();
+
+	/** Writes what is still queued and the trailer, unless the output failed, then closes it */
+	void Close();
+
+	/**
+	 * Closes the output like a crash would: queued packets and what the muxer hasn't flushed yet are thrown away
+	 * and no trailer is written. For testing what a recording survives
+	 */
+	void Abort();
+
+	bool HasFailed() const;
+
+	const FString& GetUrl() const;
+
+	FOutputSinkStats GetStats() const;
+
+protected:
+	/** Opens FormatCtx->pb, before the header is written */
+	virtual bool OpenOutput();
+
+	/** Right after the header was written, Fail the output and return false if it can't go on */
+	virtual bool OnHeaderWritten();
+
+	/** Writer thread, the packet goes back to the pool afterwards */
+	virtual void WritePacket(FEncodedPacket& Packet);
+
+	/** Writes the trailer when closed cleanly and closes FormatCtx->pb, the context itself is freed afterwards */
+	virtual void CloseOutput(bool bClean);
+
+	/** Any thread. BytesSent is already filled in */
+	virtual void GetTransportStats(FTransportStats& OutStats) const;
+
+	void Fail(const TCHAR* What, int32 Error);
+
+	FRTMPOutputSink Config;
+
+	FAVPacketPool& PacketPool;
+
+	struct AVFormatContext* FormatCtx;
+	struct AVStream* VideoStream;
+	struct AVStream* AudioStream;
+
+	/** Container specific muxer options, set up with the streams and passed to avformat_write_header */
+	struct AVDictionary* MuxerOptions;
+
+	/** Audio and video, bits per second */
+	int32 StreamBitrate;
+
+	bool bHeaderSent;
+	FThreadSafeBool bFailed;
+
+	TUniquePtr<FPacketWriter> Writer;
+
+private:
+	void MuxPacket(FEncodedPacket& Packet);
+
+	/** Written by the writer thread */
+	FThreadSafeCounter64 BytesSent;
+};
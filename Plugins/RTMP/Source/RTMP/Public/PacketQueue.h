@@ -0,0 +1,93 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Misc/ScopeLock.h"
+#include "EncodedMedia.h"
+
+struct FPacketQueueStats
+{
+	/** Packets accepted by the queue */
+	int64 NumEnqueued = 0;
+	/** Non-reference video frames dropped to shrink the backlog */
+	int64 NumDroppedDisposable = 0;
+	/** Video frames dropped with their GOP, queued ones and the ones arriving before the next IDR frame */
+	int64 NumDroppedGOPFrames = 0;
+	/** Times the queue gave up on the current GOP and waited for the next IDR frame */
+	int32 NumGOPSkips = 0;
+	/** Audio packets dropped when the backlog was still too long without any video left */
+	int64 NumDroppedAudio = 0;
+	/** Highest number of packets queued at once */
+	int32 HighWaterMark = 0;
+	/** Most packet data queued at once */
+	int64 MaxQueuedBytes = 0;
+};
+
+/**
+ * Bounded queue of encoded packets between the encoders and the output writer that never blocks its producers.
+ * When the writer falls behind (more than MaxBacklogBytes queued, or the queue is full) the backlog is shrunk
+ * in order of cost: non-reference video frames first, then whole GOPs up to the newest queued IDR frame, then
+ * all queued video with everything after it dropped until the next IDR frame arrives, audio last. The newest IDR frame
+ * is kept even when it alone is over the byte limit, otherwise video could never restart after a large keyframe.
+ * Video that gets written always decodes, frames are never dropped from the middle of a GOP that continues afterwards.
+ */
+class RTMP_API FPacketQueue
+{
+public:
+	FPacketQueue(int32 InCapacity, int64 InMaxBacklogBytes);
+
+	FPacketQueue(const FPacketQueue&) = delete;
+	FPacketQueue& operator=(const FPacketQueue&) = delete;
+
+	/** Adds a packet, shrinking the backlog if needed. False if the packet was dropped on arrival */
+	bool Enqueue(FEncodedPacket&& Packet);
+
+	/** Removes the oldest packet, OutEnqueueTime is the FPlatformTime::Seconds() it was queued at */
+	bool Dequeue(FEncodedPacket& OutPacket, double& OutEnqueueTime);
+
+	/** Drops every queued packet, not counted as backlog drops */
+	void Empty();
+
+	/**
+	 * True once after the queue started waiting for an IDR frame, the video encoder should force one
+	 * so the gap lasts one frame rather than the rest of the GOP.
+	 */
+	bool ConsumeKeyframeRequest();
+
+	int32 Num() const;
+	int32 GetCapacity() const;
+
+	/** Packet data queued right now */
+	int64 GetQueuedBytes() const;
+
+	FPacketQueueStats GetStats() const;
+
+private:
+	struct FQueuedPacket
+	{
+		FEncodedPacket Packet;
+		double EnqueueTime = 0.0;
+	};
+
+	/** ExemptBytes of the queued data don't count against the byte limit */
+	bool IsOverLimit(int64 ExemptBytes = 0) const;
+	void ShrinkBacklog();
+	void RemovePacket(int32 Index);
+
+	const int32 Capacity;
+	const int64 MaxBacklogBytes;
+
+	mutable FCriticalSection CriticalSection;
+
+	/** Oldest first, reserved once so queueing never allocates */
+	TArray<FQueuedPacket> Packets;
+
+	int64 QueuedBytes;
+
+	/** Video is dropped until the next IDR frame */
+	bool bWaitingForKeyframe;
+	bool bKeyframeRequested;
+
+	FPacketQueueStats Stats;
+};
@@ -0,0 +1,71 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "HAL/Runnable.h"
+#include "HAL/RunnableThread.h"
+#include "HAL/ThreadSafeBool.h"
+#include "Templates/Function.h"
+#include "PipelineStage.h"
+#include "PacketQueue.h"
+
+/**
+ * Writes encoded packets to the output on a dedicated thread, so a stalled connection only ever blocks this thread.
+ * Packets are queued in a FPacketQueue, which drops frames instead of blocking the encoders once the backlog
+ * grows past its limit.
+ */
+class RTMP_API FPacketWriter : public FRunnable
+{
+public:
+	typedef TFunction<void(FEncodedPacket&)> FWriteFunction;
+
+	FPacketWriter(const FString& InName, int32 Capacity, int64 MaxBacklogBytes, FWriteFunction InWrite);
+	virtual ~FPacketWriter();
+
+	FPacketWriter(const FPacketWriter&) = delete;
+	FPacketWriter& operator=(const FPacketWriter&) = delete;
+
+	bool Start(EThreadPriority Priority = TPri_Normal);
+
+	/** Queues a packet for the writer thread (thread safe, never blocks), false if it was dropped */
+	bool Push(FEncodedPacket&& Packet);
+
+	/**
+	 * Stops the writer thread and waits for it. With bDrain everything queued so far is written first,
+	 * otherwise queued packets are dropped. Stop the encoders feeding the writer first.
+	 */
+	void Shutdown(bool bDrain);
+
+	/** See FPacketQueue::ConsumeKeyframeRequest */
+	bool ConsumeKeyframeRequest();
+
+	/** Written packets and write times, NumDropped counts every packet the queue dropped */
+	FPipelineStageStats GetStats() const;
+	FPacketQueueStats GetQueueStats() const;
+
+	// FRunnable interface
+	virtual uint32 Run() override;
+	virtual void Stop() override;
+
+private:
+	FString Name;
+
+	FPacketQueue Queue;
+
+	FWriteFunction Write;
+
+	FRunnableThread* Thread;
+	FEvent* WakeupEvent;
+
+	FThreadSafeBool bStopRequested;
+	bool bDrainOnStop;
+
+	mutable FCriticalSection StatsCS;
+	int64 NumWritten;
+	int64 TotalDepth;
+	double TotalQueueTime;
+	double MaxQueueTime;
+	double TotalWriteTime;
+	double MaxWriteTime;
+};
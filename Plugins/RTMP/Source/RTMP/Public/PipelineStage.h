@@ -0,0 +1,217 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "HAL/Runnable.h"
+#include "HAL/RunnableThread.h"
+#include "HAL/ThreadSafeBool.h"
+#include "HAL/Event.h"
+#include "HAL/PlatformProcess.h"
+#include "HAL/PlatformTime.h"
+#include "Misc/ScopeLock.h"
+#include "Templates/Function.h"
+#include "BoundedQueue.h"
+
+/** Throughput, latency and queue depth of one pipeline stage, times are in seconds */
+struct FPipelineStageStats
+{
+	int64 NumProcessed = 0;
+	/** Inputs thrown away by the overflow policy before the stage got to them */
+	int64 NumDropped = 0;
+	int32 Capacity = 0;
+	/** Inputs queued right now */
+	int32 Depth = 0;
+	int32 HighWaterMark = 0;
+	/** Queue depth each input was taken at, averaged */
+	double AverageDepth = 0.0;
+	/** Time inputs waited in the queue */
+	double AverageQueueTime = 0.0;
+	double MaxQueueTime = 0.0;
+	/** Time the stage spent on an input */
+	double AverageProcessTime = 0.0;
+	double MaxProcessTime = 0.0;
+	/** Time producers spent blocked on a full queue */
+	double BlockedTime = 0.0;
+};
+
+/**
+ * One step of the media pipeline: a bounded input queue drained by a dedicated thread.
+ * Producers push from any thread, the process function runs on the stage thread only, in queue order.
+ * A stage that falls behind fills its queue, which either drops inputs or blocks the producer depending
+ * on the overflow policy, so a slow stage only stalls the stages feeding it.
+ */
+template<typename InputType>
+class TPipelineStage : public FRunnable
+{
+public:
+	typedef TFunction<void(InputType&)> FProcessFunction;
+
+	TPipelineStage(const FString& InName, int32 Capacity, ERTMPQueueOverflowPolicy OverflowPolicy, FProcessFunction InProcess)
+		: Name(InName)
+		, Queue(Capacity, OverflowPolicy)
+		, Process(MoveTemp(InProcess))
+		, Thread(nullptr)
+		, bDrainOnStop(false)
+	{
+		WakeupEvent = FPlatformProcess::GetSynchEventFromPool(false);
+	}
+
+	virtual ~TPipelineStage()
+	{
+		Shutdown(false);
+
+		FPlatformProcess::ReturnSynchEventToPool(WakeupEvent);
+		WakeupEvent = nullptr;
+	}
+
+	TPipelineStage(const TPipelineStage&) = delete;
+	TPipelineStage& operator=(const TPipelineStage&) = delete;
+
+	bool Start(EThreadPriority Priority = TPri_Normal)
+	{
+		check(Thread == nullptr);
+
+		bStopRequested = false;
+		Thread = FRunnableThread::Create(this, *Name, 0, Priority);
+		return Thread != nullptr;
+	}
+
+	/** Queues an input for the stage thread (thread safe), false if the overflow policy dropped it */
+	bool Push(InputType&& Input)
+	{
+		if (!Queue.Enqueue(FQueuedInput{ MoveTemp(Input), FPlatformTime::Seconds() })) {
+			return false;
+		}
+
+		WakeupEvent->Trigger();
+		return true;
+	}
+
+	/**
+	 * Stops the stage thread and waits for it. With bDrain everything queued so far is processed first,
+	 * otherwise queued inputs are dropped. Producers blocked on the full queue are released either way,
+	 * stop the stages feeding this one first.
+	 */
+	void Shutdown(bool bDrain)
+	{
+		Queue.ReleaseProducers();
+
+		if (Thread != nullptr) {
+			bDrainOnStop = bDrain;
+			bStopRequested = true;
+			WakeupEvent->Trigger();
+
+			Thread->WaitForCompletion();
+			delete Thread;
+			Thread = nullptr;
+		}
+
+		Queue.Empty();
+	}
+
+	/** Full queue drops the newest input from now on instead of blocking producers, see TBoundedQueue::ReleaseProducers */
+	void ReleaseProducers()
+	{
+		Queue.ReleaseProducers();
+	}
+
+	const FString& GetName() const
+	{
+		return Name;
+	}
+
+	FPipelineStageStats GetStats() const
+	{
+		const FBoundedQueueStats QueueStats = Queue.GetStats();
+
+		FPipelineStageStats Stats;
+		Stats.NumDropped = QueueStats.NumDropped;
+		Stats.Capacity = Queue.GetCapacity();
+		Stats.Depth = Queue.Num();
+		Stats.HighWaterMark = QueueStats.HighWaterMark;
+		Stats.BlockedTime = QueueStats.BlockedSeconds;
+
+		FScopeLock Lock(&StatsCS);
+		Stats.NumProcessed = NumProcessed;
+		Stats.MaxQueueTime = MaxQueueTime;
+		Stats.MaxProcessTime = MaxProcessTime;
+		if (NumProcessed > 0) {
+			Stats.AverageDepth = double(TotalDepth) / NumProcessed;
+			Stats.AverageQueueTime = TotalQueueTime / NumProcessed;
+			Stats.AverageProcessTime = TotalProcessTime / NumProcessed;
+		}
+		return Stats;
+	}
+
+	// FRunnable interface
+	virtual uint32 Run() override
+	{
+		while (true)
+		{
+			FQueuedInput Queued;
+			if (Queue.Dequeue(Queued)) {
+				if (bStopRequested && !bDrainOnStop) {
+					break;
+				}
+
+				const int32 Depth = Queue.Num() + 1;
+				const double StartTime = FPlatformTime::Seconds();
+				Process(Queued.Input);
+				const double EndTime = FPlatformTime::Seconds();
+
+				FScopeLock Lock(&StatsCS);
+				++NumProcessed;
+				TotalDepth += Depth;
+				TotalQueueTime += StartTime - Queued.EnqueueTime;
+				MaxQueueTime = FMath::Max(MaxQueueTime, StartTime - Queued.EnqueueTime);
+				TotalProcessTime += EndTime - StartTime;
+				MaxProcessTime = FMath::Max(MaxProcessTime, EndTime - StartTime);
+				continue;
+			}
+
+			if (bStopRequested) {
+				break;
+			}
+
+			// Push and Shutdown trigger the event, nothing to do until then.
+			WakeupEvent->Wait();
+		}
+
+		return 0;
+	}
+
+	virtual void Stop() override
+	{
+		bStopRequested = true;
+		WakeupEvent->Trigger();
+	}
+
+private:
+	struct FQueuedInput
+	{
+		InputType Input;
+		/** FPlatformTime::Seconds() the input was pushed at */
+		double EnqueueTime = 0.0;
+	};
+
+	FString Name;
+
+	TBoundedQueue<FQueuedInput> Queue;
+
+	FProcessFunction Process;
+
+	FRunnableThread* Thread;
+	FEvent* WakeupEvent;
+
+	FThreadSafeBool bStopRequested;
+	bool bDrainOnStop;
+
+	mutable FCriticalSection StatsCS;
+	int64 NumProcessed = 0;
+	int64 TotalDepth = 0;
+	double TotalQueueTime = 0.0;
+	double MaxQueueTime = 0.0;
+	double TotalProcessTime = 0.0;
+	double MaxProcessTime = 0.0;
+};
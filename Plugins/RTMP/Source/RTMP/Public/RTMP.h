@@ -22,7 +22,7 @@ protected:
 
 	void UnloadHandledLibraries();
 
-	void* LoadDependencyLibrary(const FString& DLLName);
+	void* LoadDependencyLibrary(const FString& DLLName, const TCHAR* LibraryDir = TEXT("ffmpeg"));
 
 public:
 
@@ -42,4 +42,5 @@ public:
 	void* SWScaleHandle;
 	void* WAVPackHandle;
 	void* ZlibHandle;
+	void* LibSRTHandle;
 };
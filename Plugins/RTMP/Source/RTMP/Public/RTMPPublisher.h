@@ -4,8 +4,15 @@
 
 #include "CoreMinimal.h"
 #include "HAL/Runnable.h"
+#include "HAL/ThreadSafeBool.h"
 #include "AudioDevice.h"
 #include "DataStructures.h"
+#include "BoundedQueue.h"
+#include "MediaClock.h"
+#include "PipelineStage.h"
+#include "EncodedMedia.h"
+#include "OutputSink.h"
+#include "RenditionOutput.h"
 
 DECLARE_LOG_CATEGORY_EXTERN(LogRTMPPublisher, Log, All);
 DECLARE_LOG_CATEGORY_EXTERN(LogFFMPEGEncoder_Video, Log, All);
@@ -13,17 +20,64 @@ DECLARE_LOG_CATEGORY_EXTERN(LogFFMPEGEncoder_Audio, Log, All);
 
 struct FOutputStream
 {
-	struct AVStream* Stream = nullptr;
 	struct AVCodecContext* CodecCtx = nullptr;
 
 	int64 NextPts = 0;
-	int32 SamplesCount = 0;
+	int64 SamplesCount = 0;
 
 	struct AVFrame* Frame = nullptr;
 	struct AVFrame* TempFrame = nullptr;
 
 	struct SwsContext* SwsCtx = nullptr;
-	struct SwrContext* SwrCtx = nullptr;
+};
+
+/** How well audio and video timestamps follow the shared media clock, all values in seconds */
+struct FAVSyncStats
+{
+	/** Smoothed video pts minus the media time the frame was captured at */
+	double VideoTimestampError = 0.0;
+	/** Smoothed audio pts minus the media time the samples were captured at */
+	double AudioTimestampError = 0.0;
+	/** How much later video is presented than audio captured at the same moment */
+	double LipSyncOffset = 0.0;
+	/** Times the audio pts were re-anchored on the media clock after losing audio */
+	int32 NumAudioResyncs = 0;
+};
+
+/** Audio encode thread timing, in seconds */
+struct FAudioEncodeStats
+{
+	int64 NumFrames = 0;
+	/** From the last sample of a frame being captured until the frame was encoded */
+	double AverageLatency = 0.0;
+	double MaxLatency = 0.0;
+	/** Encoding one frame */
+	double AverageEncodeTime = 0.0;
+	double MaxEncodeTime = 0.0;
+};
+
+/** Video encoder delay, from sending a frame to the encoder until its packet comes out, times in seconds */
+struct FVideoEncodeStats
+{
+	int64 NumFrames = 0;
+	double AverageLatency = 0.0;
+	double MaxLatency = 0.0;
+	/** Most frames sent to the encoder after a frame before its packet came out, 0 without B-frames, lookahead or frame threads */
+	int32 MaxDelayFrames = 0;
+	/** Frames that spent longer than one frame interval in the encoder */
+	int64 NumOverFrameInterval = 0;
+};
+
+/** Per stage stats of the video pipeline, capture is covered by FViewportReadbackStats */
+struct FRTMPPipelineStats
+{
+	/** Captured frames to encoder frames, its queue is the capture queue */
+	FPipelineStageStats Convert;
+	FPipelineStageStats Encode;
+	/** Writers of the primary stream's outputs, the stream URL first, then the additional outputs */
+	TArray<FOutputSinkStats> Outputs;
+	/** Lower renditions, in ladder order */
+	TArray<FRenditionStats> Renditions;
 };
 
 /**
@@ -50,6 +104,12 @@ public:
 
 	bool IsInitialized() const;
 
+	FMediaClockStats GetMediaClockStats() const;
+	FAVSyncStats GetSyncStats() const;
+	FRTMPPipelineStats GetPipelineStats() const;
+	FAudioEncodeStats GetAudioEncodeStats() const;
+	FVideoEncodeStats GetVideoEncodeStats() const;
+
 protected:
 
 	bool AddStream(FOutputStream& Stream, struct AVCodec** Codec, enum AVCodecID CodecId);
@@ -62,22 +122,43 @@ protected:
 
 	void CloseStream(FOutputStream& Stream);
 
-	bool SendVideoFrame();
 	bool SendAudioFrame();
 
-	bool SendFrameInternal(const struct AVRational* TimeBase, struct AVStream* Stream, struct AVPacket* Packet);
+	/** Convert stage, converts or copies a captured frame into an encoder frame */
+	void ConvertVideoFrame(FEncodeFramePayload& RawData);
+	/** Fills an encoder frame from a captured frame (called on the convert stage) */
+	bool FillVideoFrame(const FEncodeFramePayload& RawData, struct AVFrame* Frame);
+	/** Encode stage */
+	void EncodeVideoFrame(FConvertedVideoFrame& Converted);
+	/**
+	 * Sends a frame to the stream's encoder and queues every packet it has ready, until it wants more input.
+	 * A null frame flushes the encoder, it can't take frames afterwards.
+	 */
+	bool EncodeFrame(FOutputStream& Stream, struct AVFrame* Frame);
+
+	/** Encoder delay of the video frame with this pts, its packet just came out */
+	void RecordVideoEncodeLatency(int64 Pts);
+
+	/** Hands a reference to an encoded packet to every output, then returns it to the pool */
+	bool QueuePacket(FOutputStream& Stream, FAVPacketPtr&& Packet);
 
-	void OnViewportRecorded(const FColor* ColorBuffer, uint32 Width, uint32 Height);
+	void OnViewportRecorded(const struct FViewportRecordedFrame& Frame);
 
 private:
 	bool bInitialized;
+	/** At least one output wrote its header, the encoders have been fed */
 	bool bHeaderSent;
-	FDateTime StartRecordTime;
+
+	/** Audio clock anchored timeline shared by video capture and audio timestamps */
+	FMediaClock MediaClock;
+
+	bool bAudioPtsAnchored;
+
+	mutable FCriticalSection SyncStatsCS;
+	FAVSyncStats SyncStats;
 
 	FRTMPPublisherConfig PublisherConfig;
 
-	struct AVOutputFormat* OutputFormat;
-	struct AVFormatContext* OutputFormatCtx;
 	struct AVCodec* VideoCodec;
 	struct AVCodec* AudioCodec;
 
@@ -86,13 +167,61 @@ private:
 
 	TSharedPtr<class FGameViewportRecorder> ViewportRecorder;
 
-	bool bStopEncodeThread;
-	FRunnableThread* EncodeThread;
+	/** Capture buffers shared by the recorder callback, the capture queue and the convert stage */
+	TUniquePtr<class FFramePool> FramePool;
+
+	/** Encodes audio as soon as the submix delivers it, independent of the video pipeline. The publisher is its runnable */
+	FThreadSafeBool bStopAudioEncodeThread;
+	FRunnableThread* AudioEncodeThread;
+
+	/** Raised by the audio callback (and Stop) to wake the audio encode thread up */
+	FEvent* AudioWakeupEvent;
+
+	mutable FCriticalSection AudioEncodeStatsCS;
+	FAudioEncodeStats AudioEncodeStats;
+	double TotalAudioLatency;
+	double TotalAudioEncodeTime;
+
+	/** Video pipeline, capture (render thread) -> convert -> encode -> mux, each stage on its own thread */
+	TUniquePtr<TPipelineStage<FEncodeFramePayload>> ConvertStage;
+	TUniquePtr<TPipelineStage<FConvertedVideoFrame>> EncodeStage;
+	/** Each output muxes on its own writer thread, which never blocks the encoders and drops frames when the output can't keep up */
+	TArray<TUniquePtr<FOutputSink>> Outputs;
+
+	/** Packets move from the encoders to the writer and back */
+	TUniquePtr<FAVPacketPool> PacketPool;
+
+	/** Encoder frames not holding a converted frame, enough that the convert stage never runs out */
+	TUniquePtr<TBoundedQueue<FAVFramePtr>> FreeVideoFrames;
+
+	/** When each frame in flight was sent to the video encoder, indexed by pts modulo the ring size. Encode stage only */
+	struct FVideoEncoderInput
+	{
+		int64 Pts = -1;
+		int64 Sequence = 0;
+		double SendTime = 0.0;
+	};
+	TArray<FVideoEncoderInput> VideoEncoderInputs;
+	int64 NumVideoFramesSent;
+
+	mutable FCriticalSection VideoEncodeStatsCS;
+	FVideoEncodeStats VideoEncodeStats;
+	double TotalVideoEncodeLatency;
+
+	/** Lower rungs of the encoding ladder, fed from the convert stage */
+	TArray<TUniquePtr<FRenditionOutput>> Renditions;
+
+	/** With renditions, keyframes of every rung are forced at this capture slot and then once per GOP. Convert stage only */
+	int64 NextLadderKeyframePts;
+	int32 LadderGOPFrames;
+
+	/** Capture slot the next converted frame must at least have, only used by the convert stage */
+	int64 NextConversionPts;
+	int32 NumConversionSlices;
 
-	FCriticalSection VideoFrameQueueCS;
-	TQueue<FEncodeFramePayload> VideoFrameQueue;
-	FEncodeFramePayload FrozenFrame;
+	/** Planar float submix audio written by the audio render thread, read by the audio encode thread */
+	TUniquePtr<class FAudioRingBuffer> AudioSubmixBuffer;
 
-	FCriticalSection AudioSubmixBufferCS;
-	TArray<uint8> AudioSubmixBuffer;
+	/** Converts submix audio to the audio encoder format, only used on the audio encode thread */
+	TUniquePtr<class FAudioResampler> AudioResampler;
 };
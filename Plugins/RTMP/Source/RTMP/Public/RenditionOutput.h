@@ -0,0 +1,82 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "HAL/ThreadSafeCounter64.h"
+#include "DataStructures.h"
+#include "BoundedQueue.h"
+#include "PipelineStage.h"
+#include "EncodedMedia.h"
+#include "OutputSink.h"
+
+/** Per stage stats of one lower rendition */
+struct FRenditionStats
+{
+	FPipelineStageStats Encode;
+	FOutputSinkStats Output;
+	/** Keyframes encoded, the same count on every rendition when they are aligned */
+	int64 NumKeyframes = 0;
+};
+
+/**
+ * Lower rung of the encoding ladder: its own video encoder, encode thread and output, sharing the publisher's audio
+ * encoder. Frames are scaled on the caller's thread from the rung above (the publisher's convert stage), so the
+ * captured frame is only ever converted once.
+ */
+class RTMP_API FRenditionOutput
+{
+public:
+	FRenditionOutput(const FRTMPRendition& InRendition, FAVPacketPool& InPacketPool);
+	~FRenditionOutput();
+
+	FRenditionOutput(const FRenditionOutput&) = delete;
+	FRenditionOutput& operator=(const FRenditionOutput&) = delete;
+
+	/** Creates the output with a video stream and an audio stream for packets of the already opened audio encoder */
+	bool Setup(const FRTMPPublisherConfig& Config, const struct AVCodecContext* AudioCodecCtx);
+
+	/** Connects, writes the header and starts the encode and writer threads, false if the threads could not be created */
+	bool Start();
+
+	/** Scales the frame of the rung above into a frame of this rendition (convert stage) */
+	bool ScaleFrame(const struct AVFrame& Source, FConvertedVideoFrame& OutFrame);
+
+	/** Hands a frame from ScaleFrame to the encode thread */
+	void PushFrame(FConvertedVideoFrame&& Frame);
+
+	/** Queues a reference to an audio packet, pts in the audio encoder time base */
+	void PushAudioPacket(const struct AVPacket& Packet, const struct AVCodecContext* AudioCodecCtx);
+
+	/** See FOutputSink::ConsumeKeyframeRequest */
+	bool ConsumeKeyframeRequest();
+
+	/** Encodes the frames still queued and flushes the video encoder, audio can still be pushed afterwards */
+	void FinishVideo();
+
+	/** Writes everything queued and the trailer, then closes the output */
+	void Close();
+
+	FRenditionStats GetStats() const;
+
+	const FRTMPRendition& GetRendition() const;
+
+private:
+	void EncodeVideoFrame(FConvertedVideoFrame& Converted);
+	void EncodeFrame(struct AVFrame* Frame);
+
+	FRTMPRendition Rendition;
+
+	FAVPacketPool& PacketPool;
+
+	struct AVCodecContext* VideoCodecCtx;
+	struct SwsContext* ScaleCtx;
+	bool bStarted;
+
+	TUniquePtr<FOutputSink> Output;
+	TUniquePtr<TPipelineStage<FConvertedVideoFrame>> EncodeStage;
+	TUniquePtr<TBoundedQueue<FAVFramePtr>> FreeVideoFrames;
+
+	/** Written by the encode thread, read by GetStats */
+	FThreadSafeCounter64 NumKeyframes;
+};
@@ -0,0 +1,50 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "OutputSink.h"
+
+#if WITH_LIBSRT
+
+/**
+ * MPEG-TS over SRT, sent through libsrt directly instead of ffmpeg's srt protocol so the connection stats (round trip,
+ * retransmissions, send buffer) can be read while streaming. Connects as caller to srt://host:port, the streamid and
+ * passphrase query options are passed on to the listener.
+ *
+ * Lost packets are resent until they would arrive later than the latency window, then dropped, so a lossy link costs
+ * a few TS packets instead of stalling the stream like TCP does.
+ */
+class RTMP_API FSRTOutputSink : public FOutputSink
+{
+public:
+	FSRTOutputSink(const FRTMPOutputSink& InConfig, FAVPacketPool& InPacketPool);
+	virtual ~FSRTOutputSink();
+
+protected:
+	virtual bool OpenOutput() override;
+	virtual void CloseOutput(bool bClean) override;
+	virtual void GetTransportStats(FTransportStats& OutStats) const override;
+
+private:
+	/** Called by the muxer's IO context, one SRT message per datagram */
+	static int WriteToSocket(void* Opaque, uint8* Data, int Size);
+
+	void FailSRT(const TCHAR* What);
+
+	/** SocketCS must be held */
+	void ReadSocketStats(FTransportStats& OutStats) const;
+
+	/** SRTSOCKET */
+	int32 Socket;
+	bool bStartedUp;
+
+	struct AVIOContext* MuxedIO;
+
+	/** Guards the socket against the stats being read while it closes */
+	mutable FCriticalSection SocketCS;
+	/** Read right before the socket closed */
+	FTransportStats ClosedStats;
+};
+
+#endif
@@ -0,0 +1,75 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Misc/FrameRate.h"
+#include "DataStructures.h"
+#include "VideoEncoderSettings.h"
+
+/** What an encoder backend can do with FVideoEncoderSettings, settings it lacks are turned off before they are applied */
+struct FVideoEncoderCapabilities
+{
+	bool bBFrames = false;
+	bool bLookahead = false;
+	/** CRF, otherwise CRF falls back to VBV at the configured bitrate */
+	bool bConstantQuality = false;
+	bool bIntraRefresh = false;
+	/** Threads split frames instead of pipelining them, so threading adds no frames of delay */
+	bool bSlicedThreads = false;
+	/** Every frame can come out right after it went in, false when the encoder always reorders frames */
+	bool bZeroDelay = false;
+	/** Scene cut keyframes can be turned off, needed for keyframes aligned across renditions */
+	bool bSceneCutControl = false;
+};
+
+/**
+ * Maps the encoder settings to the private options of one ffmpeg encoder. The settings are expressed in x264 terms,
+ * presets, tunes and the CRF scale are translated to the nearest equivalent of the backend.
+ */
+class RTMP_API FVideoEncoderBackend
+{
+public:
+	virtual ~FVideoEncoderBackend() {}
+
+	virtual ERTMPVideoEncoderBackend GetType() const = 0;
+
+	/** Name of the ffmpeg encoder */
+	virtual const char* GetEncoderName() const = 0;
+
+	virtual FVideoEncoderCapabilities GetCapabilities() const = 0;
+
+	/** Sets up the codec context before avcodec_open2, with settings from AdaptSettings */
+	virtual void ApplySettings(struct AVCodecContext* CodecCtx, const FVideoEncoderSettings& Settings, const FFrameRate& FrameRate) const = 0;
+
+	/** The encoder, nullptr when the linked ffmpeg was built without it */
+	struct AVCodec* FindEncoder() const;
+
+	bool IsAvailable() const;
+
+	/** Whether the output format can carry the codec, only H.264 fits into FLV */
+	bool CanMuxInto(const struct AVOutputFormat* OutputFormat) const;
+
+	/** Turns off what the backend cannot do, logging each setting it had to drop */
+	FVideoEncoderSettings AdaptSettings(const FVideoEncoderSettings& Settings, int32 VideoBitrate) const;
+};
+
+namespace RTMPVideo
+{
+	RTMP_API const FVideoEncoderBackend& GetEncoderBackend(ERTMPVideoEncoderBackend Backend);
+
+	RTMP_API const TCHAR* GetEncoderBackendName(ERTMPVideoEncoderBackend Backend);
+
+	/** Every backend, available or not */
+	RTMP_API TArray<ERTMPVideoEncoderBackend> GetEncoderBackends();
+
+	/** One line summary of the capabilities for logs */
+	RTMP_API FString DescribeEncoderCapabilities(const FVideoEncoderCapabilities& Capabilities);
+
+	/**
+	 * Sets up a video codec context of the configured encoder at the given size and bitrate, before avcodec_open2.
+	 * Overridden peak bitrates and buffer sizes are scaled along with the bitrate. Returns the settings applied.
+	 */
+	RTMP_API FVideoEncoderSettings ConfigureVideoEncoder(struct AVCodecContext* CodecCtx, const FRTMPPublisherConfig& Config, int32 Width, int32 Height,
+		int32 VideoBitrate, bool bAlignedKeyframes);
+}
@@ -0,0 +1,47 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Misc/FrameRate.h"
+#include "DataStructures.h"
+
+/** Encoder settings in x264 terms after applying the encoder profile and overrides, bitrates in bits per second */
+struct FVideoEncoderSettings
+{
+	FString Preset;
+	/** Empty for no tune */
+	FString Tune;
+	FString Profile;
+	float GOPSeconds = 2.0f;
+	int32 BFrames = 0;
+	int32 Lookahead = 0;
+	ERTMPRateControl RateControl = ERTMPRateControl::CBR;
+	float CRF = 23.0f;
+	/** Average bitrate, 0 with ERTMPRateControl::CRF */
+	int32 Bitrate = 0;
+	/** VBV cap, 0 leaves CRF uncapped */
+	int32 MaxBitrate = 0;
+	int32 BufferSize = 0;
+	/** 0 picks from the core count */
+	int32 Threads = 0;
+	bool bSlicedThreads = false;
+	/** Periodic intra refresh, keyframes after the first are recovery points rather than IDR frames */
+	bool bIntraRefresh = false;
+	/** No keyframes at scene cuts, only every GOP and where they are forced, so ladder renditions key the same frames */
+	bool bAlignedKeyframes = false;
+};
+
+namespace RTMPVideo
+{
+	/** Settings of an encoder profile at the given bitrate and frame rate, without overrides */
+	RTMP_API FVideoEncoderSettings GetProfileEncoderSettings(ERTMPEncoderProfile Profile, int32 VideoBitrate, const FFrameRate& FrameRate);
+
+	/** Profile settings with the overrides applied, fixing combinations x264 would reject such as B-frames with baseline */
+	RTMP_API FVideoEncoderSettings ResolveEncoderSettings(ERTMPEncoderProfile Profile, const FRTMPVideoEncoderOverrides& Overrides, int32 VideoBitrate, const FFrameRate& FrameRate);
+
+	RTMP_API const TCHAR* GetEncoderProfileName(ERTMPEncoderProfile Profile);
+
+	/** One line summary for logs */
+	RTMP_API FString DescribeEncoderSettings(const FVideoEncoderSettings& Settings);
+}
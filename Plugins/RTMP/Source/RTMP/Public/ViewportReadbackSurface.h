@@ -0,0 +1,68 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "RHI.h"
+#include "RHIResources.h"
+#include "Templates/Function.h"
+#include "ColorConversion.h"
+
+class FRHICommandListImmediate;
+
+/**
+ * One slot of the viewport readback ring.
+ * The backbuffer capture rect is scaled into a render target, optionally converted to YUV 4:2:0 by a compute
+ * pass, and copied into a CPU readable staging texture, followed by a GPU fence. Resolve and read back are
+ * separate steps so the recorder can either read back right away (mapping waits on the GPU) or only once the
+ * fence signaled (never waits).
+ * Everything but the setters runs on the render thread.
+ */
+class RTMP_API FViewportReadbackSurface
+{
+public:
+	FViewportReadbackSurface(EPixelFormat InPixelFormat, FIntPoint InBufferSize, ERTMPFrameFormat InOutputFormat = ERTMPFrameFormat::BGRA);
+
+	void SetCaptureRect(FIntRect InCaptureRect) { CaptureRect = InCaptureRect; }
+	void SetWindowSize(FIntPoint InWindowSize) { WindowSize = InWindowSize; }
+	void SetYUVCoefficients(const FYUVCoefficients& InYUVCoefficients) { YUVCoefficients = InYUVCoefficients; }
+
+	ERTMPFrameFormat GetOutputFormat() const { return OutputFormat; }
+
+	/** Scales the capture rect of the backbuffer into this surface and queues the copy to CPU memory */
+	void Resolve(FRHICommandListImmediate& RHICmdList, FRHITexture2D* SourceBackBuffer);
+
+	/** A copy was queued and has not been read back yet */
+	bool IsInFlight() const { return bInFlight; }
+
+	/** The GPU finished the queued copy, reading it back will not wait */
+	bool IsReadbackReady() const;
+
+	/**
+	 * Maps the copy, waiting for the GPU if it is not done yet, hands the data and its row pitch in bytes to
+	 * Callback and frees the surface. YUV output is one buffer of Height * 3 / 2 rows of Width bytes.
+	 * @return Seconds spent waiting for the mapping.
+	 */
+	double ReadBack(FRHICommandListImmediate& RHICmdList, TFunctionRef<void(const uint8*, int32)> Callback);
+
+private:
+	void InitRHI();
+
+	/** Runs the BGRA -> YUV compute pass from the resolve texture into the YUV texture */
+	void ConvertToYUV(FRHICommandListImmediate& RHICmdList);
+
+	EPixelFormat PixelFormat;
+	FIntPoint BufferSize;
+	FIntRect CaptureRect;
+	FIntPoint WindowSize;
+	ERTMPFrameFormat OutputFormat;
+	FYUVCoefficients YUVCoefficients;
+
+	FTexture2DRHIRef ResolveTexture;
+	FTexture2DRHIRef YUVTexture;
+	FUnorderedAccessViewRHIRef YUVTextureUAV;
+	FTexture2DRHIRef ReadbackTexture;
+	FGPUFenceRHIRef ReadbackFence;
+
+	bool bInFlight;
+};
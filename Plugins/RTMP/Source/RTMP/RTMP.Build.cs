@@ -109,6 +109,26 @@ public class RTMP : ModuleRules
         return isLibrarySupported;
     }
 
+    public bool LoadLibSRT(ReadOnlyTargetRules Target)
+    {
+        // Optional, without it srt:// outputs go through ffmpeg's srt protocol and report no connection stats
+        string SRTPath = Path.Combine(ThirdPartyPath, "srt");
+        bool isLibrarySupported = Target.Platform == UnrealTargetPlatform.Win64 && Directory.Exists(SRTPath);
+
+        if (isLibrarySupported)
+        {
+            string libType = "x64_" + (Target.Configuration == UnrealTargetConfiguration.Debug ? "Debug" : "Release");
+
+            PublicIncludePaths.Add(Path.Combine(SRTPath, "include"));
+            PublicAdditionalLibraries.Add(Path.Combine(SRTPath, "libs", libType, "srt.lib"));
+            PublicDelayLoadDLLs.Add("srt.dll");
+            RuntimeDependencies.Add(Path.Combine(SRTPath, "bin", libType, "srt.dll"), StagedFileType.NonUFS);
+        }
+
+        PublicDefinitions.Add("WITH_LIBSRT=" + (isLibrarySupported ? "1" : "0"));
+        return isLibrarySupported;
+    }
+
     public RTMP(ReadOnlyTargetRules Target) : base(Target)
 	{
 		PCHUsage = ModuleRules.PCHUsageMode.UseExplicitOrSharedPCHs;
@@ -125,16 +145,22 @@ public class RTMP : ModuleRules
                 "Slate",
                 "SlateCore",
                 "RenderCore",
+                "RHI",
                 "Projects",
+                "RTMPShaders",
 				// ... add other public dependencies that you statically link with here ...
 			}
 			);
 
+        // Viewport readback draws with the renderer's screen pass helpers
+        PrivateDependencyModuleNames.Add("Renderer");
+
         if (Target.Type == TargetRules.TargetType.Editor)
         {
             PrivateDependencyModuleNames.Add("UnrealEd");
         }
 
         LoadFFmpeg(Target);
+        LoadLibSRT(Target);
     }
 }
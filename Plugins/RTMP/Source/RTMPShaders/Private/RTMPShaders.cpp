@@ -0,0 +1,23 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#include "RTMPShaders.h"
+
+#include "Interfaces/IPluginManager.h"
+#include "Misc/Paths.h"
+#include "ShaderCore.h"
+
+#define LOCTEXT_NAMESPACE "FRTMPShadersModule"
+
+void FRTMPShadersModule::StartupModule()
+{
+	const FString ShaderDir = FPaths::Combine(IPluginManager::Get().FindPlugin(TEXT("RTMP"))->GetBaseDir(), TEXT("Shaders"));
+	AddShaderSourceDirectoryMapping(TEXT("/Plugin/RTMP"), ShaderDir);
+}
+
+void FRTMPShadersModule::ShutdownModule()
+{
+}
+
+#undef LOCTEXT_NAMESPACE
+
+IMPLEMENT_MODULE(FRTMPShadersModule, RTMPShaders)
@@ -0,0 +1,36 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "GlobalShader.h"
+#include "ShaderParameterStruct.h"
+
+/**
+ * Converts a BGRA texture into 4:2:0 YUV with integer math, one thread per 2x2 pixel block.
+ * Output is a R8_UINT texture of Width x Height * 3 / 2 holding the planes back to back as if it was one
+ * linear buffer with a pitch of Width: Y, then U and V (I420) or interleaved UV (NV12).
+ * Coefficients are R, G, B weights in 1/256 units followed by the output offset * 256 + 128, the CPU
+ * reference conversion uses the very same formula so both produce identical bytes.
+ */
+class RTMPSHADERS_API FRTMPRGBToYUVCS : public FGlobalShader
+{
+public:
+	DECLARE_GLOBAL_SHADER(FRTMPRGBToYUVCS);
+	SHADER_USE_PARAMETER_STRUCT(FRTMPRGBToYUVCS, FGlobalShader);
+
+	static const int32 ThreadGroupSize = 8;
+
+	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
+		SHADER_PARAMETER_TEXTURE(Texture2D, InputTexture)
+		SHADER_PARAMETER_UAV(RWTexture2D<uint>, OutputTexture)
+		SHADER_PARAMETER(FIntPoint, Size)
+		SHADER_PARAMETER(FIntVector4, YCoefficients)
+		SHADER_PARAMETER(FIntVector4, UCoefficients)
+		SHADER_PARAMETER(FIntVector4, VCoefficients)
+		SHADER_PARAMETER(uint32, bInterleavedChroma)
+	END_SHADER_PARAMETER_STRUCT()
+
+	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters);
+	static void ModifyCompilationEnvironment(const FGlobalShaderPermutationParameters& Parameters, FShaderCompilerEnvironment& OutEnvironment);
+};
@@ -0,0 +1,20 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Modules/ModuleManager.h"
+
+/**
+ * Global shaders of the RTMP plugin.
+ * Lives in its own module because shader types and the /Plugin/RTMP source directory have to be
+ * registered at PostConfigInit, long before the publisher module itself can be loaded.
+ */
+class FRTMPShadersModule : public IModuleInterface
+{
+public:
+
+	/** IModuleInterface implementation */
+	virtual void StartupModule() override;
+	virtual void ShutdownModule() override;
+};